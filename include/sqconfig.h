@@ -75,6 +75,7 @@ typedef wchar_t SQChar;
 #define scstrtoul   wcstoul
 #define scvsprintf  vswprintf
 #define scstrstr    wcsstr
+#define scmemchr    wmemchr
 #define scprintf    wprintf
 
 #ifdef _WIN32
@@ -124,6 +125,7 @@ typedef char SQChar;
 #define scstrtoul   strtoul
 #define scvsprintf  vsnprintf
 #define scstrstr    strstr
+#define scmemchr    memchr
 #define scisspace   isspace
 #define scisdigit   isdigit
 #define scisprint   isprint
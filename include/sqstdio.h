@@ -16,6 +16,15 @@ struct SQStream {
     virtual SQInteger Seek(SQInteger offset, SQInteger origin) = 0;
     virtual bool IsValid() = 0;
     virtual bool EOS() = 0;
+    //reads up to size bytes stopping after the first '\n', returns the number of bytes read
+    virtual SQInteger ReadLine(void *buffer, SQInteger size) {
+        char *p = (char *)buffer;
+        SQInteger n = 0;
+        while(n < size && Read(&p[n],1) == 1) {
+            if(p[n++] == '\n') break;
+        }
+        return n;
+    }
 };
 
 extern "C" {
@@ -43,6 +52,10 @@ SQUIRREL_API SQRESULT sqstd_getfile(HSQUIRRELVM v, SQInteger idx, SQFILE *file);
 SQUIRREL_API SQRESULT sqstd_loadfile(HSQUIRRELVM v,const SQChar *filename,SQBool printerror);
 SQUIRREL_API SQRESULT sqstd_dofile(HSQUIRRELVM v,const SQChar *filename,SQBool retval,SQBool printerror);
 SQUIRREL_API SQRESULT sqstd_writeclosuretofile(HSQUIRRELVM v,const SQChar *filename);
+SQUIRREL_API SQRESULT sqstd_writeclosureimagetofile(HSQUIRRELVM v,const SQChar *filename);
+SQUIRREL_API SQRESULT sqstd_writesnapshottofile(HSQUIRRELVM v,SQInteger bindings,const SQChar *filename);
+SQUIRREL_API SQRESULT sqstd_loadsnapshot(HSQUIRRELVM v,SQInteger bindings,const SQChar *filename);
+SQUIRREL_API SQRESULT sqstd_setcompilecache(HSQUIRRELVM v,const SQChar *dir,SQInteger maxsize);
 
 SQUIRREL_API SQRESULT sqstd_register_iolib(HSQUIRRELVM v);
 
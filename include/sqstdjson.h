@@ -0,0 +1,18 @@
+/*  see copyright notice in squirrel.h */
+#ifndef _SQSTD_JSON_H_
+#define _SQSTD_JSON_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+SQUIRREL_API SQRESULT sqstd_parsejson(HSQUIRRELVM v,const SQChar *s,SQInteger len);
+SQUIRREL_API SQRESULT sqstd_writejson(HSQUIRRELVM v,SQInteger idx,SQInteger indent,SQWRITEFUNC writef,SQUserPointer up);
+
+SQUIRREL_API SQRESULT sqstd_register_jsonlib(HSQUIRRELVM v);
+
+#ifdef __cplusplus
+} /*extern "C"*/
+#endif
+
+#endif /*_SQSTD_JSON_H_*/
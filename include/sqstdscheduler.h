@@ -0,0 +1,23 @@
+/*  see copyright notice in squirrel.h */
+#ifndef _SQSTD_SCHEDULER_H_
+#define _SQSTD_SCHEDULER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+SQUIRREL_API SQRESULT sqstd_scheduler_spawn(HSQUIRRELVM v,SQInteger nargs);
+SQUIRREL_API SQInteger sqstd_scheduler_run(HSQUIRRELVM v,SQInteger budget);
+SQUIRREL_API SQRESULT sqstd_scheduler_advance(HSQUIRRELVM v,SQInteger ticks);
+SQUIRREL_API SQBool sqstd_scheduler_waitio(HSQUIRRELVM v,SQInteger milliseconds);
+SQUIRREL_API SQUserPointer sqstd_scheduler_current(HSQUIRRELVM v);
+SQUIRREL_API SQRESULT sqstd_scheduler_suspend(HSQUIRRELVM v);
+SQUIRREL_API SQRESULT sqstd_scheduler_resume(HSQUIRRELVM v,SQUserPointer task,SQInteger idx);
+
+SQUIRREL_API SQRESULT sqstd_register_schedulerlib(HSQUIRRELVM v);
+
+#ifdef __cplusplus
+} /*extern "C"*/
+#endif
+
+#endif /*_SQSTD_SCHEDULER_H_*/
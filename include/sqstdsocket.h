@@ -0,0 +1,17 @@
+/*  see copyright notice in squirrel.h */
+#ifndef _SQSTD_SOCKET_H_
+#define _SQSTD_SOCKET_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+SQUIRREL_API SQInteger sqstd_socket_poll(HSQUIRRELVM v,SQInteger milliseconds);
+
+SQUIRREL_API SQRESULT sqstd_register_socketlib(HSQUIRRELVM v);
+
+#ifdef __cplusplus
+} /*extern "C"*/
+#endif
+
+#endif /*_SQSTD_SOCKET_H_*/
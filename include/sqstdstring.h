@@ -6,6 +6,8 @@
 extern "C" {
 #endif
 
+#define SQREX_LINEAR 0x00000001 /*match in linear time with a DFA instead of backtracking*/
+
 typedef unsigned int SQRexBool;
 typedef struct SQRex SQRex;
 
@@ -15,6 +17,7 @@ typedef struct {
 } SQRexMatch;
 
 SQUIRREL_API SQRex *sqstd_rex_compile(const SQChar *pattern,const SQChar **error);
+SQUIRREL_API SQRex *sqstd_rex_compileex(const SQChar *pattern,SQInteger flags,const SQChar **error);
 SQUIRREL_API void sqstd_rex_free(SQRex *exp);
 SQUIRREL_API SQBool sqstd_rex_match(SQRex* exp,const SQChar* text);
 SQUIRREL_API SQBool sqstd_rex_search(SQRex* exp,const SQChar* text, const SQChar** out_begin, const SQChar** out_end);
@@ -0,0 +1,19 @@
+/*  see copyright notice in squirrel.h */
+#ifndef _SQSTD_WORKER_H_
+#define _SQSTD_WORKER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*SQWORKERINIT)(HSQUIRRELVM);
+
+SQUIRREL_API void sqstd_worker_setinit(HSQUIRRELVM v,SQWORKERINIT init);
+
+SQUIRREL_API SQRESULT sqstd_register_workerlib(HSQUIRRELVM v);
+
+#ifdef __cplusplus
+} /*extern "C"*/
+#endif
+
+#endif /*_SQSTD_WORKER_H_*/
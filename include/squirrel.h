@@ -74,8 +74,15 @@ struct SQOuter;
 #define SQ_VMSTATE_RUNNING      1
 #define SQ_VMSTATE_SUSPENDED    2
 
+#define SQ_WEAK_KEYS        0x01
+#define SQ_WEAK_VALUES      0x02
+#define SQ_WEAK_EPHEMERON   0x05 /*weak keys, the values are reachable only through live keys*/
+
 #define SQUIRREL_EOB 0
 #define SQ_BYTECODE_STREAM_TAG  0xFAFA
+#define SQ_BYTECODE_IMAGE_TAG   0xFAFB
+#define SQ_OBJECT_STREAM_TAG    0xFAFC
+#define SQ_SNAPSHOT_TAG         0xFAFD
 
 #define SQOBJECT_REF_COUNTED    0x08000000
 #define SQOBJECT_NUMERIC        0x04000000
@@ -174,6 +181,7 @@ typedef struct tagSQStackInfos{
 typedef struct SQVM* HSQUIRRELVM;
 typedef SQObject HSQOBJECT;
 typedef SQMemberHandle HSQMEMBERHANDLE;
+typedef struct SQSharedObject* HSQSHARED;
 typedef SQInteger (*SQFUNCTION)(HSQUIRRELVM);
 typedef SQInteger (*SQRELEASEHOOK)(SQUserPointer,SQInteger size);
 typedef void (*SQCOMPILERERROR)(HSQUIRRELVM,const SQChar * /*desc*/,const SQChar * /*source*/,SQInteger /*line*/,SQInteger /*column*/);
@@ -223,6 +231,7 @@ SQUIRREL_API SQInteger sq_getversion();
 SQUIRREL_API SQRESULT sq_compile(HSQUIRRELVM v,SQLEXREADFUNC read,SQUserPointer p,const SQChar *sourcename,SQBool raiseerror);
 SQUIRREL_API SQRESULT sq_compilebuffer(HSQUIRRELVM v,const SQChar *s,SQInteger size,const SQChar *sourcename,SQBool raiseerror);
 SQUIRREL_API void sq_enabledebuginfo(HSQUIRRELVM v, SQBool enable);
+SQUIRREL_API SQBool sq_getdebuginfo(HSQUIRRELVM v);
 SQUIRREL_API void sq_notifyallexceptions(HSQUIRRELVM v, SQBool enable);
 SQUIRREL_API void sq_setcompilererrorhandler(HSQUIRRELVM v,SQCOMPILERERROR f);
 
@@ -321,6 +330,13 @@ SQUIRREL_API SQRESULT sq_setfreevariable(HSQUIRRELVM v,SQInteger idx,SQUnsignedI
 SQUIRREL_API SQRESULT sq_next(HSQUIRRELVM v,SQInteger idx);
 SQUIRREL_API SQRESULT sq_getweakrefval(HSQUIRRELVM v,SQInteger idx);
 SQUIRREL_API SQRESULT sq_clear(HSQUIRRELVM v,SQInteger idx);
+SQUIRREL_API SQRESULT sq_freeze(HSQUIRRELVM v,SQInteger idx);
+SQUIRREL_API SQBool sq_isfrozen(HSQUIRRELVM v,SQInteger idx);
+SQUIRREL_API SQRESULT sq_setweak(HSQUIRRELVM v,SQInteger idx,SQInteger mode);
+SQUIRREL_API SQInteger sq_getweak(HSQUIRRELVM v,SQInteger idx);
+SQUIRREL_API SQRESULT sq_share(HSQUIRRELVM v,SQInteger idx,HSQSHARED *shared);
+SQUIRREL_API void sq_pushshared(HSQUIRRELVM v,HSQSHARED shared);
+SQUIRREL_API void sq_releaseshared(HSQSHARED shared);
 
 /*calls*/
 SQUIRREL_API SQRESULT sq_call(HSQUIRRELVM v,SQInteger params,SQBool retval,SQBool raiseerror);
@@ -357,6 +373,13 @@ SQUIRREL_API SQRESULT sq_resurrectunreachable(HSQUIRRELVM v);
 /*serialization*/
 SQUIRREL_API SQRESULT sq_writeclosure(HSQUIRRELVM vm,SQWRITEFUNC writef,SQUserPointer up);
 SQUIRREL_API SQRESULT sq_readclosure(HSQUIRRELVM vm,SQREADFUNC readf,SQUserPointer up);
+SQUIRREL_API SQRESULT sq_writeclosureimage(HSQUIRRELVM vm,SQWRITEFUNC writef,SQUserPointer up);
+SQUIRREL_API SQRESULT sq_readclosureimage(HSQUIRRELVM vm,SQUserPointer image,SQInteger size,SQRELEASEHOOK release);
+SQUIRREL_API SQRESULT sq_writeobject(HSQUIRRELVM vm,SQInteger idx,SQInteger classes,SQWRITEFUNC writef,SQUserPointer up);
+SQUIRREL_API SQRESULT sq_readobject(HSQUIRRELVM vm,SQInteger classes,SQREADFUNC readf,SQUserPointer up);
+SQUIRREL_API void sq_collectbindings(HSQUIRRELVM vm);
+SQUIRREL_API SQRESULT sq_writesnapshot(HSQUIRRELVM vm,SQInteger bindings,SQWRITEFUNC writef,SQUserPointer up);
+SQUIRREL_API SQRESULT sq_readsnapshot(HSQUIRRELVM vm,SQInteger bindings,SQREADFUNC readf,SQUserPointer up);
 
 /*mem allocation*/
 SQUIRREL_API void *sq_malloc(SQUnsignedInteger size);
@@ -16,6 +16,9 @@
 #include <sqstdmath.h>
 #include <sqstdstring.h>
 #include <sqstdaux.h>
+#include <sqstdworker.h>
+#include <sqstdjson.h>
+#include <sqstdsocket.h>
 
 #ifdef SQUNICODE
 #define scfprintf fwprintf
@@ -73,6 +76,7 @@ void PrintUsage()
         _SC("Available options are:\n")
         _SC("   -c              compiles the file to bytecode(default output 'out.cnut')\n")
         _SC("   -o              specifies output file for the -c option\n")
+        _SC("   -m              with -c writes a memory-mappable bytecode image\n")
         _SC("   -c              compiles only\n")
         _SC("   -d              generates debug infos\n")
         _SC("   -v              displays version infos\n")
@@ -87,6 +91,7 @@ int getargs(HSQUIRRELVM v,int argc, char* argv[],SQInteger *retval)
 {
     int i;
     int compiles_only = 0;
+    int image = 0;
 #ifdef SQUNICODE
     static SQChar temp[500];
 #endif
@@ -109,6 +114,9 @@ int getargs(HSQUIRRELVM v,int argc, char* argv[],SQInteger *retval)
                 case 'c':
                     compiles_only = 1;
                     break;
+                case 'm':
+                    image = 1;
+                    break;
                 case 'o':
                     if(arg < argc) {
                         arg++;
@@ -164,7 +172,11 @@ int getargs(HSQUIRRELVM v,int argc, char* argv[],SQInteger *retval)
                         outfile = output;
 #endif
                     }
-                    if(SQ_SUCCEEDED(sqstd_writeclosuretofile(v,outfile)))
+                    if(image) {
+                        if(SQ_SUCCEEDED(sqstd_writeclosureimagetofile(v,outfile)))
+                            return _DONE;
+                    }
+                    else if(SQ_SUCCEEDED(sqstd_writeclosuretofile(v,outfile)))
                         return _DONE;
                 }
             }
@@ -321,6 +333,9 @@ int main(int argc, char* argv[])
     sqstd_register_systemlib(v);
     sqstd_register_mathlib(v);
     sqstd_register_stringlib(v);
+    sqstd_register_workerlib(v);
+    sqstd_register_jsonlib(v);
+    sqstd_register_socketlib(v);
 
     //aux library
     //sets error handlers
@@ -1,5 +1,14 @@
 /* see copyright notice in squirrel.h */
 #include <new>
+#include <stdlib.h>
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include <squirrel.h>
 #include <sqstdio.h>
 #include <string.h>
@@ -8,6 +17,7 @@
 #include "sqstdblobimpl.h"
 
 #define SQSTD_BLOB_TYPE_TAG ((SQUnsignedInteger)(SQSTD_STREAM_TYPE_TAG | 0x00000002))
+#define SQSTD_MMAPFILE_TYPE_TAG ((SQUnsignedInteger)(SQSTD_STREAM_TYPE_TAG | 0x00000003))
 
 //Blob
 
@@ -114,12 +124,6 @@ static SQInteger _blob__nexti(HSQUIRRELVM v)
     return sq_throwerror(v,_SC("internal error (_nexti) wrong argument type"));
 }
 
-static SQInteger _blob__typeof(HSQUIRRELVM v)
-{
-    sq_pushstring(v,_SC("blob"),-1);
-    return 1;
-}
-
 static SQInteger _blob_releasehook(SQUserPointer p, SQInteger SQ_UNUSED_ARG(size))
 {
     SQBlob *self = (SQBlob*)p;
@@ -128,6 +132,92 @@ static SQInteger _blob_releasehook(SQUserPointer p, SQInteger SQ_UNUSED_ARG(size
     return 1;
 }
 
+static SQInteger _blob_slice(HSQUIRRELVM v)
+{
+    SETUP_BLOB(v);
+    SQInteger start, len = self->Len(), end = len;
+    sq_getinteger(v,2,&start);
+    if(sq_gettop(v) > 2)
+        sq_getinteger(v,3,&end);
+    if(start < 0) start += len;
+    if(end < 0) end += len;
+    if(start < 0 || end > len || start > end)
+        return sq_throwerror(v,_SC("slice out of range"));
+    sq_pushregistrytable(v);
+    sq_pushstring(v,_SC("std_blob"),-1);
+    if(SQ_FAILED(sq_rawget(v,-2)) || SQ_FAILED(sq_createinstance(v,-1)))
+        return sq_throwerror(v,_SC("cannot create blob"));
+    SQBlob *b = self->Slice(start,end - start);
+    sq_setinstanceup(v,-1,b);
+    sq_setreleasehook(v,-1,_blob_releasehook);
+    return 1;
+}
+
+//getn(offset, format, [count]) reads numbers at an offset without moving the stream pointer
+static SQInteger _blob_getn(HSQUIRRELVM v)
+{
+    SETUP_BLOB(v);
+    SQInteger offset, format, size, count = 1;
+    sq_getinteger(v,2,&offset);
+    sq_getinteger(v,3,&format);
+    if((size = _stream_formatsize(format)) == 0)
+        return sq_throwerror(v,_SC("invalid format"));
+    if(sq_gettop(v) > 3) {
+        sq_getinteger(v,4,&count);
+        if(count < 0)
+            return sq_throwerror(v,_SC("invalid count"));
+    }
+    if(offset < 0 || offset > self->Len() || count > (self->Len() - offset) / size)
+        return sq_throwerror(v,_SC("index out of range"));
+    const unsigned char *data = (const unsigned char *)self->GetBuf() + offset;
+    if(sq_gettop(v) > 3) {
+        sq_newarray(v,count);
+        for(SQInteger i = 0; i < count; i++) {
+            sq_pushinteger(v,i);
+            _stream_pushnumber(v,format,&data[i * size]);
+            sq_rawset(v,-3);
+        }
+        return 1;
+    }
+    _stream_pushnumber(v,format,data);
+    return 1;
+}
+
+//setn(offset, number|array, format) writes numbers at an offset without moving the stream pointer
+static SQInteger _blob_setn(HSQUIRRELVM v)
+{
+    SETUP_BLOB(v);
+    SQInteger offset, format, size, count = 1;
+    sq_getinteger(v,2,&offset);
+    sq_getinteger(v,4,&format);
+    if((size = _stream_formatsize(format)) == 0)
+        return sq_throwerror(v,_SC("invalid format"));
+    bool isarray = sq_gettype(v,3) == OT_ARRAY;
+    if(isarray) count = sq_getsize(v,3);
+    if(offset < 0 || offset > self->Len() || count > (self->Len() - offset) / size)
+        return sq_throwerror(v,_SC("index out of range"));
+    unsigned char *data = (unsigned char *)self->GetBuf() + offset;
+    if(!isarray) {
+        _stream_getnumber(v,3,format,data);
+        return 0;
+    }
+    for(SQInteger i = 0; i < count; i++) {
+        sq_pushinteger(v,i);
+        sq_rawget(v,3);
+        if(!(sq_gettype(v,-1) & SQOBJECT_NUMERIC))
+            return sq_throwerror(v,_SC("the array must contain only numbers"));
+        _stream_getnumber(v,-1,format,&data[i * size]);
+        sq_pop(v,1);
+    }
+    return 0;
+}
+
+static SQInteger _blob__typeof(HSQUIRRELVM v)
+{
+    sq_pushstring(v,_SC("blob"),-1);
+    return 1;
+}
+
 static SQInteger _blob_constructor(HSQUIRRELVM v)
 {
     SQInteger nparam = sq_gettop(v);
@@ -173,6 +263,9 @@ static const SQRegFunction _blob_methods[] = {
     _DECL_BLOB_FUNC(resize,2,_SC("xn")),
     _DECL_BLOB_FUNC(swap2,1,_SC("x")),
     _DECL_BLOB_FUNC(swap4,1,_SC("x")),
+    _DECL_BLOB_FUNC(slice,-2,_SC("xnn")),
+    _DECL_BLOB_FUNC(getn,-3,_SC("xnnn")),
+    _DECL_BLOB_FUNC(setn,4,_SC("xnn|an")),
     _DECL_BLOB_FUNC(_set,3,_SC("xnn")),
     _DECL_BLOB_FUNC(_get,2,_SC("x.")),
     _DECL_BLOB_FUNC(_typeof,1,_SC("x")),
@@ -183,6 +276,210 @@ static const SQRegFunction _blob_methods[] = {
 
 
 
+//MMapFile
+//a blob whose memory is a mapping of a file, writes go to the file only if it was mapped with "w"
+#if defined(_WIN32) || defined(__unix__) || defined(__APPLE__)
+#define SQSTD_HAS_MMAP
+#endif
+
+//the mapping is released when the mmapfile and all its slices are gone
+struct SQMMapBuffer : public SQBlobBuffer
+{
+    SQMMapBuffer(unsigned char *data, SQInteger size) : SQBlobBuffer(data, size) {}
+    virtual ~SQMMapBuffer() {
+#if defined(_WIN32)
+        if(_data) UnmapViewOfFile(_data);
+#elif defined(SQSTD_HAS_MMAP)
+        if(_data) munmap(_data, (size_t)_allocated);
+#endif
+        _data = NULL;
+    }
+    virtual void Destroy() {
+        this->~SQMMapBuffer();
+        sq_free(this, sizeof(SQMMapBuffer));
+    }
+};
+
+struct SQMMapFile : public SQBlob
+{
+    SQMMapFile(void *buf, SQInteger size, bool shared)
+        : SQBlob(new (sq_malloc(sizeof(SQMMapBuffer)))SQMMapBuffer((unsigned char *)buf, size), (unsigned char *)buf, size) {
+        _shared = shared;
+        _mapped = true;
+    }
+    virtual ~SQMMapFile() { Close(); }
+    static bool Map(const SQChar *filename, bool shared, SQInteger newsize, void **buf, SQInteger *size);
+    void Close() {
+        if(!_mapped) return;
+        Flush();
+        _buffer->Release();
+        _buffer = NULL;
+        _buf = NULL;
+        _size = _ptr = 0;
+        _mapped = false;
+    }
+    SQInteger Flush() {
+        if(!_shared || !_buf) return 0;
+#if defined(_WIN32)
+        return FlushViewOfFile(_buf, 0) ? 0 : -1;
+#elif defined(SQSTD_HAS_MMAP)
+        return msync(_buf, (size_t)_size, MS_SYNC);
+#else
+        return 0;
+#endif
+    }
+    bool IsValid() { return _mapped; }
+private:
+    bool _shared;
+    bool _mapped;
+};
+
+#if defined(_WIN32)
+bool SQMMapFile::Map(const SQChar *filename, bool shared, SQInteger newsize, void **buf, SQInteger *size)
+{
+    DWORD access = shared ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ;
+    DWORD disposition = newsize >= 0 ? OPEN_ALWAYS : OPEN_EXISTING;
+#ifdef SQUNICODE
+    HANDLE h = CreateFileW(filename,access,FILE_SHARE_READ|FILE_SHARE_WRITE,NULL,disposition,FILE_ATTRIBUTE_NORMAL,NULL);
+#else
+    HANDLE h = CreateFileA(filename,access,FILE_SHARE_READ|FILE_SHARE_WRITE,NULL,disposition,FILE_ATTRIBUTE_NORMAL,NULL);
+#endif
+    if(h == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER fsize;
+    if(newsize >= 0) {
+        fsize.QuadPart = newsize;
+        if(!SetFilePointerEx(h,fsize,NULL,FILE_BEGIN) || !SetEndOfFile(h)) {
+            CloseHandle(h);
+            return false;
+        }
+    }
+    if(!GetFileSizeEx(h,&fsize)) {
+        CloseHandle(h);
+        return false;
+    }
+    *size = (SQInteger)fsize.QuadPart;
+    *buf = NULL;
+    if(*size == 0) {
+        CloseHandle(h);
+        return true;
+    }
+    HANDLE m = CreateFileMapping(h,NULL,shared ? PAGE_READWRITE : PAGE_WRITECOPY,0,0,NULL);
+    CloseHandle(h);
+    if(!m) return false;
+    *buf = MapViewOfFile(m,shared ? FILE_MAP_WRITE : FILE_MAP_COPY,0,0,0);
+    CloseHandle(m);
+    return *buf != NULL;
+}
+#elif defined(SQSTD_HAS_MMAP)
+bool SQMMapFile::Map(const SQChar *filename, bool shared, SQInteger newsize, void **buf, SQInteger *size)
+{
+    int flags = shared ? (newsize >= 0 ? O_RDWR|O_CREAT : O_RDWR) : O_RDONLY;
+#ifdef SQUNICODE
+    //open() takes a multibyte name
+    char path[1024];
+    if(wcstombs(path, filename, sizeof(path)) >= sizeof(path)) return false;
+    int fd = open(path, flags, 0666);
+#else
+    int fd = open(filename, flags, 0666);
+#endif
+    if(fd < 0) return false;
+    struct stat st;
+    if((newsize >= 0 && ftruncate(fd,(off_t)newsize) != 0) || fstat(fd,&st) != 0) {
+        close(fd);
+        return false;
+    }
+    *size = (SQInteger)st.st_size;
+    *buf = NULL;
+    if(*size == 0) {
+        close(fd);
+        return true;
+    }
+    //read only files are mapped copy on write, the blob methods can still modify them
+    void *p = mmap(NULL,(size_t)st.st_size,PROT_READ|PROT_WRITE,shared ? MAP_SHARED : MAP_PRIVATE,fd,0);
+    close(fd);
+    if(p == MAP_FAILED) return false;
+    *buf = p;
+    return true;
+}
+#else
+bool SQMMapFile::Map(const SQChar *SQ_UNUSED_ARG(filename), bool SQ_UNUSED_ARG(shared), SQInteger SQ_UNUSED_ARG(newsize), void **SQ_UNUSED_ARG(buf), SQInteger *SQ_UNUSED_ARG(size))
+{
+    return false;
+}
+#endif
+
+#define SETUP_MMAPFILE(v) \
+    SQMMapFile *self = NULL; \
+    if(SQ_FAILED(sq_getinstanceup(v,1,(SQUserPointer*)&self,(SQUserPointer)SQSTD_MMAPFILE_TYPE_TAG))) \
+        return sq_throwerror(v,_SC("invalid type tag"));
+
+static SQInteger _mmapfile_releasehook(SQUserPointer p, SQInteger SQ_UNUSED_ARG(size))
+{
+    SQMMapFile *self = (SQMMapFile*)p;
+    self->~SQMMapFile();
+    sq_free(self,sizeof(SQMMapFile));
+    return 1;
+}
+
+static SQInteger _mmapfile_constructor(HSQUIRRELVM v)
+{
+    const SQChar *filename, *mode = _SC("r");
+    SQInteger newsize = -1, size = 0;
+    sq_getstring(v, 2, &filename);
+    if(sq_gettop(v) > 2)
+        sq_getstring(v, 3, &mode);
+    if(mode[0] != _SC('r') && mode[0] != _SC('w'))
+        return sq_throwerror(v, _SC("invalid mode"));
+    bool shared = mode[0] == _SC('w');
+    if(sq_gettop(v) > 3) {
+        sq_getinteger(v, 4, &newsize);
+        if(newsize < 0 || !shared)
+            return sq_throwerror(v, _SC("the size can only be set in \"w\" mode"));
+    }
+    void *p;
+    if(!SQMMapFile::Map(filename, shared, newsize, &p, &size))
+        return sq_throwerror(v, _SC("cannot map file"));
+    SQMMapFile *f = new (sq_malloc(sizeof(SQMMapFile)))SQMMapFile(p, size, shared);
+    if(SQ_FAILED(sq_setinstanceup(v,1,f))) {
+        f->~SQMMapFile();
+        sq_free(f,sizeof(SQMMapFile));
+        return sq_throwerror(v, _SC("cannot create mmapfile"));
+    }
+    sq_setreleasehook(v,1,_mmapfile_releasehook);
+    return 0;
+}
+
+static SQInteger _mmapfile_close(HSQUIRRELVM v)
+{
+    SETUP_MMAPFILE(v);
+    if(self) self->Close();
+    return 0;
+}
+
+static SQInteger _mmapfile__typeof(HSQUIRRELVM v)
+{
+    sq_pushstring(v,_SC("mmapfile"),-1);
+    return 1;
+}
+
+static SQInteger _mmapfile__cloned(HSQUIRRELVM v)
+{
+    return sq_throwerror(v,_SC("this object cannot be cloned"));
+}
+
+#define _DECL_MMAPFILE_FUNC(name,nparams,typecheck) {_SC(#name),_mmapfile_##name,nparams,typecheck}
+static const SQRegFunction _mmapfile_methods[] = {
+    _DECL_MMAPFILE_FUNC(constructor,-2,_SC("xssn")),
+    _DECL_MMAPFILE_FUNC(close,1,_SC("x")),
+    _DECL_MMAPFILE_FUNC(_typeof,1,_SC("x")),
+    _DECL_MMAPFILE_FUNC(_cloned,2,_SC("xx")),
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
+
+static const SQRegFunction _mmapfile_funcs[] = {
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
+
 //GLOBAL FUNCTIONS
 
 static SQInteger _g_blob_casti2f(HSQUIRRELVM v)
@@ -278,6 +575,8 @@ SQUserPointer sqstd_createblob(HSQUIRRELVM v, SQInteger size)
 
 SQRESULT sqstd_register_bloblib(HSQUIRRELVM v)
 {
-    return declare_stream(v,_SC("blob"),(SQUserPointer)SQSTD_BLOB_TYPE_TAG,_SC("std_blob"),_blob_methods,bloblib_funcs);
+    if(SQ_FAILED(declare_stream(v,_SC("blob"),(SQUserPointer)SQSTD_BLOB_TYPE_TAG,_SC("std_blob"),_blob_methods,bloblib_funcs)))
+        return SQ_ERROR;
+    return declare_streamex(v,_SC("mmapfile"),(SQUserPointer)SQSTD_MMAPFILE_TYPE_TAG,_SC("std_mmapfile"),_SC("std_blob"),_mmapfile_methods,_mmapfile_funcs);
 }
 
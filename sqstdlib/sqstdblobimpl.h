@@ -2,22 +2,60 @@
 #ifndef _SQSTD_BLOBIMPL_H_
 #define _SQSTD_BLOBIMPL_H_
 
+//memory of a blob, shared with the slices taken from it
+struct SQBlobBuffer
+{
+    SQBlobBuffer(unsigned char *data, SQInteger size) {
+        _refs = 1;
+        _data = data;
+        _allocated = size;
+    }
+    virtual ~SQBlobBuffer() {
+        if(_data) sq_free(_data, _allocated);
+    }
+    virtual void Destroy() {
+        this->~SQBlobBuffer();
+        sq_free(this, sizeof(SQBlobBuffer));
+    }
+    static SQBlobBuffer *Create(SQInteger size) {
+        unsigned char *data = (unsigned char *)sq_malloc(size);
+        return new (sq_malloc(sizeof(SQBlobBuffer)))SQBlobBuffer(data, size);
+    }
+    void AddRef() { _refs++; }
+    void Release() {
+        if(--_refs == 0) Destroy();
+    }
+    SQInteger _refs;
+    unsigned char *_data;
+    SQInteger _allocated;
+};
+
 struct SQBlob : public SQStream
 {
     SQBlob(SQInteger size) {
+        _buffer = SQBlobBuffer::Create(size);
+        _buf = _buffer->_data;
+        memset(_buf, 0, size);
         _size = size;
-        _allocated = size;
-        _buf = (unsigned char *)sq_malloc(size);
-        memset(_buf, 0, _size);
         _ptr = 0;
-        _owns = true;
+        _owner = true;
+    }
+    //a view of size bytes at buf, inside the buffer; takes over a reference to the buffer.
+    //a view cannot be resized
+    SQBlob(SQBlobBuffer *buffer, unsigned char *buf, SQInteger size) {
+        _buffer = buffer;
+        _buf = buf;
+        _size = size;
+        _ptr = 0;
+        _owner = false;
     }
     virtual ~SQBlob() {
-        sq_free(_buf, _allocated);
+        if(_buffer) _buffer->Release();
     }
     SQInteger Write(void *buffer, SQInteger size) {
         if(!CanAdvance(size)) {
-            GrowBufOf(_ptr + size - _size);
+            if(!GrowBufOf(_ptr + size - _size))
+                size = _size - _ptr;
         }
         memcpy(&_buf[_ptr], buffer, size);
         _ptr += size;
@@ -34,35 +72,49 @@ struct SQBlob : public SQStream
         _ptr += n;
         return n;
     }
+    SQInteger ReadLine(void *buffer,SQInteger size) {
+        SQInteger n = _size - _ptr;
+        if(n > size) n = size;
+        if(n <= 0) return 0;
+        unsigned char *nl = (unsigned char *)memchr(&_buf[_ptr], '\n', n);
+        if(nl) n = (nl - &_buf[_ptr]) + 1;
+        memcpy(buffer, &_buf[_ptr], n);
+        _ptr += n;
+        return n;
+    }
     bool Resize(SQInteger n) {
-        if(!_owns) return false;
-        if(n != _allocated) {
-            unsigned char *newbuf = (unsigned char *)sq_malloc(n);
-            memset(newbuf,0,n);
+        if(!_owner) return false;
+        if(n != _buffer->_allocated) {
+            if(_buffer->_refs == 1) {
+                //the bytes past the end are never read before being written, no need to clear them
+                _buffer->_data = (unsigned char *)sq_realloc(_buffer->_data, _buffer->_allocated, n);
+                _buffer->_allocated = n;
+            }
+            else {
+                //the slices keep the old memory
+                SQBlobBuffer *newbuf = SQBlobBuffer::Create(n);
+                memcpy(newbuf->_data, _buf, _size < n ? _size : n);
+                _buffer->Release();
+                _buffer = newbuf;
+            }
+            _buf = _buffer->_data;
             if(_size > n)
-                memcpy(newbuf,_buf,n);
-            else
-                memcpy(newbuf,_buf,_size);
-            sq_free(_buf,_allocated);
-            _buf=newbuf;
-            _allocated = n;
-            if(_size > _allocated)
-                _size = _allocated;
-            if(_ptr > _allocated)
-                _ptr = _allocated;
+                _size = n;
+            if(_ptr > n)
+                _ptr = n;
         }
         return true;
     }
     bool GrowBufOf(SQInteger n)
     {
         bool ret = true;
-        if(_size + n > _allocated) {
+        if(_size + n > (_owner ? _buffer->_allocated : _size)) {
             if(_size + n > _size * 2)
                 ret = Resize(_size + n);
             else
                 ret = Resize(_size * 2);
         }
-        _size = _size + n;
+        if(ret) _size = _size + n;
         return ret;
     }
     bool CanAdvance(SQInteger n) {
@@ -97,12 +149,17 @@ struct SQBlob : public SQStream
     SQInteger Tell() { return _ptr; }
     SQInteger Len() { return _size; }
     SQUserPointer GetBuf(){ return _buf; }
-private:
+    //returns a view of size bytes at offset that shares the memory of this blob
+    SQBlob *Slice(SQInteger offset, SQInteger size) {
+        _buffer->AddRef();
+        return new (sq_malloc(sizeof(SQBlob)))SQBlob(_buffer, _buf + offset, size);
+    }
+protected:
+    SQBlobBuffer *_buffer;
     SQInteger _size;
-    SQInteger _allocated;
     SQInteger _ptr;
     unsigned char *_buf;
-    bool _owns;
+    bool _owner;
 };
 
 #endif //_SQSTD_BLOBIMPL_H_
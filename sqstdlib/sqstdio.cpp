@@ -1,6 +1,18 @@
 /* see copyright notice in squirrel.h */
 #include <new>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#include <direct.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#endif
 #include <squirrel.h>
 #include <sqstdio.h>
 #include "sqstdstream.h"
@@ -60,10 +72,35 @@ SQInteger sqstd_feof(SQFILE file)
 }
 
 //File
+#define SQSTD_FILE_BUFFER_SIZE (64*1024)
+#define SQSTD_FILE_MINFILL 512
+
+#if defined(__unix__) || defined(__APPLE__)
+#define sqstd_lockfile(f) flockfile((FILE *)(f))
+#define sqstd_unlockfile(f) funlockfile((FILE *)(f))
+#define sqstd_getc(f) getc_unlocked((FILE *)(f))
+#else
+#define sqstd_lockfile(f)
+#define sqstd_unlockfile(f)
+#define sqstd_getc(f) getc((FILE *)(f))
+#endif
+
+//files opened by the file class read and write through a buffer of their own,
+//files bound with sqstd_createfile() use the FILE directly
 struct SQFile : public SQStream {
-    SQFile() { _handle = NULL; _owns = false;}
-    SQFile(SQFILE file, bool owns) { _handle = file; _owns = owns;}
-    virtual ~SQFile() { Close(); }
+    SQFile() { _handle = NULL; _owns = false; _buf = NULL; _bufsize = _bufpos = _buflen = _fillsize = 0; _writing = false; }
+    SQFile(SQFILE file, bool owns, SQInteger bufsize = 0) {
+        _handle = file; _owns = owns;
+        _buf = bufsize > 0 ? (unsigned char *)sq_malloc(bufsize) : NULL;
+        _bufsize = bufsize > 0 ? bufsize : 0;
+        _bufpos = _buflen = 0;
+        _fillsize = SQSTD_FILE_MINFILL < _bufsize ? SQSTD_FILE_MINFILL : _bufsize;
+        _writing = false;
+    }
+    virtual ~SQFile() {
+        Close();
+        if(_buf) sq_free(_buf,_bufsize);
+    }
     bool Open(const SQChar *filename ,const SQChar *mode) {
         Close();
         if( (_handle = sqstd_fopen(filename,mode)) ) {
@@ -73,40 +110,148 @@ struct SQFile : public SQStream {
         return false;
     }
     void Close() {
+        if(_handle) Sync();
         if(_handle && _owns) {
             sqstd_fclose(_handle);
             _handle = NULL;
             _owns = false;
         }
     }
+    //writes the pending data and gives the data read ahead back to the FILE,
+    //C requires a flush between a write and a following read on the same FILE
+    bool Sync() {
+        bool ret = true;
+        if(_writing) {
+            ret = sqstd_fwrite(_buf,1,_buflen,_handle) == _buflen;
+            if(sqstd_fflush(_handle) != 0) ret = false;
+            _writing = false;
+        }
+        else if(_bufpos < _buflen) {
+            ret = sqstd_fseek(_handle,_bufpos - _buflen,SQ_SEEK_CUR) == 0;
+        }
+        _bufpos = _buflen = 0;
+        return ret;
+    }
     SQInteger Read(void *buffer,SQInteger size) {
-        return sqstd_fread(buffer,1,size,_handle);
+        if(!_buf) return sqstd_fread(buffer,1,size,_handle);
+        if(_writing) Sync();
+        unsigned char *dest = (unsigned char *)buffer;
+        SQInteger n = _buflen - _bufpos;
+        if(n >= size) {
+            memcpy(dest,&_buf[_bufpos],size);
+            _bufpos += size;
+            return size;
+        }
+        memcpy(dest,&_buf[_bufpos],n);
+        _bufpos = _buflen = 0;
+        if(size - n >= _fillsize)
+            return n + sqstd_fread(dest + n,1,size - n,_handle);
+        if(!Fill()) return n;
+        SQInteger m = size - n < _buflen ? size - n : _buflen;
+        memcpy(dest + n,_buf,m);
+        _bufpos = m;
+        return n + m;
+    }
+    SQInteger ReadLine(void *buffer,SQInteger size) {
+        unsigned char *dest = (unsigned char *)buffer;
+        SQInteger n = 0;
+        if(!_buf) {
+            int c;
+            sqstd_lockfile(_handle);
+            while(n < size && (c = sqstd_getc(_handle)) != EOF) {
+                dest[n++] = (unsigned char)c;
+                if(c == '\n') break;
+            }
+            sqstd_unlockfile(_handle);
+            return n;
+        }
+        if(_writing) Sync();
+        while(n < size) {
+            if(_bufpos == _buflen && !Fill()) break;
+            SQInteger m = _buflen - _bufpos;
+            if(m > size - n) m = size - n;
+            unsigned char *nl = (unsigned char *)memchr(&_buf[_bufpos],'\n',m);
+            if(nl) m = (nl - &_buf[_bufpos]) + 1;
+            memcpy(dest + n,&_buf[_bufpos],m);
+            _bufpos += m;
+            n += m;
+            if(nl) break;
+        }
+        return n;
     }
     SQInteger Write(void *buffer,SQInteger size) {
-        return sqstd_fwrite(buffer,1,size,_handle);
+        if(!_buf) return sqstd_fwrite(buffer,1,size,_handle);
+        if(!_writing) {
+            //and a positioning call between a read and a following write
+            SQInteger back = _bufpos - _buflen;
+            if(sqstd_fseek(_handle,back,SQ_SEEK_CUR) != 0 && back != 0) return 0;
+            _bufpos = _buflen = 0;
+            _writing = true;
+        }
+        if(_buflen + size > _bufsize) {
+            SQInteger pending = _buflen;
+            _buflen = 0;
+            if(sqstd_fwrite(_buf,1,pending,_handle) != pending) return 0;
+            if(size >= _bufsize) return sqstd_fwrite(buffer,1,size,_handle);
+        }
+        memcpy(&_buf[_buflen],buffer,size);
+        _buflen += size;
+        return size;
     }
     SQInteger Flush() {
+        if(_buf && !Sync()) return -1;
         return sqstd_fflush(_handle);
     }
     SQInteger Tell() {
-        return sqstd_ftell(_handle);
+        SQInteger pos = sqstd_ftell(_handle);
+        if(pos < 0) return pos;
+        return _writing ? pos + _buflen : pos - (_buflen - _bufpos);
     }
     SQInteger Len() {
-        SQInteger prevpos=Tell();
-        Seek(0,SQ_SEEK_END);
-        SQInteger size=Tell();
-        Seek(prevpos,SQ_SEEK_SET);
+        if(_writing) Sync();
+        SQInteger prevpos = sqstd_ftell(_handle);
+        sqstd_fseek(_handle,0,SQ_SEEK_END);
+        SQInteger size = sqstd_ftell(_handle);
+        sqstd_fseek(_handle,prevpos,SQ_SEEK_SET);
         return size;
     }
     SQInteger Seek(SQInteger offset, SQInteger origin)  {
+        if(origin == SQ_SEEK_CUR && !_writing && _bufpos + offset >= 0 && _bufpos + offset <= _buflen) {
+            _bufpos += offset;
+            return 0;
+        }
+        if(origin == SQ_SEEK_CUR && !_writing) offset -= _buflen - _bufpos;
+        else if(!Sync()) return -1;
+        _bufpos = _buflen = 0;
+        _fillsize = SQSTD_FILE_MINFILL < _bufsize ? SQSTD_FILE_MINFILL : _bufsize;
         return sqstd_fseek(_handle,offset,origin);
     }
     bool IsValid() { return _handle?true:false; }
-    bool EOS() { return Tell()==Len()?true:false;}
-    SQFILE GetHandle() {return _handle;}
+    bool EOS() {
+        if(!_writing && _bufpos < _buflen) return false;
+        return Tell()==Len()?true:false;
+    }
+    SQFILE GetHandle() {
+        if(_buf) Sync();
+        return _handle;
+    }
 private:
+    //after a seek the buffer is filled a little at a time so that random accesses
+    //don't read a whole buffer, sequential reads double the size up to _bufsize
+    bool Fill() {
+        _bufpos = 0;
+        _buflen = sqstd_fread(_buf,1,_fillsize,_handle);
+        if(_fillsize < _bufsize) _fillsize = _fillsize * 2 < _bufsize ? _fillsize * 2 : _bufsize;
+        return _buflen > 0;
+    }
     SQFILE _handle;
     bool _owns;
+    unsigned char *_buf;
+    SQInteger _bufsize;
+    SQInteger _bufpos;
+    SQInteger _buflen;
+    SQInteger _fillsize;
+    bool _writing;
 };
 
 static SQInteger _file__typeof(HSQUIRRELVM v)
@@ -127,11 +272,17 @@ static SQInteger _file_constructor(HSQUIRRELVM v)
 {
     const SQChar *filename,*mode;
     bool owns = true;
+    SQInteger bufsize = 0;
     SQFile *f;
     SQFILE newf;
     if(sq_gettype(v,2) == OT_STRING && sq_gettype(v,3) == OT_STRING) {
         sq_getstring(v, 2, &filename);
         sq_getstring(v, 3, &mode);
+        bufsize = SQSTD_FILE_BUFFER_SIZE;
+        if(sq_gettop(v) > 3) {
+            if(SQ_FAILED(sq_getinteger(v, 4, &bufsize)) || bufsize < 0)
+                return sq_throwerror(v, _SC("invalid buffer size"));
+        }
         newf = sqstd_fopen(filename, mode);
         if(!newf) return sq_throwerror(v, _SC("cannot open file"));
     } else if(sq_gettype(v,2) == OT_USERPOINTER) {
@@ -141,7 +292,7 @@ static SQInteger _file_constructor(HSQUIRRELVM v)
         return sq_throwerror(v,_SC("wrong parameter"));
     }
 
-    f = new (sq_malloc(sizeof(SQFile)))SQFile(newf,owns);
+    f = new (sq_malloc(sizeof(SQFile)))SQFile(newf,owns,bufsize);
     if(SQ_FAILED(sq_setinstanceup(v,1,f))) {
         f->~SQFile();
         sq_free(f,sizeof(SQFile));
@@ -165,7 +316,7 @@ static SQInteger _file_close(HSQUIRRELVM v)
 //bindings
 #define _DECL_FILE_FUNC(name,nparams,typecheck) {_SC(#name),_file_##name,nparams,typecheck}
 static const SQRegFunction _file_methods[] = {
-    _DECL_FILE_FUNC(constructor,3,_SC("x")),
+    _DECL_FILE_FUNC(constructor,-3,_SC("x")),
     _DECL_FILE_FUNC(_typeof,1,_SC("x")),
     _DECL_FILE_FUNC(close,1,_SC("x")),
     {NULL,(SQFUNCTION)0,0,NULL}
@@ -337,6 +488,361 @@ SQInteger file_write(SQUserPointer file,SQUserPointer p,SQInteger size)
     return sqstd_fwrite(p,1,size,(SQFILE)file);
 }
 
+//bytecode images are mapped in memory and used in place by the VM
+#if defined(_WIN32)
+static SQInteger _io_unmapimage(SQUserPointer p,SQInteger SQ_UNUSED_ARG(size))
+{
+    UnmapViewOfFile(p);
+    return 1;
+}
+
+static SQUserPointer _io_mapimage(SQFILE file,SQInteger *size,SQRELEASEHOOK *release)
+{
+    HANDLE h = (HANDLE)_get_osfhandle(_fileno((FILE *)file));
+    LARGE_INTEGER fsize;
+    if(!GetFileSizeEx(h,&fsize)) return NULL;
+    HANDLE m = CreateFileMapping(h,NULL,PAGE_READONLY,0,0,NULL);
+    if(!m) return NULL;
+    SQUserPointer p = MapViewOfFile(m,FILE_MAP_READ,0,0,0);
+    CloseHandle(m);
+    *size = (SQInteger)fsize.QuadPart;
+    *release = _io_unmapimage;
+    return p;
+}
+#elif defined(__unix__) || defined(__APPLE__)
+static SQInteger _io_unmapimage(SQUserPointer p,SQInteger size)
+{
+    munmap(p,(size_t)size);
+    return 1;
+}
+
+static SQUserPointer _io_mapimage(SQFILE file,SQInteger *size,SQRELEASEHOOK *release)
+{
+    int fd = fileno((FILE *)file);
+    struct stat st;
+    if(fstat(fd,&st) != 0 || st.st_size == 0) return NULL;
+    SQUserPointer p = mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    if(p == MAP_FAILED) return NULL;
+    *size = (SQInteger)st.st_size;
+    *release = _io_unmapimage;
+    return p;
+}
+#else
+static SQInteger _io_freeimage(SQUserPointer p,SQInteger size)
+{
+    sq_free(p,size);
+    return 1;
+}
+
+static SQUserPointer _io_mapimage(SQFILE file,SQInteger *size,SQRELEASEHOOK *release)
+{
+    sqstd_fseek(file,0,SQ_SEEK_END);
+    SQInteger fsize = sqstd_ftell(file);
+    sqstd_fseek(file,0,SQ_SEEK_SET);
+    if(fsize <= 0) return NULL;
+    SQUserPointer p = sq_malloc(fsize);
+    if(sqstd_fread(p,1,fsize,file) != fsize) {
+        sq_free(p,fsize);
+        return NULL;
+    }
+    *size = fsize;
+    *release = _io_freeimage;
+    return p;
+}
+#endif
+
+//compile cache, stores the compiled scripts as bytecode images named after a hash of the source
+#define SQSTD_CACHE_KEYLEN 32
+#define SQSTD_CACHE_EXT _SC(".cnut")
+
+struct SQCompileCache
+{
+    SQInteger _maxsize;
+    SQInteger _used; //bytes used by the entries, only tracked with a maximum size
+    SQChar _dir[1];
+};
+
+struct SQCacheEntry
+{
+    SQChar _name[SQSTD_CACHE_KEYLEN + 8];
+    SQInteger _size;
+    SQInteger _mtime;
+};
+
+static SQCompileCache *_cache_get(HSQUIRRELVM v)
+{
+    SQUserPointer p = NULL;
+    SQInteger top = sq_gettop(v);
+    sq_pushregistrytable(v);
+    sq_pushstring(v,_SC("std_compilecache"),-1);
+    if(SQ_FAILED(sq_rawget(v,-2)) || SQ_FAILED(sq_getuserdata(v,-1,&p,NULL)))
+        p = NULL;
+    sq_settop(v,top);
+    return (SQCompileCache *)p;
+}
+
+//128 bits from two independent 64 bits lanes, the key is the hex string of both
+static void _cache_hash(const unsigned char *p,SQInteger len,unsigned long long h[2])
+{
+    for(SQInteger i = 0; i < len; i++) {
+        h[0] = (h[0] ^ p[i]) * 0x100000001B3ULL;
+        h[1] = (h[1] + p[i] + 1) * 0x9E3779B97F4A7C15ULL;
+        h[1] ^= h[1] >> 29;
+    }
+}
+
+static void _cache_key(HSQUIRRELVM v,const unsigned char *src,SQInteger len,const SQChar *filename,SQChar *key)
+{
+    unsigned long long h[2] = { 0xCBF29CE484222325ULL, 0x2545F4914F6CDD1DULL };
+    //everything that changes the compiled code: the source, its name (__FILE__ and the debug infos)
+    //the compiler options and the configuration of the VM
+    SQInteger opts[5] = { SQUIRREL_VERSION_NUMBER, (SQInteger)sq_getdebuginfo(v), (SQInteger)sizeof(SQChar),
+        (SQInteger)sizeof(SQInteger), (SQInteger)sizeof(SQFloat) };
+    _cache_hash((const unsigned char *)opts,sizeof(opts),h);
+    _cache_hash((const unsigned char *)filename,(SQInteger)(scstrlen(filename) * sizeof(SQChar)),h);
+    _cache_hash(src,len,h);
+    const SQChar *hex = _SC("0123456789abcdef");
+    for(SQInteger i = 0; i < SQSTD_CACHE_KEYLEN; i++)
+        key[i] = hex[(h[i / 16] >> ((15 - (i % 16)) * 4)) & 0xF];
+    key[SQSTD_CACHE_KEYLEN] = 0;
+}
+
+static bool _cache_iskey(const SQChar *name)
+{
+    for(SQInteger i = 0; i < SQSTD_CACHE_KEYLEN; i++) {
+        SQChar c = name[i];
+        if(!((c >= _SC('0') && c <= _SC('9')) || (c >= _SC('a') && c <= _SC('f'))))
+            return false;
+    }
+    return scstrcmp(&name[SQSTD_CACHE_KEYLEN],SQSTD_CACHE_EXT) == 0;
+}
+
+#if defined(SQUNICODE) && !defined(_WIN32)
+//the posix file functions take multibyte names
+static const char *_cache_mbs(const SQChar *s,char *buf,size_t size)
+{
+    return wcstombs(buf,s,size) < size ? buf : "";
+}
+
+static int _cache_remove(const SQChar *path)
+{
+    char buf[1024];
+    return remove(_cache_mbs(path,buf,sizeof(buf)));
+}
+#elif defined(SQUNICODE)
+#define _cache_remove _wremove
+#else
+#define _cache_remove remove
+#endif
+
+static bool _cache_rename(const SQChar *from,const SQChar *to)
+{
+#if defined(_WIN32)
+#ifdef SQUNICODE
+    return MoveFileExW(from,to,MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return MoveFileExA(from,to,MOVEFILE_REPLACE_EXISTING) != 0;
+#endif
+#else
+    //rename() replaces the destination atomically
+#ifdef SQUNICODE
+    char a[1024],b[1024];
+    return rename(_cache_mbs(from,a,sizeof(a)),_cache_mbs(to,b,sizeof(b))) == 0;
+#else
+    return rename(from,to) == 0;
+#endif
+#endif
+}
+
+static void _cache_addentry(SQCacheEntry **entries,SQInteger *allocated,SQInteger *n,const SQChar *name,SQInteger size,SQInteger mtime)
+{
+    if(*n == *allocated) {
+        SQInteger newsize = *n ? *n * 2 : 64;
+        *entries = (SQCacheEntry *)sq_realloc(*entries,*n * sizeof(SQCacheEntry),newsize * sizeof(SQCacheEntry));
+        *allocated = newsize;
+    }
+    SQCacheEntry &e = (*entries)[(*n)++];
+    memcpy(e._name,name,(scstrlen(name) + 1) * sizeof(SQChar));
+    e._size = size;
+    e._mtime = mtime;
+}
+
+//lists the cache entries, returns their number
+static SQInteger _cache_list(SQCompileCache *c,SQCacheEntry **entries,SQInteger *allocated)
+{
+    SQInteger n = 0;
+    SQInteger namelen = SQSTD_CACHE_KEYLEN + scstrlen(SQSTD_CACHE_EXT);
+#if defined(_WIN32)
+    SQChar path[1024];
+#ifdef SQUNICODE
+    WIN32_FIND_DATAW fd;
+    scsprintf(path,1024,_SC("%s\\*") SQSTD_CACHE_EXT,c->_dir);
+    HANDLE h = FindFirstFileW(path,&fd);
+#else
+    WIN32_FIND_DATAA fd;
+    scsprintf(path,1024,_SC("%s\\*") SQSTD_CACHE_EXT,c->_dir);
+    HANDLE h = FindFirstFileA(path,&fd);
+#endif
+    if(h == INVALID_HANDLE_VALUE) return 0;
+    do {
+        if((SQInteger)scstrlen(fd.cFileName) != namelen || !_cache_iskey(fd.cFileName)) continue;
+        _cache_addentry(entries,allocated,&n,fd.cFileName,
+            (SQInteger)(((unsigned long long)fd.nFileSizeHigh << 32) | fd.nFileSizeLow),
+            (SQInteger)(((unsigned long long)fd.ftLastWriteTime.dwHighDateTime << 32) | fd.ftLastWriteTime.dwLowDateTime));
+    }
+#ifdef SQUNICODE
+    while(FindNextFileW(h,&fd));
+#else
+    while(FindNextFileA(h,&fd));
+#endif
+    FindClose(h);
+#elif defined(__unix__) || defined(__APPLE__)
+    //the entry names are plain ascii
+    char path[1024];
+#ifdef SQUNICODE
+    char buf[1024];
+    SQChar name[SQSTD_CACHE_KEYLEN + 8];
+    const char *dir = _cache_mbs(c->_dir,buf,sizeof(buf));
+#else
+    const char *dir = c->_dir;
+#endif
+    DIR *d = opendir(dir);
+    if(!d) return 0;
+    struct dirent *de;
+    while((de = readdir(d)) != NULL) {
+        struct stat st;
+        if((SQInteger)strlen(de->d_name) != namelen) continue;
+#ifdef SQUNICODE
+        for(SQInteger i = 0; i <= namelen; i++) name[i] = (unsigned char)de->d_name[i];
+#else
+        const SQChar *name = de->d_name;
+#endif
+        if(!_cache_iskey(name)) continue;
+        snprintf(path,sizeof(path),"%s/%s",dir,de->d_name);
+        if(stat(path,&st) != 0) continue;
+        _cache_addentry(entries,allocated,&n,name,(SQInteger)st.st_size,(SQInteger)st.st_mtime);
+    }
+    closedir(d);
+#endif
+    return n;
+}
+
+static int _cache_cmpentries(const void *a,const void *b)
+{
+    SQInteger ta = ((const SQCacheEntry *)a)->_mtime, tb = ((const SQCacheEntry *)b)->_mtime;
+    return ta < tb ? -1 : (ta > tb ? 1 : 0);
+}
+
+//removes the oldest entries until the cache is under 3/4 of its maximum size
+static void _cache_evict(SQCompileCache *c)
+{
+    SQCacheEntry *entries = NULL;
+    SQInteger allocated = 0;
+    SQInteger n = _cache_list(c,&entries,&allocated);
+    SQInteger used = 0;
+    for(SQInteger i = 0; i < n; i++) used += entries[i]._size;
+    if(used > c->_maxsize) {
+        SQChar path[1024];
+        qsort(entries,(size_t)n,sizeof(SQCacheEntry),_cache_cmpentries);
+        for(SQInteger i = 0; i < n && used > (c->_maxsize / 4) * 3; i++) {
+            scsprintf(path,1024,_SC("%s/%s"),c->_dir,entries[i]._name);
+            if(_cache_remove(path) == 0) used -= entries[i]._size;
+        }
+    }
+    c->_used = used;
+    if(entries) sq_free(entries,allocated * sizeof(SQCacheEntry));
+}
+
+//writes the closure on top of the stack in the cache, failures are not errors
+static void _cache_store(HSQUIRRELVM v,SQCompileCache *c,const SQChar *key)
+{
+    SQChar path[1024],tmp[1024];
+    scsprintf(path,1024,_SC("%s/%s%s"),c->_dir,key,SQSTD_CACHE_EXT);
+    //unique name so concurrent writers never see each other's partial files
+    scsprintf(tmp,1024,_SC("%s/%s.%p.%x.tmp"),c->_dir,key,(void *)v,(unsigned int)clock());
+    SQFILE file = sqstd_fopen(tmp,_SC("wb"));
+    if(!file) return;
+    bool ok = SQ_SUCCEEDED(sq_writeclosureimage(v,file_write,file));
+    SQInteger size = sqstd_ftell(file);
+    ok = sqstd_fclose(file) == 0 && ok;
+    if(!ok || !_cache_rename(tmp,path)) {
+        _cache_remove(tmp);
+        return;
+    }
+    if(c->_maxsize > 0) {
+        c->_used += size;
+        if(c->_used > c->_maxsize) _cache_evict(c);
+    }
+}
+
+//reads the source, loads its compiled image from the cache if present; otherwise fills key and leaves the file at its beginning
+static bool _cache_load(HSQUIRRELVM v,SQCompileCache *c,SQFILE file,const SQChar *filename,SQChar *key)
+{
+    sqstd_fseek(file,0,SQ_SEEK_END);
+    SQInteger len = sqstd_ftell(file);
+    sqstd_fseek(file,0,SQ_SEEK_SET);
+    if(len < 0) return false;
+    unsigned char *src = (unsigned char *)sq_malloc(len ? len : 1);
+    bool read = sqstd_fread(src,1,len,file) == len;
+    sqstd_fseek(file,0,SQ_SEEK_SET);
+    if(read) _cache_key(v,src,len,filename,key);
+    sq_free(src,len ? len : 1);
+    if(!read) return false;
+
+    SQChar path[1024];
+    scsprintf(path,1024,_SC("%s/%s%s"),c->_dir,key,SQSTD_CACHE_EXT);
+    SQFILE cached = sqstd_fopen(path,_SC("rb"));
+    if(!cached) return false;
+    SQInteger size;
+    SQRELEASEHOOK release;
+    SQUserPointer image = _io_mapimage(cached,&size,&release);
+    sqstd_fclose(cached);
+    if(image && SQ_SUCCEEDED(sq_readclosureimage(v,image,size,release)))
+        return true;
+    //stale or corrupted entry, it is overwritten after compiling
+    return false;
+}
+
+SQRESULT sqstd_setcompilecache(HSQUIRRELVM v,const SQChar *dir,SQInteger maxsize)
+{
+    sq_pushregistrytable(v);
+    sq_pushstring(v,_SC("std_compilecache"),-1);
+    if(!dir) {
+        sq_rawdeleteslot(v,-2,SQFalse);
+        sq_pop(v,1);
+        return SQ_OK;
+    }
+    SQInteger len = scstrlen(dir);
+    while(len > 1 && (dir[len - 1] == _SC('/') || dir[len - 1] == _SC('\\'))) len--;
+    if(len == 0 || len > 512) {
+        sq_pop(v,2);
+        return sq_throwerror(v,_SC("invalid cache directory"));
+    }
+    SQCompileCache *c = (SQCompileCache *)sq_newuserdata(v,sizeof(SQCompileCache) + len * sizeof(SQChar));
+    memcpy(c->_dir,dir,len * sizeof(SQChar));
+    c->_dir[len] = 0;
+    c->_maxsize = maxsize;
+    c->_used = 0;
+#if defined(_WIN32)
+#ifdef SQUNICODE
+    _wmkdir(c->_dir);
+#else
+    _mkdir(c->_dir);
+#endif
+#elif defined(__unix__) || defined(__APPLE__)
+#ifdef SQUNICODE
+    char buf[1024];
+    mkdir(_cache_mbs(c->_dir,buf,sizeof(buf)),0777);
+#else
+    mkdir(c->_dir,0777);
+#endif
+#endif
+    if(maxsize > 0) _cache_evict(c);
+    sq_rawset(v,-3);
+    sq_pop(v,1);
+    return SQ_OK;
+}
+
 SQRESULT sqstd_loadfile(HSQUIRRELVM v,const SQChar *filename,SQBool printerror)
 {
     SQFILE file = sqstd_fopen(filename,_SC("rb"));
@@ -345,6 +851,8 @@ SQRESULT sqstd_loadfile(HSQUIRRELVM v,const SQChar *filename,SQBool printerror)
     unsigned short us;
     unsigned char uc;
     SQLEXREADFUNC func = _io_file_lexfeed_PLAIN;
+    SQCompileCache *cache = NULL;
+    SQChar key[SQSTD_CACHE_KEYLEN + 1];
     if(file){
         ret = sqstd_fread(&us,1,2,file);
         if(ret != 2) {
@@ -358,7 +866,25 @@ SQRESULT sqstd_loadfile(HSQUIRRELVM v,const SQChar *filename,SQBool printerror)
                 return SQ_OK;
             }
         }
+        else if(us == SQ_BYTECODE_IMAGE_TAG) { //BYTECODE IMAGE
+            SQInteger size;
+            SQRELEASEHOOK release;
+            SQUserPointer image = _io_mapimage(file,&size,&release);
+            sqstd_fclose(file);
+            if(!image)
+                return sq_throwerror(v,_SC("cannot map the bytecode image"));
+            //the VM releases the image once no function loaded from it is alive
+            return sq_readclosureimage(v,image,size,release);
+        }
         else { //SCRIPT
+            if((cache = _cache_get(v)) != NULL) {
+                key[0] = 0;
+                if(_cache_load(v,cache,file,filename,key)) {
+                    sqstd_fclose(file);
+                    return SQ_OK;
+                }
+                sqstd_fseek(file,2,SQ_SEEK_SET); //past the encoding prefix, as expected below
+            }
 
             switch(us)
             {
@@ -388,6 +914,7 @@ SQRESULT sqstd_loadfile(HSQUIRRELVM v,const SQChar *filename,SQBool printerror)
             buffer.file = file;
             if(SQ_SUCCEEDED(sq_compile(v,func,&buffer,filename,printerror))){
                 sqstd_fclose(file);
+                if(cache && key[0]) _cache_store(v,cache,key);
                 return SQ_OK;
             }
         }
@@ -426,6 +953,42 @@ SQRESULT sqstd_writeclosuretofile(HSQUIRRELVM v,const SQChar *filename)
     return SQ_ERROR; //forward the error
 }
 
+SQRESULT sqstd_writeclosureimagetofile(HSQUIRRELVM v,const SQChar *filename)
+{
+    SQFILE file = sqstd_fopen(filename,_SC("wb+"));
+    if(!file) return sq_throwerror(v,_SC("cannot open the file"));
+    if(SQ_SUCCEEDED(sq_writeclosureimage(v,file_write,file))) {
+        sqstd_fclose(file);
+        return SQ_OK;
+    }
+    sqstd_fclose(file);
+    return SQ_ERROR; //forward the error
+}
+
+SQRESULT sqstd_writesnapshottofile(HSQUIRRELVM v,SQInteger bindings,const SQChar *filename)
+{
+    SQFILE file = sqstd_fopen(filename,_SC("wb+"));
+    if(!file) return sq_throwerror(v,_SC("cannot open the file"));
+    if(SQ_SUCCEEDED(sq_writesnapshot(v,bindings,file_write,file))) {
+        sqstd_fclose(file);
+        return SQ_OK;
+    }
+    sqstd_fclose(file);
+    return SQ_ERROR; //forward the error
+}
+
+SQRESULT sqstd_loadsnapshot(HSQUIRRELVM v,SQInteger bindings,const SQChar *filename)
+{
+    SQFILE file = sqstd_fopen(filename,_SC("rb"));
+    if(!file) return sq_throwerror(v,_SC("cannot open the file"));
+    if(SQ_SUCCEEDED(sq_readsnapshot(v,bindings,file_read,file))) {
+        sqstd_fclose(file);
+        return SQ_OK;
+    }
+    sqstd_fclose(file);
+    return SQ_ERROR; //forward the error
+}
+
 SQInteger _g_io_loadfile(HSQUIRRELVM v)
 {
     const SQChar *filename;
@@ -448,6 +1011,24 @@ SQInteger _g_io_writeclosuretofile(HSQUIRRELVM v)
     return SQ_ERROR; //propagates the error
 }
 
+SQInteger _g_io_writeclosureimagetofile(HSQUIRRELVM v)
+{
+    const SQChar *filename;
+    sq_getstring(v,2,&filename);
+    if(SQ_SUCCEEDED(sqstd_writeclosureimagetofile(v,filename)))
+        return 1;
+    return SQ_ERROR; //propagates the error
+}
+
+SQInteger _g_io_setcompilecache(HSQUIRRELVM v)
+{
+    const SQChar *dir = NULL;
+    SQInteger maxsize = 0;
+    if(sq_gettype(v,2) == OT_STRING) sq_getstring(v,2,&dir);
+    if(sq_gettop(v) >= 3) sq_getinteger(v,3,&maxsize);
+    return sqstd_setcompilecache(v,dir,maxsize);
+}
+
 SQInteger _g_io_dofile(HSQUIRRELVM v)
 {
     const SQChar *filename;
@@ -467,6 +1048,8 @@ static const SQRegFunction iolib_funcs[]={
     _DECL_GLOBALIO_FUNC(loadfile,-2,_SC(".sb")),
     _DECL_GLOBALIO_FUNC(dofile,-2,_SC(".sb")),
     _DECL_GLOBALIO_FUNC(writeclosuretofile,3,_SC(".sc")),
+    _DECL_GLOBALIO_FUNC(writeclosureimagetofile,3,_SC(".sc")),
+    _DECL_GLOBALIO_FUNC(setcompilecache,-2,_SC(".s|on")),
     {NULL,(SQFUNCTION)0,0,NULL}
 };
 
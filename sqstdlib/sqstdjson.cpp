@@ -0,0 +1,1129 @@
+/* see copyright notice in squirrel.h */
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <squirrel.h>
+#include <sqstdio.h>
+#include <sqstdblob.h>
+#include <sqstdjson.h>
+
+#define SQSTD_JSONPARSER_TYPE_TAG ((SQUnsignedInteger)0x80000300)
+
+#define SQSTD_JSON_MAXDEPTH 512
+//containers up to this size are collected on the stack and created with their exact size
+#define SQSTD_JSON_PRESIZE 256
+#define SQSTD_JSON_WRITEBUF 4096
+
+//Lexer
+
+#define TK_ERROR    -2
+#define TK_MORE     -1
+#define TK_EOF      0
+#define TK_STRING   256
+#define TK_NUMBER   257
+#define TK_TRUE     258
+#define TK_FALSE    259
+#define TK_NULL     260
+
+struct SQJsonToken
+{
+    SQInteger _type;
+    const SQChar *_begin;
+    const SQChar *_end;
+    bool _escaped;
+    bool _float;
+};
+
+static bool _json_isdigit(SQChar c) { return c >= '0' && c <= '9'; }
+
+static SQInteger _json_hex(SQChar c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static SQInteger _json_lexliteral(const SQChar *&p,const SQChar *end,bool final,const SQChar *lit,SQInteger type)
+{
+    const SQChar *s = p;
+    while(*lit) {
+        if(s == end) return final ? TK_ERROR : TK_MORE;
+        if(*s++ != *lit++) return TK_ERROR;
+    }
+    p = s;
+    return type;
+}
+
+static SQInteger _json_lexnumber(const SQChar *&p,const SQChar *end,bool final,SQJsonToken &t)
+{
+    //a number can only be known to be complete once something follows it
+    #define _NEXT() { if(++s == end) return final ? (ok ? (p = s, TK_NUMBER) : TK_ERROR) : TK_MORE; }
+    const SQChar *s = p;
+    bool ok = false;
+    t._float = false;
+    if(*s == '-') _NEXT();
+    if(*s == '0') { ok = true; _NEXT(); }
+    else if(_json_isdigit(*s)) { ok = true; do { _NEXT(); } while(_json_isdigit(*s)); }
+    else return TK_ERROR;
+    if(*s == '.') {
+        t._float = true; ok = false; _NEXT();
+        if(!_json_isdigit(*s)) return TK_ERROR;
+        ok = true; do { _NEXT(); } while(_json_isdigit(*s));
+    }
+    if(*s == 'e' || *s == 'E') {
+        t._float = true; ok = false; _NEXT();
+        if(*s == '+' || *s == '-') _NEXT();
+        if(!_json_isdigit(*s)) return TK_ERROR;
+        ok = true; do { _NEXT(); } while(_json_isdigit(*s));
+    }
+    #undef _NEXT
+    p = s;
+    return TK_NUMBER;
+}
+
+//scans the next token from [p,end); p is only advanced past complete tokens.
+//when 'final' is false, a token cut by the end of the buffer returns TK_MORE
+static SQInteger _json_lex(const SQChar *&p,const SQChar *end,bool final,SQJsonToken &t)
+{
+    while(p != end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    if(p == end) return TK_EOF;
+    t._begin = p;
+    switch(*p) {
+    case '{': case '}': case '[': case ']': case ':': case ',':
+        return t._type = *p++;
+    case '"': {
+        const SQChar *s = p + 1;
+        t._escaped = false;
+        for(;;) {
+            if(s == end) return final ? TK_ERROR : TK_MORE;
+            SQChar c = *s;
+            if(c == '"') break;
+            if(c == '\\') {
+                t._escaped = true;
+                if(end - s < 2) return final ? TK_ERROR : TK_MORE;
+                switch(s[1]) {
+                case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                    s += 2;
+                    break;
+                case 'u':
+                    if(end - s < 6) return final ? TK_ERROR : TK_MORE;
+                    for(SQInteger i = 2; i < 6; i++) {
+                        if(_json_hex(s[i]) < 0) return TK_ERROR;
+                    }
+                    s += 6;
+                    break;
+                default:
+                    return TK_ERROR;
+                }
+                continue;
+            }
+            if((unsigned)c < 0x20) return TK_ERROR;
+            s++;
+        }
+        t._begin = p + 1;
+        t._end = s;
+        p = s + 1;
+        return t._type = TK_STRING;
+              }
+    case 't': return t._type = _json_lexliteral(p,end,final,_SC("true"),TK_TRUE);
+    case 'f': return t._type = _json_lexliteral(p,end,final,_SC("false"),TK_FALSE);
+    case 'n': return t._type = _json_lexliteral(p,end,final,_SC("null"),TK_NULL);
+    default: {
+        SQInteger r = _json_lexnumber(p,end,final,t);
+        t._end = p;
+        return t._type = r;
+             }
+    }
+}
+
+static SQChar *_json_putcodepoint(SQChar *d,SQUnsignedInteger32 cp)
+{
+#ifdef SQUNICODE
+    if(sizeof(SQChar) == 2 && cp >= 0x10000) {
+        cp -= 0x10000;
+        *d++ = (SQChar)(0xD800 + (cp >> 10));
+        *d++ = (SQChar)(0xDC00 + (cp & 0x3FF));
+    }
+    else *d++ = (SQChar)cp;
+#else
+    if(cp < 0x80) *d++ = (SQChar)cp;
+    else if(cp < 0x800) {
+        *d++ = (SQChar)(0xC0 | (cp >> 6));
+        *d++ = (SQChar)(0x80 | (cp & 0x3F));
+    }
+    else if(cp < 0x10000) {
+        *d++ = (SQChar)(0xE0 | (cp >> 12));
+        *d++ = (SQChar)(0x80 | ((cp >> 6) & 0x3F));
+        *d++ = (SQChar)(0x80 | (cp & 0x3F));
+    }
+    else {
+        *d++ = (SQChar)(0xF0 | (cp >> 18));
+        *d++ = (SQChar)(0x80 | ((cp >> 12) & 0x3F));
+        *d++ = (SQChar)(0x80 | ((cp >> 6) & 0x3F));
+        *d++ = (SQChar)(0x80 | (cp & 0x3F));
+    }
+#endif
+    return d;
+}
+
+static SQUnsignedInteger32 _json_hex4(const SQChar *s)
+{
+    return (SQUnsignedInteger32)((_json_hex(s[0]) << 12) | (_json_hex(s[1]) << 8) | (_json_hex(s[2]) << 4) | _json_hex(s[3]));
+}
+
+//the lexer already validated the escapes
+static void _json_pushstring(HSQUIRRELVM v,const SQJsonToken &t)
+{
+    SQInteger len = t._end - t._begin;
+    if(!t._escaped) {
+        sq_pushstring(v,t._begin,len);
+        return;
+    }
+    //an escape never decodes to more characters than it takes
+    SQChar *dest = sq_getscratchpad(v,len * sizeof(SQChar)), *d = dest;
+    const SQChar *s = t._begin;
+    while(s != t._end) {
+        if(*s != '\\') { *d++ = *s++; continue; }
+        switch(s[1]) {
+        case 'b': *d++ = '\b'; break;
+        case 'f': *d++ = '\f'; break;
+        case 'n': *d++ = '\n'; break;
+        case 'r': *d++ = '\r'; break;
+        case 't': *d++ = '\t'; break;
+        case 'u': {
+            SQUnsignedInteger32 cp = _json_hex4(s + 2);
+            if(cp >= 0xD800 && cp < 0xDC00 && t._end - s >= 12 && s[6] == '\\' && s[7] == 'u') {
+                SQUnsignedInteger32 lo = _json_hex4(s + 8);
+                if(lo >= 0xDC00 && lo < 0xE000) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    s += 6;
+                }
+            }
+            d = _json_putcodepoint(d,cp);
+            s += 6;
+            continue;
+                  }
+        default: *d++ = s[1]; break;
+        }
+        s += 2;
+    }
+    sq_pushstring(v,dest,d - dest);
+}
+
+static void _json_pushnumber(HSQUIRRELVM v,const SQJsonToken &t)
+{
+    const SQChar *s = t._begin;
+    if(!t._float) {
+        bool neg = *s == '-';
+        if(neg) s++;
+        SQUnsignedInteger limit = (SQUnsignedInteger)(~(SQUnsignedInteger)0 >> 1) + (neg ? 1 : 0);
+        SQUnsignedInteger n = 0;
+        for(; s != t._end; s++) {
+            SQUnsignedInteger d = (SQUnsignedInteger)(*s - '0');
+            if(n > (limit - d) / 10) break;
+            n = n * 10 + d;
+        }
+        if(s == t._end) {
+            sq_pushinteger(v,neg ? (SQInteger)(0 - n) : (SQInteger)n);
+            return;
+        }
+        //too large for an integer
+        s = t._begin;
+    }
+    SQInteger len = t._end - s;
+    SQChar *tmp = sq_getscratchpad(v,(len + 1) * sizeof(SQChar));
+    memcpy(tmp,s,len * sizeof(SQChar));
+    tmp[len] = 0;
+    sq_pushfloat(v,(SQFloat)scstrtod(tmp,NULL));
+}
+
+static void _json_pushscalar(HSQUIRRELVM v,const SQJsonToken &t)
+{
+    switch(t._type) {
+    case TK_STRING: _json_pushstring(v,t); break;
+    case TK_NUMBER: _json_pushnumber(v,t); break;
+    case TK_TRUE: sq_pushbool(v,SQTrue); break;
+    case TK_FALSE: sq_pushbool(v,SQFalse); break;
+    default: sq_pushnull(v); break;
+    }
+}
+
+static SQRESULT _json_syntaxerror(HSQUIRRELVM v,SQInteger offset,SQInteger tk)
+{
+    SQChar msg[64];
+    scsprintf(msg,64,tk == TK_EOF || tk == TK_MORE ? _SC("unexpected end of JSON input at offset %d")
+        : _SC("JSON syntax error at offset %d"),(int)offset);
+    return sq_throwerror(v,msg);
+}
+
+//moves the object on top of the stack to base + 1 and drops everything in between
+static void _json_collapse(HSQUIRRELVM v,SQInteger base)
+{
+    HSQOBJECT o;
+    sq_getstackobj(v,-1,&o);
+    sq_addref(v,&o);
+    sq_settop(v,base);
+    sq_pushobject(v,o);
+    sq_release(v,&o);
+}
+
+//Parser (whole documents)
+
+struct SQJsonReader
+{
+    HSQUIRRELVM _v;
+    const SQChar *_begin;
+    const SQChar *_p;
+    const SQChar *_end;
+    SQRESULT Error(SQInteger tk) { return _json_syntaxerror(_v,_p - _begin,tk); }
+    SQInteger Next(SQJsonToken &t) { return t._type = _json_lex(_p,_end,true,t); }
+};
+
+static SQRESULT _json_parsevalue(SQJsonReader &r,SQJsonToken &t,SQInteger depth);
+
+static SQRESULT _json_parsearray(SQJsonReader &r,SQInteger depth)
+{
+    HSQUIRRELVM v = r._v;
+    SQJsonToken t;
+    SQInteger tk, n = 0, base = sq_gettop(v);
+    bool spilled = false;
+    if(depth >= SQSTD_JSON_MAXDEPTH)
+        return sq_throwerror(v,_SC("JSON document nested too deeply"));
+    if((tk = r.Next(t)) == ']') {
+        sq_newarray(v,0);
+        return SQ_OK;
+    }
+    if(SQ_FAILED(sq_reservestack(v,SQSTD_JSON_PRESIZE + 2)))
+        return SQ_ERROR;
+    for(;;) {
+        if(SQ_FAILED(_json_parsevalue(r,t,depth + 1)))
+            return SQ_ERROR;
+        if(spilled) {
+            sq_arrayappend(v,base + 1);
+        }
+        else if(++n == SQSTD_JSON_PRESIZE) {
+            //too large to collect, the rest is appended
+            sq_newarray(v,n);
+            for(SQInteger i = 0; i < n; i++) {
+                sq_pushinteger(v,i);
+                sq_push(v,base + 1 + i);
+                sq_rawset(v,-3);
+            }
+            _json_collapse(v,base);
+            spilled = true;
+        }
+        tk = r.Next(t);
+        if(tk == ']') break;
+        if(tk != ',') return r.Error(tk);
+        r.Next(t);
+    }
+    if(!spilled) {
+        sq_newarray(v,n);
+        for(SQInteger i = 0; i < n; i++) {
+            sq_pushinteger(v,i);
+            sq_push(v,base + 1 + i);
+            sq_rawset(v,-3);
+        }
+        _json_collapse(v,base);
+    }
+    return SQ_OK;
+}
+
+static SQRESULT _json_parseobject(SQJsonReader &r,SQInteger depth)
+{
+    HSQUIRRELVM v = r._v;
+    SQJsonToken t;
+    SQInteger tk, n = 0, base = sq_gettop(v);
+    bool spilled = false;
+    if(depth >= SQSTD_JSON_MAXDEPTH)
+        return sq_throwerror(v,_SC("JSON document nested too deeply"));
+    if((tk = r.Next(t)) == '}') {
+        sq_newtable(v);
+        return SQ_OK;
+    }
+    if(SQ_FAILED(sq_reservestack(v,SQSTD_JSON_PRESIZE * 2 + 2)))
+        return SQ_ERROR;
+    for(;;) {
+        if(tk != TK_STRING) return r.Error(tk);
+        _json_pushstring(v,t);
+        if((tk = r.Next(t)) != ':') return r.Error(tk);
+        r.Next(t);
+        if(SQ_FAILED(_json_parsevalue(r,t,depth + 1)))
+            return SQ_ERROR;
+        if(spilled) {
+            sq_rawset(v,base + 1);
+        }
+        else if(++n == SQSTD_JSON_PRESIZE) {
+            sq_newtableex(v,n * 2);
+            for(SQInteger i = 0; i < n; i++) {
+                sq_push(v,base + 1 + i * 2);
+                sq_push(v,base + 2 + i * 2);
+                sq_rawset(v,-3);
+            }
+            _json_collapse(v,base);
+            spilled = true;
+        }
+        tk = r.Next(t);
+        if(tk == '}') break;
+        if(tk != ',') return r.Error(tk);
+        tk = r.Next(t);
+    }
+    if(!spilled) {
+        sq_newtableex(v,n);
+        for(SQInteger i = 0; i < n; i++) {
+            sq_push(v,base + 1 + i * 2);
+            sq_push(v,base + 2 + i * 2);
+            sq_rawset(v,-3);
+        }
+        _json_collapse(v,base);
+    }
+    return SQ_OK;
+}
+
+static SQRESULT _json_parsevalue(SQJsonReader &r,SQJsonToken &t,SQInteger depth)
+{
+    switch(t._type) {
+    case TK_STRING: case TK_NUMBER: case TK_TRUE: case TK_FALSE: case TK_NULL:
+        _json_pushscalar(r._v,t);
+        return SQ_OK;
+    case '[': return _json_parsearray(r,depth);
+    case '{': return _json_parseobject(r,depth);
+    default: return r.Error(t._type);
+    }
+}
+
+SQRESULT sqstd_parsejson(HSQUIRRELVM v,const SQChar *s,SQInteger len)
+{
+    SQJsonReader r;
+    SQJsonToken t;
+    SQInteger top = sq_gettop(v);
+    r._v = v;
+    r._begin = r._p = s;
+    r._end = s + len;
+    r.Next(t);
+    if(t._type == TK_EOF) return r.Error(TK_EOF);
+    if(SQ_FAILED(_json_parsevalue(r,t,0))) {
+        sq_settop(v,top);
+        return SQ_ERROR;
+    }
+    SQInteger tk = r.Next(t);
+    if(tk != TK_EOF) {
+        sq_settop(v,top);
+        return r.Error(tk);
+    }
+    return SQ_OK;
+}
+
+//Writer
+
+struct SQJsonWriter
+{
+    HSQUIRRELVM _v;
+    SQWRITEFUNC _write;
+    SQUserPointer _up;
+    SQInteger _indent;
+    SQInteger _n;
+    SQChar _buf[SQSTD_JSON_WRITEBUF];
+    bool Flush() {
+        SQInteger size = _n * sizeof(SQChar);
+        _n = 0;
+        return !size || _write(_up,_buf,size) == size;
+    }
+    bool Put(SQChar c) {
+        if(_n == SQSTD_JSON_WRITEBUF && !Flush()) return false;
+        _buf[_n++] = c;
+        return true;
+    }
+    bool Put(const SQChar *s,SQInteger len) {
+        while(len) {
+            if(_n == SQSTD_JSON_WRITEBUF && !Flush()) return false;
+            SQInteger chunk = SQSTD_JSON_WRITEBUF - _n;
+            if(chunk > len) chunk = len;
+            memcpy(&_buf[_n],s,chunk * sizeof(SQChar));
+            _n += chunk; s += chunk; len -= chunk;
+        }
+        return true;
+    }
+    bool NewLine(SQInteger depth) {
+        if(!_indent) return true;
+        if(!Put('\n')) return false;
+        for(SQInteger i = 0; i < _indent * depth; i++) {
+            if(!Put(' ')) return false;
+        }
+        return true;
+    }
+};
+
+#define _CHECK_PUT(exp) { if(!(exp)) return sq_throwerror(w._v,_SC("io error")); }
+
+static SQRESULT _json_writestring(SQJsonWriter &w,const SQChar *s,SQInteger len)
+{
+    static const SQChar hex[] = _SC("0123456789abcdef");
+    const SQChar *end = s + len, *run = s;
+    _CHECK_PUT(w.Put('"'));
+    for(; s != end; s++) {
+        SQChar c = *s;
+        if(c != '"' && c != '\\' && (unsigned)c >= 0x20) continue;
+        _CHECK_PUT(w.Put(run,s - run));
+        run = s + 1;
+        SQChar esc[6] = { '\\', 0, 0, 0, 0, 0 };
+        SQInteger n = 2;
+        switch(c) {
+        case '"': esc[1] = '"'; break;
+        case '\\': esc[1] = '\\'; break;
+        case '\b': esc[1] = 'b'; break;
+        case '\f': esc[1] = 'f'; break;
+        case '\n': esc[1] = 'n'; break;
+        case '\r': esc[1] = 'r'; break;
+        case '\t': esc[1] = 't'; break;
+        default:
+            esc[1] = 'u'; esc[2] = '0'; esc[3] = '0';
+            esc[4] = hex[(c >> 4) & 0xF]; esc[5] = hex[c & 0xF];
+            n = 6;
+            break;
+        }
+        _CHECK_PUT(w.Put(esc,n));
+    }
+    _CHECK_PUT(w.Put(run,s - run));
+    _CHECK_PUT(w.Put('"'));
+    return SQ_OK;
+}
+
+static SQRESULT _json_writefloat(SQJsonWriter &w,SQFloat f)
+{
+    SQChar tmp[64];
+    //JSON has no nan or infinity
+    if(f != f || f - f != 0) {
+        _CHECK_PUT(w.Put(_SC("null"),4));
+        return SQ_OK;
+    }
+    bool single = sizeof(SQFloat) == sizeof(float);
+    //the shortest form that reads back as the same value
+    scsprintf(tmp,64,_SC("%.*g"),single ? 7 : 15,(double)f);
+    if((SQFloat)scstrtod(tmp,NULL) != f)
+        scsprintf(tmp,64,_SC("%.*g"),single ? 9 : 17,(double)f);
+    SQInteger len = (SQInteger)scstrlen(tmp);
+    bool integral = true;
+    for(SQInteger i = 0; i < len; i++) {
+        if(tmp[i] == '.' || tmp[i] == 'e' || tmp[i] == 'E') integral = false;
+    }
+    _CHECK_PUT(w.Put(tmp,len));
+    //keeps floats floats when the document is read back
+    if(integral) _CHECK_PUT(w.Put(_SC(".0"),2));
+    return SQ_OK;
+}
+
+static SQRESULT _json_writevalue(SQJsonWriter &w,SQInteger idx,SQInteger depth)
+{
+    HSQUIRRELVM v = w._v;
+    SQObjectType type = sq_gettype(v,idx);
+    switch(type) {
+    case OT_NULL:
+        _CHECK_PUT(w.Put(_SC("null"),4));
+        break;
+    case OT_BOOL: {
+        SQBool b;
+        sq_getbool(v,idx,&b);
+        _CHECK_PUT(b ? w.Put(_SC("true"),4) : w.Put(_SC("false"),5));
+                  }
+        break;
+    case OT_INTEGER: {
+        SQChar tmp[32];
+        SQInteger i;
+        sq_getinteger(v,idx,&i);
+        scsprintf(tmp,32,_PRINT_INT_FMT,i);
+        _CHECK_PUT(w.Put(tmp,(SQInteger)scstrlen(tmp)));
+                     }
+        break;
+    case OT_FLOAT: {
+        SQFloat f;
+        sq_getfloat(v,idx,&f);
+        return _json_writefloat(w,f);
+                   }
+    case OT_STRING: {
+        const SQChar *s;
+        SQInteger len;
+        sq_getstringandsize(v,idx,&s,&len);
+        return _json_writestring(w,s,len);
+                    }
+    case OT_INSTANCE: {
+        SQUserPointer up = NULL;
+        sq_getinstanceup(v,idx,&up,0);
+        if(up)
+            return sq_throwerror(v,_SC("cannot convert an instance of a native class to JSON"));
+                      }
+        //fallthrough
+    case OT_TABLE:
+    case OT_ARRAY: {
+        bool isarray = type == OT_ARRAY, first = true;
+        if(depth >= SQSTD_JSON_MAXDEPTH)
+            return sq_throwerror(v,_SC("object nested too deeply to be converted to JSON (cycle?)"));
+        SQInteger iter = idx;
+        if(SQ_FAILED(sq_reservestack(v,5)))
+            return SQ_ERROR;
+        _CHECK_PUT(w.Put(isarray ? '[' : '{'));
+        //instances are written as the object of their fields, the members are listed by the class
+        if(type == OT_INSTANCE) {
+            sq_getclass(v,idx);
+            iter = sq_gettop(v);
+        }
+        sq_pushnull(v);
+        while(SQ_SUCCEEDED(sq_next(v,iter))) {
+            if(type == OT_INSTANCE) {
+                sq_pop(v,1);
+                sq_push(v,-1);
+                sq_rawget(v,idx);
+                SQObjectType vt = sq_gettype(v,-1);
+                if(vt == OT_CLOSURE || vt == OT_NATIVECLOSURE) {
+                    sq_pop(v,2);
+                    continue;
+                }
+            }
+            if(!first) _CHECK_PUT(w.Put(','));
+            first = false;
+            _CHECK_PUT(w.NewLine(depth + 1));
+            if(!isarray) {
+                SQInteger key = sq_gettop(v) - 1;
+                if(sq_gettype(v,key) == OT_INTEGER) {
+                    SQChar tmp[32];
+                    SQInteger i;
+                    sq_getinteger(v,key,&i);
+                    scsprintf(tmp,32,_PRINT_INT_FMT,i);
+                    if(SQ_FAILED(_json_writestring(w,tmp,(SQInteger)scstrlen(tmp)))) return SQ_ERROR;
+                }
+                else if(sq_gettype(v,key) == OT_STRING) {
+                    if(SQ_FAILED(_json_writevalue(w,key,depth + 1))) return SQ_ERROR;
+                }
+                else return sq_throwerror(v,_SC("JSON object keys must be strings or integers"));
+                _CHECK_PUT(w.Put(':'));
+                if(w._indent) _CHECK_PUT(w.Put(' '));
+            }
+            if(SQ_FAILED(_json_writevalue(w,sq_gettop(v),depth + 1)))
+                return SQ_ERROR;
+            sq_pop(v,2);
+        }
+        sq_pop(v,type == OT_INSTANCE ? 2 : 1);
+        if(!first) _CHECK_PUT(w.NewLine(depth));
+        _CHECK_PUT(w.Put(isarray ? ']' : '}'));
+                   }
+        break;
+    default:
+        sq_typeof(v,idx);
+        {
+            const SQChar *name = _SC("?");
+            sq_getstring(v,-1,&name);
+            SQChar msg[64];
+            scsprintf(msg,64,_SC("cannot convert a %s to JSON"),name);
+            return sq_throwerror(v,msg);
+        }
+    }
+    return SQ_OK;
+}
+
+SQRESULT sqstd_writejson(HSQUIRRELVM v,SQInteger idx,SQInteger indent,SQWRITEFUNC writef,SQUserPointer up)
+{
+    SQJsonWriter *w = (SQJsonWriter *)sq_malloc(sizeof(SQJsonWriter));
+    SQInteger top = sq_gettop(v);
+    w->_v = v;
+    w->_write = writef;
+    w->_up = up;
+    w->_indent = indent < 0 ? 0 : indent;
+    w->_n = 0;
+    if(idx < 0) idx = top + idx + 1;
+    SQRESULT r = _json_writevalue(*w,idx,0);
+    if(SQ_SUCCEEDED(r) && !w->Flush())
+        r = sq_throwerror(v,_SC("io error"));
+    sq_free(w,sizeof(SQJsonWriter));
+    sq_settop(v,top);
+    return r;
+}
+
+//Streaming parser
+
+#define ST_VALUE        0   //a value (top level, after ':' or after ',' in an array)
+#define ST_ARRAY_FIRST  1   //a value or ']'
+#define ST_ARRAY_NEXT   2   //',' or ']'
+#define ST_OBJECT_FIRST 3   //a key or '}'
+#define ST_OBJECT_KEY   4   //a key
+#define ST_COLON        5   //':'
+#define ST_OBJECT_NEXT  6   //',' or '}'
+#define ST_FAILED       7
+
+struct SQJsonParser
+{
+    unsigned char *_stack; //'a' or 'o' for every open container
+    SQInteger _depth;
+    SQInteger _stacksize;
+    SQInteger _state;
+    SQChar *_pending; //the unfinished token at the end of the last chunk
+    SQInteger _pendinglen;
+    SQInteger _pendingsize;
+    SQInteger _offset;
+};
+
+//handler methods, in the order they are pushed on the stack
+#define EV_BEGINOBJECT  0
+#define EV_ENDOBJECT    1
+#define EV_BEGINARRAY   2
+#define EV_ENDARRAY     3
+#define EV_KEY          4
+#define EV_VALUE        5
+#define EV_COUNT        6
+
+static const SQChar *_json_events[EV_COUNT] = {
+    _SC("beginobject"), _SC("endobject"), _SC("beginarray"), _SC("endarray"), _SC("key"), _SC("value")
+};
+
+//without a handler the parser builds the values itself; containers still open
+//(and the pending keys) are kept in 'build', finished documents go to 'results'
+struct SQJsonSink
+{
+    HSQUIRRELVM _v;
+    SQInteger _handler; //stack index of the handler or 0
+    SQInteger _methods; //stack index of the first handler method
+    SQInteger _build;
+    SQInteger _results;
+};
+
+static SQRESULT _json_call(SQJsonSink &s,SQInteger ev,const SQJsonToken *t)
+{
+    HSQUIRRELVM v = s._v;
+    if(sq_gettype(v,s._methods + ev) == OT_NULL)
+        return SQ_OK;
+    sq_push(v,s._methods + ev);
+    sq_push(v,s._handler);
+    if(t) _json_pushscalar(v,*t);
+    SQRESULT r = sq_call(v,t ? 2 : 1,SQFalse,SQFalse);
+    sq_pop(v,1);
+    return r;
+}
+
+//adds the value on top of the stack to the innermost open container and pops it
+static void _json_buildadd(SQJsonSink &s,SQJsonParser *p)
+{
+    HSQUIRRELVM v = s._v;
+    SQInteger n = sq_getsize(v,s._build);
+    if(p->_depth == 0) {
+        sq_arrayappend(v,s._results);
+        return;
+    }
+    if(p->_stack[p->_depth - 1] == 'a') {
+        sq_pushinteger(v,n - 1);
+        sq_rawget(v,s._build);
+        sq_push(v,-2);
+        sq_arrayappend(v,-2);
+        sq_pop(v,2);
+    }
+    else {
+        sq_pushinteger(v,n - 2);
+        sq_rawget(v,s._build);
+        sq_pushinteger(v,n - 1);
+        sq_rawget(v,s._build);
+        sq_push(v,-3);
+        sq_rawset(v,-3);
+        sq_pop(v,2);
+        sq_arraypop(v,s._build,SQFalse);
+    }
+}
+
+static SQRESULT _json_begin(SQJsonSink &s,SQJsonParser *p,unsigned char kind)
+{
+    HSQUIRRELVM v = s._v;
+    if(p->_depth >= SQSTD_JSON_MAXDEPTH)
+        return sq_throwerror(v,_SC("JSON document nested too deeply"));
+    if(s._handler) {
+        if(SQ_FAILED(_json_call(s,kind == 'a' ? EV_BEGINARRAY : EV_BEGINOBJECT,NULL)))
+            return SQ_ERROR;
+    }
+    else {
+        if(kind == 'a') sq_newarray(v,0);
+        else sq_newtable(v);
+        if(p->_depth) {
+            sq_push(v,-1);
+            _json_buildadd(s,p);
+        }
+        sq_arrayappend(v,s._build);
+    }
+    if(p->_depth == p->_stacksize) {
+        SQInteger newsize = p->_stacksize ? p->_stacksize * 2 : 16;
+        p->_stack = (unsigned char *)sq_realloc(p->_stack,p->_stacksize,newsize);
+        p->_stacksize = newsize;
+    }
+    p->_stack[p->_depth++] = kind;
+    p->_state = kind == 'a' ? ST_ARRAY_FIRST : ST_OBJECT_FIRST;
+    return SQ_OK;
+}
+
+static void _json_valuedone(SQJsonParser *p)
+{
+    p->_state = p->_depth == 0 ? ST_VALUE : (p->_stack[p->_depth - 1] == 'a' ? ST_ARRAY_NEXT : ST_OBJECT_NEXT);
+}
+
+static SQRESULT _json_end(SQJsonSink &s,SQJsonParser *p)
+{
+    HSQUIRRELVM v = s._v;
+    unsigned char kind = p->_stack[--p->_depth];
+    if(s._handler) {
+        if(SQ_FAILED(_json_call(s,kind == 'a' ? EV_ENDARRAY : EV_ENDOBJECT,NULL)))
+            return SQ_ERROR;
+    }
+    else {
+        sq_arraypop(v,s._build,p->_depth == 0 ? SQTrue : SQFalse);
+        if(p->_depth == 0) sq_arrayappend(v,s._results);
+    }
+    _json_valuedone(p);
+    return SQ_OK;
+}
+
+static SQRESULT _json_scalar(SQJsonSink &s,SQJsonParser *p,const SQJsonToken &t)
+{
+    if(s._handler) {
+        if(SQ_FAILED(_json_call(s,EV_VALUE,&t)))
+            return SQ_ERROR;
+    }
+    else {
+        _json_pushscalar(s._v,t);
+        _json_buildadd(s,p);
+    }
+    _json_valuedone(p);
+    return SQ_OK;
+}
+
+static SQRESULT _json_key(SQJsonSink &s,SQJsonParser *p,const SQJsonToken &t)
+{
+    if(s._handler) {
+        if(SQ_FAILED(_json_call(s,EV_KEY,&t)))
+            return SQ_ERROR;
+    }
+    else {
+        _json_pushstring(s._v,t);
+        sq_arrayappend(s._v,s._build);
+    }
+    p->_state = ST_COLON;
+    return SQ_OK;
+}
+
+static SQRESULT _json_feed(SQJsonSink &s,SQJsonParser *p,const SQChar *data,SQInteger len,bool final)
+{
+    HSQUIRRELVM v = s._v;
+    const SQChar *begin, *cur, *end;
+    SQChar *joined = NULL;
+    SQInteger joinedsize = 0;
+    if(p->_pendinglen) {
+        joinedsize = (p->_pendinglen + len) * sizeof(SQChar);
+        joined = (SQChar *)sq_malloc(joinedsize);
+        memcpy(joined,p->_pending,p->_pendinglen * sizeof(SQChar));
+        memcpy(joined + p->_pendinglen,data,len * sizeof(SQChar));
+        begin = joined;
+        end = joined + p->_pendinglen + len;
+        p->_pendinglen = 0;
+    }
+    else {
+        begin = data;
+        end = data + len;
+    }
+    cur = begin;
+    SQRESULT r = SQ_OK;
+    SQJsonToken t;
+    for(;;) {
+        SQInteger tk = _json_lex(cur,end,final,t);
+        if(tk == TK_EOF) {
+            if(final && (p->_state != ST_VALUE || p->_depth))
+                r = _json_syntaxerror(v,p->_offset + (cur - begin),tk);
+            break;
+        }
+        if(tk == TK_MORE) {
+            SQInteger left = end - cur;
+            if(left > p->_pendingsize) {
+                p->_pending = (SQChar *)sq_realloc(p->_pending,p->_pendingsize * sizeof(SQChar),left * sizeof(SQChar));
+                p->_pendingsize = left;
+            }
+            memcpy(p->_pending,cur,left * sizeof(SQChar));
+            p->_pendinglen = left;
+            p->_offset += cur - begin;
+            cur = begin;
+            break;
+        }
+        bool ok = true;
+        switch(p->_state) {
+        case ST_VALUE:
+        case ST_ARRAY_FIRST:
+            if(tk == ']' && p->_state == ST_ARRAY_FIRST) r = _json_end(s,p);
+            else if(tk == '[' || tk == '{') r = _json_begin(s,p,tk == '[' ? 'a' : 'o');
+            else if(tk >= TK_STRING) r = _json_scalar(s,p,t);
+            else ok = false;
+            break;
+        case ST_ARRAY_NEXT:
+            if(tk == ',') p->_state = ST_VALUE;
+            else if(tk == ']') r = _json_end(s,p);
+            else ok = false;
+            break;
+        case ST_OBJECT_FIRST:
+        case ST_OBJECT_KEY:
+            if(tk == '}' && p->_state == ST_OBJECT_FIRST) r = _json_end(s,p);
+            else if(tk == TK_STRING) r = _json_key(s,p,t);
+            else ok = false;
+            break;
+        case ST_COLON:
+            if(tk == ':') p->_state = ST_VALUE;
+            else ok = false;
+            break;
+        case ST_OBJECT_NEXT:
+            if(tk == ',') p->_state = ST_OBJECT_KEY;
+            else if(tk == '}') r = _json_end(s,p);
+            else ok = false;
+            break;
+        }
+        if(!ok) r = _json_syntaxerror(v,p->_offset + (t._begin - begin),tk);
+        if(SQ_FAILED(r)) break;
+    }
+    p->_offset += cur - begin;
+    if(joined) sq_free(joined,joinedsize);
+    if(SQ_FAILED(r)) p->_state = ST_FAILED;
+    return r;
+}
+
+#define SETUP_JSONPARSER(v) \
+    SQJsonParser *self = NULL; \
+    if(SQ_FAILED(sq_getinstanceup(v,1,(SQUserPointer*)&self,(SQUserPointer)SQSTD_JSONPARSER_TYPE_TAG))) \
+        return sq_throwerror(v,_SC("invalid type tag")); \
+    if(!self) \
+        return sq_throwerror(v,_SC("the parser is invalid"));
+
+static SQInteger _jsonparser_releasehook(SQUserPointer p, SQInteger SQ_UNUSED_ARG(size))
+{
+    SQJsonParser *self = (SQJsonParser *)p;
+    if(self->_stack) sq_free(self->_stack,self->_stacksize);
+    if(self->_pending) sq_free(self->_pending,self->_pendingsize * sizeof(SQChar));
+    sq_free(self,sizeof(SQJsonParser));
+    return 1;
+}
+
+static SQInteger _jsonparser_constructor(HSQUIRRELVM v)
+{
+    SQJsonParser *p = (SQJsonParser *)sq_malloc(sizeof(SQJsonParser));
+    memset(p,0,sizeof(SQJsonParser));
+    p->_state = ST_VALUE;
+    if(SQ_FAILED(sq_setinstanceup(v,1,p))) {
+        sq_free(p,sizeof(SQJsonParser));
+        return sq_throwerror(v,_SC("cannot create parser"));
+    }
+    sq_setreleasehook(v,1,_jsonparser_releasehook);
+    sq_pushstring(v,_SC("_handler"),-1);
+    if(sq_gettop(v) > 2) sq_push(v,2);
+    else sq_pushnull(v);
+    sq_set(v,1);
+    sq_pushstring(v,_SC("_build"),-1);
+    sq_newarray(v,0);
+    sq_set(v,1);
+    return 0;
+}
+
+static SQRESULT _jsonparser_run(HSQUIRRELVM v,SQJsonParser *self,const SQChar *data,SQInteger len,bool final)
+{
+    SQJsonSink s;
+    if(self->_state == ST_FAILED)
+        return sq_throwerror(v,_SC("the parser failed on a previous chunk"));
+    s._v = v;
+    s._handler = 0;
+    SQInteger base = sq_gettop(v);
+    if(SQ_FAILED(sq_reservestack(v,EV_COUNT + 8)))
+        return SQ_ERROR;
+    sq_pushstring(v,_SC("_handler"),-1);
+    sq_get(v,1);
+    if(sq_gettype(v,-1) != OT_NULL) {
+        s._handler = sq_gettop(v);
+        s._methods = s._handler + 1;
+        for(SQInteger i = 0; i < EV_COUNT; i++) {
+            sq_pushstring(v,_json_events[i],-1);
+            if(SQ_FAILED(sq_get(v,s._handler)))
+                sq_pushnull(v);
+        }
+    }
+    sq_pushstring(v,_SC("_build"),-1);
+    sq_get(v,1);
+    s._build = sq_gettop(v);
+    sq_newarray(v,0);
+    s._results = sq_gettop(v);
+    if(SQ_FAILED(_json_feed(s,self,data,len,final))) {
+        sq_settop(v,base);
+        return SQ_ERROR;
+    }
+    if(s._handler) {
+        sq_settop(v,base);
+        return 0;
+    }
+    _json_collapse(v,base);
+    return 1;
+}
+
+static SQRESULT _json_getdata(HSQUIRRELVM v,SQInteger idx,const SQChar **data,SQInteger *len)
+{
+    if(sq_gettype(v,idx) == OT_STRING)
+        return sq_getstringandsize(v,idx,data,len);
+    SQUserPointer p;
+    if(SQ_FAILED(sqstd_getblob(v,idx,&p)))
+        return sq_throwerror(v,_SC("string or blob expected"));
+    *data = (const SQChar *)p;
+    *len = sqstd_getblobsize(v,idx) / sizeof(SQChar);
+    return SQ_OK;
+}
+
+static SQInteger _jsonparser_feed(HSQUIRRELVM v)
+{
+    SETUP_JSONPARSER(v);
+    const SQChar *data;
+    SQInteger len;
+    if(SQ_FAILED(_json_getdata(v,2,&data,&len)))
+        return SQ_ERROR;
+    return _jsonparser_run(v,self,data,len,false);
+}
+
+static SQInteger _jsonparser_finish(HSQUIRRELVM v)
+{
+    SETUP_JSONPARSER(v);
+    SQInteger r = _jsonparser_run(v,self,_SC(""),0,true);
+    //ready for the next stream
+    if(SQ_SUCCEEDED(r)) self->_offset = 0;
+    return r;
+}
+
+static SQInteger _jsonparser__typeof(HSQUIRRELVM v)
+{
+    sq_pushstring(v,_SC("jsonparser"),-1);
+    return 1;
+}
+
+#define _DECL_JSONPARSER_FUNC(name,nparams,typecheck) {_SC(#name),_jsonparser_##name,nparams,typecheck}
+static const SQRegFunction _jsonparser_methods[] = {
+    _DECL_JSONPARSER_FUNC(constructor,-1,_SC("x.")),
+    _DECL_JSONPARSER_FUNC(feed,2,_SC("xs|x")),
+    _DECL_JSONPARSER_FUNC(finish,1,_SC("x")),
+    _DECL_JSONPARSER_FUNC(_typeof,1,_SC("x")),
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
+#undef _DECL_JSONPARSER_FUNC
+
+//Script functions
+
+static SQInteger _json_parsejson(HSQUIRRELVM v)
+{
+    const SQChar *data;
+    SQInteger len;
+    SQStream *stream = NULL;
+    if(sq_gettype(v,2) == OT_STRING || SQ_SUCCEEDED(sqstd_getblob(v,2,(SQUserPointer *)&data))) {
+        if(SQ_FAILED(_json_getdata(v,2,&data,&len)))
+            return SQ_ERROR;
+        return SQ_SUCCEEDED(sqstd_parsejson(v,data,len)) ? 1 : SQ_ERROR;
+    }
+    //any other stream is read from the current position to the end
+    if(SQ_FAILED(sq_getinstanceup(v,2,(SQUserPointer*)&stream,(SQUserPointer)((SQUnsignedInteger)SQSTD_STREAM_TYPE_TAG))) || !stream)
+        return sq_throwerror(v,_SC("string, blob or stream expected"));
+    SQInteger size = 0, allocated = 4096, n;
+    unsigned char *buf = (unsigned char *)sq_malloc(allocated);
+    while((n = stream->Read(buf + size,allocated - size)) > 0) {
+        size += n;
+        if(size == allocated) {
+            buf = (unsigned char *)sq_realloc(buf,allocated,allocated * 2);
+            allocated *= 2;
+        }
+    }
+    SQRESULT r = sqstd_parsejson(v,(const SQChar *)buf,size / sizeof(SQChar));
+    sq_free(buf,allocated);
+    return SQ_SUCCEEDED(r) ? 1 : SQ_ERROR;
+}
+
+struct SQJsonString
+{
+    SQChar *_buf;
+    SQInteger _size;
+    SQInteger _allocated;
+};
+
+static SQInteger _json_stringwrite(SQUserPointer up,SQUserPointer data,SQInteger size)
+{
+    SQJsonString *s = (SQJsonString *)up;
+    if(s->_size + size > s->_allocated) {
+        SQInteger newsize = s->_allocated ? s->_allocated * 2 : 256;
+        while(newsize < s->_size + size) newsize *= 2;
+        s->_buf = (SQChar *)sq_realloc(s->_buf,s->_allocated,newsize);
+        s->_allocated = newsize;
+    }
+    memcpy((unsigned char *)s->_buf + s->_size,data,size);
+    s->_size += size;
+    return size;
+}
+
+static SQInteger _json_tojson(HSQUIRRELVM v)
+{
+    SQInteger indent = 0;
+    if(sq_gettop(v) > 2) sq_getinteger(v,3,&indent);
+    SQJsonString s = { NULL, 0, 0 };
+    SQRESULT r = sqstd_writejson(v,2,indent,_json_stringwrite,&s);
+    if(SQ_SUCCEEDED(r)) sq_pushstring(v,s._buf,s._size / sizeof(SQChar));
+    if(s._buf) sq_free(s._buf,s._allocated);
+    return SQ_SUCCEEDED(r) ? 1 : SQ_ERROR;
+}
+
+static SQInteger _json_streamwrite(SQUserPointer up,SQUserPointer data,SQInteger size)
+{
+    return ((SQStream *)up)->Write(data,size);
+}
+
+static SQInteger _json_writejson(HSQUIRRELVM v)
+{
+    SQStream *stream = NULL;
+    SQInteger indent = 0;
+    if(SQ_FAILED(sq_getinstanceup(v,2,(SQUserPointer*)&stream,(SQUserPointer)((SQUnsignedInteger)SQSTD_STREAM_TYPE_TAG))) || !stream)
+        return sq_throwerror(v,_SC("stream expected"));
+    if(sq_gettop(v) > 3) sq_getinteger(v,4,&indent);
+    return SQ_SUCCEEDED(sqstd_writejson(v,3,indent,_json_streamwrite,stream)) ? 0 : SQ_ERROR;
+}
+
+#define _DECL_JSON_FUNC(name,nparams,typecheck) {_SC(#name),_json_##name,nparams,typecheck}
+static const SQRegFunction jsonlib_funcs[]={
+    _DECL_JSON_FUNC(parsejson,2,_SC(".s|x")),
+    _DECL_JSON_FUNC(tojson,-2,_SC("..n")),
+    _DECL_JSON_FUNC(writejson,-3,_SC(".x.n")),
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
+#undef _DECL_JSON_FUNC
+
+SQRESULT sqstd_register_jsonlib(HSQUIRRELVM v)
+{
+    if(sq_gettype(v,-1) != OT_TABLE)
+        return sq_throwerror(v,_SC("table expected"));
+    sq_pushstring(v,_SC("jsonparser"),-1);
+    sq_newclass(v,SQFalse);
+    sq_settypetag(v,-1,(SQUserPointer)SQSTD_JSONPARSER_TYPE_TAG);
+    sq_pushstring(v,_SC("_handler"),-1);
+    sq_pushnull(v);
+    sq_newslot(v,-3,SQFalse);
+    sq_pushstring(v,_SC("_build"),-1);
+    sq_pushnull(v);
+    sq_newslot(v,-3,SQFalse);
+    SQInteger i = 0;
+    while(_jsonparser_methods[i].name != 0) {
+        const SQRegFunction &f = _jsonparser_methods[i];
+        sq_pushstring(v,f.name,-1);
+        sq_newclosure(v,f.f,0);
+        sq_setparamscheck(v,f.nparamscheck,f.typemask);
+        sq_setnativeclosurename(v,-1,f.name);
+        sq_newslot(v,-3,SQFalse);
+        i++;
+    }
+    sq_newslot(v,-3,SQFalse);
+    i = 0;
+    while(jsonlib_funcs[i].name != 0) {
+        const SQRegFunction &f = jsonlib_funcs[i];
+        sq_pushstring(v,f.name,-1);
+        sq_newclosure(v,f.f,0);
+        sq_setparamscheck(v,f.nparamscheck,f.typemask);
+        sq_setnativeclosurename(v,-1,f.name);
+        sq_newslot(v,-3,SQFalse);
+        i++;
+    }
+    return SQ_OK;
+}
@@ -114,6 +114,18 @@ SOURCE=.\sqstdaux.cpp
 
 SOURCE=.\sqstdsystem.cpp
 # End Source File
+# Begin Source File
+
+SOURCE=.\sqstdjson.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\sqstdworker.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\sqstdscheduler.cpp
+# End Source File
 # End Group
 # Begin Group "Header Files"
 
@@ -2,7 +2,12 @@
 #include <squirrel.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <sqstdmath.h>
+#include <sqstdblob.h>
+
+#define SQSTD_RANDOM_TYPE_TAG ((SQUnsignedInteger)0x80000600)
 
 #define SINGLE_ARG_FUNC(_funcname) static SQInteger math_##_funcname(HSQUIRRELVM v){ \
     SQFloat f; \
@@ -19,18 +24,110 @@
     return 1; \
 }
 
+//xoshiro256** generator, see http://prng.di.unimi.it
+typedef unsigned long long SQRandWord;
+
+struct SQRandom
+{
+    SQRandWord _s[4];
+    double _spare; //second value of the last pair generated by Normal()
+    bool _hasspare;
+
+    static SQRandWord SplitMix(SQRandWord &x) {
+        SQRandWord z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    static SQRandWord Rotl(SQRandWord x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+    void Seed(SQRandWord seed) {
+        for(int i = 0; i < 4; i++) _s[i] = SplitMix(seed);
+        _hasspare = false;
+    }
+    //seeds from the clock and the address of the generator
+    void SeedRandom() {
+        static SQRandWord counter = 0;
+        Seed((SQRandWord)time(NULL) ^ ((SQRandWord)clock() << 32) ^ (SQRandWord)(size_t)this ^ (++counter * 0x9E3779B97F4A7C15ULL));
+    }
+    SQRandWord Next() {
+        const SQRandWord result = Rotl(_s[1] * 5, 7) * 9;
+        const SQRandWord t = _s[1] << 17;
+        _s[2] ^= _s[0];
+        _s[3] ^= _s[1];
+        _s[1] ^= _s[2];
+        _s[0] ^= _s[3];
+        _s[2] ^= t;
+        _s[3] = Rotl(_s[3], 45);
+        return result;
+    }
+    //a non negative integer that uses all the bits of SQInteger
+    SQInteger Integer() {
+        return (SQInteger)(Next() >> (65 - sizeof(SQInteger) * 8));
+    }
+    //uniform in [min,max], without the bias of the modulo
+    SQInteger Range(SQInteger min, SQInteger max) {
+        SQRandWord range = (SQRandWord)((SQUnsignedInteger)max - (SQUnsignedInteger)min);
+        if(sizeof(SQInteger) < sizeof(SQRandWord)) range &= (SQRandWord)(SQUnsignedInteger)-1;
+        range++;
+        if(range == 0 || (sizeof(SQInteger) < sizeof(SQRandWord) && range > (SQRandWord)(SQUnsignedInteger)-1))
+            return (SQInteger)Next();
+        SQRandWord threshold = (0 - range) % range, x;
+        while((x = Next()) < threshold);
+        return (SQInteger)((SQUnsignedInteger)min + (SQUnsignedInteger)(x % range));
+    }
+    //uniform in [0,1)
+    double Double() {
+        return (double)(Next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+    SQFloat Float() {
+#ifdef SQUSEDOUBLE
+        return (SQFloat)Double();
+#else
+        return (SQFloat)(Next() >> 40) * (1.0f / 16777216.0f);
+#endif
+    }
+    //normal distribution with the polar method
+    double Normal() {
+        if(_hasspare) {
+            _hasspare = false;
+            return _spare;
+        }
+        double x, y, r;
+        do {
+            x = Double() * 2.0 - 1.0;
+            y = Double() * 2.0 - 1.0;
+            r = x * x + y * y;
+        } while(r >= 1.0 || r == 0.0);
+        r = sqrt(-2.0 * log(r) / r);
+        _spare = y * r;
+        _hasspare = true;
+        return x * r;
+    }
+};
+
+//the generator of rand() and srand() is the free variable, every VM has its own
+#define SETUP_GLOBALRANDOM(v) \
+    SQRandom *self = NULL; \
+    { SQUserPointer p = NULL; \
+    sq_getuserdata(v,-1,&p,NULL); \
+    self = (SQRandom *)p; }
+
 static SQInteger math_srand(HSQUIRRELVM v)
 {
+    SETUP_GLOBALRANDOM(v);
     SQInteger i;
     if(SQ_FAILED(sq_getinteger(v,2,&i)))
         return sq_throwerror(v,_SC("invalid param"));
-    srand((unsigned int)i);
+    self->Seed((SQRandWord)i);
     return 0;
 }
 
 static SQInteger math_rand(HSQUIRRELVM v)
 {
-    sq_pushinteger(v,rand());
+    SETUP_GLOBALRANDOM(v);
+    sq_pushinteger(v,(SQInteger)((self->Next() >> 11) % ((SQRandWord)RAND_MAX + 1)));
     return 1;
 }
 
@@ -74,14 +171,231 @@ static const SQRegFunction mathlib_funcs[] = {
     _DECL_FUNC(floor,2,_SC(".n")),
     _DECL_FUNC(ceil,2,_SC(".n")),
     _DECL_FUNC(exp,2,_SC(".n")),
-    _DECL_FUNC(srand,2,_SC(".n")),
-    _DECL_FUNC(rand,1,NULL),
     _DECL_FUNC(fabs,2,_SC(".n")),
     _DECL_FUNC(abs,2,_SC(".n")),
     {NULL,(SQFUNCTION)0,0,NULL}
 };
+static const SQRegFunction mathlib_randfuncs[] = {
+    _DECL_FUNC(srand,2,_SC(".n")),
+    _DECL_FUNC(rand,1,NULL),
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
 #undef _DECL_FUNC
 
+//Random
+
+#define SETUP_RANDOM(v) \
+    SQRandom *self = NULL; \
+    if(SQ_FAILED(sq_getinstanceup(v,1,(SQUserPointer*)&self,(SQUserPointer)SQSTD_RANDOM_TYPE_TAG)) || !self) \
+        return sq_throwerror(v,_SC("invalid type tag"));
+
+static SQInteger _random_releasehook(SQUserPointer p, SQInteger SQ_UNUSED_ARG(size))
+{
+    sq_free(p,sizeof(SQRandom));
+    return 1;
+}
+
+static SQInteger _random_constructor(HSQUIRRELVM v)
+{
+    SQRandom *r = (SQRandom *)sq_malloc(sizeof(SQRandom));
+    if(sq_gettop(v) > 1) {
+        SQInteger seed;
+        sq_getinteger(v,2,&seed);
+        r->Seed((SQRandWord)seed);
+    }
+    else r->SeedRandom();
+    sq_setinstanceup(v,1,r);
+    sq_setreleasehook(v,1,_random_releasehook);
+    return 0;
+}
+
+static SQInteger _random__cloned(HSQUIRRELVM v)
+{
+    SQRandom *other = NULL;
+    if(SQ_FAILED(sq_getinstanceup(v,2,(SQUserPointer*)&other,(SQUserPointer)SQSTD_RANDOM_TYPE_TAG)) || !other)
+        return sq_throwerror(v,_SC("invalid type tag"));
+    SQRandom *r = (SQRandom *)sq_malloc(sizeof(SQRandom));
+    memcpy(r,other,sizeof(SQRandom));
+    sq_setinstanceup(v,1,r);
+    sq_setreleasehook(v,1,_random_releasehook);
+    return 0;
+}
+
+static SQInteger _random_seed(HSQUIRRELVM v)
+{
+    SETUP_RANDOM(v);
+    SQInteger seed;
+    sq_getinteger(v,2,&seed);
+    self->Seed((SQRandWord)seed);
+    return 0;
+}
+
+static SQInteger _random_next(HSQUIRRELVM v)
+{
+    SETUP_RANDOM(v);
+    sq_pushinteger(v,self->Integer());
+    return 1;
+}
+
+static SQInteger _random_range(HSQUIRRELVM v)
+{
+    SETUP_RANDOM(v);
+    SQInteger min, max;
+    sq_getinteger(v,2,&min);
+    sq_getinteger(v,3,&max);
+    if(min > max)
+        return sq_throwerror(v,_SC("min cannot be greater than max"));
+    sq_pushinteger(v,self->Range(min,max));
+    return 1;
+}
+
+static SQInteger _random_float(HSQUIRRELVM v)
+{
+    SETUP_RANDOM(v);
+    SQFloat min = 0, max = 1;
+    if(sq_gettop(v) > 2) {
+        sq_getfloat(v,2,&min);
+        sq_getfloat(v,3,&max);
+    }
+    else if(sq_gettop(v) > 1) sq_getfloat(v,2,&max);
+    if(!(min < max))
+        return sq_throwerror(v,_SC("min must be less than max"));
+    sq_pushfloat(v,min + self->Float() * (max - min));
+    return 1;
+}
+
+static SQInteger _random_normal(HSQUIRRELVM v)
+{
+    SETUP_RANDOM(v);
+    SQFloat mean = 0, stddev = 1;
+    if(sq_gettop(v) > 1) sq_getfloat(v,2,&mean);
+    if(sq_gettop(v) > 2) sq_getfloat(v,3,&stddev);
+    if(!(stddev >= 0))
+        return sq_throwerror(v,_SC("stddev cannot be negative"));
+    sq_pushfloat(v,(SQFloat)(mean + self->Normal() * stddev));
+    return 1;
+}
+
+//fill(array,[min,max]) integers in [min,max] if both are integers, otherwise floats in [min,max)
+static SQInteger _random_fill(HSQUIRRELVM v)
+{
+    SETUP_RANDOM(v);
+    SQInteger size = sq_getsize(v,2), top = sq_gettop(v);
+    if(sq_isfrozen(v,2))
+        return sq_throwerror(v,_SC("trying to modify a frozen array"));
+    if(top == 3)
+        return sq_throwerror(v,_SC("both min and max are required"));
+    bool integers = top > 3 && sq_gettype(v,3) == OT_INTEGER && sq_gettype(v,4) == OT_INTEGER;
+    SQInteger imin = 0, imax = 0;
+    SQFloat fmin = 0, fmax = 1;
+    if(integers) {
+        sq_getinteger(v,3,&imin);
+        sq_getinteger(v,4,&imax);
+        if(imin > imax)
+            return sq_throwerror(v,_SC("min cannot be greater than max"));
+    }
+    else if(top > 3) {
+        sq_getfloat(v,3,&fmin);
+        sq_getfloat(v,4,&fmax);
+        if(!(fmin < fmax))
+            return sq_throwerror(v,_SC("min must be less than max"));
+    }
+    for(SQInteger i = 0; i < size; i++) {
+        sq_pushinteger(v,i);
+        if(integers) sq_pushinteger(v,self->Range(imin,imax));
+        else sq_pushfloat(v,fmin + self->Float() * (fmax - fmin));
+        if(SQ_FAILED(sq_rawset(v,2)))
+            return SQ_ERROR;
+    }
+    sq_push(v,2);
+    return 1;
+}
+
+//fillblob(blob,type,[min,max]) fills the blob with numbers of the type used by readn()/writen()
+static SQInteger _random_fillblob(HSQUIRRELVM v)
+{
+    SETUP_RANDOM(v);
+    SQUserPointer p;
+    SQInteger format, size, top = sq_gettop(v);
+    if(SQ_FAILED(sqstd_getblob(v,2,&p)))
+        return sq_throwerror(v,_SC("blob expected"));
+    sq_getinteger(v,3,&format);
+    switch(format) {
+    case 'l': size = sizeof(SQInteger); break;
+    case 'i': size = sizeof(SQInt32); break;
+    case 's': case 'w': size = sizeof(short); break;
+    case 'c': case 'b': size = sizeof(char); break;
+    case 'f': size = sizeof(float); break;
+    case 'd': size = sizeof(double); break;
+    default: return sq_throwerror(v,_SC("invalid format"));
+    }
+    if(top == 4)
+        return sq_throwerror(v,_SC("both min and max are required"));
+    bool ranged = top > 4;
+    SQInteger imin = 0, imax = 0;
+    double fmin = 0, fmax = 1;
+    if(ranged && format != 'f' && format != 'd') {
+        sq_getinteger(v,4,&imin);
+        sq_getinteger(v,5,&imax);
+        if(imin > imax)
+            return sq_throwerror(v,_SC("min cannot be greater than max"));
+    }
+    else if(ranged) {
+        SQFloat f1, f2;
+        sq_getfloat(v,4,&f1);
+        sq_getfloat(v,5,&f2);
+        fmin = f1;
+        fmax = f2;
+        if(!(fmin < fmax))
+            return sq_throwerror(v,_SC("min must be less than max"));
+    }
+    unsigned char *data = (unsigned char *)p;
+    SQInteger count = sqstd_getblobsize(v,2) / size;
+    for(SQInteger i = 0; i < count; i++, data += size) {
+        if(format == 'f') {
+            float f = (float)(fmin + self->Double() * (fmax - fmin));
+            memcpy(data,&f,sizeof(f));
+        }
+        else if(format == 'd') {
+            double d = fmin + self->Double() * (fmax - fmin);
+            memcpy(data,&d,sizeof(d));
+        }
+        else {
+            //without a range all the bits are random
+            SQRandWord x = ranged ? (SQRandWord)self->Range(imin,imax) : self->Next();
+            switch(format) {
+            case 'l': { SQInteger n = (SQInteger)x; memcpy(data,&n,sizeof(n)); } break;
+            case 'i': { SQInt32 n = (SQInt32)x; memcpy(data,&n,sizeof(n)); } break;
+            case 's': case 'w': { unsigned short n = (unsigned short)x; memcpy(data,&n,sizeof(n)); } break;
+            default: *data = (unsigned char)x; break;
+            }
+        }
+    }
+    return 0;
+}
+
+static SQInteger _random__typeof(HSQUIRRELVM v)
+{
+    sq_pushstring(v,_SC("random"),-1);
+    return 1;
+}
+
+#define _DECL_RANDOM_FUNC(name,nparams,typecheck) {_SC(#name),_random_##name,nparams,typecheck}
+static const SQRegFunction _random_methods[] = {
+    _DECL_RANDOM_FUNC(constructor,-1,_SC("xn")),
+    _DECL_RANDOM_FUNC(seed,2,_SC("xn")),
+    _DECL_RANDOM_FUNC(next,1,_SC("x")),
+    _DECL_RANDOM_FUNC(range,3,_SC("xnn")),
+    _DECL_RANDOM_FUNC(float,-1,_SC("xnn")),
+    _DECL_RANDOM_FUNC(normal,-1,_SC("xnn")),
+    _DECL_RANDOM_FUNC(fill,-2,_SC("xann")),
+    _DECL_RANDOM_FUNC(fillblob,-3,_SC("xxnnn")),
+    _DECL_RANDOM_FUNC(_typeof,1,_SC("x")),
+    _DECL_RANDOM_FUNC(_cloned,2,_SC("xx")),
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
+#undef _DECL_RANDOM_FUNC
+
 #ifndef M_PI
 #define M_PI (3.14159265358979323846)
 #endif
@@ -97,6 +411,34 @@ SQRESULT sqstd_register_mathlib(HSQUIRRELVM v)
         sq_newslot(v,-3,SQFalse);
         i++;
     }
+    //rand() and srand() share a generator of the VM, seeded with 1 like the C runtime one
+    SQRandom *r = (SQRandom *)sq_newuserdata(v,sizeof(SQRandom));
+    r->Seed(1);
+    i=0;
+    while(mathlib_randfuncs[i].name!=0) {
+        sq_pushstring(v,mathlib_randfuncs[i].name,-1);
+        sq_push(v,-2);
+        sq_newclosure(v,mathlib_randfuncs[i].f,1);
+        sq_setparamscheck(v,mathlib_randfuncs[i].nparamscheck,mathlib_randfuncs[i].typemask);
+        sq_setnativeclosurename(v,-1,mathlib_randfuncs[i].name);
+        sq_newslot(v,-4,SQFalse);
+        i++;
+    }
+    sq_pop(v,1);
+    sq_pushstring(v,_SC("random"),-1);
+    sq_newclass(v,SQFalse);
+    sq_settypetag(v,-1,(SQUserPointer)SQSTD_RANDOM_TYPE_TAG);
+    i=0;
+    while(_random_methods[i].name!=0) {
+        const SQRegFunction &f = _random_methods[i];
+        sq_pushstring(v,f.name,-1);
+        sq_newclosure(v,f.f,0);
+        sq_setparamscheck(v,f.nparamscheck,f.typemask);
+        sq_setnativeclosurename(v,-1,f.name);
+        sq_newslot(v,-3,SQFalse);
+        i++;
+    }
+    sq_newslot(v,-3,SQFalse);
     sq_pushstring(v,_SC("RAND_MAX"),-1);
     sq_pushinteger(v,RAND_MAX);
     sq_newslot(v,-3,SQFalse);
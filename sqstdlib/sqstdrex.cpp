@@ -45,6 +45,8 @@ static const SQChar *g_nnames[] =
 
 typedef int SQRexNodeType;
 
+struct SQRexProg;
+
 typedef struct tagSQRexNode{
     SQRexNodeType type;
     SQInteger left;
@@ -66,6 +68,9 @@ struct SQRex{
     SQInteger _currsubexp;
     void *_jmpbuf;
     const SQChar **_error;
+    SQRexProg *_prog;
+    SQChar *_prefix;
+    SQInteger _prefixlen;
 };
 
 static SQInteger sqstd_rex_list(SQRex *exp);
@@ -550,8 +555,581 @@ static const SQChar *sqstd_rex_matchnode(SQRex* exp,SQRexNode *node,const SQChar
     return NULL;
 }
 
+#define SQREX_MAXPREFIX 32
+
+//the characters every match starts with, the searches skip the positions where they are missing
+static void sqstd_rex_computeprefix(SQRex *exp)
+{
+    SQChar prefix[SQREX_MAXPREFIX];
+    SQInteger n = exp->_nodes[exp->_first].left, len = 0;
+    while(n != -1 && exp->_nodes[n].type < OP_GREEDY && len < SQREX_MAXPREFIX) {
+        prefix[len++] = (SQChar)exp->_nodes[n].type;
+        n = exp->_nodes[n].next;
+    }
+    if(len) {
+        exp->_prefix = (SQChar *)sq_malloc(sq_rsl(len));
+        memcpy(exp->_prefix,prefix,sq_rsl(len));
+        exp->_prefixlen = len;
+    }
+}
+
+static const SQChar *sqstd_rex_findprefix(SQRex *exp,const SQChar *p,const SQChar *end)
+{
+    SQInteger len = exp->_prefixlen;
+    while(end - p >= len) {
+        p = (const SQChar *)scmemchr(p,exp->_prefix[0],(end - p) - len + 1);
+        if(!p) return NULL;
+        if(memcmp(p,exp->_prefix,sq_rsl(len)) == 0) return p;
+        p++;
+    }
+    return NULL;
+}
+
+/* linear engine
+   the node tree is compiled to the program of a Thompson NFA. A DFA built lazily from the
+   program finds out whether the text matches and a Pike VM, that runs only if it does,
+   computes the bounds of the match and the captures. Both take a time linear in the
+   length of the text, whatever the pattern. */
+
+#define RI_CHAR     0
+#define RI_ANY      1
+#define RI_CLASS    2
+#define RI_NCLASS   3
+#define RI_CCLASS   4
+#define RI_MATCH    5 //last instruction that stops the closure
+#define RI_SPLIT    6 //x has the priority over y
+#define RI_JMP      7
+#define RI_SAVE     8
+#define RI_BOL      9
+#define RI_EOL      10
+#define RI_WB       11
+#define RI_NWB      12
+
+#define SQREX_MAXINSTS          10000
+#define SQREX_DFA_MAXSTATES     1024
+#define SQREX_DFA_MAXPCS        (64*1024)
+#define SQREX_DFA_BUCKETS       1024
+
+//context of a position in the text
+#define CTX_BOL         0x01
+#define CTX_EOL         0x02
+#define CTX_PREVWORD    0x04
+#define CTX_NEXTWORD    0x08
+#define CTX_KNOWN       0x10 //the next character is known(so EOL,NEXTWORD are valid)
+
+typedef struct tagSQRexInst{
+    SQInteger op;
+    SQInteger x;
+    SQInteger y;
+}SQRexInst;
+
+typedef struct tagSQRexDState{
+    SQInteger flags; //CTX_BOL and CTX_PREVWORD
+    SQInteger npcs;
+    SQInteger pcs; //offset in _dpcs
+    SQInteger eolmatch; //-1 not computed yet
+    SQInteger hashnext;
+    SQBool idle; //no match started, the prefix can be searched
+}SQRexDState;
+
+typedef struct tagSQRexStackEntry{
+    SQInteger pc; //-1 restores a capture slot
+    SQInteger slot;
+    const SQChar *old;
+}SQRexStackEntry;
+
+typedef struct tagSQRexThreads{
+    SQInteger *sparse;
+    SQInteger *dense;
+    const SQChar **caps;
+    SQInteger n;
+}SQRexThreads;
+
+struct SQRexProg{
+    SQRexInst *_insts;
+    SQInteger _ninsts;
+    SQInteger _nallocated;
+    SQInteger _start; //entry of the anchored program, 0 is the unanchored one
+    SQBool _haswb;
+    SQInteger _ncap;
+    SQInteger *_marks;
+    SQInteger _gen;
+    SQRexStackEntry *_stack;
+    SQInteger *_set;
+    SQInteger *_kernel;
+    //dfa
+    SQRexDState *_dstates;
+    SQInteger _ndstates;
+    SQInt32 *_dtrans;
+    SQInteger *_dpcs;
+    SQInteger _ndpcs;
+    SQInteger *_dbuckets;
+    SQInteger _dstart[2];
+    SQInteger *_idle;
+    SQInteger _nidle;
+    //pike vm
+    SQRexThreads _threads[2];
+    const SQChar **_tcaps;
+    const SQChar **_mcaps;
+};
+
+static SQInteger sqstd_rex_emit(SQRex *exp,SQInteger op,SQInteger x,SQInteger y)
+{
+    SQRexProg *prog = exp->_prog;
+    if(prog->_ninsts == SQREX_MAXINSTS)
+        sqstd_rex_error(exp,_SC("expression too big for the linear engine"));
+    if(prog->_nallocated == prog->_ninsts) {
+        SQInteger oldsize = prog->_nallocated;
+        prog->_nallocated = oldsize ? oldsize * 2 : 16;
+        prog->_insts = (SQRexInst *)sq_realloc(prog->_insts,oldsize * sizeof(SQRexInst),prog->_nallocated * sizeof(SQRexInst));
+    }
+    SQRexInst &i = prog->_insts[prog->_ninsts];
+    i.op = op; i.x = x; i.y = y;
+    return prog->_ninsts++;
+}
+
+static void sqstd_rex_compilelist(SQRex *exp,SQInteger n);
+
+static void sqstd_rex_compilenode(SQRex *exp,SQInteger n)
+{
+    SQRexNode *node = &exp->_nodes[n];
+    switch(node->type) {
+    case OP_EXPR:
+        sqstd_rex_emit(exp,RI_SAVE,node->right * 2,0);
+        sqstd_rex_compilelist(exp,node->left);
+        sqstd_rex_emit(exp,RI_SAVE,node->right * 2 + 1,0);
+        break;
+    case OP_NOCAPEXPR:
+        sqstd_rex_compilelist(exp,node->left);
+        break;
+    case OP_OR: {
+        SQInteger split = sqstd_rex_emit(exp,RI_SPLIT,0,0);
+        exp->_prog->_insts[split].x = exp->_prog->_ninsts;
+        sqstd_rex_compilelist(exp,node->left);
+        SQInteger jmp = sqstd_rex_emit(exp,RI_JMP,0,0);
+        exp->_prog->_insts[split].y = exp->_prog->_ninsts;
+        sqstd_rex_compilelist(exp,node->right);
+        exp->_prog->_insts[jmp].x = exp->_prog->_ninsts;
+        }
+        break;
+    case OP_GREEDY: {
+        SQInteger p0 = (node->right >> 16)&0x0000FFFF, p1 = node->right&0x0000FFFF, i;
+        if(p1 != 0xFFFF && p0 > p1) sqstd_rex_error(exp,_SC("invalid repetition count"));
+        for(i = 0; i < p0; i++)
+            sqstd_rex_compilelist(exp,node->left);
+        if(p1 == 0xFFFF) {
+            SQInteger split = sqstd_rex_emit(exp,RI_SPLIT,0,0);
+            exp->_prog->_insts[split].x = exp->_prog->_ninsts;
+            sqstd_rex_compilelist(exp,node->left);
+            sqstd_rex_emit(exp,RI_JMP,split,0);
+            exp->_prog->_insts[split].y = exp->_prog->_ninsts;
+        }
+        else if(p1 > p0) {
+            //the optional occurrences share the exit
+            SQInteger first = exp->_prog->_ninsts;
+            for(; i < p1; i++) {
+                sqstd_rex_emit(exp,RI_SPLIT,exp->_prog->_ninsts + 1,-1);
+                sqstd_rex_compilelist(exp,node->left);
+            }
+            for(i = first; i < exp->_prog->_ninsts; i++) {
+                if(exp->_prog->_insts[i].op == RI_SPLIT && exp->_prog->_insts[i].y == -1)
+                    exp->_prog->_insts[i].y = exp->_prog->_ninsts;
+            }
+        }
+        }
+        break;
+    case OP_DOT: sqstd_rex_emit(exp,RI_ANY,0,0); break;
+    case OP_CLASS: sqstd_rex_emit(exp,RI_CLASS,node->left,0); break;
+    case OP_NCLASS: sqstd_rex_emit(exp,RI_NCLASS,node->left,0); break;
+    case OP_CCLASS: sqstd_rex_emit(exp,RI_CCLASS,node->left,0); break;
+    case OP_BOL: sqstd_rex_emit(exp,RI_BOL,0,0); break;
+    case OP_EOL: sqstd_rex_emit(exp,RI_EOL,0,0); break;
+    case OP_WB:
+        sqstd_rex_emit(exp,node->left == 'b' ? RI_WB : RI_NWB,0,0);
+        exp->_prog->_haswb = SQTrue;
+        break;
+    case OP_MB: sqstd_rex_error(exp,_SC("balanced matches are not supported by the linear engine")); break;
+    default: sqstd_rex_emit(exp,RI_CHAR,node->type,0); break;
+    }
+}
+
+static void sqstd_rex_compilelist(SQRex *exp,SQInteger n)
+{
+    while(n != -1) {
+        sqstd_rex_compilenode(exp,n);
+        n = exp->_nodes[n].next;
+    }
+}
+
+static void sqstd_rex_compileprog(SQRex *exp)
+{
+    SQRexProg *prog = (SQRexProg *)sq_malloc(sizeof(SQRexProg));
+    memset(prog,0,sizeof(SQRexProg));
+    prog->_dstart[0] = prog->_dstart[1] = -1;
+    exp->_prog = prog;
+    //.*? in front of the program for the unanchored DFA
+    sqstd_rex_emit(exp,RI_SPLIT,3,1);
+    sqstd_rex_emit(exp,RI_ANY,0,0);
+    sqstd_rex_emit(exp,RI_JMP,0,0);
+    prog->_start = prog->_ninsts;
+    sqstd_rex_compilenode(exp,exp->_first);
+    sqstd_rex_emit(exp,RI_MATCH,0,0);
+    prog->_ncap = exp->_nsubexpr * 2;
+    prog->_marks = (SQInteger *)sq_malloc(prog->_ninsts * sizeof(SQInteger));
+    memset(prog->_marks,0,prog->_ninsts * sizeof(SQInteger));
+    prog->_stack = (SQRexStackEntry *)sq_malloc((prog->_ninsts * 2 + 1) * sizeof(SQRexStackEntry));
+    prog->_set = (SQInteger *)sq_malloc(prog->_ninsts * sizeof(SQInteger));
+    prog->_kernel = (SQInteger *)sq_malloc(prog->_ninsts * sizeof(SQInteger));
+}
+
+static void sqstd_rex_freeprog(SQRexProg *prog)
+{
+    SQInteger ninsts = prog->_ninsts;
+    if(prog->_insts) sq_free(prog->_insts,prog->_nallocated * sizeof(SQRexInst));
+    if(prog->_marks) sq_free(prog->_marks,ninsts * sizeof(SQInteger));
+    if(prog->_stack) sq_free(prog->_stack,(ninsts * 2 + 1) * sizeof(SQRexStackEntry));
+    if(prog->_set) sq_free(prog->_set,ninsts * sizeof(SQInteger));
+    if(prog->_kernel) sq_free(prog->_kernel,ninsts * sizeof(SQInteger));
+    if(prog->_dstates) {
+        sq_free(prog->_dstates,SQREX_DFA_MAXSTATES * sizeof(SQRexDState));
+        sq_free(prog->_dtrans,SQREX_DFA_MAXSTATES * 256 * sizeof(SQInt32));
+        sq_free(prog->_dpcs,SQREX_DFA_MAXPCS * sizeof(SQInteger));
+        sq_free(prog->_dbuckets,SQREX_DFA_BUCKETS * sizeof(SQInteger));
+    }
+    if(prog->_idle) sq_free(prog->_idle,ninsts * sizeof(SQInteger));
+    if(prog->_tcaps) {
+        for(SQInteger i = 0; i < 2; i++) {
+            sq_free(prog->_threads[i].sparse,ninsts * sizeof(SQInteger));
+            sq_free(prog->_threads[i].dense,ninsts * sizeof(SQInteger));
+            sq_free(prog->_threads[i].caps,ninsts * prog->_ncap * sizeof(const SQChar *));
+        }
+        sq_free(prog->_tcaps,prog->_ncap * sizeof(const SQChar *));
+        sq_free(prog->_mcaps,prog->_ncap * sizeof(const SQChar *));
+    }
+    sq_free(prog,sizeof(SQRexProg));
+}
+
+static SQBool sqstd_rex_instmatch(SQRex *exp,SQRexInst *i,SQChar c)
+{
+    switch(i->op) {
+    case RI_CHAR: return c == i->x;
+    case RI_ANY: return SQTrue;
+    case RI_CLASS: return sqstd_rex_matchclass(exp,&exp->_nodes[i->x],c);
+    case RI_NCLASS: return !sqstd_rex_matchclass(exp,&exp->_nodes[i->x],c);
+    case RI_CCLASS: return sqstd_rex_matchcclass(i->x,c);
+    }
+    return SQFalse;
+}
+
+#define sqstd_rex_isword(c) (scisspace(c) ? 0 : 1)
+
+static SQInteger sqstd_rex_context(const SQChar *bol,const SQChar *eol,const SQChar *p)
+{
+    SQInteger ctx = CTX_KNOWN;
+    if(p == bol) ctx |= CTX_BOL;
+    else if(sqstd_rex_isword(p[-1])) ctx |= CTX_PREVWORD;
+    if(p == eol) ctx |= CTX_EOL;
+    else if(sqstd_rex_isword(*p)) ctx |= CTX_NEXTWORD;
+    return ctx;
+}
+
+/* follows the instructions that don't consume characters from pc and adds the others to set;
+   without CTX_KNOWN the assertions on the next character are added to set too */
+static void sqstd_rex_closure(SQRexProg *prog,SQInteger pc,SQInteger ctx,SQInteger *set,SQInteger *n)
+{
+    SQRexStackEntry *stack = prog->_stack;
+    SQInteger sp = 0;
+    stack[sp++].pc = pc;
+    while(sp) {
+        pc = stack[--sp].pc;
+        if(prog->_marks[pc] == prog->_gen) continue;
+        prog->_marks[pc] = prog->_gen;
+        SQRexInst *i = &prog->_insts[pc];
+        switch(i->op) {
+        case RI_JMP: stack[sp++].pc = i->x; break;
+        case RI_SPLIT: stack[sp++].pc = i->y; stack[sp++].pc = i->x; break;
+        case RI_SAVE: stack[sp++].pc = pc + 1; break;
+        case RI_BOL: if(ctx & CTX_BOL) stack[sp++].pc = pc + 1; break;
+        case RI_EOL:
+            if(!(ctx & CTX_KNOWN)) set[(*n)++] = pc;
+            else if(ctx & CTX_EOL) stack[sp++].pc = pc + 1;
+            break;
+        case RI_WB:
+        case RI_NWB:
+            if(!(ctx & CTX_KNOWN)) set[(*n)++] = pc;
+            else if((((ctx & CTX_PREVWORD) != 0) != ((ctx & CTX_NEXTWORD) != 0)) == (i->op == RI_WB))
+                stack[sp++].pc = pc + 1;
+            break;
+        default: set[(*n)++] = pc; break;
+        }
+    }
+}
+
+static void sqstd_rex_sortpcs(SQInteger *k,SQInteger n)
+{
+    for(SQInteger i = 1; i < n; i++) { //the kernels are tiny, insertion sort makes them canonical
+        SQInteger t = k[i], j;
+        for(j = i; j > 0 && k[j - 1] > t; j--) k[j] = k[j - 1];
+        k[j] = t;
+    }
+}
+
+static void sqstd_rex_dfareset(SQRexProg *prog)
+{
+    prog->_ndstates = 0;
+    prog->_ndpcs = 0;
+    prog->_dstart[0] = prog->_dstart[1] = -1;
+    for(SQInteger i = 0; i < SQREX_DFA_BUCKETS; i++) prog->_dbuckets[i] = -1;
+}
+
+/* returns the state for the kernel in prog->_kernel; when the cache is full it is flushed
+   and *flushed is set, the indexes of the states computed before are no longer valid */
+static SQInteger sqstd_rex_dfastate(SQRexProg *prog,SQInteger n,SQInteger flags,SQBool *flushed)
+{
+    SQInteger *k = prog->_kernel, i, j;
+    sqstd_rex_sortpcs(k,n);
+    SQUnsignedInteger h = (SQUnsignedInteger)flags * 2654435761u;
+    for(i = 0; i < n; i++) h = (h ^ (SQUnsignedInteger)k[i]) * 16777619u;
+    h %= SQREX_DFA_BUCKETS;
+    for(i = prog->_dbuckets[h]; i != -1; i = prog->_dstates[i].hashnext) {
+        SQRexDState *s = &prog->_dstates[i];
+        if(s->flags == flags && s->npcs == n && memcmp(&prog->_dpcs[s->pcs],k,n * sizeof(SQInteger)) == 0)
+            return i;
+    }
+    if(prog->_ndstates == SQREX_DFA_MAXSTATES || prog->_ndpcs + n > SQREX_DFA_MAXPCS) {
+        sqstd_rex_dfareset(prog);
+        *flushed = SQTrue;
+    }
+    i = prog->_ndstates++;
+    SQRexDState *s = &prog->_dstates[i];
+    s->flags = flags;
+    s->npcs = n;
+    s->pcs = prog->_ndpcs;
+    s->eolmatch = -1;
+    s->hashnext = prog->_dbuckets[h];
+    prog->_dbuckets[h] = i;
+    s->idle = prog->_idle && n == prog->_nidle && memcmp(k,prog->_idle,n * sizeof(SQInteger)) == 0;
+    memcpy(&prog->_dpcs[s->pcs],k,n * sizeof(SQInteger));
+    prog->_ndpcs += n;
+    for(j = 0; j < 256; j++) prog->_dtrans[i * 256 + j] = -1;
+    return i;
+}
+
+static SQInteger sqstd_rex_dfastart(SQRex *exp,SQBool anchored)
+{
+    SQRexProg *prog = exp->_prog;
+    if(!prog->_dstates) {
+        prog->_dstates = (SQRexDState *)sq_malloc(SQREX_DFA_MAXSTATES * sizeof(SQRexDState));
+        prog->_dtrans = (SQInt32 *)sq_malloc(SQREX_DFA_MAXSTATES * 256 * sizeof(SQInt32));
+        prog->_dpcs = (SQInteger *)sq_malloc(SQREX_DFA_MAXPCS * sizeof(SQInteger));
+        prog->_dbuckets = (SQInteger *)sq_malloc(SQREX_DFA_BUCKETS * sizeof(SQInteger));
+        sqstd_rex_dfareset(prog);
+        if(exp->_prefixlen) {
+            //the kernel of the unanchored DFA until the prefix is found
+            prog->_idle = (SQInteger *)sq_malloc(prog->_ninsts * sizeof(SQInteger));
+            prog->_nidle = 0;
+            prog->_gen++;
+            sqstd_rex_closure(prog,0,0,prog->_idle,&prog->_nidle);
+            sqstd_rex_sortpcs(prog->_idle,prog->_nidle);
+        }
+    }
+    if(prog->_dstart[anchored] == -1) {
+        SQInteger n = 0;
+        SQBool flushed = SQFalse;
+        prog->_gen++;
+        sqstd_rex_closure(prog,anchored ? prog->_start : 0,CTX_BOL,prog->_kernel,&n);
+        SQInteger s = sqstd_rex_dfastate(prog,n,CTX_BOL,&flushed);
+        prog->_dstart[anchored] = s;
+    }
+    return prog->_dstart[anchored];
+}
+
+//resolves the pending assertions of the state s in the context ctx, returns SQTrue if it contains a match
+static SQBool sqstd_rex_dfaresolve(SQRexProg *prog,SQInteger s,SQInteger ctx,SQInteger *n)
+{
+    SQRexDState *st = &prog->_dstates[s];
+    SQBool matched = SQFalse;
+    ctx |= st->flags | CTX_KNOWN;
+    prog->_gen++;
+    *n = 0;
+    for(SQInteger i = 0; i < st->npcs; i++)
+        sqstd_rex_closure(prog,prog->_dpcs[st->pcs + i],ctx,prog->_set,n);
+    for(SQInteger i = 0; i < *n; i++)
+        if(prog->_insts[prog->_set[i]].op == RI_MATCH) matched = SQTrue;
+    return matched;
+}
+
+static SQInteger sqstd_rex_dfanext(SQRex *exp,SQInteger s,SQChar c)
+{
+    SQRexProg *prog = exp->_prog;
+    SQInteger nset, n = 0;
+    SQBool matched = sqstd_rex_dfaresolve(prog,s,sqstd_rex_isword(c) ? CTX_NEXTWORD : 0,&nset);
+    SQInteger ctx = (prog->_haswb && sqstd_rex_isword(c)) ? CTX_PREVWORD : 0;
+    prog->_gen++;
+    for(SQInteger i = 0; i < nset; i++) {
+        SQRexInst *inst = &prog->_insts[prog->_set[i]];
+        if(inst->op < RI_MATCH && sqstd_rex_instmatch(exp,inst,c))
+            sqstd_rex_closure(prog,prog->_set[i] + 1,ctx,prog->_kernel,&n);
+    }
+    SQBool flushed = SQFalse;
+    SQInteger t = sqstd_rex_dfastate(prog,n,ctx,&flushed);
+    SQUnsignedInteger uc = (SQUnsignedInteger)c;
+    if(sizeof(SQChar) == 1) uc &= 0xFF;
+    SQInteger next = (t << 1) | (matched ? 1 : 0);
+    if(!flushed && uc < 256) prog->_dtrans[s * 256 + uc] = (SQInt32)next;
+    return next;
+}
+
+static SQInteger sqstd_rex_dfastep(SQRex *exp,SQInteger s,SQChar c)
+{
+    SQUnsignedInteger uc = (SQUnsignedInteger)c;
+    if(sizeof(SQChar) == 1) uc &= 0xFF;
+    SQInteger next = uc < 256 ? exp->_prog->_dtrans[s * 256 + uc] : -1;
+    return next >= 0 ? next : sqstd_rex_dfanext(exp,s,c);
+}
+
+/* runs the DFA on [begin,end); anchored it returns SQTrue if the whole text matches,
+   otherwise if a match ends anywhere in the text */
+static SQBool sqstd_rex_dfaexec(SQRex *exp,SQBool anchored,const SQChar *begin,const SQChar *end)
+{
+    SQRexProg *prog = exp->_prog;
+    SQInteger s = sqstd_rex_dfastart(exp,anchored);
+    for(const SQChar *p = begin; p != end; p++) {
+        if(prog->_dstates[s].idle && !anchored) {
+            p = sqstd_rex_findprefix(exp,p,end);
+            if(!p) return SQFalse;
+        }
+        SQInteger next = sqstd_rex_dfastep(exp,s,*p);
+        s = next >> 1;
+        if(anchored) {
+            if(prog->_dstates[s].npcs == 0) return SQFalse;
+        }
+        else if(next & 1) return SQTrue;
+    }
+    if(prog->_dstates[s].eolmatch == -1) {
+        SQInteger n;
+        prog->_dstates[s].eolmatch = sqstd_rex_dfaresolve(prog,s,CTX_EOL,&n) ? 1 : 0;
+    }
+    return prog->_dstates[s].eolmatch ? SQTrue : SQFalse;
+}
+
+/* adds the thread at pc and the ones reachable from it without consuming characters
+   to the list, caps are the captures of the thread */
+static void sqstd_rex_addthread(SQRexProg *prog,SQRexThreads *list,SQInteger pc,const SQChar **caps,const SQChar *p,SQInteger ctx)
+{
+    SQRexStackEntry *stack = prog->_stack;
+    SQInteger sp = 0;
+    stack[sp++].pc = pc;
+    while(sp) {
+        SQRexStackEntry *e = &stack[--sp];
+        if(e->pc == -1) {
+            caps[e->slot] = e->old;
+            continue;
+        }
+        pc = e->pc;
+        SQInteger idx = list->sparse[pc];
+        if(idx < list->n && list->dense[idx] == pc) continue;
+        idx = list->n++;
+        list->sparse[pc] = idx;
+        list->dense[idx] = pc;
+        SQRexInst *i = &prog->_insts[pc];
+        switch(i->op) {
+        case RI_JMP: stack[sp++].pc = i->x; break;
+        case RI_SPLIT: stack[sp++].pc = i->y; stack[sp++].pc = i->x; break;
+        case RI_SAVE:
+            stack[sp].pc = -1; stack[sp].slot = i->x; stack[sp].old = caps[i->x]; sp++;
+            caps[i->x] = p;
+            stack[sp++].pc = pc + 1;
+            break;
+        case RI_BOL: if(ctx & CTX_BOL) stack[sp++].pc = pc + 1; break;
+        case RI_EOL: if(ctx & CTX_EOL) stack[sp++].pc = pc + 1; break;
+        case RI_WB:
+        case RI_NWB:
+            if((((ctx & CTX_PREVWORD) != 0) != ((ctx & CTX_NEXTWORD) != 0)) == (i->op == RI_WB))
+                stack[sp++].pc = pc + 1;
+            break;
+        default:
+            memcpy(&list->caps[idx * prog->_ncap],caps,prog->_ncap * sizeof(const SQChar *));
+            break;
+        }
+    }
+}
+
+/* finds the leftmost match in [begin,end) giving the priority to the left alternatives and to
+   the longest repetitions; anchored the match must span the whole text */
+static SQBool sqstd_rex_pikeexec(SQRex *exp,SQBool anchored,const SQChar *begin,const SQChar *end)
+{
+    SQRexProg *prog = exp->_prog;
+    SQInteger ncap = prog->_ncap, i;
+    if(!prog->_tcaps) {
+        for(i = 0; i < 2; i++) {
+            prog->_threads[i].sparse = (SQInteger *)sq_malloc(prog->_ninsts * sizeof(SQInteger));
+            prog->_threads[i].dense = (SQInteger *)sq_malloc(prog->_ninsts * sizeof(SQInteger));
+            prog->_threads[i].caps = (const SQChar **)sq_malloc(prog->_ninsts * ncap * sizeof(const SQChar *));
+            memset(prog->_threads[i].sparse,0,prog->_ninsts * sizeof(SQInteger));
+        }
+        prog->_tcaps = (const SQChar **)sq_malloc(ncap * sizeof(const SQChar *));
+        prog->_mcaps = (const SQChar **)sq_malloc(ncap * sizeof(const SQChar *));
+    }
+    SQRexThreads *clist = &prog->_threads[0], *nlist = &prog->_threads[1];
+    SQBool matched = SQFalse;
+    clist->n = 0;
+    for(const SQChar *p = begin; ; p++) {
+        if(!anchored && !matched && clist->n == 0 && exp->_prefixlen) {
+            //no thread is alive, skips to the next occurrence of the prefix
+            p = sqstd_rex_findprefix(exp,p,end);
+            if(!p) break;
+        }
+        else if(!anchored && !matched && clist->n == 0 && !prog->_haswb) {
+            //no thread is alive, skips the characters that cannot start a match
+            while(p != end) {
+                SQInteger s = sqstd_rex_dfastart(exp,SQTrue);
+                SQInteger next = sqstd_rex_dfastep(exp,s,*p);
+                if((next & 1) || prog->_dstates[next >> 1].npcs != 0) break;
+                p++;
+            }
+            if(p == end) break;
+        }
+        SQInteger ctx = sqstd_rex_context(begin,end,p);
+        if(!matched && (anchored ? p == begin : p != end)) {
+            //the new thread has the lowest priority, the leftmost match wins
+            for(i = 0; i < ncap; i++) prog->_tcaps[i] = NULL;
+            sqstd_rex_addthread(prog,clist,prog->_start,prog->_tcaps,p,ctx);
+        }
+        if(clist->n == 0) break;
+        SQInteger nctx = p != end ? sqstd_rex_context(begin,end,p + 1) : 0;
+        nlist->n = 0;
+        for(i = 0; i < clist->n; i++) {
+            SQRexInst *inst = &prog->_insts[clist->dense[i]];
+            const SQChar **caps = &clist->caps[i * ncap];
+            if(inst->op == RI_MATCH) {
+                if(anchored && p != end) continue;
+                memcpy(prog->_mcaps,caps,ncap * sizeof(const SQChar *));
+                matched = SQTrue;
+                break; //the threads that follow have a lower priority
+            }
+            if(inst->op < RI_MATCH && p != end && sqstd_rex_instmatch(exp,inst,*p))
+                sqstd_rex_addthread(prog,nlist,clist->dense[i] + 1,caps,p + 1,nctx);
+        }
+        if(p == end) break;
+        SQRexThreads *t = clist; clist = nlist; nlist = t;
+    }
+    if(!matched) return SQFalse;
+    for(i = 0; i < exp->_nsubexpr; i++) {
+        const SQChar *b = prog->_mcaps[i * 2], *e = prog->_mcaps[i * 2 + 1];
+        exp->_matches[i].begin = (b && e) ? b : NULL;
+        exp->_matches[i].len = (b && e) ? e - b : 0;
+    }
+    return SQTrue;
+}
+
 /* public api */
 SQRex *sqstd_rex_compile(const SQChar *pattern,const SQChar **error)
+{
+    return sqstd_rex_compileex(pattern,0,error);
+}
+
+SQRex *sqstd_rex_compileex(const SQChar *pattern,SQInteger flags,const SQChar **error)
 {
     SQRex * volatile exp = (SQRex *)sq_malloc(sizeof(SQRex)); // "volatile" is needed for setjmp()
     exp->_eol = exp->_bol = NULL;
@@ -563,12 +1141,18 @@ SQRex *sqstd_rex_compile(const SQChar *pattern,const SQChar **error)
     exp->_nsubexpr = 0;
     exp->_first = sqstd_rex_newnode(exp,OP_EXPR);
     exp->_error = error;
+    exp->_prog = NULL;
+    exp->_prefix = NULL;
+    exp->_prefixlen = 0;
     exp->_jmpbuf = sq_malloc(sizeof(jmp_buf));
     if(setjmp(*((jmp_buf*)exp->_jmpbuf)) == 0) {
         SQInteger res = sqstd_rex_list(exp);
         exp->_nodes[exp->_first].left = res;
         if(*exp->_p!='\0')
             sqstd_rex_error(exp,_SC("unexpected character"));
+        sqstd_rex_computeprefix(exp);
+        if(flags & SQREX_LINEAR)
+            sqstd_rex_compileprog(exp);
 #ifdef _DEBUG
         {
             SQInteger nsize,i;
@@ -602,6 +1186,8 @@ void sqstd_rex_free(SQRex *exp)
         if(exp->_nodes) sq_free(exp->_nodes,exp->_nallocated * sizeof(SQRexNode));
         if(exp->_jmpbuf) sq_free(exp->_jmpbuf,sizeof(jmp_buf));
         if(exp->_matches) sq_free(exp->_matches,exp->_nsubexpr * sizeof(SQRexMatch));
+        if(exp->_prog) sqstd_rex_freeprog(exp->_prog);
+        if(exp->_prefix) sq_free(exp->_prefix,sq_rsl(exp->_prefixlen));
         sq_free(exp,sizeof(SQRex));
     }
 }
@@ -609,6 +1195,16 @@ void sqstd_rex_free(SQRex *exp)
 SQBool sqstd_rex_match(SQRex* exp,const SQChar* text)
 {
     const SQChar* res = NULL;
+    if(exp->_prog) {
+        const SQChar *eol = text + scstrlen(text);
+        if(!sqstd_rex_dfaexec(exp,SQTrue,text,eol))
+            return SQFalse;
+        if(exp->_nsubexpr > 1)
+            return sqstd_rex_pikeexec(exp,SQTrue,text,eol);
+        exp->_matches[0].begin = text;
+        exp->_matches[0].len = eol - text;
+        return SQTrue;
+    }
     exp->_bol = text;
     exp->_eol = text + scstrlen(text);
     exp->_currsubexp = 0;
@@ -623,9 +1219,19 @@ SQBool sqstd_rex_searchrange(SQRex* exp,const SQChar* text_begin,const SQChar* t
     const SQChar *cur = NULL;
     SQInteger node = exp->_first;
     if(text_begin >= text_end) return SQFalse;
+    if(exp->_prog) {
+        if(!sqstd_rex_dfaexec(exp,SQFalse,text_begin,text_end)
+            || !sqstd_rex_pikeexec(exp,SQFalse,text_begin,text_end))
+            return SQFalse;
+        if(out_begin) *out_begin = exp->_matches[0].begin;
+        if(out_end) *out_end = exp->_matches[0].begin + exp->_matches[0].len;
+        return SQTrue;
+    }
     exp->_bol = text_begin;
     exp->_eol = text_end;
     do {
+        if(exp->_prefixlen && !(text_begin = sqstd_rex_findprefix(exp,text_begin,text_end)))
+            return SQFalse;
         cur = text_begin;
         while(node != -1) {
             exp->_currsubexp = 0;
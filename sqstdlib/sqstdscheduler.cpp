@@ -0,0 +1,852 @@
+/* see copyright notice in squirrel.h */
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <squirrel.h>
+#include <sqstdio.h>
+#include <sqstdblob.h>
+#include <sqstdscheduler.h>
+
+#define SQSTD_EVENT_TYPE_TAG ((SQUnsignedInteger)0x80000100)
+#define SQSTD_SCHED_WHEEL_SIZE 256 //must be a power of 2
+#define SQSTD_SCHED_STACKSIZE 64
+#define SQSTD_SCHED_IOTHREADS 4
+
+struct SQSchedList;
+struct SQSchedIOPool;
+
+struct SQSchedTask
+{
+    HSQOBJECT _thread;
+    HSQUIRRELVM _vm;
+    HSQOBJECT _value; //returned by the suspending call when the task is resumed
+    SQSchedTask *_prev,*_next; //links in the run queue, a wheel slot or an event
+    SQSchedTask *_allprev,*_allnext; //links in the list of all live tasks
+    SQSchedList *_list;
+    SQInteger _wakeup;
+    SQInteger _nargs; //number of arguments of the first call, -1 once started
+    bool _held; //suspended waiting for an i/o request or for sqstd_scheduler_resume()
+};
+
+//intrusive FIFO; insertion and removal are O(1)
+struct SQSchedList
+{
+    void Init() { _head = _tail = NULL; _count = 0; }
+    void PushBack(SQSchedTask *t) {
+        t->_prev = _tail;
+        t->_next = NULL;
+        if(_tail) _tail->_next = t;
+        else _head = t;
+        _tail = t;
+        t->_list = this;
+        _count++;
+    }
+    void Remove(SQSchedTask *t) {
+        if(t->_prev) t->_prev->_next = t->_next;
+        else _head = t->_next;
+        if(t->_next) t->_next->_prev = t->_prev;
+        else _tail = t->_prev;
+        t->_prev = t->_next = NULL;
+        t->_list = NULL;
+        _count--;
+    }
+    SQSchedTask *PopFront() {
+        SQSchedTask *t = _head;
+        if(t) Remove(t);
+        return t;
+    }
+    SQSchedTask *_head,*_tail;
+    SQInteger _count;
+};
+
+struct SQScheduler
+{
+    void Init() {
+        _refs = 1;
+        _now = 0;
+        _ntasks = 0;
+        _all = NULL;
+        _free = NULL;
+        _current = NULL;
+        _io = NULL;
+        _ready.Init();
+        _far.Init();
+        _cascade = 0;
+        for(SQInteger i = 0; i < SQSTD_SCHED_WHEEL_SIZE; i++)
+            _wheel[i].Init();
+    }
+    SQSchedTask *NewTask() {
+        SQSchedTask *t = _free;
+        if(t) _free = t->_next;
+        else t = (SQSchedTask *)sq_malloc(sizeof(SQSchedTask));
+        sq_resetobject(&t->_thread);
+        sq_resetobject(&t->_value);
+        t->_vm = NULL;
+        t->_prev = t->_next = NULL;
+        t->_list = NULL;
+        t->_wakeup = 0;
+        t->_nargs = 0;
+        t->_held = false;
+        t->_allprev = NULL;
+        t->_allnext = _all;
+        if(_all) _all->_allprev = t;
+        _all = t;
+        _ntasks++;
+        return t;
+    }
+    void FreeTask(SQSchedTask *t) {
+        if(t->_list) t->_list->Remove(t);
+        if(t->_allprev) t->_allprev->_allnext = t->_allnext;
+        else _all = t->_allnext;
+        if(t->_allnext) t->_allnext->_allprev = t->_allprev;
+        _ntasks--;
+        t->_next = _free;
+        _free = t;
+    }
+    void Sleep(SQSchedTask *t,SQInteger ticks) {
+        if(ticks <= 0) {
+            _ready.PushBack(t);
+            return;
+        }
+        t->_wakeup = _now + ticks;
+        if(ticks < SQSTD_SCHED_WHEEL_SIZE)
+            _wheel[t->_wakeup & (SQSTD_SCHED_WHEEL_SIZE - 1)].PushBack(t);
+        else
+            _far.PushBack(t);
+    }
+    void Advance(SQInteger ticks) {
+        SQInteger target = _now + ticks;
+        //past a full turn of the wheel every slot has to be visited once
+        SQInteger steps = ticks < SQSTD_SCHED_WHEEL_SIZE ? ticks : SQSTD_SCHED_WHEEL_SIZE;
+        for(SQInteger i = 1; i <= steps; i++) {
+            SQSchedList &slot = _wheel[(_now + i) & (SQSTD_SCHED_WHEEL_SIZE - 1)];
+            SQSchedTask *t = slot._head;
+            while(t) {
+                SQSchedTask *next = t->_next;
+                if(t->_wakeup <= target) {
+                    slot.Remove(t);
+                    _ready.PushBack(t);
+                }
+                t = next;
+            }
+        }
+        _now = target;
+        //sleeps longer than a turn of the wheel wait in _far, which is only scanned once
+        //per turn to move the ones that now fit in the wheel
+        if(_far._head && _now >= _cascade) {
+            SQSchedTask *t = _far._head;
+            while(t) {
+                SQSchedTask *next = t->_next;
+                if(t->_wakeup - _now < SQSTD_SCHED_WHEEL_SIZE) {
+                    _far.Remove(t);
+                    if(t->_wakeup <= _now) _ready.PushBack(t);
+                    else _wheel[t->_wakeup & (SQSTD_SCHED_WHEEL_SIZE - 1)].PushBack(t);
+                }
+                t = next;
+            }
+            _cascade = _now + SQSTD_SCHED_WHEEL_SIZE;
+        }
+    }
+    void AddRef() { _refs++; }
+    void Release();
+    SQInteger _refs;
+    SQInteger _now;
+    SQInteger _ntasks;
+    SQSchedTask *_all;
+    SQSchedTask *_free;
+    SQSchedTask *_current;
+    SQSchedIOPool *_io; //created by the first i/o request
+    SQSchedList _ready;
+    SQSchedList _wheel[SQSTD_SCHED_WHEEL_SIZE];
+    SQSchedList _far; //sleeping for a turn of the wheel or more
+    SQInteger _cascade; //time of the next scan of _far
+};
+
+struct SQSchedEvent
+{
+    SQScheduler *_sched;
+    SQSchedList _waiters;
+};
+
+//I/O
+//the requests are executed by a small pool of threads with blocking calls;
+//sqstd_scheduler_run() collects the completed ones and resumes the waiting tasks
+
+#define SQSTD_IO_READ 0
+#define SQSTD_IO_WRITE 1
+#define SQSTD_IO_APPEND 2
+
+struct SQSchedIO
+{
+    SQInteger _op;
+    SQChar *_path;
+    SQInteger _pathsize;
+    SQInteger _offset;
+    SQInteger _size; //bytes to read, -1 reads up to the end of the file
+    unsigned char *_buf; //data to write or data read
+    SQInteger _allocated;
+    SQInteger _result; //bytes transferred or -1 if the request failed
+    SQSchedTask *_task;
+    SQSchedIO *_next;
+};
+
+static void _freeio(SQSchedIO *io)
+{
+    if(io->_buf) sq_free(io->_buf,io->_allocated);
+    sq_free(io->_path,io->_pathsize);
+    sq_free(io,sizeof(SQSchedIO));
+}
+
+static void _performio(SQSchedIO *io)
+{
+    io->_result = -1;
+    if(io->_op == SQSTD_IO_READ) {
+        SQFILE f = sqstd_fopen(io->_path,_SC("rb"));
+        if(!f) return;
+        //the buffer is sized from the file, not from the size asked for
+        SQInteger filelen = sqstd_fseek(f,0,SQ_SEEK_END) == 0 ? sqstd_ftell(f) : -1;
+        SQInteger size = filelen - io->_offset;
+        if(io->_size >= 0 && io->_size < size) size = io->_size;
+        else if(io->_size >= 0 && size < 0) size = 0;
+        if(filelen >= 0 && size >= 0 && sqstd_fseek(f,io->_offset,SQ_SEEK_SET) == 0) {
+            io->_buf = (unsigned char *)sq_malloc(size > 0 ? size : 1);
+            if(io->_buf) {
+                io->_allocated = size > 0 ? size : 1;
+                io->_result = sqstd_fread(io->_buf,1,size,f);
+            }
+        }
+        sqstd_fclose(f);
+    }
+    else {
+        SQFILE f = sqstd_fopen(io->_path,io->_op == SQSTD_IO_APPEND ? _SC("ab") : _SC("wb"));
+        if(!f) return;
+        io->_result = sqstd_fwrite(io->_buf,1,io->_size,f);
+        if(sqstd_fclose(f) != 0) io->_result = -1;
+    }
+}
+
+//FIFO of requests
+struct SQSchedIOQueue
+{
+    void Init() { _head = _tail = NULL; }
+    void PushBack(SQSchedIO *io) {
+        io->_next = NULL;
+        if(_tail) _tail->_next = io;
+        else _head = io;
+        _tail = io;
+    }
+    SQSchedIO *PopFront() {
+        SQSchedIO *io = _head;
+        if(io) {
+            _head = io->_next;
+            if(!_head) _tail = NULL;
+        }
+        return io;
+    }
+    SQSchedIO *_head,*_tail;
+};
+
+struct SQSchedIOPool
+{
+    SQSchedIOPool() {
+        _submitted.Init();
+        _completed.Init();
+        _nthreads = 0;
+        _idle = 0;
+        _stop = false;
+    }
+    ~SQSchedIOPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wake.notify_all();
+        for(SQInteger i = 0; i < _nthreads; i++)
+            _threads[i].join();
+        SQSchedIO *io;
+        while((io = _submitted.PopFront()) != NULL) _freeio(io);
+        while((io = _completed.PopFront()) != NULL) _freeio(io);
+    }
+    void Submit(SQSchedIO *io) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _submitted.PushBack(io);
+        if(_idle == 0 && _nthreads < SQSTD_SCHED_IOTHREADS) {
+            _threads[_nthreads++] = std::thread(&SQSchedIOPool::Run,this);
+        }
+        else _wake.notify_one();
+    }
+    void Run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for(;;) {
+            SQSchedIO *io;
+            while(!_stop && (io = _submitted.PopFront()) == NULL) {
+                _idle++;
+                _wake.wait(lock);
+                _idle--;
+            }
+            if(_stop) return;
+            lock.unlock();
+            _performio(io);
+            lock.lock();
+            _completed.PushBack(io);
+            _done.notify_all();
+        }
+    }
+    //returns the completed requests in the order they completed
+    SQSchedIO *Collect() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        SQSchedIO *list = _completed._head;
+        _completed.Init();
+        return list;
+    }
+    bool Wait(SQInteger milliseconds) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if(!_completed._head)
+            _done.wait_for(lock,std::chrono::milliseconds(milliseconds));
+        return _completed._head != NULL;
+    }
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    SQSchedIOQueue _submitted;
+    SQSchedIOQueue _completed;
+    std::thread _threads[SQSTD_SCHED_IOTHREADS];
+    SQInteger _nthreads;
+    SQInteger _idle;
+    bool _stop;
+};
+
+void SQScheduler::Release()
+{
+    if(--_refs == 0) {
+        if(_io) {
+            _io->~SQSchedIOPool();
+            sq_free(_io,sizeof(SQSchedIOPool));
+        }
+        while(_free) {
+            SQSchedTask *t = _free;
+            _free = t->_next;
+            sq_free(t,sizeof(SQSchedTask));
+        }
+        sq_free(this,sizeof(SQScheduler));
+    }
+}
+
+//moves the tasks whose request completed to the run queue, the result is returned by the suspended call
+static void _collectio(HSQUIRRELVM v,SQScheduler *sched)
+{
+    if(!sched->_io) return;
+    SQSchedIO *io = sched->_io->Collect();
+    while(io) {
+        SQSchedIO *next = io->_next;
+        SQSchedTask *t = io->_task;
+        if(io->_result >= 0) {
+            if(io->_op == SQSTD_IO_READ) {
+                SQUserPointer p = sqstd_createblob(v,io->_result);
+                if(p) {
+                    memcpy(p,io->_buf,io->_result);
+                    sq_getstackobj(v,-1,&t->_value);
+                    sq_addref(v,&t->_value);
+                    sq_pop(v,1);
+                }
+            }
+            else {
+                sq_pushinteger(v,io->_result);
+                sq_getstackobj(v,-1,&t->_value);
+                sq_pop(v,1);
+            }
+        }
+        sched->_ready.PushBack(t);
+        _freeio(io);
+        io = next;
+    }
+}
+
+static SQSchedIO *_newio(HSQUIRRELVM v,SQInteger op,SQInteger pathidx)
+{
+    const SQChar *path;
+    SQInteger len;
+    sq_getstringandsize(v,pathidx,&path,&len);
+    SQSchedIO *io = (SQSchedIO *)sq_malloc(sizeof(SQSchedIO));
+    io->_op = op;
+    io->_pathsize = (len + 1) * sizeof(SQChar);
+    io->_path = (SQChar *)sq_malloc(io->_pathsize);
+    memcpy(io->_path,path,io->_pathsize);
+    io->_offset = 0;
+    io->_size = -1;
+    io->_buf = NULL;
+    io->_allocated = 0;
+    io->_result = -1;
+    io->_task = NULL;
+    io->_next = NULL;
+    return io;
+}
+
+static SQRESULT _submitio(HSQUIRRELVM v,SQScheduler *sched,SQSchedTask *task,SQSchedIO *io)
+{
+    SQRESULT r = sq_suspendvm(v);
+    if(r == SQ_ERROR) {
+        _freeio(io);
+        return r;
+    }
+    if(!sched->_io)
+        sched->_io = new (sq_malloc(sizeof(SQSchedIOPool))) SQSchedIOPool();
+    io->_task = task;
+    task->_held = true;
+    sched->_io->Submit(io);
+    return r;
+}
+
+static SQScheduler *_getscheduler(HSQUIRRELVM v)
+{
+    SQUserPointer p = NULL;
+    SQScheduler *s = NULL;
+    SQInteger top = sq_gettop(v);
+    sq_pushregistrytable(v);
+    sq_pushstring(v,_SC("std_scheduler"),-1);
+    if(SQ_SUCCEEDED(sq_rawget(v,-2))
+        && SQ_SUCCEEDED(sq_getuserdata(v,-1,&p,NULL))) {
+        s = *((SQScheduler **)p);
+    }
+    sq_settop(v,top);
+    return s;
+}
+
+//the scheduler is bound to the library functions as their only free variable
+#define SETUP_SCHED(v) \
+    SQScheduler *sched = NULL; \
+    { SQUserPointer p = NULL; \
+    if(SQ_FAILED(sq_getuserdata(v,-1,&p,NULL))) \
+        return sq_throwerror(v,_SC("invalid scheduler")); \
+    sched = *((SQScheduler **)p); }
+
+#define SETUP_EVENT(v) \
+    SQSchedEvent *self = NULL; \
+    if(SQ_FAILED(sq_getinstanceup(v,1,(SQUserPointer*)&self,(SQUserPointer)SQSTD_EVENT_TYPE_TAG))) \
+        return sq_throwerror(v,_SC("invalid type tag"));
+
+static SQSchedTask *_getcurrent(HSQUIRRELVM v,SQScheduler *sched)
+{
+    SQSchedTask *t = sched->_current;
+    if(t && t->_vm == v) return t;
+    return NULL;
+}
+
+#define SETUP_CURRENT(v,sched) \
+    SQSchedTask *task = _getcurrent(v,sched); \
+    if(!task) \
+        return sq_throwerror(v,_SC("not running in a scheduled thread"));
+
+static SQRESULT _spawn(HSQUIRRELVM v,SQScheduler *sched,SQInteger func,SQInteger nargs)
+{
+    HSQUIRRELVM thread = sq_newthread(v,SQSTD_SCHED_STACKSIZE);
+    if(!thread)
+        return sq_throwerror(v,_SC("cannot create thread"));
+    sq_move(thread,v,func);
+    sq_pushroottable(thread);
+    for(SQInteger i = 1; i <= nargs; i++)
+        sq_move(thread,v,func + i);
+    SQSchedTask *t = sched->NewTask();
+    t->_vm = thread;
+    t->_nargs = nargs;
+    sq_getstackobj(v,-1,&t->_thread);
+    sq_addref(v,&t->_thread);
+    sched->_ready.PushBack(t);
+    return SQ_OK;
+}
+
+static void _kill(HSQUIRRELVM v,SQScheduler *sched,SQSchedTask *t)
+{
+    sq_settop(t->_vm,0);
+    sq_release(v,&t->_value);
+    sq_release(v,&t->_thread);
+    sched->FreeTask(t);
+}
+
+static SQInteger _scheduler_spawn(HSQUIRRELVM v)
+{
+    SETUP_SCHED(v);
+    SQInteger nargs = sq_gettop(v) - 3;
+    if(SQ_FAILED(_spawn(v,sched,2,nargs)))
+        return SQ_ERROR;
+    return 1;
+}
+
+static SQInteger _scheduler_yieldthread(HSQUIRRELVM v)
+{
+    SETUP_SCHED(v);
+    SETUP_CURRENT(v,sched);
+    SQRESULT r = sq_suspendvm(v);
+    if(r == SQ_ERROR) return r;
+    sched->_ready.PushBack(task);
+    return r;
+}
+
+static SQInteger _scheduler_sleep(HSQUIRRELVM v)
+{
+    SETUP_SCHED(v);
+    SETUP_CURRENT(v,sched);
+    SQInteger ticks;
+    sq_getinteger(v,2,&ticks);
+    SQRESULT r = sq_suspendvm(v);
+    if(r == SQ_ERROR) return r;
+    sched->Sleep(task,ticks);
+    return r;
+}
+
+static SQInteger _scheduler_now(HSQUIRRELVM v)
+{
+    SETUP_SCHED(v);
+    sq_pushinteger(v,sched->_now);
+    return 1;
+}
+
+static SQInteger _scheduler_count(HSQUIRRELVM v)
+{
+    SETUP_SCHED(v);
+    sq_pushinteger(v,sched->_ntasks);
+    return 1;
+}
+
+static SQInteger _scheduler_current(HSQUIRRELVM v)
+{
+    SETUP_SCHED(v);
+    SQSchedTask *t = _getcurrent(v,sched);
+    if(!t) return 0;
+    sq_pushobject(v,t->_thread);
+    return 1;
+}
+
+static SQInteger _scheduler_readfile(HSQUIRRELVM v)
+{
+    SETUP_SCHED(v);
+    SETUP_CURRENT(v,sched);
+    SQInteger offset = 0, size = -1, top = sq_gettop(v) - 1; //the last parameter is the free variable
+    if(top > 2) sq_getinteger(v,3,&offset);
+    if(top > 3) sq_getinteger(v,4,&size);
+    if(offset < 0)
+        return sq_throwerror(v,_SC("invalid offset"));
+    SQSchedIO *io = _newio(v,SQSTD_IO_READ,2);
+    io->_offset = offset;
+    io->_size = size < 0 ? -1 : size;
+    return _submitio(v,sched,task,io);
+}
+
+static SQInteger _scheduler_writefile(HSQUIRRELVM v)
+{
+    SETUP_SCHED(v);
+    SETUP_CURRENT(v,sched);
+    SQBool append = SQFalse;
+    const SQChar *str = NULL;
+    SQUserPointer blob;
+    const void *data;
+    SQInteger size;
+    if(sq_gettop(v) > 4) sq_getbool(v,4,&append);
+    if(sq_gettype(v,3) == OT_STRING) {
+        sq_getstringandsize(v,3,&str,&size);
+        data = str;
+        size *= sizeof(SQChar);
+    }
+    else if(SQ_SUCCEEDED(sqstd_getblob(v,3,&blob))) {
+        data = blob;
+        size = sqstd_getblobsize(v,3);
+    }
+    else return sq_throwerror(v,_SC("the data must be a string or a blob"));
+    //the data is copied, the string or the blob can change while the request is executed
+    SQSchedIO *io = _newio(v,append ? SQSTD_IO_APPEND : SQSTD_IO_WRITE,2);
+    io->_size = size;
+    io->_allocated = size > 0 ? size : 1;
+    io->_buf = (unsigned char *)sq_malloc(io->_allocated);
+    memcpy(io->_buf,data,size);
+    return _submitio(v,sched,task,io);
+}
+
+#define _DECL_SCHED_FUNC(name,nparams,typecheck) {_SC(#name),_scheduler_##name,nparams,typecheck}
+static const SQRegFunction schedulerlib_funcs[]={
+    _DECL_SCHED_FUNC(spawn,-2,_SC(".c")),
+    _DECL_SCHED_FUNC(yieldthread,1,NULL),
+    _DECL_SCHED_FUNC(sleep,2,_SC(".n")),
+    _DECL_SCHED_FUNC(now,1,NULL),
+    _DECL_SCHED_FUNC(count,1,NULL),
+    _DECL_SCHED_FUNC(current,1,NULL),
+    _DECL_SCHED_FUNC(readfile,-2,_SC(".snn")),
+    _DECL_SCHED_FUNC(writefile,-3,_SC(".s.b")),
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
+#undef _DECL_SCHED_FUNC
+
+//EVENT
+
+static void _wake(HSQUIRRELVM v,SQScheduler *sched,SQSchedList &waiters,HSQOBJECT *value)
+{
+    SQSchedTask *t = waiters.PopFront();
+    if(value) {
+        t->_value = *value;
+        sq_addref(v,&t->_value);
+    }
+    sched->_ready.PushBack(t);
+}
+
+static SQInteger _event_releasehook(SQUserPointer p, SQInteger SQ_UNUSED_ARG(size))
+{
+    SQSchedEvent *self = (SQSchedEvent*)p;
+    //tasks still waiting are left parked; this only happens when the vm is closed
+    while(self->_waiters.PopFront());
+    self->_sched->Release();
+    sq_free(self,sizeof(SQSchedEvent));
+    return 1;
+}
+
+static SQInteger _event_constructor(HSQUIRRELVM v)
+{
+    SETUP_SCHED(v);
+    SQSchedEvent *e = (SQSchedEvent *)sq_malloc(sizeof(SQSchedEvent));
+    e->_sched = sched;
+    e->_waiters.Init();
+    if(SQ_FAILED(sq_setinstanceup(v,1,e))) {
+        sq_free(e,sizeof(SQSchedEvent));
+        return sq_throwerror(v, _SC("cannot create event"));
+    }
+    sched->AddRef();
+    sq_setreleasehook(v,1,_event_releasehook);
+    return 0;
+}
+
+static SQInteger _event_wait(HSQUIRRELVM v)
+{
+    SETUP_EVENT(v);
+    SETUP_CURRENT(v,self->_sched);
+    SQRESULT r = sq_suspendvm(v);
+    if(r == SQ_ERROR) return r;
+    self->_waiters.PushBack(task);
+    return r;
+}
+
+static SQInteger _event_signal(HSQUIRRELVM v)
+{
+    SETUP_EVENT(v);
+    if(self->_waiters._count) {
+        HSQOBJECT value;
+        if(sq_gettop(v) > 1) sq_getstackobj(v,2,&value);
+        _wake(v,self->_sched,self->_waiters,sq_gettop(v) > 1 ? &value : NULL);
+        sq_pushbool(v,SQTrue);
+    }
+    else sq_pushbool(v,SQFalse);
+    return 1;
+}
+
+static SQInteger _event_broadcast(HSQUIRRELVM v)
+{
+    SETUP_EVENT(v);
+    SQInteger n = self->_waiters._count;
+    HSQOBJECT value;
+    if(sq_gettop(v) > 1) sq_getstackobj(v,2,&value);
+    while(self->_waiters._count)
+        _wake(v,self->_sched,self->_waiters,sq_gettop(v) > 1 ? &value : NULL);
+    sq_pushinteger(v,n);
+    return 1;
+}
+
+static SQInteger _event_waiting(HSQUIRRELVM v)
+{
+    SETUP_EVENT(v);
+    sq_pushinteger(v,self->_waiters._count);
+    return 1;
+}
+
+static SQInteger _event__typeof(HSQUIRRELVM v)
+{
+    sq_pushstring(v,_SC("event"),-1);
+    return 1;
+}
+
+#define _DECL_EVENT_FUNC(name,nparams,typecheck) {_SC(#name),_event_##name,nparams,typecheck}
+static const SQRegFunction _event_methods[] = {
+    _DECL_EVENT_FUNC(wait,1,_SC("x")),
+    _DECL_EVENT_FUNC(signal,-1,_SC("x.")),
+    _DECL_EVENT_FUNC(broadcast,-1,_SC("x.")),
+    _DECL_EVENT_FUNC(waiting,1,_SC("x")),
+    _DECL_EVENT_FUNC(_typeof,1,_SC("x")),
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
+#undef _DECL_EVENT_FUNC
+
+static SQInteger _scheduler_releasehook(SQUserPointer p, SQInteger SQ_UNUSED_ARG(size))
+{
+    SQScheduler *sched = *((SQScheduler **)p);
+    //the vm is being closed; the thread references are dropped with the vm's reference table
+    while(sched->_all)
+        sched->FreeTask(sched->_all);
+    sched->Release();
+    return 1;
+}
+
+SQRESULT sqstd_scheduler_spawn(HSQUIRRELVM v,SQInteger nargs)
+{
+    SQScheduler *sched = _getscheduler(v);
+    if(!sched)
+        return sq_throwerror(v,_SC("the scheduler library is not registered"));
+    SQInteger func = sq_gettop(v) - nargs;
+    if(func < 1)
+        return sq_throwerror(v,_SC("wrong number of parameters"));
+    if(SQ_FAILED(_spawn(v,sched,func,nargs)))
+        return SQ_ERROR;
+    sq_remove(v,func); //closure and args are on the new thread; leaves the thread on the stack
+    for(SQInteger i = 0; i < nargs; i++)
+        sq_remove(v,func);
+    return SQ_OK;
+}
+
+SQInteger sqstd_scheduler_run(HSQUIRRELVM v,SQInteger budget)
+{
+    SQScheduler *sched = _getscheduler(v);
+    if(!sched)
+        return sq_throwerror(v,_SC("the scheduler library is not registered"));
+    if(sched->_current)
+        return sq_throwerror(v,_SC("the scheduler is already running"));
+    _collectio(v,sched);
+    SQSchedTask *t;
+    while(budget-- > 0 && (t = sched->_ready.PopFront()) != NULL) {
+        HSQUIRRELVM thread = t->_vm;
+        SQRESULT r;
+        sched->_current = t;
+        t->_held = false;
+        if(t->_nargs >= 0) {
+            SQInteger nargs = t->_nargs;
+            t->_nargs = -1;
+            r = sq_call(thread,nargs + 1,SQFalse,SQTrue);
+        }
+        else {
+            SQBool wakeupret = sq_type(t->_value) != OT_NULL ? SQTrue : SQFalse;
+            if(wakeupret) {
+                sq_pushobject(thread,t->_value);
+                sq_release(v,&t->_value);
+                sq_resetobject(&t->_value);
+            }
+            r = sq_wakeupvm(thread,wakeupret,SQFalse,SQTrue,SQFalse);
+        }
+        sched->_current = NULL;
+        if(SQ_FAILED(r) || sq_getvmstate(thread) != SQ_VMSTATE_SUSPENDED) {
+            _kill(v,sched,t);
+        }
+        else if(!t->_list && !t->_held) {
+            //suspended by the base library suspend(), nobody would resume it
+            sched->_ready.PushBack(t);
+        }
+    }
+    return sched->_ntasks;
+}
+
+SQRESULT sqstd_scheduler_advance(HSQUIRRELVM v,SQInteger ticks)
+{
+    SQScheduler *sched = _getscheduler(v);
+    if(!sched)
+        return sq_throwerror(v,_SC("the scheduler library is not registered"));
+    if(ticks < 0)
+        return sq_throwerror(v,_SC("cannot advance the scheduler by a negative amount"));
+    sched->Advance(ticks);
+    return SQ_OK;
+}
+
+SQUserPointer sqstd_scheduler_current(HSQUIRRELVM v)
+{
+    SQScheduler *sched = _getscheduler(v);
+    return sched ? (SQUserPointer)_getcurrent(v,sched) : NULL;
+}
+
+SQRESULT sqstd_scheduler_suspend(HSQUIRRELVM v)
+{
+    SQScheduler *sched = _getscheduler(v);
+    SQSchedTask *t = sched ? _getcurrent(v,sched) : NULL;
+    if(!t)
+        return sq_throwerror(v,_SC("not running in a scheduled thread"));
+    SQRESULT r = sq_suspendvm(v);
+    if(r != SQ_ERROR) t->_held = true;
+    return r;
+}
+
+SQRESULT sqstd_scheduler_resume(HSQUIRRELVM v,SQUserPointer task,SQInteger idx)
+{
+    SQScheduler *sched = _getscheduler(v);
+    if(!sched)
+        return sq_throwerror(v,_SC("the scheduler library is not registered"));
+    SQSchedTask *t = (SQSchedTask *)task;
+    if(idx != 0) {
+        sq_getstackobj(v,idx,&t->_value);
+        sq_addref(v,&t->_value);
+    }
+    sched->_ready.PushBack(t);
+    return SQ_OK;
+}
+
+SQBool sqstd_scheduler_waitio(HSQUIRRELVM v,SQInteger milliseconds)
+{
+    SQScheduler *sched = _getscheduler(v);
+    if(!sched || sched->_ready._count > 0)
+        return SQFalse;
+    if(!sched->_io) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+        return SQFalse;
+    }
+    return sched->_io->Wait(milliseconds) ? SQTrue : SQFalse;
+}
+
+static void _pushfunc(HSQUIRRELVM v,const SQRegFunction &f)
+{
+    sq_pushstring(v,f.name,-1);
+    sq_pushregistrytable(v);
+    sq_pushstring(v,_SC("std_scheduler"),-1);
+    sq_rawget(v,-2);
+    sq_remove(v,-2);
+    sq_newclosure(v,f.f,1);
+    sq_setparamscheck(v,f.nparamscheck,f.typemask);
+    sq_setnativeclosurename(v,-1,f.name);
+}
+
+SQRESULT sqstd_register_schedulerlib(HSQUIRRELVM v)
+{
+    if(sq_gettype(v,-1) != OT_TABLE)
+        return sq_throwerror(v,_SC("table expected"));
+    if(!_getscheduler(v)) {
+        SQScheduler *sched = (SQScheduler *)sq_malloc(sizeof(SQScheduler));
+        sched->Init();
+        sq_pushregistrytable(v);
+        sq_pushstring(v,_SC("std_scheduler"),-1);
+        SQScheduler **p = (SQScheduler **)sq_newuserdata(v,sizeof(SQScheduler *));
+        *p = sched;
+        sq_setreleasehook(v,-1,_scheduler_releasehook);
+        sq_rawset(v,-3);
+        sq_pop(v,1);
+    }
+    sq_pushstring(v,_SC("scheduler"),-1);
+    sq_newtable(v);
+    SQInteger i = 0;
+    while(schedulerlib_funcs[i].name != 0) {
+        _pushfunc(v,schedulerlib_funcs[i]);
+        sq_newslot(v,-3,SQFalse);
+        i++;
+    }
+    sq_pushstring(v,_SC("event"),-1);
+    sq_newclass(v,SQFalse);
+    sq_settypetag(v,-1,(SQUserPointer)SQSTD_EVENT_TYPE_TAG);
+    static const SQRegFunction constructor = {_SC("constructor"),_event_constructor,1,_SC("x")};
+    _pushfunc(v,constructor);
+    sq_newslot(v,-3,SQFalse);
+    i = 0;
+    while(_event_methods[i].name != 0) {
+        const SQRegFunction &f = _event_methods[i];
+        sq_pushstring(v,f.name,-1);
+        sq_newclosure(v,f.f,0);
+        sq_setparamscheck(v,f.nparamscheck,f.typemask);
+        sq_setnativeclosurename(v,-1,f.name);
+        sq_newslot(v,-3,SQFalse);
+        i++;
+    }
+    sq_newslot(v,-3,SQFalse);
+    sq_newslot(v,-3,SQFalse);
+    return SQ_OK;
+}
@@ -0,0 +1,805 @@
+/* see copyright notice in squirrel.h */
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <squirrel.h>
+#include <sqstdblob.h>
+#include <sqstdscheduler.h>
+#include <sqstdsocket.h>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define SQSTD_EPOLL
+#endif
+
+#define SQSTD_SOCKET_TYPE_TAG ((SQUnsignedInteger)0x80000500)
+#define SQSTD_SOCKET_MAXEVENTS 64
+#define SQSTD_SOCKET_MAXHOST 256
+
+#ifdef MSG_NOSIGNAL
+#define SQSTD_SENDFLAGS MSG_NOSIGNAL
+#else
+#define SQSTD_SENDFLAGS 0
+#endif
+
+#define SQSTD_OP_NONE 0
+#define SQSTD_OP_CONNECT 1
+#define SQSTD_OP_ACCEPT 2
+#define SQSTD_OP_RECV 3
+#define SQSTD_OP_RECVFROM 4
+#define SQSTD_OP_SEND 5
+#define SQSTD_OP_SENDTO 6
+
+struct SQSocketPoller;
+
+//an operation that waits for the socket to be ready; it is executed by the poller,
+//that resumes the waiting thread with the result
+struct SQSocketOp
+{
+    SQInteger _kind;
+    SQUserPointer _task; //scheduler task waiting for the result
+    SQInteger _size; //bytes to receive
+    const unsigned char *_data; //data to send
+    SQInteger _len;
+    SQInteger _done;
+    unsigned char *_owned; //copy of the data made before the task is suspended
+    struct sockaddr_storage _addr; //destination of sendto
+    socklen_t _addrlen;
+    HSQOBJECT _self; //socket returned by connect
+};
+
+struct SQSocket
+{
+    int _fd;
+    int _family;
+    int _type;
+    int _events; //events the poller is waiting for
+    SQSocketPoller *_poller;
+    SQSocketOp _read;
+    SQSocketOp _write;
+    SQSocket *_prev,*_next; //links in the list of the sockets with a waiting task
+};
+
+static void _initop(SQSocketOp *op)
+{
+    op->_kind = SQSTD_OP_NONE;
+    op->_task = NULL;
+    op->_size = 0;
+    op->_data = NULL;
+    op->_len = op->_done = 0;
+    op->_owned = NULL;
+    op->_addrlen = 0;
+    sq_resetobject(&op->_self);
+}
+
+static void _clearop(HSQUIRRELVM v,SQSocketOp *op)
+{
+    if(op->_owned) sq_free(op->_owned,op->_len);
+    if(v) sq_release(v,&op->_self);
+    _initop(op);
+}
+
+struct SQSocketPoller
+{
+    void Init() {
+        _refs = 1;
+        _waiting = NULL;
+        _nwaiting = 0;
+#ifdef SQSTD_EPOLL
+        _epfd = epoll_create1(EPOLL_CLOEXEC);
+#endif
+    }
+    void AddRef() { _refs++; }
+    void Release() {
+        if(--_refs == 0) {
+#ifdef SQSTD_EPOLL
+            if(_epfd >= 0) close(_epfd);
+#endif
+            sq_free(this,sizeof(SQSocketPoller));
+        }
+    }
+    //waits for the events of the operations pending on the socket
+    void Update(SQSocket *s) {
+        int events = (s->_read._task ? POLLIN : 0) | (s->_write._task ? POLLOUT : 0);
+        if(events == s->_events) return;
+#ifdef SQSTD_EPOLL
+        struct epoll_event ev;
+        ev.events = ((events & POLLIN) ? (uint32_t)EPOLLIN : 0) | ((events & POLLOUT) ? (uint32_t)EPOLLOUT : 0);
+        ev.data.ptr = s;
+        epoll_ctl(_epfd,!s->_events ? EPOLL_CTL_ADD : (events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL),s->_fd,&ev);
+#endif
+        if(!s->_events) {
+            s->_prev = NULL;
+            s->_next = _waiting;
+            if(_waiting) _waiting->_prev = s;
+            _waiting = s;
+            _nwaiting++;
+        }
+        else if(!events) {
+            Unlink(s);
+        }
+        s->_events = events;
+    }
+    void Unlink(SQSocket *s) {
+        if(s->_prev) s->_prev->_next = s->_next;
+        else _waiting = s->_next;
+        if(s->_next) s->_next->_prev = s->_prev;
+        s->_prev = s->_next = NULL;
+        _nwaiting--;
+    }
+    SQInteger _refs;
+    SQSocket *_waiting;
+    SQInteger _nwaiting;
+#ifdef SQSTD_EPOLL
+    int _epfd;
+#endif
+};
+
+static bool _narrow(const SQChar *s,char *dest,SQInteger size)
+{
+    SQInteger i;
+    for(i = 0; s[i]; i++) {
+        if(i >= size - 1) return false;
+        dest[i] = (char)s[i];
+    }
+    dest[i] = 0;
+    return true;
+}
+
+static void _pushnarrow(HSQUIRRELVM v,const char *s)
+{
+#ifdef SQUNICODE
+    SQInteger len = (SQInteger)strlen(s);
+    SQChar *dest = sq_getscratchpad(v,len * sizeof(SQChar));
+    for(SQInteger i = 0; i < len; i++) dest[i] = (unsigned char)s[i];
+    sq_pushstring(v,dest,len);
+#else
+    sq_pushstring(v,s,-1);
+#endif
+}
+
+static int _newfd(int family,int type)
+{
+    int fd = socket(family,type,0);
+    if(fd < 0) return fd;
+    fcntl(fd,F_SETFL,fcntl(fd,F_GETFL) | O_NONBLOCK);
+    fcntl(fd,F_SETFD,FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(fd,SOL_SOCKET,SO_NOSIGPIPE,&one,sizeof(one));
+#endif
+    return fd;
+}
+
+static SQRESULT _resolve(HSQUIRRELVM v,SQInteger hostidx,SQInteger port,int family,int type,bool passive,struct addrinfo **res)
+{
+    char host[SQSTD_SOCKET_MAXHOST],service[32];
+    const SQChar *h = NULL;
+    if(sq_gettype(v,hostidx) == OT_STRING) {
+        sq_getstring(v,hostidx,&h);
+        if(!_narrow(h,host,sizeof(host)))
+            return sq_throwerror(v,_SC("host name too long"));
+    }
+    if(port < 0 || port > 65535)
+        return sq_throwerror(v,_SC("invalid port"));
+    snprintf(service,sizeof(service),"%d",(int)port);
+    struct addrinfo hints;
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family = family;
+    hints.ai_socktype = type;
+    hints.ai_flags = AI_NUMERICSERV | (passive ? AI_PASSIVE : 0);
+    if(getaddrinfo(h ? host : NULL,service,&hints,res) != 0 || !*res)
+        return sq_throwerror(v,_SC("cannot resolve the address"));
+    return SQ_OK;
+}
+
+static SQInteger _socket_releasehook(SQUserPointer p,SQInteger SQ_UNUSED_ARG(size))
+{
+    SQSocket *s = (SQSocket *)p;
+    //only happens when the vm is closed with threads still waiting
+    if(s->_events) s->_poller->Unlink(s);
+    if(s->_fd >= 0) close(s->_fd);
+    _clearop(NULL,&s->_read);
+    _clearop(NULL,&s->_write);
+    s->_poller->Release();
+    sq_free(s,sizeof(SQSocket));
+    return 1;
+}
+
+//pushes a new socket object
+static SQSocket *_pushsocket(HSQUIRRELVM v,SQSocketPoller *poller,int fd,int family,int type)
+{
+    sq_pushregistrytable(v);
+    sq_pushstring(v,_SC("std_socket"),-1);
+    sq_rawget(v,-2);
+    sq_remove(v,-2);
+    sq_createinstance(v,-1);
+    sq_remove(v,-2);
+    SQSocket *s = (SQSocket *)sq_malloc(sizeof(SQSocket));
+    s->_fd = fd;
+    s->_family = family;
+    s->_type = type;
+    s->_events = 0;
+    s->_poller = poller;
+    s->_prev = s->_next = NULL;
+    _initop(&s->_read);
+    _initop(&s->_write);
+    poller->AddRef();
+    sq_setinstanceup(v,-1,s);
+    sq_setreleasehook(v,-1,_socket_releasehook);
+    return s;
+}
+
+static void _pushaddress(HSQUIRRELVM v,const struct sockaddr *addr,socklen_t len)
+{
+    char host[NI_MAXHOST],service[NI_MAXSERV];
+    if(getnameinfo(addr,len,host,sizeof(host),service,sizeof(service),NI_NUMERICHOST|NI_NUMERICSERV) != 0) {
+        host[0] = 0;
+        service[0] = '0';
+        service[1] = 0;
+    }
+    sq_pushstring(v,_SC("host"),-1);
+    _pushnarrow(v,host);
+    sq_newslot(v,-3,SQFalse);
+    sq_pushstring(v,_SC("port"),-1);
+    sq_pushinteger(v,atoi(service));
+    sq_newslot(v,-3,SQFalse);
+}
+
+//tries the operation, returns false if it would block; otherwise the result is pushed
+static bool _perform(HSQUIRRELVM v,SQSocket *s,SQSocketOp *op)
+{
+    for(;;) {
+        switch(op->_kind) {
+        case SQSTD_OP_CONNECT: {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if(getsockopt(s->_fd,SOL_SOCKET,SO_ERROR,&err,&len) != 0 || err != 0)
+                sq_pushnull(v);
+            else
+                sq_pushobject(v,op->_self);
+            return true;
+            }
+        case SQSTD_OP_ACCEPT: {
+            int fd = accept(s->_fd,NULL,NULL);
+            if(fd < 0) break;
+            fcntl(fd,F_SETFL,fcntl(fd,F_GETFL) | O_NONBLOCK);
+            fcntl(fd,F_SETFD,FD_CLOEXEC);
+            _pushsocket(v,s->_poller,fd,s->_family,s->_type);
+            return true;
+            }
+        case SQSTD_OP_RECV:
+        case SQSTD_OP_RECVFROM: {
+            struct sockaddr_storage addr;
+            socklen_t addrlen = sizeof(addr);
+            unsigned char *buf = (unsigned char *)sq_getscratchpad(v,op->_size);
+            ssize_t n = recvfrom(s->_fd,buf,(size_t)op->_size,0,(struct sockaddr *)&addr,&addrlen);
+            if(n < 0) break;
+            if(n == 0 && s->_type == SOCK_STREAM) {
+                sq_pushnull(v); //end of the stream
+                return true;
+            }
+            if(op->_kind == SQSTD_OP_RECVFROM) {
+                sq_newtable(v);
+                _pushaddress(v,(struct sockaddr *)&addr,addrlen);
+                sq_pushstring(v,_SC("data"),-1);
+            }
+            SQUserPointer p = sqstd_createblob(v,(SQInteger)n);
+            if(!p) sq_pushnull(v);
+            else memcpy(p,buf,(size_t)n);
+            if(op->_kind == SQSTD_OP_RECVFROM)
+                sq_newslot(v,-3,SQFalse);
+            return true;
+            }
+        case SQSTD_OP_SEND:
+        case SQSTD_OP_SENDTO: {
+            ssize_t n;
+            if(op->_kind == SQSTD_OP_SENDTO)
+                n = sendto(s->_fd,op->_data,(size_t)op->_len,SQSTD_SENDFLAGS,(struct sockaddr *)&op->_addr,op->_addrlen);
+            else
+                n = send(s->_fd,op->_data + op->_done,(size_t)(op->_len - op->_done),SQSTD_SENDFLAGS);
+            if(n < 0) break;
+            op->_done += n;
+            if(op->_kind == SQSTD_OP_SEND && op->_done < op->_len) continue;
+            sq_pushinteger(v,op->_done);
+            return true;
+            }
+        }
+        if(errno == EINTR || (op->_kind == SQSTD_OP_ACCEPT && errno == ECONNABORTED)) continue;
+        if(errno == EAGAIN || errno == EWOULDBLOCK) return false;
+        sq_pushnull(v);
+        return true;
+    }
+}
+
+//executes the operation; a scheduled thread is suspended until the socket is ready,
+//otherwise the call blocks the VM
+static SQInteger _wait(HSQUIRRELVM v,SQSocket *s,SQSocketOp *op,bool tryfirst)
+{
+    if(tryfirst && _perform(v,s,op)) {
+        _clearop(v,op);
+        return 1;
+    }
+    SQUserPointer task = sqstd_scheduler_current(v);
+    if(!task) {
+        struct pollfd p;
+        p.fd = s->_fd;
+        p.events = op == &s->_read ? POLLIN : POLLOUT;
+        do {
+            p.revents = 0;
+            if(poll(&p,1,-1) < 0 && errno != EINTR) {
+                _clearop(v,op);
+                return sq_throwerror(v,_SC("poll failed"));
+            }
+        } while(!_perform(v,s,op));
+        _clearop(v,op);
+        return 1;
+    }
+    if(op->_data && !op->_owned) {
+        //the string or blob could change while the thread is suspended
+        SQInteger len = op->_len - op->_done;
+        op->_owned = (unsigned char *)sq_malloc(len);
+        memcpy(op->_owned,op->_data + op->_done,len);
+        op->_data = op->_owned;
+        op->_len = len;
+        op->_done = 0;
+    }
+    SQRESULT r = sqstd_scheduler_suspend(v);
+    if(r == SQ_ERROR) {
+        _clearop(v,op);
+        return r;
+    }
+    op->_task = task;
+    s->_poller->Update(s);
+    return r;
+}
+
+//executes the operation of a socket that is ready and resumes the thread waiting for it
+static SQInteger _complete(HSQUIRRELVM v,SQSocket *s,SQSocketOp *op)
+{
+    if(!_perform(v,s,op)) return 0;
+    SQUserPointer task = op->_task;
+    _clearop(v,op);
+    sqstd_scheduler_resume(v,task,-1);
+    sq_pop(v,1);
+    return 1;
+}
+
+static SQInteger _dispatch(HSQUIRRELVM v,SQSocket *s,int revents)
+{
+    SQInteger resumed = 0;
+    if((revents & (POLLIN|POLLERR|POLLHUP)) && s->_read._task)
+        resumed += _complete(v,s,&s->_read);
+    if((revents & (POLLOUT|POLLERR|POLLHUP)) && s->_write._task)
+        resumed += _complete(v,s,&s->_write);
+    s->_poller->Update(s);
+    return resumed;
+}
+
+#define SETUP_SOCKET(v) \
+    SQSocket *self = NULL; \
+    if(SQ_FAILED(sq_getinstanceup(v,1,(SQUserPointer*)&self,(SQUserPointer)SQSTD_SOCKET_TYPE_TAG)) || !self) \
+        return sq_throwerror(v,_SC("invalid type tag")); \
+    if(self->_fd < 0) \
+        return sq_throwerror(v,_SC("the socket is closed"));
+
+#define SETUP_OP(op) \
+    if((op)->_kind != SQSTD_OP_NONE) \
+        return sq_throwerror(v,_SC("another thread is waiting on the socket"));
+
+static SQRESULT _getdata(HSQUIRRELVM v,SQInteger idx,SQSocketOp *op)
+{
+    if(sq_gettype(v,idx) == OT_STRING) {
+        const SQChar *str;
+        SQInteger len;
+        sq_getstringandsize(v,idx,&str,&len);
+        op->_data = (const unsigned char *)str;
+        op->_len = len * sizeof(SQChar);
+        return SQ_OK;
+    }
+    SQUserPointer p;
+    if(SQ_FAILED(sqstd_getblob(v,idx,&p)))
+        return sq_throwerror(v,_SC("the data must be a string or a blob"));
+    op->_data = (const unsigned char *)p;
+    op->_len = sqstd_getblobsize(v,idx);
+    return SQ_OK;
+}
+
+static SQInteger _socket_accept(HSQUIRRELVM v)
+{
+    SETUP_SOCKET(v);
+    SETUP_OP(&self->_read);
+    self->_read._kind = SQSTD_OP_ACCEPT;
+    return _wait(v,self,&self->_read,true);
+}
+
+static SQInteger _socket_recv(HSQUIRRELVM v)
+{
+    SETUP_SOCKET(v);
+    SETUP_OP(&self->_read);
+    SQInteger size;
+    sq_getinteger(v,2,&size);
+    if(size <= 0)
+        return sq_throwerror(v,_SC("the size must be greater than 0"));
+    self->_read._kind = SQSTD_OP_RECV;
+    self->_read._size = size;
+    return _wait(v,self,&self->_read,true);
+}
+
+static SQInteger _socket_recvfrom(HSQUIRRELVM v)
+{
+    SETUP_SOCKET(v);
+    SETUP_OP(&self->_read);
+    SQInteger size;
+    sq_getinteger(v,2,&size);
+    if(size <= 0)
+        return sq_throwerror(v,_SC("the size must be greater than 0"));
+    self->_read._kind = SQSTD_OP_RECVFROM;
+    self->_read._size = size;
+    return _wait(v,self,&self->_read,true);
+}
+
+static SQInteger _socket_send(HSQUIRRELVM v)
+{
+    SETUP_SOCKET(v);
+    SETUP_OP(&self->_write);
+    if(SQ_FAILED(_getdata(v,2,&self->_write)))
+        return SQ_ERROR;
+    self->_write._kind = SQSTD_OP_SEND;
+    return _wait(v,self,&self->_write,true);
+}
+
+static SQInteger _socket_sendto(HSQUIRRELVM v)
+{
+    SETUP_SOCKET(v);
+    SETUP_OP(&self->_write);
+    SQInteger port;
+    struct addrinfo *ai;
+    sq_getinteger(v,4,&port);
+    if(SQ_FAILED(_resolve(v,3,port,self->_family,self->_type,false,&ai)))
+        return SQ_ERROR;
+    memcpy(&self->_write._addr,ai->ai_addr,ai->ai_addrlen);
+    self->_write._addrlen = (socklen_t)ai->ai_addrlen;
+    freeaddrinfo(ai);
+    if(SQ_FAILED(_getdata(v,2,&self->_write))) {
+        _clearop(v,&self->_write);
+        return SQ_ERROR;
+    }
+    self->_write._kind = SQSTD_OP_SENDTO;
+    return _wait(v,self,&self->_write,true);
+}
+
+static SQInteger _socket_close(HSQUIRRELVM v)
+{
+    SQSocket *self = NULL;
+    if(SQ_FAILED(sq_getinstanceup(v,1,(SQUserPointer*)&self,(SQUserPointer)SQSTD_SOCKET_TYPE_TAG)) || !self)
+        return sq_throwerror(v,_SC("invalid type tag"));
+    if(self->_fd < 0) return 0;
+    //the threads waiting on the socket get null
+    SQSocketOp *ops[2] = { &self->_read, &self->_write };
+    for(SQInteger i = 0; i < 2; i++) {
+        SQUserPointer task = ops[i]->_task;
+        if(!task) continue;
+        _clearop(v,ops[i]);
+        sq_pushnull(v);
+        sqstd_scheduler_resume(v,task,-1);
+        sq_pop(v,1);
+    }
+    self->_poller->Update(self);
+    close(self->_fd);
+    self->_fd = -1;
+    return 0;
+}
+
+static SQInteger _socket_port(HSQUIRRELVM v)
+{
+    SETUP_SOCKET(v);
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    SQInteger port = 0;
+    if(getsockname(self->_fd,(struct sockaddr *)&addr,&len) == 0) {
+        if(addr.ss_family == AF_INET) port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+        else if(addr.ss_family == AF_INET6) port = ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+    }
+    sq_pushinteger(v,port);
+    return 1;
+}
+
+static SQInteger _socket__typeof(HSQUIRRELVM v)
+{
+    sq_pushstring(v,_SC("socket"),-1);
+    return 1;
+}
+
+static SQInteger _socket__cloned(HSQUIRRELVM v)
+{
+    return sq_throwerror(v,_SC("this object cannot be cloned"));
+}
+
+#define _DECL_SOCKET_FUNC(name,nparams,typecheck) {_SC(#name),_socket_##name,nparams,typecheck}
+static const SQRegFunction _socket_methods[] = {
+    _DECL_SOCKET_FUNC(accept,1,_SC("x")),
+    _DECL_SOCKET_FUNC(recv,2,_SC("xn")),
+    _DECL_SOCKET_FUNC(recvfrom,2,_SC("xn")),
+    _DECL_SOCKET_FUNC(send,2,_SC("x.")),
+    _DECL_SOCKET_FUNC(sendto,4,_SC("x.sn")),
+    _DECL_SOCKET_FUNC(close,1,_SC("x")),
+    _DECL_SOCKET_FUNC(port,1,_SC("x")),
+    _DECL_SOCKET_FUNC(_typeof,1,_SC("x")),
+    _DECL_SOCKET_FUNC(_cloned,2,_SC("xx")),
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
+#undef _DECL_SOCKET_FUNC
+
+//the poller is bound to the library functions as their only free variable
+#define SETUP_POLLER(v) \
+    SQSocketPoller *poller = NULL; \
+    { SQUserPointer p = NULL; \
+    if(SQ_FAILED(sq_getuserdata(v,-1,&p,NULL))) \
+        return sq_throwerror(v,_SC("invalid poller")); \
+    poller = *((SQSocketPoller **)p); }
+
+//pushes the socket and waits for the connection
+static SQInteger _connect(HSQUIRRELVM v,SQSocketPoller *poller,int fd,int family,int type,const struct sockaddr *addr,socklen_t len)
+{
+    int res;
+    while((res = connect(fd,addr,len)) != 0 && errno == EINTR);
+    if(res != 0 && errno != EINPROGRESS) {
+        close(fd);
+        sq_pushnull(v);
+        return 1;
+    }
+    SQSocket *s = _pushsocket(v,poller,fd,family,type);
+    if(res == 0) return 1;
+    s->_write._kind = SQSTD_OP_CONNECT;
+    sq_getstackobj(v,-1,&s->_write._self);
+    sq_addref(v,&s->_write._self);
+    return _wait(v,s,&s->_write,false);
+}
+
+static SQInteger _socketlib_connect(HSQUIRRELVM v)
+{
+    SETUP_POLLER(v);
+    SQInteger port;
+    struct addrinfo *ai;
+    sq_getinteger(v,3,&port);
+    if(SQ_FAILED(_resolve(v,2,port,AF_UNSPEC,SOCK_STREAM,false,&ai)))
+        return SQ_ERROR;
+    int fd = _newfd(ai->ai_family,SOCK_STREAM);
+    if(fd < 0) {
+        freeaddrinfo(ai);
+        return sq_throwerror(v,_SC("cannot create the socket"));
+    }
+    SQInteger r = _connect(v,poller,fd,ai->ai_family,SOCK_STREAM,ai->ai_addr,(socklen_t)ai->ai_addrlen);
+    freeaddrinfo(ai);
+    return r;
+}
+
+static SQInteger _bind(HSQUIRRELVM v,SQSocketPoller *poller,int type,SQInteger hostidx,SQInteger port,SQInteger backlog)
+{
+    struct addrinfo *ai;
+    if(SQ_FAILED(_resolve(v,hostidx,port,AF_UNSPEC,type,true,&ai)))
+        return SQ_ERROR;
+    int fd = _newfd(ai->ai_family,type);
+    int one = 1;
+    if(fd >= 0) setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+    if(fd < 0 || bind(fd,ai->ai_addr,(socklen_t)ai->ai_addrlen) != 0
+        || (type == SOCK_STREAM && listen(fd,(int)backlog) != 0)) {
+        if(fd >= 0) close(fd);
+        freeaddrinfo(ai);
+        return sq_throwerror(v,_SC("cannot bind the socket"));
+    }
+    _pushsocket(v,poller,fd,ai->ai_family,type);
+    freeaddrinfo(ai);
+    return 1;
+}
+
+static SQInteger _socketlib_listen(HSQUIRRELVM v)
+{
+    SETUP_POLLER(v);
+    SQInteger port, backlog = SOMAXCONN;
+    sq_getinteger(v,3,&port);
+    if(sq_gettop(v) > 4) sq_getinteger(v,4,&backlog);
+    return _bind(v,poller,SOCK_STREAM,2,port,backlog);
+}
+
+static SQInteger _socketlib_udp(HSQUIRRELVM v)
+{
+    SETUP_POLLER(v);
+    if(sq_gettop(v) > 3) {
+        SQInteger port;
+        sq_getinteger(v,3,&port);
+        return _bind(v,poller,SOCK_DGRAM,2,port,0);
+    }
+    int fd = _newfd(AF_INET,SOCK_DGRAM);
+    if(fd < 0)
+        return sq_throwerror(v,_SC("cannot create the socket"));
+    _pushsocket(v,poller,fd,AF_INET,SOCK_DGRAM);
+    return 1;
+}
+
+static SQRESULT _unixaddress(HSQUIRRELVM v,SQInteger idx,struct sockaddr_un *addr)
+{
+    const SQChar *path;
+    sq_getstring(v,idx,&path);
+    memset(addr,0,sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if(!_narrow(path,addr->sun_path,sizeof(addr->sun_path)))
+        return sq_throwerror(v,_SC("path too long"));
+    return SQ_OK;
+}
+
+static SQInteger _socketlib_connectunix(HSQUIRRELVM v)
+{
+    SETUP_POLLER(v);
+    struct sockaddr_un addr;
+    if(SQ_FAILED(_unixaddress(v,2,&addr)))
+        return SQ_ERROR;
+    int fd = _newfd(AF_UNIX,SOCK_STREAM);
+    if(fd < 0)
+        return sq_throwerror(v,_SC("cannot create the socket"));
+    return _connect(v,poller,fd,AF_UNIX,SOCK_STREAM,(struct sockaddr *)&addr,sizeof(addr));
+}
+
+static SQInteger _socketlib_listenunix(HSQUIRRELVM v)
+{
+    SETUP_POLLER(v);
+    struct sockaddr_un addr;
+    SQInteger backlog = SOMAXCONN;
+    if(sq_gettop(v) > 3) sq_getinteger(v,3,&backlog);
+    if(SQ_FAILED(_unixaddress(v,2,&addr)))
+        return SQ_ERROR;
+    int fd = _newfd(AF_UNIX,SOCK_STREAM);
+    if(fd < 0 || bind(fd,(struct sockaddr *)&addr,sizeof(addr)) != 0 || listen(fd,(int)backlog) != 0) {
+        if(fd >= 0) close(fd);
+        return sq_throwerror(v,_SC("cannot bind the socket"));
+    }
+    _pushsocket(v,poller,fd,AF_UNIX,SOCK_STREAM);
+    return 1;
+}
+
+#define _DECL_SOCKETLIB_FUNC(name,nparams,typecheck) {_SC(#name),_socketlib_##name,nparams,typecheck}
+static const SQRegFunction socketlib_funcs[]={
+    _DECL_SOCKETLIB_FUNC(connect,3,_SC(".sn")),
+    _DECL_SOCKETLIB_FUNC(listen,-3,_SC(".s|onn")),
+    _DECL_SOCKETLIB_FUNC(udp,-1,_SC(".s|on")),
+    _DECL_SOCKETLIB_FUNC(connectunix,2,_SC(".s")),
+    _DECL_SOCKETLIB_FUNC(listenunix,-2,_SC(".sn")),
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
+#undef _DECL_SOCKETLIB_FUNC
+
+static SQSocketPoller *_getpoller(HSQUIRRELVM v)
+{
+    SQUserPointer p = NULL;
+    SQSocketPoller *poller = NULL;
+    SQInteger top = sq_gettop(v);
+    sq_pushregistrytable(v);
+    sq_pushstring(v,_SC("std_socketpoller"),-1);
+    if(SQ_SUCCEEDED(sq_rawget(v,-2))
+        && SQ_SUCCEEDED(sq_getuserdata(v,-1,&p,NULL))) {
+        poller = *((SQSocketPoller **)p);
+    }
+    sq_settop(v,top);
+    return poller;
+}
+
+static SQInteger _poller_releasehook(SQUserPointer p,SQInteger SQ_UNUSED_ARG(size))
+{
+    SQSocketPoller *poller = *((SQSocketPoller **)p);
+    poller->Release();
+    return 1;
+}
+
+SQInteger sqstd_socket_poll(HSQUIRRELVM v,SQInteger milliseconds)
+{
+    SQSocketPoller *poller = _getpoller(v);
+    if(!poller)
+        return sq_throwerror(v,_SC("the socket library is not registered"));
+    SQInteger resumed = 0;
+#ifdef SQSTD_EPOLL
+    struct epoll_event evs[SQSTD_SOCKET_MAXEVENTS];
+    int n = epoll_wait(poller->_epfd,evs,SQSTD_SOCKET_MAXEVENTS,(int)milliseconds);
+    for(int i = 0; i < n; i++) {
+        int revents = ((evs[i].events & EPOLLIN) ? POLLIN : 0) | ((evs[i].events & EPOLLOUT) ? POLLOUT : 0)
+            | ((evs[i].events & (EPOLLERR|EPOLLHUP)) ? POLLERR : 0);
+        resumed += _dispatch(v,(SQSocket *)evs[i].data.ptr,revents);
+    }
+#else
+    SQInteger n = poller->_nwaiting;
+    if(n == 0) {
+        poll(NULL,0,(int)milliseconds);
+        return 0;
+    }
+    struct pollfd *fds = (struct pollfd *)sq_malloc(n * sizeof(struct pollfd));
+    SQSocket **socks = (SQSocket **)sq_malloc(n * sizeof(SQSocket *));
+    SQInteger i = 0;
+    for(SQSocket *s = poller->_waiting; s; s = s->_next, i++) {
+        fds[i].fd = s->_fd;
+        fds[i].events = (short)s->_events;
+        fds[i].revents = 0;
+        socks[i] = s;
+    }
+    if(poll(fds,(nfds_t)n,(int)milliseconds) > 0) {
+        for(i = 0; i < n; i++) {
+            if(fds[i].revents) resumed += _dispatch(v,socks[i],fds[i].revents);
+        }
+    }
+    sq_free(socks,n * sizeof(SQSocket *));
+    sq_free(fds,n * sizeof(struct pollfd));
+#endif
+    return resumed;
+}
+
+SQRESULT sqstd_register_socketlib(HSQUIRRELVM v)
+{
+    if(sq_gettype(v,-1) != OT_TABLE)
+        return sq_throwerror(v,_SC("table expected"));
+    if(!_getpoller(v)) {
+        SQSocketPoller *poller = (SQSocketPoller *)sq_malloc(sizeof(SQSocketPoller));
+        poller->Init();
+        sq_pushregistrytable(v);
+        sq_pushstring(v,_SC("std_socketpoller"),-1);
+        SQSocketPoller **p = (SQSocketPoller **)sq_newuserdata(v,sizeof(SQSocketPoller *));
+        *p = poller;
+        sq_setreleasehook(v,-1,_poller_releasehook);
+        sq_rawset(v,-3);
+        sq_pushstring(v,_SC("std_socket"),-1);
+        sq_newclass(v,SQFalse);
+        sq_settypetag(v,-1,(SQUserPointer)SQSTD_SOCKET_TYPE_TAG);
+        SQInteger i = 0;
+        while(_socket_methods[i].name != 0) {
+            const SQRegFunction &f = _socket_methods[i];
+            sq_pushstring(v,f.name,-1);
+            sq_newclosure(v,f.f,0);
+            sq_setparamscheck(v,f.nparamscheck,f.typemask);
+            sq_setnativeclosurename(v,-1,f.name);
+            sq_newslot(v,-3,SQFalse);
+            i++;
+        }
+        sq_rawset(v,-3);
+        sq_pop(v,1);
+    }
+    sq_pushstring(v,_SC("socket"),-1);
+    sq_newtable(v);
+    SQInteger i = 0;
+    while(socketlib_funcs[i].name != 0) {
+        const SQRegFunction &f = socketlib_funcs[i];
+        sq_pushstring(v,f.name,-1);
+        sq_pushregistrytable(v);
+        sq_pushstring(v,_SC("std_socketpoller"),-1);
+        sq_rawget(v,-2);
+        sq_remove(v,-2);
+        sq_newclosure(v,f.f,1);
+        sq_setparamscheck(v,f.nparamscheck,f.typemask);
+        sq_setnativeclosurename(v,-1,f.name);
+        sq_newslot(v,-3,SQFalse);
+        i++;
+    }
+    sq_newslot(v,-3,SQFalse);
+    return SQ_OK;
+}
+
+#else
+
+SQInteger sqstd_socket_poll(HSQUIRRELVM v,SQInteger SQ_UNUSED_ARG(milliseconds))
+{
+    return sq_throwerror(v,_SC("sockets are not supported on this platform"));
+}
+
+SQRESULT sqstd_register_socketlib(HSQUIRRELVM v)
+{
+    return sq_throwerror(v,_SC("sockets are not supported on this platform"));
+}
+
+#endif
@@ -6,9 +6,15 @@
 #include <squirrel.h>
 #include <sqstdio.h>
 #include <sqstdblob.h>
+#include <sqstdstring.h>
 #include "sqstdstream.h"
 #include "sqstdblobimpl.h"
 
+#define SQSTD_STREAMLINES_TYPE_TAG ((SQUnsignedInteger)0x80000400)
+//readn() and writen() convert arrays through the scratchpad this many bytes at a time
+#define SQSTD_STREAM_CHUNK_SIZE (64*1024)
+#define SQSTD_STREAM_MAX_SIZE ((SQInteger)(~(SQUnsignedInteger)0 >> 1))
+
 #define SETUP_STREAM(v) \
     SQStream *self = NULL; \
     if(SQ_FAILED(sq_getinstanceup(v,1,(SQUserPointer*)&self,(SQUserPointer)((SQUnsignedInteger)SQSTD_STREAM_TYPE_TAG)))) \
@@ -19,81 +25,139 @@
 SQInteger _stream_readblob(HSQUIRRELVM v)
 {
     SETUP_STREAM(v);
-    SQUserPointer data,blobp;
+    SQUserPointer blobp;
     SQInteger size,res;
     sq_getinteger(v,2,&size);
     if(size > self->Len()) {
         size = self->Len();
     }
-    data = sq_getscratchpad(v,size);
-    res = self->Read(data,size);
+    //reads straight into the new blob and shrinks it if the stream had less data
+    blobp = sqstd_createblob(v,size > 0 ? size : 0);
+    if(!blobp && size > 0)
+        return sq_throwerror(v,_SC("cannot create blob"));
+    res = size > 0 ? self->Read(blobp,size) : 0;
     if(res <= 0)
         return sq_throwerror(v,_SC("no data left to read"));
-    blobp = sqstd_createblob(v,res);
-    memcpy(blobp,data,res);
+    if(res < size) {
+        SQBlob *blob = NULL;
+        sq_getinstanceup(v,-1,(SQUserPointer*)&blob,0);
+        blob->Resize(res);
+    }
     return 1;
 }
 
-#define SAFE_READN(ptr,len) { \
-    if(self->Read(ptr,len) != len) return sq_throwerror(v,_SC("io error")); \
+SQInteger _stream_formatsize(SQInteger format)
+{
+    switch(format) {
+    case 'l': return sizeof(SQInteger);
+    case 'i': return sizeof(SQInt32);
+    case 's': return sizeof(short);
+    case 'w': return sizeof(unsigned short);
+    case 'c': return sizeof(char);
+    case 'b': return sizeof(unsigned char);
+    case 'f': return sizeof(float);
+    case 'd': return sizeof(double);
+    }
+    return 0;
+}
+
+void _stream_pushnumber(HSQUIRRELVM v,SQInteger format,const void *p)
+{
+    switch(format) {
+    case 'l': { SQInteger i; memcpy(&i, p, sizeof(i)); sq_pushinteger(v, i); } break;
+    case 'i': { SQInt32 i; memcpy(&i, p, sizeof(i)); sq_pushinteger(v, i); } break;
+    case 's': { short s; memcpy(&s, p, sizeof(s)); sq_pushinteger(v, s); } break;
+    case 'w': { unsigned short w; memcpy(&w, p, sizeof(w)); sq_pushinteger(v, w); } break;
+    case 'c': { char c; memcpy(&c, p, sizeof(c)); sq_pushinteger(v, c); } break;
+    case 'b': { unsigned char c; memcpy(&c, p, sizeof(c)); sq_pushinteger(v, c); } break;
+    case 'f': { float f; memcpy(&f, p, sizeof(f)); sq_pushfloat(v, f); } break;
+    case 'd': { double d; memcpy(&d, p, sizeof(d)); sq_pushfloat(v, (SQFloat)d); } break;
+    }
+}
+
+void _stream_getnumber(HSQUIRRELVM v,SQInteger idx,SQInteger format,void *p)
+{
+    SQInteger ti;
+    SQFloat tf;
+    switch(format) {
+    case 'l': { SQInteger i; sq_getinteger(v, idx, &ti); i = ti; memcpy(p, &i, sizeof(i)); } break;
+    case 'i': { SQInt32 i; sq_getinteger(v, idx, &ti); i = (SQInt32)ti; memcpy(p, &i, sizeof(i)); } break;
+    case 's': { short s; sq_getinteger(v, idx, &ti); s = (short)ti; memcpy(p, &s, sizeof(s)); } break;
+    case 'w': { unsigned short w; sq_getinteger(v, idx, &ti); w = (unsigned short)ti; memcpy(p, &w, sizeof(w)); } break;
+    case 'c': { char c; sq_getinteger(v, idx, &ti); c = (char)ti; memcpy(p, &c, sizeof(c)); } break;
+    case 'b': { unsigned char b; sq_getinteger(v, idx, &ti); b = (unsigned char)ti; memcpy(p, &b, sizeof(b)); } break;
+    case 'f': { float f; sq_getfloat(v, idx, &tf); f = (float)tf; memcpy(p, &f, sizeof(f)); } break;
+    case 'd': { double d; sq_getfloat(v, idx, &tf); d = tf; memcpy(p, &d, sizeof(d)); } break;
     }
+}
+
 SQInteger _stream_readn(HSQUIRRELVM v)
 {
     SETUP_STREAM(v);
-    SQInteger format;
+    SQInteger format, size;
     sq_getinteger(v, 2, &format);
-    switch(format) {
-    case 'l': {
-        SQInteger i;
-        SAFE_READN(&i, sizeof(i));
-        sq_pushinteger(v, i);
-              }
-        break;
-    case 'i': {
-        SQInt32 i;
-        SAFE_READN(&i, sizeof(i));
-        sq_pushinteger(v, i);
-              }
-        break;
-    case 's': {
-        short s;
-        SAFE_READN(&s, sizeof(short));
-        sq_pushinteger(v, s);
-              }
-        break;
-    case 'w': {
-        unsigned short w;
-        SAFE_READN(&w, sizeof(unsigned short));
-        sq_pushinteger(v, w);
-              }
-        break;
-    case 'c': {
-        char c;
-        SAFE_READN(&c, sizeof(char));
-        sq_pushinteger(v, c);
-              }
-        break;
-    case 'b': {
-        unsigned char c;
-        SAFE_READN(&c, sizeof(unsigned char));
-        sq_pushinteger(v, c);
-              }
-        break;
-    case 'f': {
-        float f;
-        SAFE_READN(&f, sizeof(float));
-        sq_pushfloat(v, f);
-              }
-        break;
-    case 'd': {
-        double d;
-        SAFE_READN(&d, sizeof(double));
-        sq_pushfloat(v, (SQFloat)d);
-              }
-        break;
-    default:
+    if((size = _stream_formatsize(format)) == 0)
         return sq_throwerror(v, _SC("invalid format"));
+    if(sq_gettop(v) > 2) {
+        //reads the array a chunk at a time with a single Read() per chunk
+        SQInteger count, chunk = SQSTD_STREAM_CHUNK_SIZE / size;
+        sq_getinteger(v, 3, &count);
+        if(count < 0 || count > SQSTD_STREAM_MAX_SIZE / size)
+            return sq_throwerror(v, _SC("invalid count"));
+        sq_newarray(v, 0);
+        while(count > 0) {
+            SQInteger n = count < chunk ? count : chunk;
+            unsigned char *data = (unsigned char *)sq_getscratchpad(v, n * size);
+            SQInteger res = self->Read(data, n * size) / size;
+            for(SQInteger i = 0; i < res; i++) {
+                _stream_pushnumber(v, format, &data[i * size]);
+                sq_arrayappend(v, -2);
+            }
+            if(res < n) break;
+            count -= n;
+        }
+        return 1;
+    }
+    double buf;
+    if(self->Read(&buf, size) != size)
+        return sq_throwerror(v, _SC("io error"));
+    _stream_pushnumber(v, format, &buf);
+    return 1;
+}
+
+//reads a line and pushes it without the line terminator, pushes null at the end of the stream
+static SQRESULT _stream_pushline(HSQUIRRELVM v,SQStream *self)
+{
+    SQInteger len = 0, cap = 256;
+    char *buf = (char *)sq_getscratchpad(v, cap);
+    for(;;) {
+        SQInteger n = self->ReadLine(&buf[len], cap - len);
+        len += n;
+        if(n == 0 || buf[len - 1] == '\n') break;
+        cap *= 2;
+        buf = (char *)sq_getscratchpad(v, cap);
+    }
+    if(len == 0) {
+        sq_pushnull(v);
+        return SQ_OK;
     }
+    if(buf[len - 1] == '\n') len--;
+    if(len > 0 && buf[len - 1] == '\r') len--;
+#ifdef SQUNICODE
+    SQChar *line = (SQChar *)sq_getscratchpad(v, len * sizeof(SQChar));
+    buf = (char *)line;
+    for(SQInteger i = len - 1; i >= 0; i--) line[i] = (unsigned char)buf[i];
+    sq_pushstring(v, line, len);
+#else
+    sq_pushstring(v, buf, len);
+#endif
+    return SQ_OK;
+}
+
+SQInteger _stream_readline(HSQUIRRELVM v)
+{
+    SETUP_STREAM(v);
+    _stream_pushline(v, self);
     return 1;
 }
 
@@ -114,72 +178,135 @@ SQInteger _stream_writeblob(HSQUIRRELVM v)
 SQInteger _stream_writen(HSQUIRRELVM v)
 {
     SETUP_STREAM(v);
-    SQInteger format, ti;
-    SQFloat tf;
+    SQInteger format, size;
     sq_getinteger(v, 3, &format);
-    switch(format) {
-    case 'l': {
-        SQInteger i;
-        sq_getinteger(v, 2, &ti);
-        i = ti;
-        self->Write(&i, sizeof(SQInteger));
-              }
-        break;
-    case 'i': {
-        SQInt32 i;
-        sq_getinteger(v, 2, &ti);
-        i = (SQInt32)ti;
-        self->Write(&i, sizeof(SQInt32));
-              }
-        break;
-    case 's': {
-        short s;
-        sq_getinteger(v, 2, &ti);
-        s = (short)ti;
-        self->Write(&s, sizeof(short));
-              }
-        break;
-    case 'w': {
-        unsigned short w;
-        sq_getinteger(v, 2, &ti);
-        w = (unsigned short)ti;
-        self->Write(&w, sizeof(unsigned short));
-              }
-        break;
-    case 'c': {
-        char c;
-        sq_getinteger(v, 2, &ti);
-        c = (char)ti;
-        self->Write(&c, sizeof(char));
-                  }
-        break;
-    case 'b': {
-        unsigned char b;
-        sq_getinteger(v, 2, &ti);
-        b = (unsigned char)ti;
-        self->Write(&b, sizeof(unsigned char));
-              }
-        break;
-    case 'f': {
-        float f;
-        sq_getfloat(v, 2, &tf);
-        f = (float)tf;
-        self->Write(&f, sizeof(float));
-              }
-        break;
-    case 'd': {
-        double d;
-        sq_getfloat(v, 2, &tf);
-        d = tf;
-        self->Write(&d, sizeof(double));
-              }
-        break;
-    default:
+    if((size = _stream_formatsize(format)) == 0)
         return sq_throwerror(v, _SC("invalid format"));
+    if(sq_gettype(v, 2) == OT_ARRAY) {
+        //converts the array a chunk at a time and writes each chunk with a single Write()
+        SQInteger count = sq_getsize(v, 2), chunk = SQSTD_STREAM_CHUNK_SIZE / size;
+        for(SQInteger base = 0; base < count; base += chunk) {
+            SQInteger n = count - base < chunk ? count - base : chunk;
+            unsigned char *data = (unsigned char *)sq_getscratchpad(v, n * size);
+            for(SQInteger i = 0; i < n; i++) {
+                sq_pushinteger(v, base + i);
+                sq_rawget(v, 2);
+                if(!(sq_gettype(v, -1) & SQOBJECT_NUMERIC))
+                    return sq_throwerror(v, _SC("the array must contain only numbers"));
+                _stream_getnumber(v, -1, format, &data[i * size]);
+                sq_pop(v, 1);
+            }
+            if(self->Write(data, n * size) != n * size)
+                return sq_throwerror(v, _SC("io error"));
+        }
+        return 0;
     }
+    double buf;
+    _stream_getnumber(v, 2, format, &buf);
+    if(self->Write(&buf, size) != size)
+        return sq_throwerror(v, _SC("io error"));
     return 0;
 }
 
+SQInteger _stream_writeline(HSQUIRRELVM v)
+{
+    SETUP_STREAM(v);
+    const SQChar *str;
+    SQInteger len = sq_getsize(v, 2);
+    sq_getstring(v, 2, &str);
+    char *buf = (char *)sq_getscratchpad(v, len + 1);
+#ifdef SQUNICODE
+    for(SQInteger i = 0; i < len; i++) buf[i] = (char)str[i];
+#else
+    memcpy(buf, str, len);
+#endif
+    buf[len] = '\n';
+    if(self->Write(buf, len + 1) != len + 1)
+        return sq_throwerror(v, _SC("io error"));
+    return 0;
+}
+
+//formats straight into the scratchpad and writes it, no string is created
+SQInteger _stream_writef(HSQUIRRELVM v)
+{
+    SETUP_STREAM(v);
+    SQChar *dest;
+    SQInteger len;
+    if(SQ_FAILED(sqstd_format(v, 2, &len, &dest)))
+        return SQ_ERROR;
+#ifdef SQUNICODE
+    char *buf = (char *)dest;
+    for(SQInteger i = 0; i < len; i++) buf[i] = (char)dest[i];
+#else
+    char *buf = dest;
+#endif
+    if(self->Write(buf, len) != len)
+        return sq_throwerror(v, _SC("io error"));
+    return 0;
+}
+
+//iterator returned by lines(), keeps the stream and the last line in two member variables
+struct SQStreamLines {
+    HSQMEMBERHANDLE stream;
+    HSQMEMBERHANDLE line;
+};
+
+static SQInteger _lines_releasehook(SQUserPointer p, SQInteger SQ_UNUSED_ARG(size))
+{
+    sq_free(p,sizeof(SQStreamLines));
+    return 1;
+}
+
+static SQInteger _lines__nexti(HSQUIRRELVM v)
+{
+    SQStreamLines *self = NULL;
+    SQStream *stream = NULL;
+    if(SQ_FAILED(sq_getinstanceup(v,1,(SQUserPointer*)&self,(SQUserPointer)SQSTD_STREAMLINES_TYPE_TAG)) || !self)
+        return sq_throwerror(v,_SC("invalid line iterator"));
+    sq_getbyhandle(v,1,&self->stream);
+    if(SQ_FAILED(sq_getinstanceup(v,-1,(SQUserPointer*)&stream,(SQUserPointer)((SQUnsignedInteger)SQSTD_STREAM_TYPE_TAG)))
+        || !stream || !stream->IsValid())
+        return sq_throwerror(v,_SC("the stream is invalid"));
+    _stream_pushline(v,stream);
+    if(sq_gettype(v,-1) == OT_NULL)
+        return 1;
+    sq_setbyhandle(v,1,&self->line);
+    SQInteger idx = -1;
+    if(sq_gettype(v,2) == OT_INTEGER)
+        sq_getinteger(v,2,&idx);
+    sq_pushinteger(v,idx + 1);
+    return 1;
+}
+
+static SQInteger _lines__get(HSQUIRRELVM v)
+{
+    SQStreamLines *self = NULL;
+    if(SQ_FAILED(sq_getinstanceup(v,1,(SQUserPointer*)&self,(SQUserPointer)SQSTD_STREAMLINES_TYPE_TAG)) || !self)
+        return sq_throwerror(v,_SC("invalid line iterator"));
+    sq_getbyhandle(v,1,&self->line);
+    return 1;
+}
+
+SQInteger _stream_lines(HSQUIRRELVM v)
+{
+    SETUP_STREAM(v);
+    sq_pushregistrytable(v);
+    sq_pushstring(v,_SC("std_stream_lines"),-1);
+    if(SQ_FAILED(sq_rawget(v,-2)))
+        return sq_throwerror(v,_SC("the stream library is not initialized"));
+    SQStreamLines *lines = (SQStreamLines *)sq_malloc(sizeof(SQStreamLines));
+    sq_pushstring(v,_SC("_stream"),-1);
+    sq_getmemberhandle(v,-2,&lines->stream);
+    sq_pushstring(v,_SC("_line"),-1);
+    sq_getmemberhandle(v,-2,&lines->line);
+    sq_createinstance(v,-1);
+    sq_setinstanceup(v,-1,lines);
+    sq_setreleasehook(v,-1,_lines_releasehook);
+    sq_push(v,1);
+    sq_setbyhandle(v,-2,&lines->stream);
+    return 1;
+}
+
 SQInteger _stream_seek(HSQUIRRELVM v)
 {
     SETUP_STREAM(v);
@@ -233,6 +360,32 @@ SQInteger _stream_eos(HSQUIRRELVM v)
     return 1;
 }
 
+static SQInteger _stream_writefunc(SQUserPointer up,SQUserPointer data,SQInteger size)
+{
+    return ((SQStream *)up)->Write(data,size);
+}
+
+static SQInteger _stream_readfunc(SQUserPointer up,SQUserPointer data,SQInteger size)
+{
+    return ((SQStream *)up)->Read(data,size);
+}
+
+SQInteger _stream_writeobject(HSQUIRRELVM v)
+{
+    SETUP_STREAM(v);
+    if(SQ_FAILED(sq_writeobject(v,2,sq_gettop(v) > 2 ? 3 : 0,_stream_writefunc,self)))
+        return SQ_ERROR;
+    return 0;
+}
+
+SQInteger _stream_readobject(HSQUIRRELVM v)
+{
+    SETUP_STREAM(v);
+    if(SQ_FAILED(sq_readobject(v,sq_gettop(v) > 1 ? 2 : 0,_stream_readfunc,self)))
+        return SQ_ERROR;
+    return 1;
+}
+
  SQInteger _stream__cloned(HSQUIRRELVM v)
  {
      return sq_throwerror(v,_SC("this object cannot be cloned"));
@@ -240,9 +393,15 @@ SQInteger _stream_eos(HSQUIRRELVM v)
 
 static const SQRegFunction _stream_methods[] = {
     _DECL_STREAM_FUNC(readblob,2,_SC("xn")),
-    _DECL_STREAM_FUNC(readn,2,_SC("xn")),
+    _DECL_STREAM_FUNC(readn,-2,_SC("xnn")),
+    _DECL_STREAM_FUNC(readline,1,_SC("x")),
+    _DECL_STREAM_FUNC(lines,1,_SC("x")),
     _DECL_STREAM_FUNC(writeblob,-2,_SC("xx")),
-    _DECL_STREAM_FUNC(writen,3,_SC("xnn")),
+    _DECL_STREAM_FUNC(writen,3,_SC("xn|an")),
+    _DECL_STREAM_FUNC(writeline,2,_SC("xs")),
+    _DECL_STREAM_FUNC(writef,-2,_SC("xs")),
+    _DECL_STREAM_FUNC(readobject,-1,_SC("xt")),
+    _DECL_STREAM_FUNC(writeobject,-2,_SC("x.t")),
     _DECL_STREAM_FUNC(seek,-2,_SC("xnn")),
     _DECL_STREAM_FUNC(tell,1,_SC("x")),
     _DECL_STREAM_FUNC(len,1,_SC("x")),
@@ -270,6 +429,24 @@ void init_streamclass(HSQUIRRELVM v)
             i++;
         }
         sq_newslot(v,-3,SQFalse);
+        sq_pushstring(v,_SC("std_stream_lines"),-1);
+        sq_newclass(v,SQFalse);
+        sq_settypetag(v,-1,(SQUserPointer)SQSTD_STREAMLINES_TYPE_TAG);
+        sq_pushstring(v,_SC("_stream"),-1);
+        sq_pushnull(v);
+        sq_newslot(v,-3,SQFalse);
+        sq_pushstring(v,_SC("_line"),-1);
+        sq_pushnull(v);
+        sq_newslot(v,-3,SQFalse);
+        sq_pushstring(v,_SC("_nexti"),-1);
+        sq_newclosure(v,_lines__nexti,0);
+        sq_setparamscheck(v,2,_SC("x"));
+        sq_newslot(v,-3,SQFalse);
+        sq_pushstring(v,_SC("_get"),-1);
+        sq_newclosure(v,_lines__get,0);
+        sq_setparamscheck(v,2,_SC("x"));
+        sq_newslot(v,-3,SQFalse);
+        sq_newslot(v,-3,SQFalse);
         sq_pushroottable(v);
         sq_pushstring(v,_SC("stream"),-1);
         sq_pushstring(v,_SC("std_stream"),-1);
@@ -284,6 +461,11 @@ void init_streamclass(HSQUIRRELVM v)
 }
 
 SQRESULT declare_stream(HSQUIRRELVM v,const SQChar* name,SQUserPointer typetag,const SQChar* reg_name,const SQRegFunction *methods,const SQRegFunction *globals)
+{
+    return declare_streamex(v,name,typetag,reg_name,_SC("std_stream"),methods,globals);
+}
+
+SQRESULT declare_streamex(HSQUIRRELVM v,const SQChar* name,SQUserPointer typetag,const SQChar* reg_name,const SQChar* base_reg_name,const SQRegFunction *methods,const SQRegFunction *globals)
 {
     if(sq_gettype(v,-1) != OT_TABLE)
         return sq_throwerror(v,_SC("table expected"));
@@ -292,7 +474,7 @@ SQRESULT declare_stream(HSQUIRRELVM v,const SQChar* name,SQUserPointer typetag,c
     init_streamclass(v);
     sq_pushregistrytable(v);
     sq_pushstring(v,reg_name,-1);
-    sq_pushstring(v,_SC("std_stream"),-1);
+    sq_pushstring(v,base_reg_name,-1);
     if(SQ_SUCCEEDED(sq_get(v,-3))) {
         sq_newclass(v,SQTrue);
         sq_settypetag(v,-1,typetag);
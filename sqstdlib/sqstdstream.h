@@ -2,11 +2,19 @@
 #ifndef _SQSTD_STREAM_H_
 #define _SQSTD_STREAM_H_
 
+SQInteger _stream_formatsize(SQInteger format);
+void _stream_pushnumber(HSQUIRRELVM v,SQInteger format,const void *p);
+void _stream_getnumber(HSQUIRRELVM v,SQInteger idx,SQInteger format,void *p);
 SQInteger _stream_readblob(HSQUIRRELVM v);
 SQInteger _stream_readline(HSQUIRRELVM v);
 SQInteger _stream_readn(HSQUIRRELVM v);
 SQInteger _stream_writeblob(HSQUIRRELVM v);
 SQInteger _stream_writen(HSQUIRRELVM v);
+SQInteger _stream_writeline(HSQUIRRELVM v);
+SQInteger _stream_writef(HSQUIRRELVM v);
+SQInteger _stream_lines(HSQUIRRELVM v);
+SQInteger _stream_readobject(HSQUIRRELVM v);
+SQInteger _stream_writeobject(HSQUIRRELVM v);
 SQInteger _stream_seek(HSQUIRRELVM v);
 SQInteger _stream_tell(HSQUIRRELVM v);
 SQInteger _stream_len(HSQUIRRELVM v);
@@ -15,4 +23,5 @@ SQInteger _stream_flush(HSQUIRRELVM v);
 
 #define _DECL_STREAM_FUNC(name,nparams,typecheck) {_SC(#name),_stream_##name,nparams,typecheck}
 SQRESULT declare_stream(HSQUIRRELVM v,const SQChar* name,SQUserPointer typetag,const SQChar* reg_name,const SQRegFunction *methods,const SQRegFunction *globals);
+SQRESULT declare_streamex(HSQUIRRELVM v,const SQChar* name,SQUserPointer typetag,const SQChar* reg_name,const SQChar* base_reg_name,const SQRegFunction *methods,const SQRegFunction *globals);
 #endif /*_SQSTD_STREAM_H_*/
@@ -7,11 +7,20 @@
 #include <ctype.h>
 #include <assert.h>
 #include <stdarg.h>
+#include <math.h>
 
 #define MAX_FORMAT_LEN  20
 #define MAX_WFORMAT_LEN 3
 #define ADDITIONAL_FORMAT_SPACE (100*sizeof(SQChar))
 
+#define FMT_LEFT  1
+#define FMT_PLUS  2
+#define FMT_SPACE 4
+#define FMT_ALT   8
+#define FMT_ZERO  16
+
+#define SQSTD_FORMAT_CACHE_SIZE 256
+
 static SQBool isfmtchr(SQChar ch)
 {
     switch(ch) {
@@ -20,140 +29,363 @@ static SQBool isfmtchr(SQChar ch)
     return SQFalse;
 }
 
-static SQInteger validate_format(HSQUIRRELVM v, SQChar *fmt, const SQChar *src, SQInteger n,SQInteger &width)
+//a piece of a compiled format string: some text followed by a conversion
+struct SQFormatOp
+{
+    SQInteger _start, _len; //the text, as a position in the format string
+    SQChar _conv; //conversion character, 0 if there is only text
+    SQInteger _flags;
+    SQInteger _width;
+    SQInteger _precision; //-1 if not specified
+    SQChar _fmt[MAX_FORMAT_LEN + 4]; //printf format, used for the floats that are not converted directly
+};
+
+//format strings are compiled once and cached in the registry, keyed by the format string
+struct SQFormat
+{
+    SQInteger _nops;
+    SQFormatOp _ops[1];
+};
+
+static SQInteger _format_number(HSQUIRRELVM v, const SQChar *src, SQInteger &n, const SQChar *toolong)
 {
-    SQChar *dummy;
-    SQChar swidth[MAX_WFORMAT_LEN];
-    SQInteger wc = 0;
-    SQInteger start = n;
-    fmt[0] = '%';
-    while (isfmtchr(src[n])) n++;
+    SQInteger val = 0, wc = 0;
     while (scisdigit(src[n])) {
-        swidth[wc] = src[n];
+        val = val * 10 + (src[n] - '0');
         n++;
         wc++;
         if(wc>=MAX_WFORMAT_LEN)
-            return sq_throwerror(v,_SC("width format too long"));
+            return sq_throwerror(v,toolong);
     }
-    swidth[wc] = '\0';
-    if(wc > 0) {
-        width = scstrtol(swidth,&dummy,10);
-    }
-    else
-        width = 0;
-    if (src[n] == '.') {
-        n++;
+    return val;
+}
 
-        wc = 0;
-        while (scisdigit(src[n])) {
-            swidth[wc] = src[n];
+static SQFormat *_format_compile(HSQUIRRELVM v, const SQChar *format, SQInteger format_size)
+{
+    SQInteger maxops = 1;
+    for(SQInteger n = 0; n < format_size; n++)
+        if(format[n] == '%') maxops++;
+    SQFormat *f = (SQFormat *)sq_newuserdata(v, sizeof(SQFormat) + (maxops - 1) * sizeof(SQFormatOp));
+    SQFormatOp *op = f->_ops;
+    SQInteger n = 0, start = 0;
+    f->_nops = 0;
+    while(n < format_size) {
+        if(format[n] != '%') {
             n++;
-            wc++;
-            if(wc>=MAX_WFORMAT_LEN)
-                return sq_throwerror(v,_SC("precision format too long"));
+            continue;
+        }
+        op->_start = start;
+        if(format[n+1] == '%') { //handles %%, the text ends with the first one
+            op->_len = n + 1 - start;
+            op->_conv = 0;
+            n += 2;
+        }
+        else {
+            op->_len = n - start;
+            SQInteger fstart = ++n;
+            op->_flags = 0;
+            while (isfmtchr(format[n])) {
+                switch(format[n]) {
+                case '-': op->_flags |= FMT_LEFT; break;
+                case '+': op->_flags |= FMT_PLUS; break;
+                case ' ': op->_flags |= FMT_SPACE; break;
+                case '#': op->_flags |= FMT_ALT; break;
+                case '0': op->_flags |= FMT_ZERO; break;
+                }
+                n++;
+            }
+            if((op->_width = _format_number(v, format, n, _SC("width format too long"))) < 0)
+                return NULL;
+            op->_precision = -1;
+            if (format[n] == '.') {
+                n++;
+                if((op->_precision = _format_number(v, format, n, _SC("precision format too long"))) < 0)
+                    return NULL;
+            }
+            if (n-fstart > MAX_FORMAT_LEN ) {
+                sq_throwerror(v,_SC("format too long"));
+                return NULL;
+            }
+            switch(format[n]) {
+            case 's': case 'c':
+            case 'i': case 'd': case 'o': case 'u': case 'x': case 'X':
+            case 'f': case 'g': case 'G': case 'e': case 'E':
+                break;
+            default:
+                sq_throwerror(v,_SC("invalid format"));
+                return NULL;
+            }
+            op->_conv = format[n];
+            op->_fmt[0] = '%';
+            memcpy(&op->_fmt[1],&format[fstart],((n-fstart)+1)*sizeof(SQChar));
+            op->_fmt[(n-fstart)+2] = '\0';
+            n++;
+        }
+        start = n;
+        op++;
+        f->_nops++;
+    }
+    if(start < format_size) {
+        op->_start = start;
+        op->_len = format_size - start;
+        op->_conv = 0;
+        f->_nops++;
+    }
+    return f;
+}
+
+//pushes the table of the compiled format strings
+static void _format_pushcache(HSQUIRRELVM v)
+{
+    sq_pushregistrytable(v);
+    sq_pushstring(v,_SC("std_formatcache"),-1);
+    if(SQ_FAILED(sq_rawget(v,-2))) {
+        sq_newtable(v);
+        sq_pushstring(v,_SC("std_formatcache"),-1);
+        sq_push(v,-2);
+        sq_rawset(v,-4);
+    }
+    sq_remove(v,-2);
+}
+
+//returns the compiled format string at idx, cacheidx is the table of the compiled format strings
+static SQFormat *_format_get(HSQUIRRELVM v, SQInteger idx, SQInteger cacheidx)
+{
+    SQUserPointer p = NULL;
+    SQInteger top = sq_gettop(v);
+    sq_push(v,cacheidx);
+    sq_push(v,idx);
+    if(SQ_SUCCEEDED(sq_rawget(v,-2))) {
+        sq_getuserdata(v,-1,&p,NULL);
+        sq_settop(v,top);
+        return (SQFormat *)p;
+    }
+    const SQChar *format;
+    sq_getstring(v,idx,&format);
+    if(sq_getsize(v,-1) >= SQSTD_FORMAT_CACHE_SIZE)
+        sq_clear(v,-1);
+    sq_push(v,idx);
+    SQFormat *f = _format_compile(v,format,sq_getsize(v,idx));
+    if(f) sq_rawset(v,-3);
+    sq_settop(v,top);
+    return f;
+}
+
+//output in the scratchpad
+struct SQFormatOut
+{
+    SQFormatOut(HSQUIRRELVM v, SQInteger size) {
+        _v = v;
+        _len = 0;
+        _allocated = size + 1;
+        _buf = sq_getscratchpad(v,_allocated*sizeof(SQChar));
+    }
+    SQChar *Reserve(SQInteger n) {
+        if(_len + n + 1 > _allocated) {
+            _allocated = (_len + n + 1) * 2;
+            _buf = sq_getscratchpad(_v,_allocated*sizeof(SQChar));
         }
-        swidth[wc] = '\0';
-        if(wc > 0) {
-            width += scstrtol(swidth,&dummy,10);
+        return &_buf[_len];
+    }
+    void Append(const SQChar *s, SQInteger n) {
+        memcpy(Reserve(n),s,n*sizeof(SQChar));
+        _len += n;
+    }
+    void Fill(SQChar c, SQInteger n) {
+        SQChar *dest = Reserve(n);
+        for(SQInteger i = 0; i < n; i++) dest[i] = c;
+        _len += n;
+    }
+    HSQUIRRELVM _v;
+    SQChar *_buf;
+    SQInteger _len;
+    SQInteger _allocated;
+};
+
+//writes the sign or prefix, the digits and the padding required by the width
+static void _format_padded(SQFormatOut &out, const SQFormatOp &op, const SQChar *prefix, SQInteger prefixlen,
+    SQInteger zeros, const SQChar *digits, SQInteger ndigits, bool zeropad)
+{
+    SQInteger pad = op._width - (prefixlen + zeros + ndigits);
+    if(pad > 0 && zeropad && !(op._flags & FMT_LEFT)) {
+        zeros += pad;
+        pad = 0;
+    }
+    if(pad > 0 && !(op._flags & FMT_LEFT)) out.Fill(' ',pad);
+    out.Append(prefix,prefixlen);
+    out.Fill('0',zeros);
+    out.Append(digits,ndigits);
+    if(pad > 0 && (op._flags & FMT_LEFT)) out.Fill(' ',pad);
+}
+
+static SQInteger _format_sign(const SQFormatOp &op, bool neg, SQChar *prefix)
+{
+    if(neg) prefix[0] = '-';
+    else if(op._flags & FMT_PLUS) prefix[0] = '+';
+    else if(op._flags & FMT_SPACE) prefix[0] = ' ';
+    else return 0;
+    return 1;
+}
 
+static void _format_integer(SQFormatOut &out, const SQFormatOp &op, SQInteger val)
+{
+    SQChar buf[sizeof(SQInteger) * 3 + 2], prefix[2];
+    SQInteger prefixlen = 0, base = 10, pos = sizeof(buf)/sizeof(SQChar);
+    const char *digits = "0123456789abcdef";
+    SQUnsignedInteger u = (SQUnsignedInteger)val;
+    switch(op._conv) {
+    case 'd': case 'i':
+        if(val < 0) u = 0 - u;
+        prefixlen = _format_sign(op,val < 0,prefix);
+        break;
+    case 'o': base = 8; break;
+    case 'x': case 'X':
+        base = 16;
+        if(op._conv == 'X') digits = "0123456789ABCDEF";
+        if((op._flags & FMT_ALT) && u != 0) {
+            prefix[0] = '0';
+            prefix[1] = op._conv;
+            prefixlen = 2;
         }
+        break;
+    }
+    while(u != 0) {
+        buf[--pos] = digits[u % base];
+        u /= base;
     }
-    if (n-start > MAX_FORMAT_LEN )
-        return sq_throwerror(v,_SC("format too long"));
-    memcpy(&fmt[1],&src[start],((n-start)+1)*sizeof(SQChar));
-    fmt[(n-start)+2] = '\0';
-    return n;
+    SQInteger ndigits = sizeof(buf)/sizeof(SQChar) - pos;
+    SQInteger mindigits = op._precision >= 0 ? op._precision : 1;
+    SQInteger zeros = mindigits > ndigits ? mindigits - ndigits : 0;
+    if(op._conv == 'o' && (op._flags & FMT_ALT) && zeros == 0 && (ndigits == 0 || buf[pos] != '0'))
+        zeros = 1;
+    _format_padded(out,op,prefix,prefixlen,zeros,&buf[pos],ndigits,(op._flags & FMT_ZERO) && op._precision < 0);
 }
 
-SQRESULT sqstd_format(HSQUIRRELVM v,SQInteger nformatstringidx,SQInteger *outlen,SQChar **output)
+static const double _format_pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+
+//converts %f directly when the value is exactly rounded with integer arithmetic
+static bool _format_fixed(SQFormatOut &out, const SQFormatOp &op, SQFloat val)
+{
+    SQInteger prec = op._precision >= 0 ? op._precision : 6;
+    if(prec > 9 || (op._flags & FMT_ALT)) return false;
+    double x = (double)val;
+    bool neg = signbit(x) != 0;
+    double scaled = fabs(x) * _format_pow10[prec];
+    const double limit = sizeof(SQUnsignedInteger) >= 8 ? 4503599627370496.0 : 2147483648.0;
+    if(!(scaled < limit)) return false; //also rejects nan and inf
+    double ip = floor(scaled), frac = scaled - ip;
+    //the multiplication is rounded; close to a tie the rounding of the exact value is unknown
+    if(fabs(frac - 0.5) <= scaled * 4.5e-16) return false;
+    SQUnsignedInteger u = (SQUnsignedInteger)ip + (frac > 0.5 ? 1 : 0);
+    SQChar buf[32], prefix[1];
+    SQInteger pos = 32;
+    for(SQInteger i = 0; i < prec; i++) {
+        buf[--pos] = (SQChar)('0' + u % 10);
+        u /= 10;
+    }
+    if(prec > 0) buf[--pos] = '.';
+    do {
+        buf[--pos] = (SQChar)('0' + u % 10);
+        u /= 10;
+    } while(u != 0);
+    _format_padded(out,op,prefix,_format_sign(op,neg,prefix),0,&buf[pos],32 - pos,(op._flags & FMT_ZERO) != 0);
+    return true;
+}
+
+static SQRESULT _format_float(SQFormatOut &out, const SQFormatOp &op, SQFloat val)
+{
+    if(op._conv == 'f' && _format_fixed(out,op,val))
+        return SQ_OK;
+    SQInteger size = ADDITIONAL_FORMAT_SPACE + op._width + op._precision;
+    for(;;) {
+        SQChar *dest = out.Reserve(size);
+        SQInteger r = scsprintf(dest,size,op._fmt,val);
+        if(r >= 0 && r < size) {
+            out._len += r;
+            return SQ_OK;
+        }
+        if(size > 4096)
+            return sq_throwerror(out._v,_SC("format error"));
+        size = r > 0 ? r + 1 : size * 2;
+    }
+}
+
+//formats with the parameters up to top, the result is in the scratchpad
+static SQRESULT _format(HSQUIRRELVM v,SQInteger nformatstringidx,SQInteger top,SQInteger cacheidx,SQInteger *outlen,SQChar **output)
 {
     const SQChar *format;
-    SQChar *dest;
-    SQChar fmt[MAX_FORMAT_LEN];
     const SQRESULT res = sq_getstring(v,nformatstringidx,&format);
     if (SQ_FAILED(res)) {
         return res; // propagate the error
     }
-    SQInteger format_size = sq_getsize(v,nformatstringidx);
-    SQInteger allocated = (format_size+2)*sizeof(SQChar);
-    dest = sq_getscratchpad(v,allocated);
-    SQInteger n = 0,i = 0, nparam = nformatstringidx+1, w = 0;
-    //while(format[n] != '\0')
-    while(n < format_size)
-    {
-        if(format[n] != '%') {
-            assert(i < allocated);
-            dest[i++] = format[n];
-            n++;
-        }
-        else if(format[n+1] == '%') { //handles %%
-                dest[i++] = '%';
-                n += 2;
-        }
-        else {
-            n++;
-            if( nparam > sq_gettop(v) )
-                return sq_throwerror(v,_SC("not enough parameters for the given format string"));
-            n = validate_format(v,fmt,format,n,w);
-            if(n < 0) return -1;
-            SQInteger addlen = 0;
-            SQInteger valtype = 0;
-            const SQChar *ts = NULL;
-            SQInteger ti = 0;
-            SQFloat tf = 0;
-            switch(format[n]) {
-            case 's':
-                if(SQ_FAILED(sq_getstring(v,nparam,&ts)))
-                    return sq_throwerror(v,_SC("string expected for the specified format"));
-                addlen = (sq_getsize(v,nparam)*sizeof(SQChar))+((w+1)*sizeof(SQChar));
-                valtype = 's';
-                break;
-            case 'i': case 'd': case 'o': case 'u':  case 'x':  case 'X':
-#ifdef _SQ64
-                {
-                size_t flen = scstrlen(fmt);
-                SQInteger fpos = flen - 1;
-                SQChar f = fmt[fpos];
-                const SQChar *prec = (const SQChar *)_PRINT_INT_PREC;
-                while(*prec != _SC('\0')) {
-                    fmt[fpos++] = *prec++;
-                }
-                fmt[fpos++] = f;
-                fmt[fpos++] = _SC('\0');
-                }
+    SQFormat *f = _format_get(v,nformatstringidx,cacheidx);
+    if(!f) return SQ_ERROR;
+    SQFormatOut out(v,sq_getsize(v,nformatstringidx));
+    SQInteger nparam = nformatstringidx+1;
+    for(SQInteger o = 0; o < f->_nops; o++) {
+        const SQFormatOp &op = f->_ops[o];
+        out.Append(&format[op._start],op._len);
+        if(!op._conv) continue;
+        if( nparam > top )
+            return sq_throwerror(v,_SC("not enough parameters for the given format string"));
+        switch(op._conv) {
+        case 's': {
+            const SQChar *ts;
+            if(SQ_FAILED(sq_getstring(v,nparam,&ts)))
+                return sq_throwerror(v,_SC("string expected for the specified format"));
+            //like printf the string ends at the first '\0'
+            SQInteger len = 0, maxlen = sq_getsize(v,nparam);
+            if(op._precision >= 0 && op._precision < maxlen) maxlen = op._precision;
+            while(len < maxlen && ts[len]) len++;
+            _format_padded(out,op,_SC(""),0,0,ts,len,false);
+            }
+            break;
+        case 'c': {
+            SQInteger ti;
+            if(SQ_FAILED(sq_getinteger(v,nparam,&ti)))
+                return sq_throwerror(v,_SC("integer expected for the specified format"));
+#ifdef SQUNICODE
+            SQChar c = (SQChar)ti;
+#else
+            SQChar c = (SQChar)(unsigned char)ti;
 #endif
-            case 'c':
-                if(SQ_FAILED(sq_getinteger(v,nparam,&ti)))
-                    return sq_throwerror(v,_SC("integer expected for the specified format"));
-                addlen = (ADDITIONAL_FORMAT_SPACE)+((w+1)*sizeof(SQChar));
-                valtype = 'i';
-                break;
-            case 'f': case 'g': case 'G': case 'e':  case 'E':
-                if(SQ_FAILED(sq_getfloat(v,nparam,&tf)))
-                    return sq_throwerror(v,_SC("float expected for the specified format"));
-                addlen = (ADDITIONAL_FORMAT_SPACE)+((w+1)*sizeof(SQChar));
-                valtype = 'f';
-                break;
-            default:
-                return sq_throwerror(v,_SC("invalid format"));
+            _format_padded(out,op,_SC(""),0,0,&c,1,false);
             }
-            n++;
-            allocated += addlen + sizeof(SQChar);
-            dest = sq_getscratchpad(v,allocated);
-            switch(valtype) {
-            case 's': i += scsprintf(&dest[i],allocated,fmt,ts); break;
-            case 'i': i += scsprintf(&dest[i],allocated,fmt,ti); break;
-            case 'f': i += scsprintf(&dest[i],allocated,fmt,tf); break;
-            };
-            nparam ++;
+            break;
+        case 'i': case 'd': case 'o': case 'u': case 'x': case 'X': {
+            SQInteger ti;
+            if(SQ_FAILED(sq_getinteger(v,nparam,&ti)))
+                return sq_throwerror(v,_SC("integer expected for the specified format"));
+            _format_integer(out,op,ti);
+            }
+            break;
+        default: {
+            SQFloat tf;
+            if(SQ_FAILED(sq_getfloat(v,nparam,&tf)))
+                return sq_throwerror(v,_SC("float expected for the specified format"));
+            if(SQ_FAILED(_format_float(out,op,tf)))
+                return SQ_ERROR;
+            }
+            break;
         }
+        nparam ++;
     }
-    *outlen = i;
-    dest[i] = '\0';
-    *output = dest;
+    *outlen = out._len;
+    out._buf[out._len] = '\0';
+    *output = out._buf;
     return SQ_OK;
 }
 
+SQRESULT sqstd_format(HSQUIRRELVM v,SQInteger nformatstringidx,SQInteger *outlen,SQChar **output)
+{
+    SQInteger top = sq_gettop(v);
+    if(nformatstringidx < 0) nformatstringidx += top + 1;
+    _format_pushcache(v);
+    SQRESULT r = _format(v,nformatstringidx,top,top + 1,outlen,output);
+    sq_settop(v,top);
+    return r;
+}
+
 void sqstd_pushstringf(HSQUIRRELVM v,const SQChar *s,...)
 {
     SQInteger n=256;
@@ -173,11 +405,12 @@ begin:
     }
 }
 
+//format() and printf() have the table of the compiled format strings as free variable
 static SQInteger _string_printf(HSQUIRRELVM v)
 {
     SQChar *dest = NULL;
-    SQInteger length = 0;
-    if(SQ_FAILED(sqstd_format(v,2,&length,&dest)))
+    SQInteger length = 0, top = sq_gettop(v);
+    if(SQ_FAILED(_format(v,2,top - 1,top,&length,&dest)))
         return -1;
 
     SQPRINTFUNCTION printfunc = sq_getprintfunc(v);
@@ -189,8 +422,8 @@ static SQInteger _string_printf(HSQUIRRELVM v)
 static SQInteger _string_format(HSQUIRRELVM v)
 {
     SQChar *dest = NULL;
-    SQInteger length = 0;
-    if(SQ_FAILED(sqstd_format(v,2,&length,&dest)))
+    SQInteger length = 0, top = sq_gettop(v);
+    if(SQ_FAILED(_format(v,2,top - 1,top,&length,&dest)))
         return -1;
     sq_pushstring(v,dest,length);
     return 1;
@@ -221,7 +454,8 @@ static SQInteger _string_strip(HSQUIRRELVM v)
     SQInteger len = sq_getsize(v,2);
     __strip_l(str,&start);
     __strip_r(str,len,&end);
-    sq_pushstring(v,start,end - start);
+    if(end - start == len) sq_push(v,2); //nothing to strip
+    else sq_pushstring(v,start,end - start);
     return 1;
 }
 
@@ -229,8 +463,10 @@ static SQInteger _string_lstrip(HSQUIRRELVM v)
 {
     const SQChar *str,*start;
     sq_getstring(v,2,&str);
+    SQInteger len = sq_getsize(v,2);
     __strip_l(str,&start);
-    sq_pushstring(v,start,-1);
+    if(start == str) sq_push(v,2);
+    else sq_pushstring(v,start,len - (start - str));
     return 1;
 }
 
@@ -240,43 +476,61 @@ static SQInteger _string_rstrip(HSQUIRRELVM v)
     sq_getstring(v,2,&str);
     SQInteger len = sq_getsize(v,2);
     __strip_r(str,len,&end);
-    sq_pushstring(v,str,end - str);
+    if(end - str == len) sq_push(v,2);
+    else sq_pushstring(v,str,end - str);
     return 1;
 }
 
+static SQUnsignedInteger _charcode(SQChar c)
+{
+    return sizeof(SQChar) == 1 ? (SQUnsignedInteger)(unsigned char)c : (SQUnsignedInteger)c;
+}
+
 static SQInteger _string_split(HSQUIRRELVM v)
 {
     const SQChar *str,*seps;
-    SQChar *stemp;
     sq_getstring(v,2,&str);
     sq_getstring(v,3,&seps);
     SQInteger sepsize = sq_getsize(v,3);
     if(sepsize == 0) return sq_throwerror(v,_SC("empty separators string"));
-    SQInteger memsize = (sq_getsize(v,2)+1)*sizeof(SQChar);
-    stemp = sq_getscratchpad(v,memsize);
-    memcpy(stemp,str,memsize);
-    SQChar *start = stemp;
-    SQChar *end = stemp;
+    const SQChar *start = str;
+    const SQChar *strend = str + sq_getsize(v,2);
     sq_newarray(v,0);
-    while(*end != '\0')
-    {
-        SQChar cur = *end;
-        for(SQInteger i = 0; i < sepsize; i++)
-        {
-            if(cur == seps[i])
-            {
-                *end = 0;
-                sq_pushstring(v,start,-1);
+    if(sepsize == 1) {
+        const SQChar *end;
+        while((end = (const SQChar *)scmemchr(start,seps[0],strend - start)) != NULL) {
+            sq_pushstring(v,start,end - start);
+            sq_arrayappend(v,-2);
+            start = end + 1;
+        }
+    }
+    else {
+        //bitmap of the separators below 256, the others are compared one by one
+        unsigned char sepmap[256 / 8];
+        SQBool wide = SQFalse;
+        memset(sepmap,0,sizeof(sepmap));
+        for(SQInteger i = 0; i < sepsize; i++) {
+            SQUnsignedInteger c = _charcode(seps[i]);
+            if(c < 256) sepmap[c >> 3] |= (unsigned char)(1 << (c & 7));
+            else wide = SQTrue;
+        }
+        for(const SQChar *end = str; end != strend; end++) {
+            SQUnsignedInteger c = _charcode(*end);
+            SQBool issep = c < 256 ? (sepmap[c >> 3] >> (c & 7)) & 1 : SQFalse;
+            if(!issep && wide && c >= 256) {
+                for(SQInteger i = 0; i < sepsize; i++)
+                    if(*end == seps[i]) { issep = SQTrue; break; }
+            }
+            if(issep) {
+                sq_pushstring(v,start,end - start);
                 sq_arrayappend(v,-2);
                 start = end + 1;
-                break;
             }
         }
-        end++;
     }
-    if(end != start)
+    if(strend != start)
     {
-        sq_pushstring(v,start,-1);
+        sq_pushstring(v,start,strend - start);
         sq_arrayappend(v,-2);
     }
     return 1;
@@ -465,9 +719,19 @@ static SQInteger _regexp_subexpcount(HSQUIRRELVM v)
 
 static SQInteger _regexp_constructor(HSQUIRRELVM v)
 {
-    const SQChar *error,*pattern;
+    const SQChar *error,*pattern,*options;
+    SQInteger flags = 0;
     sq_getstring(v,2,&pattern);
-    SQRex *rex = sqstd_rex_compile(pattern,&error);
+    if(sq_gettop(v) > 2) {
+        sq_getstring(v,3,&options);
+        for(; *options; options++) {
+            switch(*options) {
+                case 'l': flags |= SQREX_LINEAR; break;
+                default: return sq_throwerror(v,_SC("invalid regexp option"));
+            }
+        }
+    }
+    SQRex *rex = sqstd_rex_compileex(pattern,flags,&error);
     if(!rex) return sq_throwerror(v,error);
     sq_setinstanceup(v,1,rex);
     sq_setreleasehook(v,1,_rexobj_releasehook);
@@ -482,7 +746,7 @@ static SQInteger _regexp__typeof(HSQUIRRELVM v)
 
 #define _DECL_REX_FUNC(name,nparams,pmask) {_SC(#name),_regexp_##name,nparams,pmask}
 static const SQRegFunction rexobj_funcs[]={
-    _DECL_REX_FUNC(constructor,2,_SC(".s")),
+    _DECL_REX_FUNC(constructor,-2,_SC(".ss")),
     _DECL_REX_FUNC(search,-2,_SC("xsn")),
     _DECL_REX_FUNC(match,2,_SC("xs")),
     _DECL_REX_FUNC(capture,-2,_SC("xsn")),
@@ -494,8 +758,6 @@ static const SQRegFunction rexobj_funcs[]={
 
 #define _DECL_FUNC(name,nparams,pmask) {_SC(#name),_string_##name,nparams,pmask}
 static const SQRegFunction stringlib_funcs[]={
-    _DECL_FUNC(format,-2,_SC(".s")),
-    _DECL_FUNC(printf,-2,_SC(".s")),
     _DECL_FUNC(strip,2,_SC(".s")),
     _DECL_FUNC(lstrip,2,_SC(".s")),
     _DECL_FUNC(rstrip,2,_SC(".s")),
@@ -505,6 +767,11 @@ static const SQRegFunction stringlib_funcs[]={
     _DECL_FUNC(endswith,3,_SC(".ss")),
     {NULL,(SQFUNCTION)0,0,NULL}
 };
+static const SQRegFunction formatlib_funcs[]={
+    _DECL_FUNC(format,-2,_SC(".s")),
+    _DECL_FUNC(printf,-2,_SC(".s")),
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
 #undef _DECL_FUNC
 
 
@@ -534,5 +801,16 @@ SQInteger sqstd_register_stringlib(HSQUIRRELVM v)
         sq_newslot(v,-3,SQFalse);
         i++;
     }
+    i = 0;
+    while(formatlib_funcs[i].name!=0)
+    {
+        sq_pushstring(v,formatlib_funcs[i].name,-1);
+        _format_pushcache(v);
+        sq_newclosure(v,formatlib_funcs[i].f,1);
+        sq_setparamscheck(v,formatlib_funcs[i].nparamscheck,formatlib_funcs[i].typemask);
+        sq_setnativeclosurename(v,-1,formatlib_funcs[i].name);
+        sq_newslot(v,-3,SQFalse);
+        i++;
+    }
     return 1;
 }
@@ -0,0 +1,598 @@
+/* see copyright notice in squirrel.h */
+#include <new>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <squirrel.h>
+#include <sqstdaux.h>
+#include <sqstdblob.h>
+#include <sqstdio.h>
+#include <sqstdmath.h>
+#include <sqstdstring.h>
+#include <sqstdsystem.h>
+#include <sqstdscheduler.h>
+#include <sqstdsocket.h>
+#include <sqstdjson.h>
+#include <sqstdworker.h>
+
+#define SQSTD_WORKER_TYPE_TAG ((SQUnsignedInteger)0x80000200)
+#define SQSTD_WORKER_QUEUE_SIZE 1024 //must be a power of 2
+#define SQSTD_WORKER_MAX_DEPTH 128
+
+//Message
+
+#define MSG_NULL    'n'
+#define MSG_TRUE    't'
+#define MSG_FALSE   'f'
+#define MSG_INTEGER 'i'
+#define MSG_FLOAT   'r'
+#define MSG_STRING  's'
+#define MSG_BLOB    'b'
+#define MSG_ARRAY   'a'
+#define MSG_TABLE   'h'
+#define MSG_SHARED  'z'
+
+//a value serialized out of one VM so that it can be rebuilt in another
+struct SQWorkerMsg
+{
+    SQWorkerMsg() { _buf = NULL; _size = 0; _allocated = 0; _ptr = 0; _shared = NULL; _nshared = 0; _next = NULL; }
+    ~SQWorkerMsg() {
+        if(_buf) sq_free(_buf,_allocated);
+        for(SQInteger i = 0; i < _nshared; i++) sq_releaseshared(_shared[i]);
+        if(_shared) sq_free(_shared,_nshared * sizeof(HSQSHARED));
+    }
+    void Write(const void *p,SQInteger size) {
+        if(_size + size > _allocated) {
+            SQInteger newsize = _allocated ? _allocated * 2 : 64;
+            while(newsize < _size + size) newsize *= 2;
+            _buf = (unsigned char *)sq_realloc(_buf,_allocated,newsize);
+            _allocated = newsize;
+        }
+        memcpy(&_buf[_size],p,size);
+        _size += size;
+    }
+    void WriteTag(unsigned char tag) { Write(&tag,1); }
+    bool Read(void *p,SQInteger size) {
+        if(_ptr + size > _size) return false;
+        memcpy(p,&_buf[_ptr],size);
+        _ptr += size;
+        return true;
+    }
+    void WriteShared(HSQSHARED s) {
+        _shared = (HSQSHARED *)sq_realloc(_shared,_nshared * sizeof(HSQSHARED),(_nshared + 1) * sizeof(HSQSHARED));
+        _shared[_nshared] = s;
+        WriteTag(MSG_SHARED);
+        Write(&_nshared,sizeof(_nshared));
+        _nshared++;
+    }
+    unsigned char *_buf;
+    SQInteger _size;
+    SQInteger _allocated;
+    SQInteger _ptr;
+    //frozen tables and arrays are passed by reference
+    HSQSHARED *_shared;
+    SQInteger _nshared;
+    SQWorkerMsg *_next; //messages held by a joined worker
+};
+
+static SQWorkerMsg *_newmsg()
+{
+    return new (sq_malloc(sizeof(SQWorkerMsg))) SQWorkerMsg();
+}
+
+static void _freemsg(SQWorkerMsg *m)
+{
+    m->~SQWorkerMsg();
+    sq_free(m,sizeof(SQWorkerMsg));
+}
+
+static SQRESULT _serialize(HSQUIRRELVM v,SQInteger idx,SQWorkerMsg *m,SQInteger depth)
+{
+    if(depth > SQSTD_WORKER_MAX_DEPTH)
+        return sq_throwerror(v,_SC("message nested too deeply (cycle?)"));
+    switch(sq_gettype(v,idx)) {
+        case OT_NULL: m->WriteTag(MSG_NULL); break;
+        case OT_BOOL: {
+            SQBool b;
+            sq_getbool(v,idx,&b);
+            m->WriteTag(b ? MSG_TRUE : MSG_FALSE);
+            }
+            break;
+        case OT_INTEGER: {
+            SQInteger i;
+            sq_getinteger(v,idx,&i);
+            m->WriteTag(MSG_INTEGER);
+            m->Write(&i,sizeof(i));
+            }
+            break;
+        case OT_FLOAT: {
+            SQFloat f;
+            sq_getfloat(v,idx,&f);
+            m->WriteTag(MSG_FLOAT);
+            m->Write(&f,sizeof(f));
+            }
+            break;
+        case OT_STRING: {
+            const SQChar *s;
+            SQInteger len;
+            sq_getstringandsize(v,idx,&s,&len);
+            m->WriteTag(MSG_STRING);
+            m->Write(&len,sizeof(len));
+            m->Write(s,len * sizeof(SQChar));
+            }
+            break;
+        case OT_INSTANCE: {
+            SQUserPointer buf;
+            SQInteger size = sqstd_getblobsize(v,idx);
+            if(size < 0 || SQ_FAILED(sqstd_getblob(v,idx,&buf)))
+                return sq_throwerror(v,_SC("cannot send an instance"));
+            m->WriteTag(MSG_BLOB);
+            m->Write(&size,sizeof(size));
+            m->Write(buf,size);
+            }
+            break;
+        case OT_ARRAY:
+        case OT_TABLE: {
+            if(sq_isfrozen(v,idx)) {
+                HSQSHARED s;
+                if(SQ_FAILED(sq_share(v,idx,&s)))
+                    return SQ_ERROR;
+                m->WriteShared(s);
+                break;
+            }
+            SQInteger n = sq_getsize(v,idx);
+            m->WriteTag(sq_gettype(v,idx) == OT_ARRAY ? MSG_ARRAY : MSG_TABLE);
+            m->Write(&n,sizeof(n));
+            bool istable = sq_gettype(v,idx) == OT_TABLE;
+            sq_push(v,idx);
+            sq_pushnull(v);
+            while(SQ_SUCCEEDED(sq_next(v,-2))) {
+                if((istable && SQ_FAILED(_serialize(v,-2,m,depth + 1)))
+                    || SQ_FAILED(_serialize(v,-1,m,depth + 1))) {
+                    sq_pop(v,4);
+                    return SQ_ERROR;
+                }
+                sq_pop(v,2);
+            }
+            sq_pop(v,2);
+            }
+            break;
+        default:
+            return sq_throwerror(v,_SC("cannot send a function, thread, class or userdata"));
+    }
+    return SQ_OK;
+}
+
+static SQRESULT _deserialize(HSQUIRRELVM v,SQWorkerMsg *m)
+{
+    unsigned char tag;
+    if(!m->Read(&tag,1))
+        return sq_throwerror(v,_SC("corrupted message"));
+    switch(tag) {
+        case MSG_NULL: sq_pushnull(v); break;
+        case MSG_TRUE: sq_pushbool(v,SQTrue); break;
+        case MSG_FALSE: sq_pushbool(v,SQFalse); break;
+        case MSG_INTEGER: {
+            SQInteger i;
+            if(!m->Read(&i,sizeof(i))) return sq_throwerror(v,_SC("corrupted message"));
+            sq_pushinteger(v,i);
+            }
+            break;
+        case MSG_FLOAT: {
+            SQFloat f;
+            if(!m->Read(&f,sizeof(f))) return sq_throwerror(v,_SC("corrupted message"));
+            sq_pushfloat(v,f);
+            }
+            break;
+        case MSG_STRING: {
+            SQInteger len;
+            if(!m->Read(&len,sizeof(len)) || m->_ptr + len * (SQInteger)sizeof(SQChar) > m->_size)
+                return sq_throwerror(v,_SC("corrupted message"));
+            sq_pushstring(v,(const SQChar *)&m->_buf[m->_ptr],len);
+            m->_ptr += len * sizeof(SQChar);
+            }
+            break;
+        case MSG_BLOB: {
+            SQInteger size;
+            if(!m->Read(&size,sizeof(size)) || m->_ptr + size > m->_size)
+                return sq_throwerror(v,_SC("corrupted message"));
+            SQUserPointer buf = sqstd_createblob(v,size);
+            if(!buf) return sq_throwerror(v,_SC("cannot create blob"));
+            m->Read(buf,size);
+            }
+            break;
+        case MSG_SHARED: {
+            SQInteger i;
+            if(!m->Read(&i,sizeof(i)) || i < 0 || i >= m->_nshared)
+                return sq_throwerror(v,_SC("corrupted message"));
+            sq_pushshared(v,m->_shared[i]);
+            }
+            break;
+        case MSG_ARRAY:
+        case MSG_TABLE: {
+            SQInteger n;
+            if(!m->Read(&n,sizeof(n)))
+                return sq_throwerror(v,_SC("corrupted message"));
+            if(tag == MSG_ARRAY) sq_newarray(v,0);
+            else sq_newtableex(v,n);
+            for(SQInteger i = 0; i < n; i++) {
+                if(tag == MSG_TABLE) {
+                    if(SQ_FAILED(_deserialize(v,m))) { sq_pop(v,1); return SQ_ERROR; }
+                    if(SQ_FAILED(_deserialize(v,m))) { sq_pop(v,2); return SQ_ERROR; }
+                    sq_newslot(v,-3,SQFalse);
+                }
+                else {
+                    if(SQ_FAILED(_deserialize(v,m))) { sq_pop(v,1); return SQ_ERROR; }
+                    sq_arrayappend(v,-2);
+                }
+            }
+            }
+            break;
+        default:
+            return sq_throwerror(v,_SC("corrupted message"));
+    }
+    return SQ_OK;
+}
+
+//Queue
+
+//bounded single producer/single consumer ring; the mutex is only taken to sleep
+//when the queue is empty or full and to wake the other side
+struct SQWorkerQueue
+{
+    SQWorkerQueue() : _head(0), _tail(0), _sleepers(0), _closed(false) {}
+    ~SQWorkerQueue() {
+        SQWorkerMsg *m;
+        while((m = TryPop()) != NULL) _freemsg(m);
+    }
+    bool TryPush(SQWorkerMsg *m) {
+        if(_closed.load()) return false;
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if(tail - _head.load(std::memory_order_acquire) == SQSTD_WORKER_QUEUE_SIZE)
+            return false;
+        _slots[tail & (SQSTD_WORKER_QUEUE_SIZE - 1)] = m;
+        _tail.store(tail + 1,std::memory_order_seq_cst);
+        Wake();
+        return true;
+    }
+    SQWorkerMsg *TryPop() {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if(head == _tail.load(std::memory_order_acquire))
+            return NULL;
+        SQWorkerMsg *m = _slots[head & (SQSTD_WORKER_QUEUE_SIZE - 1)];
+        _head.store(head + 1,std::memory_order_seq_cst);
+        Wake();
+        return m;
+    }
+    //blocks while the queue is full; fails if the queue was closed
+    bool Push(SQWorkerMsg *m) {
+        for(;;) {
+            if(TryPush(m)) return true;
+            if(_closed.load()) return false;
+            Sleep(true);
+        }
+    }
+    //blocks while the queue is empty; returns NULL once the queue is closed and drained
+    SQWorkerMsg *Pop() {
+        for(;;) {
+            SQWorkerMsg *m = TryPop();
+            if(m || _closed.load()) return m ? m : TryPop();
+            Sleep(false);
+        }
+    }
+    SQInteger Count() { return (SQInteger)(_tail.load() - _head.load()); }
+    void Close() {
+        _closed.store(true);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _cond.notify_all();
+    }
+    void Sleep(bool full) {
+        _sleepers++;
+        std::unique_lock<std::mutex> lock(_mutex);
+        while(!_closed.load() && (full ? Count() == SQSTD_WORKER_QUEUE_SIZE : Count() == 0))
+            _cond.wait(lock);
+        _sleepers--;
+    }
+    void Wake() {
+        if(_sleepers.load()) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _cond.notify_all();
+        }
+    }
+    SQWorkerMsg *_slots[SQSTD_WORKER_QUEUE_SIZE];
+    std::atomic<size_t> _head;
+    std::atomic<size_t> _tail;
+    std::atomic<int> _sleepers;
+    std::atomic<bool> _closed;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+};
+
+//Worker
+
+struct SQWorker
+{
+    SQWorkerQueue _inbox; //parent to worker
+    SQWorkerQueue _outbox; //worker to parent
+    std::thread _thread;
+    SQChar *_path;
+    SQInteger _pathsize;
+    SQPRINTFUNCTION _print;
+    SQPRINTFUNCTION _error;
+    SQWORKERINIT _init;
+    bool _succeeded;
+    //messages taken from _outbox while the parent waited in join()
+    SQWorkerMsg *_held;
+    SQWorkerMsg *_heldtail;
+    SQInteger _nheld;
+};
+
+static SQRESULT _post(HSQUIRRELVM v,SQWorkerQueue &q,bool wait)
+{
+    SQWorkerMsg *m = _newmsg();
+    if(SQ_FAILED(_serialize(v,2,m,0))) {
+        _freemsg(m);
+        return SQ_ERROR;
+    }
+    if(!(wait ? q.Push(m) : q.TryPush(m))) {
+        _freemsg(m);
+        sq_pushbool(v,SQFalse);
+        return 1;
+    }
+    sq_pushbool(v,SQTrue);
+    return 1;
+}
+
+static SQRESULT _pushmsg(HSQUIRRELVM v,SQWorkerMsg *m)
+{
+    if(!m) return 0;
+    SQRESULT r = _deserialize(v,m);
+    _freemsg(m);
+    return SQ_SUCCEEDED(r) ? 1 : SQ_ERROR;
+}
+
+static SQRESULT _receive(HSQUIRRELVM v,SQWorkerQueue &q,bool wait)
+{
+    return _pushmsg(v,wait ? q.Pop() : q.TryPop());
+}
+
+//the worker is bound to the functions of the 'parent' table as their only free variable
+#define SETUP_PARENT(v) \
+    SQWorker *self = NULL; \
+    sq_getuserpointer(v,-1,(SQUserPointer *)&self);
+
+static SQInteger _parent_post(HSQUIRRELVM v) { SETUP_PARENT(v); return _post(v,self->_outbox,true); }
+static SQInteger _parent_trypost(HSQUIRRELVM v) { SETUP_PARENT(v); return _post(v,self->_outbox,false); }
+static SQInteger _parent_receive(HSQUIRRELVM v) { SETUP_PARENT(v); return _receive(v,self->_inbox,true); }
+static SQInteger _parent_tryreceive(HSQUIRRELVM v) { SETUP_PARENT(v); return _receive(v,self->_inbox,false); }
+
+static SQInteger _parent_pending(HSQUIRRELVM v)
+{
+    SETUP_PARENT(v);
+    sq_pushinteger(v,self->_inbox.Count());
+    return 1;
+}
+
+#define _DECL_PARENT_FUNC(name,nparams,typecheck) {_SC(#name),_parent_##name,nparams,typecheck}
+static const SQRegFunction parent_funcs[]={
+    _DECL_PARENT_FUNC(post,2,NULL),
+    _DECL_PARENT_FUNC(trypost,2,NULL),
+    _DECL_PARENT_FUNC(receive,1,NULL),
+    _DECL_PARENT_FUNC(tryreceive,1,NULL),
+    _DECL_PARENT_FUNC(pending,1,NULL),
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
+#undef _DECL_PARENT_FUNC
+
+static void _worker_defaultinit(HSQUIRRELVM v)
+{
+    sqstd_seterrorhandlers(v);
+    sqstd_register_bloblib(v);
+    sqstd_register_iolib(v);
+    sqstd_register_systemlib(v);
+    sqstd_register_mathlib(v);
+    sqstd_register_stringlib(v);
+    sqstd_register_schedulerlib(v);
+    sqstd_register_workerlib(v);
+    sqstd_register_jsonlib(v);
+    sqstd_register_socketlib(v);
+}
+
+static void _worker_main(SQWorker *self)
+{
+    HSQUIRRELVM v = sq_open(1024);
+    sq_setprintfunc(v,self->_print,self->_error);
+    sq_pushroottable(v);
+    self->_init(v);
+    sq_pushstring(v,_SC("parent"),-1);
+    sq_newtable(v);
+    for(SQInteger i = 0; parent_funcs[i].name != 0; i++) {
+        const SQRegFunction &f = parent_funcs[i];
+        sq_pushstring(v,f.name,-1);
+        sq_pushuserpointer(v,self);
+        sq_newclosure(v,f.f,1);
+        sq_setparamscheck(v,f.nparamscheck,f.typemask);
+        sq_setnativeclosurename(v,-1,f.name);
+        sq_newslot(v,-3,SQFalse);
+    }
+    sq_newslot(v,-3,SQFalse);
+    self->_succeeded = SQ_SUCCEEDED(sqstd_dofile(v,self->_path,SQFalse,SQTrue));
+    sq_pop(v,1);
+    sq_close(v);
+    self->_outbox.Close();
+}
+
+//a worker blocked posting to a full queue would never terminate: a released worker
+//has nobody left to receive its messages so its queue is closed, while join() keeps
+//taking them out of the queue so that they can still be received afterwards
+static void _worker_join(SQWorker *self,bool release)
+{
+    self->_inbox.Close();
+    if(release) {
+        self->_outbox.Close();
+    }
+    else {
+        SQWorkerMsg *m;
+        while((m = self->_outbox.Pop()) != NULL) {
+            if(self->_heldtail) self->_heldtail->_next = m;
+            else self->_held = m;
+            self->_heldtail = m;
+            self->_nheld++;
+        }
+    }
+    if(self->_thread.joinable())
+        self->_thread.join();
+}
+
+static SQWorkerMsg *_worker_unhold(SQWorker *self)
+{
+    SQWorkerMsg *m = self->_held;
+    if(m) {
+        self->_held = m->_next;
+        if(!self->_held) self->_heldtail = NULL;
+        self->_nheld--;
+    }
+    return m;
+}
+
+#define SETUP_WORKER(v) \
+    SQWorker *self = NULL; \
+    if(SQ_FAILED(sq_getinstanceup(v,1,(SQUserPointer*)&self,(SQUserPointer)SQSTD_WORKER_TYPE_TAG))) \
+        return sq_throwerror(v,_SC("invalid type tag")); \
+    if(!self) \
+        return sq_throwerror(v,_SC("the worker is invalid"));
+
+static SQInteger _worker_releasehook(SQUserPointer p, SQInteger SQ_UNUSED_ARG(size))
+{
+    SQWorker *self = (SQWorker*)p;
+    _worker_join(self,true);
+    SQWorkerMsg *m;
+    while((m = _worker_unhold(self)) != NULL) _freemsg(m);
+    sq_free(self->_path,self->_pathsize);
+    self->~SQWorker();
+    sq_free(self,sizeof(SQWorker));
+    return 1;
+}
+
+static SQInteger _worker_constructor(HSQUIRRELVM v)
+{
+    const SQChar *path;
+    SQInteger len;
+    sq_getstringandsize(v,2,&path,&len);
+    SQWorker *w = new (sq_malloc(sizeof(SQWorker))) SQWorker();
+    w->_pathsize = (len + 1) * sizeof(SQChar);
+    w->_path = (SQChar *)sq_malloc(w->_pathsize);
+    memcpy(w->_path,path,w->_pathsize);
+    w->_print = sq_getprintfunc(v);
+    w->_error = sq_geterrorfunc(v);
+    w->_init = _worker_defaultinit;
+    w->_succeeded = false;
+    w->_held = w->_heldtail = NULL;
+    w->_nheld = 0;
+    sq_pushregistrytable(v);
+    sq_pushstring(v,_SC("std_workerinit"),-1);
+    SQUserPointer init = NULL;
+    if(SQ_SUCCEEDED(sq_rawget(v,-2)) && SQ_SUCCEEDED(sq_getuserpointer(v,-1,&init)) && init)
+        w->_init = (SQWORKERINIT)init;
+    sq_settop(v,2);
+    if(SQ_FAILED(sq_setinstanceup(v,1,w))) {
+        sq_free(w->_path,w->_pathsize);
+        w->~SQWorker();
+        sq_free(w,sizeof(SQWorker));
+        return sq_throwerror(v, _SC("cannot create worker"));
+    }
+    sq_setreleasehook(v,1,_worker_releasehook);
+    w->_thread = std::thread(_worker_main,w);
+    return 0;
+}
+
+static SQInteger _worker_post(HSQUIRRELVM v) { SETUP_WORKER(v); return _post(v,self->_inbox,true); }
+static SQInteger _worker_trypost(HSQUIRRELVM v) { SETUP_WORKER(v); return _post(v,self->_inbox,false); }
+static SQInteger _worker_receive(HSQUIRRELVM v)
+{
+    SETUP_WORKER(v);
+    SQWorkerMsg *m = _worker_unhold(self);
+    return m ? _pushmsg(v,m) : _receive(v,self->_outbox,true);
+}
+
+static SQInteger _worker_tryreceive(HSQUIRRELVM v)
+{
+    SETUP_WORKER(v);
+    SQWorkerMsg *m = _worker_unhold(self);
+    return m ? _pushmsg(v,m) : _receive(v,self->_outbox,false);
+}
+
+static SQInteger _worker_pending(HSQUIRRELVM v)
+{
+    SETUP_WORKER(v);
+    sq_pushinteger(v,self->_outbox.Count() + self->_nheld);
+    return 1;
+}
+
+static SQInteger _worker_close(HSQUIRRELVM v)
+{
+    SETUP_WORKER(v);
+    self->_inbox.Close();
+    return 0;
+}
+
+static SQInteger _worker_join(HSQUIRRELVM v)
+{
+    SETUP_WORKER(v);
+    _worker_join(self,false);
+    sq_pushbool(v,self->_succeeded ? SQTrue : SQFalse);
+    return 1;
+}
+
+static SQInteger _worker__typeof(HSQUIRRELVM v)
+{
+    sq_pushstring(v,_SC("worker"),-1);
+    return 1;
+}
+
+#define _DECL_WORKER_FUNC(name,nparams,typecheck) {_SC(#name),_worker_##name,nparams,typecheck}
+static const SQRegFunction _worker_methods[] = {
+    _DECL_WORKER_FUNC(constructor,2,_SC("xs")),
+    _DECL_WORKER_FUNC(post,2,_SC("x.")),
+    _DECL_WORKER_FUNC(trypost,2,_SC("x.")),
+    _DECL_WORKER_FUNC(receive,1,_SC("x")),
+    _DECL_WORKER_FUNC(tryreceive,1,_SC("x")),
+    _DECL_WORKER_FUNC(pending,1,_SC("x")),
+    _DECL_WORKER_FUNC(close,1,_SC("x")),
+    _DECL_WORKER_FUNC(join,1,_SC("x")),
+    _DECL_WORKER_FUNC(_typeof,1,_SC("x")),
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
+#undef _DECL_WORKER_FUNC
+
+void sqstd_worker_setinit(HSQUIRRELVM v,SQWORKERINIT init)
+{
+    sq_pushregistrytable(v);
+    sq_pushstring(v,_SC("std_workerinit"),-1);
+    sq_pushuserpointer(v,(SQUserPointer)init);
+    sq_rawset(v,-3);
+    sq_pop(v,1);
+}
+
+SQRESULT sqstd_register_workerlib(HSQUIRRELVM v)
+{
+    if(sq_gettype(v,-1) != OT_TABLE)
+        return sq_throwerror(v,_SC("table expected"));
+    sq_pushstring(v,_SC("worker"),-1);
+    sq_newclass(v,SQFalse);
+    sq_settypetag(v,-1,(SQUserPointer)SQSTD_WORKER_TYPE_TAG);
+    SQInteger i = 0;
+    while(_worker_methods[i].name != 0) {
+        const SQRegFunction &f = _worker_methods[i];
+        sq_pushstring(v,f.name,-1);
+        sq_newclosure(v,f.f,0);
+        sq_setparamscheck(v,f.nparamscheck,f.typemask);
+        sq_setnativeclosurename(v,-1,f.name);
+        sq_newslot(v,-3,SQFalse);
+        i++;
+    }
+    sq_newslot(v,-3,SQFalse);
+    return SQ_OK;
+}
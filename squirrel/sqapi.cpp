@@ -143,6 +143,11 @@ void sq_enabledebuginfo(HSQUIRRELVM v, SQBool enable)
     _ss(v)->_debuginfo = enable?true:false;
 }
 
+SQBool sq_getdebuginfo(HSQUIRRELVM v)
+{
+    return _ss(v)->_debuginfo?SQTrue:SQFalse;
+}
+
 void sq_notifyallexceptions(HSQUIRRELVM v, SQBool enable)
 {
     _ss(v)->_notifyallexceptions = enable?true:false;
@@ -314,6 +319,7 @@ SQRESULT sq_arrayappend(HSQUIRRELVM v,SQInteger idx)
     sq_aux_paramscheck(v,2);
     SQObjectPtr *arr;
     _GETSAFE_OBJ(v, idx, OT_ARRAY,arr);
+    if(_array(*arr)->_frozen) { v->Raise_FrozenError(*arr); return SQ_ERROR; }
     _array(*arr)->Append(v->GetUp(-1));
     v->Pop();
     return SQ_OK;
@@ -324,6 +330,7 @@ SQRESULT sq_arraypop(HSQUIRRELVM v,SQInteger idx,SQBool pushval)
     sq_aux_paramscheck(v, 1);
     SQObjectPtr *arr;
     _GETSAFE_OBJ(v, idx, OT_ARRAY,arr);
+    if(_array(*arr)->_frozen) { v->Raise_FrozenError(*arr); return SQ_ERROR; }
     if(_array(*arr)->Size() > 0) {
         if(pushval != 0){ v->Push(_array(*arr)->Top()); }
         _array(*arr)->Pop();
@@ -337,6 +344,7 @@ SQRESULT sq_arrayresize(HSQUIRRELVM v,SQInteger idx,SQInteger newsize)
     sq_aux_paramscheck(v,1);
     SQObjectPtr *arr;
     _GETSAFE_OBJ(v, idx, OT_ARRAY,arr);
+    if(_array(*arr)->_frozen) { v->Raise_FrozenError(*arr); return SQ_ERROR; }
     if(newsize >= 0) {
         _array(*arr)->Resize(newsize);
         return SQ_OK;
@@ -350,11 +358,13 @@ SQRESULT sq_arrayreverse(HSQUIRRELVM v,SQInteger idx)
     sq_aux_paramscheck(v, 1);
     SQObjectPtr *o;
     _GETSAFE_OBJ(v, idx, OT_ARRAY,o);
+    if(_array(*o)->_frozen) { v->Raise_FrozenError(*o); return SQ_ERROR; }
     SQArray *arr = _array(*o);
     if(arr->Size() > 0) {
         SQObjectPtr t;
         SQInteger size = arr->Size();
         SQInteger n = size >> 1; size -= 1;
+        arr->Unshare();
         for(SQInteger i = 0; i < n; i++) {
             t = arr->_values[i];
             arr->_values[i] = arr->_values[size-i];
@@ -370,6 +380,7 @@ SQRESULT sq_arrayremove(HSQUIRRELVM v,SQInteger idx,SQInteger itemidx)
     sq_aux_paramscheck(v, 1);
     SQObjectPtr *arr;
     _GETSAFE_OBJ(v, idx, OT_ARRAY,arr);
+    if(_array(*arr)->_frozen) { v->Raise_FrozenError(*arr); return SQ_ERROR; }
     return _array(*arr)->Remove(itemidx) ? SQ_OK : sq_throwerror(v,_SC("index out of range"));
 }
 
@@ -378,6 +389,7 @@ SQRESULT sq_arrayinsert(HSQUIRRELVM v,SQInteger idx,SQInteger destpos)
     sq_aux_paramscheck(v, 1);
     SQObjectPtr *arr;
     _GETSAFE_OBJ(v, idx, OT_ARRAY,arr);
+    if(_array(*arr)->_frozen) { v->Raise_FrozenError(*arr); return SQ_ERROR; }
     SQRESULT ret = _array(*arr)->Insert(destpos, v->GetUp(-1)) ? SQ_OK : sq_throwerror(v,_SC("index out of range"));
     v->Pop();
     return ret;
@@ -524,6 +536,10 @@ SQRESULT sq_getclosureroot(HSQUIRRELVM v,SQInteger idx)
 SQRESULT sq_clear(HSQUIRRELVM v,SQInteger idx)
 {
     SQObject &o=stack_get(v,idx);
+    if((sq_type(o) == OT_TABLE && _table(o)->_frozen) || (sq_type(o) == OT_ARRAY && _array(o)->_frozen)) {
+        v->Raise_FrozenError(o);
+        return SQ_ERROR;
+    }
     switch(sq_type(o)) {
         case OT_TABLE: _table(o)->Clear();  break;
         case OT_ARRAY: _array(o)->Resize(0); break;
@@ -535,6 +551,76 @@ SQRESULT sq_clear(HSQUIRRELVM v,SQInteger idx)
     return SQ_OK;
 }
 
+SQRESULT sq_freeze(HSQUIRRELVM v,SQInteger idx)
+{
+    return FreezeObject(v,stack_get(v,idx)) ? SQ_OK : SQ_ERROR;
+}
+
+SQBool sq_isfrozen(HSQUIRRELVM v,SQInteger idx)
+{
+    SQObjectPtr &o = stack_get(v,idx);
+    switch(sq_type(o)) {
+        case OT_TABLE: return _table(o)->_frozen ? SQTrue : SQFalse;
+        case OT_ARRAY: return _array(o)->_frozen ? SQTrue : SQFalse;
+        case OT_NULL: case OT_BOOL: case OT_INTEGER: case OT_FLOAT:
+        case OT_USERPOINTER: case OT_STRING:
+            return SQTrue;
+        default: return SQFalse;
+    }
+}
+
+SQRESULT sq_setweak(HSQUIRRELVM v,SQInteger idx,SQInteger mode)
+{
+    SQObjectPtr *o = NULL;
+    _GETSAFE_OBJ(v, idx, OT_TABLE,o);
+    SQTable *t = _table(*o);
+    if(mode != 0 && !SQTable::IsWeakMode(mode))
+        return sq_throwerror(v,_SC("invalid weak mode"));
+    if(t->_frozen) { v->Raise_FrozenError(*o); return SQ_ERROR; }
+    if(t->CountUsed() != 0) return sq_throwerror(v,_SC("cannot change the weak mode of a non empty table"));
+    t->SetWeakMode(mode);
+    return SQ_OK;
+}
+
+SQInteger sq_getweak(HSQUIRRELVM v,SQInteger idx)
+{
+    SQObjectPtr *o = NULL;
+    _GETSAFE_OBJ(v, idx, OT_TABLE,o);
+    return _table(*o)->_weakmode;
+}
+
+SQRESULT sq_share(HSQUIRRELVM v,SQInteger idx,HSQSHARED *shared)
+{
+    SQObjectPtr &o = stack_get(v,idx);
+    if(!FreezeObject(v,o)) return SQ_ERROR;
+    SQSharedState *ss = _ss(v);
+    ss->Share(o);
+    //the graph can contain objects received from other states, all their heaps are kept alive
+    SQInteger n = ss->_attachedheaps.size() + (ss->_frozenheap ? 1 : 0);
+    SQSharedObject *s = (SQSharedObject *)SQ_MALLOC(sizeof(SQSharedObject) + n * sizeof(SQFrozenHeap *));
+    s->_obj = o;
+    s->_nheaps = 0;
+    if(ss->_frozenheap) s->_heaps[s->_nheaps++] = ss->_frozenheap;
+    for(SQUnsignedInteger i = 0; i < ss->_attachedheaps.size(); i++)
+        s->_heaps[s->_nheaps++] = ss->_attachedheaps[i];
+    for(SQInteger i = 0; i < n; i++) s->_heaps[i]->AddRef();
+    *shared = s;
+    return SQ_OK;
+}
+
+void sq_pushshared(HSQUIRRELVM v,HSQSHARED shared)
+{
+    for(SQInteger i = 0; i < shared->_nheaps; i++) _ss(v)->Attach(shared->_heaps[i]);
+    v->Push(shared->_obj);
+}
+
+void sq_releaseshared(HSQSHARED shared)
+{
+    SQInteger n = shared->_nheaps;
+    for(SQInteger i = 0; i < n; i++) shared->_heaps[i]->Release();
+    SQ_FREE(shared,sizeof(SQSharedObject) + n * sizeof(SQFrozenHeap *));
+}
+
 void sq_pushroottable(HSQUIRRELVM v)
 {
     v->Push(v->_roottable);
@@ -913,6 +999,11 @@ SQRESULT sq_rawset(HSQUIRRELVM v,SQInteger idx)
     }
     switch(sq_type(self)) {
     case OT_TABLE:
+        if(_table(self)->_frozen) {
+            v->Pop(2);
+            v->Raise_FrozenError(self);
+            return SQ_ERROR;
+        }
         _table(self)->NewSlot(key, v->GetUp(-1));
         v->Pop(2);
         return SQ_OK;
@@ -976,6 +1067,7 @@ SQRESULT sq_setdelegate(HSQUIRRELVM v,SQInteger idx)
     SQObjectType type = sq_type(self);
     switch(type) {
     case OT_TABLE:
+        if(_table(self)->_frozen) { v->Raise_FrozenError(self); return SQ_ERROR; }
         if(sq_type(mt) == OT_TABLE) {
             if(!_table(self)->SetDelegate(_table(mt))) {
                 return sq_throwerror(v, _SC("delegate cycle"));
@@ -1005,6 +1097,7 @@ SQRESULT sq_rawdeleteslot(HSQUIRRELVM v,SQInteger idx,SQBool pushval)
     sq_aux_paramscheck(v, 2);
     SQObjectPtr *self;
     _GETSAFE_OBJ(v, idx, OT_TABLE,self);
+    if(_table(*self)->_frozen) { v->Raise_FrozenError(*self); return SQ_ERROR; }
     SQObjectPtr &key = v->GetUp(-1);
     SQObjectPtr t;
     if(_table(*self)->Get(key,t)) {
@@ -1150,10 +1243,16 @@ void sq_getlasterror(HSQUIRRELVM v)
 SQRESULT sq_reservestack(HSQUIRRELVM v,SQInteger nsize)
 {
     if (((SQUnsignedInteger)v->_top + nsize) > v->_stack.size()) {
+#ifdef SQ_RESERVED_STACK
+        if(!v->_stack.resize(v->_top + nsize)) {
+            return sq_throwerror(v,_SC("stack overflow"));
+        }
+#else
         if(v->_nmetamethodscall) {
             return sq_throwerror(v,_SC("cannot resize stack while in a metamethod"));
         }
         v->_stack.resize(v->_stack.size() + ((v->_top + nsize) - v->_stack.size()));
+#endif
     }
     return SQ_OK;
 }
@@ -1287,6 +1386,79 @@ SQRESULT sq_readclosure(HSQUIRRELVM v,SQREADFUNC r,SQUserPointer up)
     return SQ_OK;
 }
 
+SQRESULT sq_writeclosureimage(HSQUIRRELVM v,SQWRITEFUNC w,SQUserPointer up)
+{
+    SQObjectPtr *o = NULL;
+    _GETSAFE_OBJ(v, -1, OT_CLOSURE,o);
+    if(_closure(*o)->_function->_noutervalues)
+        return sq_throwerror(v,_SC("a closure with free variables bound cannot be serialized"));
+    if(!_closure(*o)->_function->SaveImage(v,up,w))
+        return SQ_ERROR;
+    return SQ_OK;
+}
+
+SQRESULT sq_readclosureimage(HSQUIRRELVM v,SQUserPointer image,SQInteger size,SQRELEASEHOOK release)
+{
+    SQObjectPtr func;
+    if(!SQFunctionProto::LoadImage(v,image,size,release,func))
+        return SQ_ERROR;
+    v->Push(SQClosure::Create(_ss(v),_funcproto(func),_table(v->_roottable)->GetWeakRef(OT_TABLE)));
+    return SQ_OK;
+}
+
+SQRESULT sq_writeobject(HSQUIRRELVM v,SQInteger idx,SQInteger classes,SQWRITEFUNC w,SQUserPointer up)
+{
+    SQObjectPtr o = stack_get(v,idx);
+    SQObjectPtr cls;
+    if(classes) {
+        SQObjectPtr *c = NULL;
+        _GETSAFE_OBJ(v, classes, OT_TABLE,c);
+        cls = *c;
+    }
+    if(!WriteObjectGraph(v,o,cls,up,w))
+        return SQ_ERROR;
+    return SQ_OK;
+}
+
+SQRESULT sq_readobject(HSQUIRRELVM v,SQInteger classes,SQREADFUNC r,SQUserPointer up)
+{
+    SQObjectPtr o,cls;
+    if(classes) {
+        SQObjectPtr *c = NULL;
+        _GETSAFE_OBJ(v, classes, OT_TABLE,c);
+        cls = *c;
+    }
+    if(!ReadObjectGraph(v,cls,up,r,o))
+        return SQ_ERROR;
+    v->Push(o);
+    return SQ_OK;
+}
+
+void sq_collectbindings(HSQUIRRELVM v)
+{
+    SQObjectPtr o;
+    CollectBindings(v,o);
+    v->Push(o);
+}
+
+SQRESULT sq_writesnapshot(HSQUIRRELVM v,SQInteger bindings,SQWRITEFUNC w,SQUserPointer up)
+{
+    SQObjectPtr *b = NULL;
+    _GETSAFE_OBJ(v, bindings, OT_TABLE,b);
+    if(!WriteSnapshot(v,*b,up,w))
+        return SQ_ERROR;
+    return SQ_OK;
+}
+
+SQRESULT sq_readsnapshot(HSQUIRRELVM v,SQInteger bindings,SQREADFUNC r,SQUserPointer up)
+{
+    SQObjectPtr *b = NULL;
+    _GETSAFE_OBJ(v, bindings, OT_TABLE,b);
+    if(!ReadSnapshot(v,*b,up,r))
+        return SQ_ERROR;
+    return SQ_OK;
+}
+
 SQChar *sq_getscratchpad(HSQUIRRELVM v,SQInteger minsize)
 {
     return _ss(v)->GetScratchPad(minsize);
@@ -5,10 +5,52 @@
 struct SQArray : public CHAINABLE_OBJ
 {
 private:
-    SQArray(SQSharedState *ss,SQInteger nsize){_values.resize(nsize); INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_chain,this);}
+    SQArray(SQSharedState *ss,SQInteger nsize){_values.resize(nsize); _sharers = NULL; _frozen = false; INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_chain,this);}
+    //a clone of a that uses its values until one of the two is modified
+    SQArray(SQSharedState *ss,SQArray *a)
+    {
+        _sharers = NULL;
+        _frozen = false;
+        if(ISIMMORTAL(a)) {
+            //other threads read a, it cannot be touched
+            _values.copy(a->_values);
+        }
+        else {
+            if(!a->_sharers) {
+                a->_sharers = (SQUnsignedInteger *)SQ_MALLOC(sizeof(SQUnsignedInteger));
+                *a->_sharers = 1;
+            }
+            (*a->_sharers)++;
+            _sharers = a->_sharers;
+            _values.alias(a->_values);
+        }
+        INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_chain,this);
+    }
     ~SQArray()
     {
         REMOVE_FROM_CHAIN(&_ss(this)->_gc_chain,this);
+        if(_ReleaseShared()) _values.unalias();
+    }
+    //stops sharing the values, returns true if other arrays still use them
+    bool _ReleaseShared()
+    {
+        if(!_sharers) return false;
+        if(--(*_sharers) == 0) {
+            SQ_FREE(_sharers,sizeof(SQUnsignedInteger));
+            _sharers = NULL;
+            return false;
+        }
+        _sharers = NULL;
+        return true;
+    }
+    void _Unshare()
+    {
+        if(!_ReleaseShared()) return; //the last array using the values keeps them
+        SQObjectPtrVec shared;
+        shared.alias(_values);
+        _values.unalias();
+        _values.copy(shared);
+        shared.unalias();
     }
 public:
     static SQArray* Create(SQSharedState *ss,SQInteger nInitialSize){
@@ -17,12 +59,16 @@ public:
         return newarray;
     }
 #ifndef NO_GARBAGE_COLLECTOR
-    void Mark(SQCollectable **chain);
+    void Mark(SQGCMarker *marker);
     SQObjectType GetType() {return OT_ARRAY;}
 #endif
     void Finalize(){
-        _values.resize(0);
+        //values still used by other arrays are left alone
+        if(_ReleaseShared()) _values.unalias();
+        else _values.resize(0);
     }
+    //called before the values are modified in place, takes a private copy if they are shared
+    inline void Unshare() { if(_sharers) _Unshare(); }
     bool Get(const SQInteger nidx,SQObjectPtr &val)
     {
         if(nidx>=0 && nidx<(SQInteger)_values.size()){
@@ -35,6 +81,7 @@ public:
     bool Set(const SQInteger nidx,const SQObjectPtr &val)
     {
         if(nidx>=0 && nidx<(SQInteger)_values.size()){
+            Unshare();
             _values[nidx]=val;
             return true;
         }
@@ -54,22 +101,23 @@ public:
         //nothing to iterate anymore
         return -1;
     }
-    SQArray *Clone(){SQArray *anew=Create(_opt_ss(this),0); anew->_values.copy(_values); return anew; }
+    SQArray *Clone(SQSharedState *ss){SQArray *anew=(SQArray*)SQ_MALLOC(sizeof(SQArray)); new (anew) SQArray(ss,this); return anew; }
     SQInteger Size() const {return _values.size();}
     void Resize(SQInteger size)
     {
         SQObjectPtr _null;
         Resize(size,_null);
     }
-    void Resize(SQInteger size,SQObjectPtr &fill) { _values.resize(size,fill); ShrinkIfNeeded(); }
-    void Reserve(SQInteger size) { _values.reserve(size); }
-    void Append(const SQObject &o){_values.push_back(o);}
+    void Resize(SQInteger size,SQObjectPtr &fill) { Unshare(); _values.resize(size,fill); ShrinkIfNeeded(); }
+    void Reserve(SQInteger size) { if(size > (SQInteger)_values.capacity()) { Unshare(); _values.reserve(size); } }
+    void Append(const SQObject &o){Unshare(); _values.push_back(o);}
     void Extend(const SQArray *a);
     SQObjectPtr &Top(){return _values.top();}
-    void Pop(){_values.pop_back(); ShrinkIfNeeded(); }
+    void Pop(){Unshare(); _values.pop_back(); ShrinkIfNeeded(); }
     bool Insert(SQInteger idx,const SQObject &val){
         if(idx < 0 || idx > (SQInteger)_values.size())
             return false;
+        Unshare();
         _values.insert(idx,val);
         return true;
     }
@@ -80,6 +128,7 @@ public:
     bool Remove(SQInteger idx){
         if(idx < 0 || idx >= (SQInteger)_values.size())
             return false;
+        Unshare();
         _values.remove(idx);
         ShrinkIfNeeded();
         return true;
@@ -90,5 +139,9 @@ public:
     }
 
     SQObjectPtrVec _values;
+    //clones share the values (copy on write), this counts the arrays using them; NULL if never shared
+    SQUnsignedInteger *_sharers;
+    //set by sq_freeze, the array cannot be modified anymore
+    bool _frozen;
 };
 #endif //_SQARRAY_H_
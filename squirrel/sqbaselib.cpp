@@ -263,6 +263,18 @@ static SQInteger base_array(HSQUIRRELVM v)
     return 1;
 }
 
+static SQInteger base_table(HSQUIRRELVM v)
+{
+    SQInteger capacity = 0;
+    if(sq_gettop(v) > 1) {
+        capacity = tointeger(stack_get(v,2));
+        if(capacity < 0) return sq_throwerror(v,_SC("negative capacity"));
+        if(capacity > MAXTABLECAPACITY) return sq_throwerror(v,_SC("capacity too large"));
+    }
+    v->Push(SQTable::Create(_ss(v),capacity));
+    return 1;
+}
+
 static SQInteger base_type(HSQUIRRELVM v)
 {
     SQObjectPtr &o = stack_get(v,2);
@@ -270,6 +282,20 @@ static SQInteger base_type(HSQUIRRELVM v)
     return 1;
 }
 
+static SQInteger base_freeze(HSQUIRRELVM v)
+{
+    if(SQ_FAILED(sq_freeze(v,2)))
+        return SQ_ERROR;
+    sq_push(v,2);
+    return 1;
+}
+
+static SQInteger base_isfrozen(HSQUIRRELVM v)
+{
+    sq_pushbool(v,sq_isfrozen(v,2));
+    return 1;
+}
+
 static SQInteger base_callee(HSQUIRRELVM v)
 {
     if(v->_callsstacksize > 1)
@@ -297,7 +323,10 @@ static const SQRegFunction base_funcs[]={
     {_SC("newthread"),base_newthread,2, _SC(".c")},
     {_SC("suspend"),base_suspend,-1, NULL},
     {_SC("array"),base_array,-2, _SC(".n")},
+    {_SC("table"),base_table,-1, _SC(".n")},
     {_SC("type"),base_type,2, NULL},
+    {_SC("freeze"),base_freeze,2, NULL},
+    {_SC("isfrozen"),base_isfrozen,2, NULL},
     {_SC("callee"),base_callee,0,NULL},
     {_SC("dummy"),base_dummy,0,NULL},
 #ifndef NO_GARBAGE_COLLECTOR
@@ -467,6 +496,55 @@ static SQInteger table_setdelegate(HSQUIRRELVM v)
     return 1;
 }
 
+static SQInteger table_reserve(HSQUIRRELVM v)
+{
+    SQObject &o = stack_get(v,1);
+    SQInteger n = tointeger(stack_get(v,2));
+    if(_table(o)->_frozen) { v->Raise_FrozenError(o); return SQ_ERROR; }
+    if(n < 0) return sq_throwerror(v,_SC("negative capacity"));
+    if(n > MAXTABLECAPACITY) return sq_throwerror(v,_SC("capacity too large"));
+    _table(o)->Reserve(n);
+    sq_settop(v,1);
+    return 1;
+}
+
+//"k" weak keys, "v" weak values, "e" ephemeron keys, they can be combined
+static SQInteger table_setweak(HSQUIRRELVM v)
+{
+    SQInteger mode = 0;
+    if(sq_gettop(v) > 1 && sq_type(stack_get(v,2)) != OT_NULL) {
+        SQObject &o = stack_get(v,2);
+        if(sq_type(o) != OT_STRING) return sq_throwerror(v,_SC("the mode must be a string or null"));
+        for(const SQChar *c = _stringval(o); *c; c++) {
+            switch(*c) {
+            case 'k': mode |= SQ_WEAK_KEYS; break;
+            case 'v': mode |= SQ_WEAK_VALUES; break;
+            case 'e': mode |= SQ_WEAK_EPHEMERON; break;
+            default: return sq_throwerror(v,_SC("invalid weak mode"));
+            }
+        }
+    }
+    if(SQ_FAILED(sq_setweak(v,1,mode)))
+        return SQ_ERROR;
+    sq_settop(v,1);
+    return 1;
+}
+
+static SQInteger table_getweak(HSQUIRRELVM v)
+{
+    SQInteger mode = sq_getweak(v,1);
+    SQChar s[3];
+    SQInteger n = 0;
+    if(mode == 0) {
+        sq_pushnull(v);
+        return 1;
+    }
+    s[n++] = (mode & SQ_WEAK_EPHEMERON) == SQ_WEAK_EPHEMERON ? _SC('e') : _SC('k');
+    if(mode & SQ_WEAK_VALUES) s[n++] = _SC('v');
+    sq_pushstring(v,s,n);
+    return 1;
+}
+
 static SQInteger table_getdelegate(HSQUIRRELVM v)
 {
     return SQ_SUCCEEDED(sq_getdelegate(v,-1))?1:SQ_ERROR;
@@ -538,6 +616,9 @@ const SQRegFunction SQSharedState::_table_default_delegate_funcz[]={
     {_SC("filter"),table_filter,2, _SC("tc")},
 	{_SC("keys"),table_keys,1, _SC("t") },
 	{_SC("values"),table_values,1, _SC("t") },
+    {_SC("reserve"),table_reserve,2, _SC("tn")},
+    {_SC("setweak"),table_setweak,-1, _SC("t.")},
+    {_SC("getweak"),table_getweak,1, _SC("t")},
     {NULL,(SQFUNCTION)0,0,NULL}
 };
 
@@ -550,6 +631,7 @@ static SQInteger array_append(HSQUIRRELVM v)
 
 static SQInteger array_extend(HSQUIRRELVM v)
 {
+    if(_array(stack_get(v,1))->_frozen) { v->Raise_FrozenError(stack_get(v,1)); return SQ_ERROR; }
     _array(stack_get(v,1))->Extend(_array(stack_get(v,2)));
     sq_pop(v,1);
     return 1;
@@ -580,6 +662,7 @@ static SQInteger array_insert(HSQUIRRELVM v)
     SQObject &o=stack_get(v,1);
     SQObject &idx=stack_get(v,2);
     SQObject &val=stack_get(v,3);
+    if(_array(o)->_frozen) { v->Raise_FrozenError(o); return SQ_ERROR; }
     if(!_array(o)->Insert(tointeger(idx),val))
         return sq_throwerror(v,_SC("index out of range"));
     sq_pop(v,2);
@@ -591,6 +674,7 @@ static SQInteger array_remove(HSQUIRRELVM v)
     SQObject &o = stack_get(v, 1);
     SQObject &idx = stack_get(v, 2);
     if(!sq_isnumeric(idx)) return sq_throwerror(v, _SC("wrong type"));
+    if(_array(o)->_frozen) { v->Raise_FrozenError(o); return SQ_ERROR; }
     SQObjectPtr val;
     if(_array(o)->Get(tointeger(idx), val)) {
         _array(o)->Remove(tointeger(idx));
@@ -605,6 +689,7 @@ static SQInteger array_resize(HSQUIRRELVM v)
     SQObject &o = stack_get(v, 1);
     SQObject &nsize = stack_get(v, 2);
     SQObjectPtr fill;
+    if(_array(o)->_frozen) { v->Raise_FrozenError(o); return SQ_ERROR; }
     if(sq_isnumeric(nsize)) {
         SQInteger sz = tointeger(nsize);
         if (sz<0)
@@ -619,6 +704,17 @@ static SQInteger array_resize(HSQUIRRELVM v)
     return sq_throwerror(v, _SC("size must be a number"));
 }
 
+static SQInteger array_reserve(HSQUIRRELVM v)
+{
+    SQObject &o = stack_get(v,1);
+    SQInteger n = tointeger(stack_get(v,2));
+    if(_array(o)->_frozen) { v->Raise_FrozenError(o); return SQ_ERROR; }
+    if(n < 0) return sq_throwerror(v,_SC("negative capacity"));
+    _array(o)->Reserve(n);
+    sq_settop(v,1);
+    return 1;
+}
+
 static SQInteger __map_array(SQArray *dest,SQArray *src,HSQUIRRELVM v) {
     SQObjectPtr temp;
     SQInteger size = src->Size();
@@ -648,6 +744,7 @@ static SQInteger __map_array(SQArray *dest,SQArray *src,HSQUIRRELVM v) {
         if(SQ_FAILED(sq_call(v,nArgs,SQTrue,SQFalse))) {
             return SQ_ERROR;
         }
+        if(dest->_frozen) return sq_throwerror(v,_SC("trying to modify a frozen array")); //frozen by the callback
         dest->Set(n,v->GetUp(-1));
         v->Pop();
     }
@@ -669,6 +766,7 @@ static SQInteger array_map(HSQUIRRELVM v)
 static SQInteger array_apply(HSQUIRRELVM v)
 {
     SQObject &o = stack_get(v,1);
+    if(_array(o)->_frozen) { v->Raise_FrozenError(o); return SQ_ERROR; }
     if(SQ_FAILED(__map_array(_array(o),_array(o),v)))
         return SQ_ERROR;
     sq_pop(v,1);
@@ -810,6 +908,9 @@ static bool _hsort_sift_down(HSQUIRRELVM v,SQArray *arr, SQInteger root, SQInteg
                 return false; // We'd be swapping ourselve. The compare function is incorrect
             }
 
+            //the compare function could have cloned or frozen the array
+            if(arr->_frozen) { v->Raise_Error(_SC("trying to modify a frozen array")); return false; }
+            arr->Unshare();
             _Swap(arr->_values[root],arr->_values[maxChild]);
             root = maxChild;
         }
@@ -831,6 +932,8 @@ static bool _hsort(HSQUIRRELVM v,SQObjectPtr &arr, SQInteger SQ_UNUSED_ARG(l), S
 
     for (i = array_size-1; i >= 1; i--)
     {
+        if(a->_frozen) { v->Raise_Error(_SC("trying to modify a frozen array")); return false; }
+        a->Unshare();
         _Swap(a->_values[0],a->_values[i]);
         if(!_hsort_sift_down(v,a, 0, i-1,func)) return false;
     }
@@ -841,6 +944,7 @@ static SQInteger array_sort(HSQUIRRELVM v)
 {
     SQInteger func = -1;
     SQObjectPtr &o = stack_get(v,1);
+    if(_array(o)->_frozen) { v->Raise_FrozenError(o); return SQ_ERROR; }
     if(_array(o)->Size() > 1) {
         if(sq_gettop(v) == 2) func = 2;
         if(!_hsort(v, o, 0, _array(o)->Size()-1, func))
@@ -883,6 +987,7 @@ const SQRegFunction SQSharedState::_array_default_delegate_funcz[]={
     {_SC("insert"),array_insert,3, _SC("an")},
     {_SC("remove"),array_remove,2, _SC("an")},
     {_SC("resize"),array_resize,-2, _SC("an")},
+    {_SC("reserve"),array_reserve,2, _SC("an")},
     {_SC("reverse"),array_reverse,1, _SC("a")},
     {_SC("sort"),array_sort,-1, _SC("ac")},
     {_SC("slice"),array_slice,-1, _SC("ann")},
@@ -908,6 +1013,11 @@ static SQInteger string_slice(HSQUIRRELVM v)
     if(eidx < 0)eidx = slen + eidx;
     if(eidx < sidx) return sq_throwerror(v,_SC("wrong indexes"));
     if(eidx > slen || sidx < 0) return sq_throwerror(v, _SC("slice out of range"));
+    if(eidx - sidx == slen) {
+        //strings are immutable, the whole string is the string itself
+        v->Push(o);
+        return 1;
+    }
     v->Push(SQString::Create(_ss(v),&_stringval(o)[sidx],eidx-sidx));
     return 1;
 }
@@ -942,6 +1052,8 @@ static SQInteger string_find(HSQUIRRELVM v)
     if(eidx > slen || sidx < 0) return sq_throwerror(v,_SC("slice out of range")); \
     SQInteger len=_string(str)->_len; \
     const SQChar *sthis=_stringval(str); \
+    while(sidx<eidx && func(sthis[sidx]) == sthis[sidx]) sidx++; \
+    if(sidx == eidx) { v->Push(str); return 1; } /*unchanged*/ \
     SQChar *snew=(_ss(v)->GetScratchPad(sq_rsl(len))); \
     memcpy(snew,sthis,sq_rsl(len));\
     for(SQInteger i=sidx;i<eidx;i++) snew[i] = func(sthis[i]); \
@@ -26,7 +26,7 @@ SQClass::SQClass(SQSharedState *ss,SQClass *base)
         _COPY_VECTOR(_metamethods,base->_metamethods,MT_LAST);
         __ObjAddRef(_base);
     }
-    _members = base?base->_members->Clone() : SQTable::Create(ss,0);
+    _members = base?base->_members->Clone(ss) : SQTable::Create(ss,0);
     __ObjAddRef(_members);
 
     INIT_CHAIN();
@@ -98,6 +98,17 @@ bool SQClass::NewSlot(SQSharedState *ss,const SQObjectPtr &key,const SQObjectPtr
     return true;
 }
 
+//makes room for the members of a class body before they are added one by one
+void SQClass::Reserve(SQInteger nfields,SQInteger nmethods)
+{
+    if(nfields + nmethods == 0) return;
+    _members->Reserve(_members->CountUsed() + nfields + nmethods);
+    if(_defaultvalues.size() + nfields > _defaultvalues.capacity())
+        _defaultvalues.reserve(_defaultvalues.size() + nfields);
+    if(_methods.size() + nmethods > _methods.capacity())
+        _methods.reserve(_methods.size() + nmethods);
+}
+
 SQInstance *SQClass::CreateInstance()
 {
     if(!_locked) Lock();
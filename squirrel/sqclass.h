@@ -36,6 +36,7 @@ public:
     }
     ~SQClass();
     bool NewSlot(SQSharedState *ss, const SQObjectPtr &key,const SQObjectPtr &val,bool bstatic);
+    void Reserve(SQInteger nfields,SQInteger nmethods);
     bool Get(const SQObjectPtr &key,SQObjectPtr &val) {
         if(_members->Get(key,val)) {
             if(_isfield(val)) {
@@ -66,7 +67,7 @@ public:
     }
     void Finalize();
 #ifndef NO_GARBAGE_COLLECTOR
-    void Mark(SQCollectable ** );
+    void Mark(SQGCMarker *marker);
     SQObjectType GetType() {return OT_CLASS;}
 #endif
     SQInteger Next(const SQObjectPtr &refpos, SQObjectPtr &outkey, SQObjectPtr &outval);
@@ -146,7 +147,7 @@ public:
     }
     void Finalize();
 #ifndef NO_GARBAGE_COLLECTOR
-    void Mark(SQCollectable ** );
+    void Mark(SQGCMarker *marker);
     SQObjectType GetType() {return OT_INSTANCE;}
 #endif
     bool InstanceOf(SQClass *trg);
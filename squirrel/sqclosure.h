@@ -54,7 +54,7 @@ public:
     bool Save(SQVM *v,SQUserPointer up,SQWRITEFUNC write);
     static bool Load(SQVM *v,SQUserPointer up,SQREADFUNC read,SQObjectPtr &ret);
 #ifndef NO_GARBAGE_COLLECTOR
-    void Mark(SQCollectable **chain);
+    void Mark(SQGCMarker *marker);
     void Finalize(){
         SQFunctionProto *f = _function;
         _NULL_SQOBJECT_VECTOR(_outervalues,f->_noutervalues);
@@ -93,7 +93,7 @@ public:
     }
 
 #ifndef NO_GARBAGE_COLLECTOR
-    void Mark(SQCollectable **chain);
+    void Mark(SQGCMarker *marker);
     void Finalize() { _value.Null(); }
     SQObjectType GetType() {return OT_OUTER;}
 #endif
@@ -131,7 +131,7 @@ public:
     bool Yield(SQVM *v,SQInteger target);
     bool Resume(SQVM *v,SQObjectPtr &dest);
 #ifndef NO_GARBAGE_COLLECTOR
-    void Mark(SQCollectable **chain);
+    void Mark(SQGCMarker *marker);
     void Finalize(){_stack.resize(0);_closure.Null();}
     SQObjectType GetType() {return OT_GENERATOR;}
 #endif
@@ -183,7 +183,7 @@ public:
     }
 
 #ifndef NO_GARBAGE_COLLECTOR
-    void Mark(SQCollectable **chain);
+    void Mark(SQGCMarker *marker);
     void Finalize() { _NULL_SQOBJECT_VECTOR(_outervalues,_noutervalues); }
     SQObjectType GetType() {return OT_NATIVECLOSURE;}
 #endif
@@ -967,7 +967,7 @@ public:
     }
     void ParseTableOrClass(SQInteger separator,SQInteger terminator)
     {
-        SQInteger tpos = _fs->GetCurrentPos(),nkeys = 0;
+        SQInteger tpos = _fs->GetCurrentPos(),nkeys = 0,nmethods = 0;
         while(_token != terminator) {
             bool hasattrs = false;
             bool isstatic = false;
@@ -987,6 +987,7 @@ public:
             case TK_FUNCTION:
             case TK_CONSTRUCTOR:{
                 SQInteger tk = _token;
+                if(!isstatic) nmethods++;
                 Lex();
                 SQObject id = tk == TK_FUNCTION ? Expect(TK_IDENTIFIER) : _fs->CreateString(_SC("constructor"));
                 Expect(_SC('('));
@@ -1011,6 +1012,7 @@ public:
             }
             if(_token == separator) Lex();//optional comma/semicolon
             nkeys++;
+            if(isstatic) nmethods++; //static members are stored with the methods
             SQInteger val = _fs->PopTarget();
             SQInteger key = _fs->PopTarget();
             SQInteger attrs = hasattrs ? _fs->PopTarget():-1;
@@ -1027,6 +1029,12 @@ public:
         }
         if(separator == _SC(',')) //hack recognizes a table from the separator
             _fs->SetInstructionParam(tpos, 1, nkeys);
+        else { //presizes the class, see _newclass_arg()
+            SQInteger base = _fs->GetInstruction(tpos)._arg1;
+            SQInteger nfields = nkeys - nmethods;
+            _fs->SetInstructionParam(tpos, 1, _newclass_arg(base, nfields < NEWCLASS_MAXFIELDS ? nfields : NEWCLASS_MAXFIELDS,
+                nmethods < NEWCLASS_MAXMETHODS ? nmethods : NEWCLASS_MAXMETHODS));
+        }
         Lex();
     }
     void LocalDeclStatement()
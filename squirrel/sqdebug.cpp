@@ -94,6 +94,11 @@ void SQVM::Raise_IdxError(const SQObjectPtr &o)
     Raise_Error(_SC("the index '%.50s' does not exist"), _stringval(oval));
 }
 
+void SQVM::Raise_FrozenError(const SQObject &o)
+{
+    Raise_Error(_SC("trying to modify a frozen %s"), GetTypeName(o));
+}
+
 void SQVM::Raise_CompareError(const SQObject &o1, const SQObject &o2)
 {
     SQObjectPtr oval1 = PrintObjVal(o1), oval2 = PrintObjVal(o2);
@@ -53,7 +53,7 @@ typedef sqvector<SQLocalVarInfo> SQLocalVarInfoVec;
 typedef sqvector<SQLineInfo> SQLineInfoVec;
 
 #define _FUNC_SIZE(ni,nl,nparams,nfuncs,nouters,nlineinf,localinf,defparams) (sizeof(SQFunctionProto) \
-        +((ni-1)*sizeof(SQInstruction))+(nl*sizeof(SQObjectPtr)) \
+        +(ni*sizeof(SQInstruction))+(nl*sizeof(SQObjectPtr)) \
         +(nparams*sizeof(SQObjectPtr))+(nfuncs*sizeof(SQObjectPtr)) \
         +(nouters*sizeof(SQOuterVar))+(nlineinf*sizeof(SQLineInfo)) \
         +(localinf*sizeof(SQLocalVarInfo))+(defparams*sizeof(SQInteger)))
@@ -75,28 +75,27 @@ public:
         //I compact the whole class and members in a single memory allocation
         f = (SQFunctionProto *)sq_vm_malloc(_FUNC_SIZE(ninstructions,nliterals,nparameters,nfunctions,noutervalues,nlineinfos,nlocalvarinfos,ndefaultparams));
         new (f) SQFunctionProto(ss);
+        f->Init(nliterals,nparameters,nfunctions,noutervalues,nlineinfos,nlocalvarinfos,ndefaultparams);
+        f->_lineinfos = (SQLineInfo *)&f->_defaultparams[ndefaultparams];
+        f->_instructions = (SQInstruction *)&f->_lineinfos[nlineinfos];
+        f->_ninstructions = ninstructions;
+        return f;
+    }
+    //instructions and line infos are used in place from a bytecode image, 'image' keeps it alive
+    static SQFunctionProto *CreateMapped(SQSharedState *ss,const SQObjectPtr &image,
+        SQInstruction *instructions,SQInteger ninstructions,
+        SQInteger nliterals,SQInteger nparameters,
+        SQInteger nfunctions,SQInteger noutervalues,
+        SQLineInfo *lineinfos,SQInteger nlineinfos,SQInteger nlocalvarinfos,SQInteger ndefaultparams)
+    {
+        SQFunctionProto *f;
+        f = (SQFunctionProto *)sq_vm_malloc(_FUNC_SIZE(0,nliterals,nparameters,nfunctions,noutervalues,0,nlocalvarinfos,ndefaultparams));
+        new (f) SQFunctionProto(ss);
+        f->_image = image;
+        f->Init(nliterals,nparameters,nfunctions,noutervalues,nlineinfos,nlocalvarinfos,ndefaultparams);
+        f->_lineinfos = lineinfos;
+        f->_instructions = instructions;
         f->_ninstructions = ninstructions;
-        f->_literals = (SQObjectPtr*)&f->_instructions[ninstructions];
-        f->_nliterals = nliterals;
-        f->_parameters = (SQObjectPtr*)&f->_literals[nliterals];
-        f->_nparameters = nparameters;
-        f->_functions = (SQObjectPtr*)&f->_parameters[nparameters];
-        f->_nfunctions = nfunctions;
-        f->_outervalues = (SQOuterVar*)&f->_functions[nfunctions];
-        f->_noutervalues = noutervalues;
-        f->_lineinfos = (SQLineInfo *)&f->_outervalues[noutervalues];
-        f->_nlineinfos = nlineinfos;
-        f->_localvarinfos = (SQLocalVarInfo *)&f->_lineinfos[nlineinfos];
-        f->_nlocalvarinfos = nlocalvarinfos;
-        f->_defaultparams = (SQInteger *)&f->_localvarinfos[nlocalvarinfos];
-        f->_ndefaultparams = ndefaultparams;
-
-        _CONSTRUCT_VECTOR(SQObjectPtr,f->_nliterals,f->_literals);
-        _CONSTRUCT_VECTOR(SQObjectPtr,f->_nparameters,f->_parameters);
-        _CONSTRUCT_VECTOR(SQObjectPtr,f->_nfunctions,f->_functions);
-        _CONSTRUCT_VECTOR(SQOuterVar,f->_noutervalues,f->_outervalues);
-        //_CONSTRUCT_VECTOR(SQLineInfo,f->_nlineinfos,f->_lineinfos); //not required are 2 integers
-        _CONSTRUCT_VECTOR(SQLocalVarInfo,f->_nlocalvarinfos,f->_localvarinfos);
         return f;
     }
     void Release(){
@@ -106,7 +105,8 @@ public:
         _DESTRUCT_VECTOR(SQOuterVar,_noutervalues,_outervalues);
         //_DESTRUCT_VECTOR(SQLineInfo,_nlineinfos,_lineinfos); //not required are 2 integers
         _DESTRUCT_VECTOR(SQLocalVarInfo,_nlocalvarinfos,_localvarinfos);
-        SQInteger size = _FUNC_SIZE(_ninstructions,_nliterals,_nparameters,_nfunctions,_noutervalues,_nlineinfos,_nlocalvarinfos,_ndefaultparams);
+        bool mapped = sq_type(_image) != OT_NULL;
+        SQInteger size = _FUNC_SIZE(mapped?0:_ninstructions,_nliterals,_nparameters,_nfunctions,_noutervalues,mapped?0:_nlineinfos,_nlocalvarinfos,_ndefaultparams);
         this->~SQFunctionProto();
         sq_vm_free(this,size);
     }
@@ -115,8 +115,10 @@ public:
     SQInteger GetLine(SQInstruction *curr);
     bool Save(SQVM *v,SQUserPointer up,SQWRITEFUNC write);
     static bool Load(SQVM *v,SQUserPointer up,SQREADFUNC read,SQObjectPtr &ret);
+    bool SaveImage(SQVM *v,SQUserPointer up,SQWRITEFUNC write);
+    static bool LoadImage(SQVM *v,SQUserPointer image,SQInteger size,SQRELEASEHOOK release,SQObjectPtr &ret);
 #ifndef NO_GARBAGE_COLLECTOR
-    void Mark(SQCollectable **chain);
+    void Mark(SQGCMarker *marker);
     void Finalize(){ _NULL_SQOBJECT_VECTOR(_literals,_nliterals); }
     SQObjectType GetType() {return OT_FUNCPROTO;}
 #endif
@@ -148,7 +150,107 @@ public:
     SQInteger *_defaultparams;
 
     SQInteger _ninstructions;
-    SQInstruction _instructions[1];
+    SQInstruction *_instructions;
+
+    SQObjectPtr _image;
+private:
+    void Init(SQInteger nliterals,SQInteger nparameters,
+        SQInteger nfunctions,SQInteger noutervalues,
+        SQInteger nlineinfos,SQInteger nlocalvarinfos,SQInteger ndefaultparams)
+    {
+        _literals = (SQObjectPtr*)(this + 1);
+        _nliterals = nliterals;
+        _parameters = (SQObjectPtr*)&_literals[nliterals];
+        _nparameters = nparameters;
+        _functions = (SQObjectPtr*)&_parameters[nparameters];
+        _nfunctions = nfunctions;
+        _outervalues = (SQOuterVar*)&_functions[nfunctions];
+        _noutervalues = noutervalues;
+        _nlineinfos = nlineinfos;
+        _localvarinfos = (SQLocalVarInfo *)&_outervalues[noutervalues];
+        _nlocalvarinfos = nlocalvarinfos;
+        _defaultparams = (SQInteger *)&_localvarinfos[nlocalvarinfos];
+        _ndefaultparams = ndefaultparams;
+
+        _CONSTRUCT_VECTOR(SQObjectPtr,_nliterals,_literals);
+        _CONSTRUCT_VECTOR(SQObjectPtr,_nparameters,_parameters);
+        _CONSTRUCT_VECTOR(SQObjectPtr,_nfunctions,_functions);
+        _CONSTRUCT_VECTOR(SQOuterVar,_noutervalues,_outervalues);
+        //_CONSTRUCT_VECTOR(SQLineInfo,_nlineinfos,_lineinfos); //not required are 2 integers
+        _CONSTRUCT_VECTOR(SQLocalVarInfo,_nlocalvarinfos,_localvarinfos);
+    }
+};
+
+//memory-mappable bytecode image, every reference is an offset from the start of the image
+#define SQ_BYTECODE_IMAGE_MAGIC (('S'<<24)|('Q'<<16)|('I'<<8)|('M'))
+#define SQ_BYTECODE_IMAGE_VERSION 2
+#define SQ_BYTECODE_IMAGE_ENDIAN 0x01020304
+
+struct SQImageHeader
+{
+    unsigned short _tag; //SQ_BYTECODE_IMAGE_TAG
+    unsigned char _charsize;
+    unsigned char _intsize;
+    unsigned char _floatsize;
+    unsigned char _instrsize;
+    unsigned short _padding;
+    SQUnsignedInteger32 _magic;
+    SQUnsignedInteger32 _version;
+    SQUnsignedInteger32 _endian;
+    SQUnsignedInteger32 _nstrings;
+    SQUnsignedInteger _size;
+    SQUnsignedInteger _strings; //offsets of the strings: { SQInteger len; SQChar s[len+1]; }
+    SQUnsignedInteger _root; //offset of the SQImageProto of the main function
+};
+
+//strings are indexes in the string table of the image, interned once per load
+struct SQImageObject
+{
+    SQInteger _type;
+    union {
+        SQInteger _integer;
+        SQFloat _float;
+    } _val;
+};
+
+struct SQImageOuterVar
+{
+    SQInteger _type;
+    SQImageObject _name;
+    SQImageObject _src;
+};
+
+struct SQImageLocalVarInfo
+{
+    SQImageObject _name;
+    SQUnsignedInteger _start_op;
+    SQUnsignedInteger _end_op;
+    SQUnsignedInteger _pos;
+};
+
+struct SQImageProto
+{
+    SQImageObject _sourcename;
+    SQImageObject _name;
+    SQInteger _stacksize;
+    SQInteger _bgenerator;
+    SQInteger _varparams;
+    SQInteger _nliterals;
+    SQInteger _nparameters;
+    SQInteger _noutervalues;
+    SQInteger _nlocalvarinfos;
+    SQInteger _nlineinfos;
+    SQInteger _ndefaultparams;
+    SQInteger _ninstructions;
+    SQInteger _nfunctions;
+    SQUnsignedInteger _literals; //SQImageObject[]
+    SQUnsignedInteger _parameters; //SQImageObject[]
+    SQUnsignedInteger _outervalues; //SQImageOuterVar[]
+    SQUnsignedInteger _localvarinfos; //SQImageLocalVarInfo[]
+    SQUnsignedInteger _lineinfos; //SQLineInfo[], used in place
+    SQUnsignedInteger _defaultparams; //SQInteger[]
+    SQUnsignedInteger _instructions; //SQInstruction[], used in place
+    SQUnsignedInteger _functions; //offsets of the SQImageProto of the nested functions
 };
 
 #endif //_SQFUNCTION_H_
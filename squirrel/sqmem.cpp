@@ -2,10 +2,47 @@
     see copyright notice in squirrel.h
 */
 #include "sqpcheader.h"
+#if defined(SQ_RESERVED_STACK) && !defined(SQ_EXCLUDE_DEFAULT_MEMFUNCTIONS)
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#endif
 #ifndef SQ_EXCLUDE_DEFAULT_MEMFUNCTIONS
 void *sq_vm_malloc(SQUnsignedInteger size){ return malloc(size); }
 
 void *sq_vm_realloc(void *p, SQUnsignedInteger SQ_UNUSED_ARG(oldsize), SQUnsignedInteger size){ return realloc(p, size); }
 
 void sq_vm_free(void *p, SQUnsignedInteger SQ_UNUSED_ARG(size)){ free(p); }
+
+#ifdef SQ_RESERVED_STACK
+#ifdef _WIN32
+void *sq_vm_reserve(SQUnsignedInteger size){ return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS); }
+
+bool sq_vm_commit(void *p, SQUnsignedInteger oldsize, SQUnsignedInteger size)
+{
+    return VirtualAlloc((char *)p + oldsize, size - oldsize, MEM_COMMIT, PAGE_READWRITE) != NULL;
+}
+
+void sq_vm_unreserve(void *p, SQUnsignedInteger SQ_UNUSED_ARG(size)){ VirtualFree(p, 0, MEM_RELEASE); }
+#else
+void *sq_vm_reserve(SQUnsignedInteger size)
+{
+    void *p = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return p != MAP_FAILED ? p : NULL;
+}
+
+bool sq_vm_commit(void *p, SQUnsignedInteger oldsize, SQUnsignedInteger size)
+{
+    SQUnsignedInteger page = (SQUnsignedInteger)sysconf(_SC_PAGESIZE);
+    SQUnsignedInteger from = oldsize & ~(page - 1);
+    SQUnsignedInteger to = (size + page - 1) & ~(page - 1);
+    return mprotect((char *)p + from, to - from, PROT_READ | PROT_WRITE) == 0;
+}
+
+void sq_vm_unreserve(void *p, SQUnsignedInteger size){ munmap(p, size); }
+#endif
+#endif
 #endif
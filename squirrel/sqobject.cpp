@@ -84,13 +84,18 @@ SQUnsignedInteger TranslateIndex(const SQObjectPtr &idx)
 
 SQWeakRef *SQRefCounted::GetWeakRef(SQObjectType type)
 {
-    if(!_weakref) {
-        sq_new(_weakref,SQWeakRef);
+    if(!_weakref || ISIMMORTAL(this)) {
+        SQWeakRef *w;
+        sq_new(w,SQWeakRef);
 #if defined(SQUSEDOUBLE) && !defined(_SQ64)
-        _weakref->_obj._unVal.raw = 0; //clean the whole union on 32 bits with double
+        w->_obj._unVal.raw = 0; //clean the whole union on 32 bits with double
 #endif
-        _weakref->_obj._type = type;
-        _weakref->_obj._unVal.pRefCounted = this;
+        w->_obj._type = type;
+        w->_obj._unVal.pRefCounted = this;
+        //an immortal object is shared with other threads and outlives its weak references,
+        //they are not cached in it
+        if(ISIMMORTAL(this)) return w;
+        _weakref = w;
     }
     return _weakref;
 }
@@ -100,11 +105,52 @@ SQRefCounted::~SQRefCounted()
     if(_weakref) {
         _weakref->_obj._type = OT_NULL;
         _weakref->_obj._unVal.pRefCounted = NULL;
+        if(_weakref->_entries) _weakref->PurgeEntries();
     }
 }
 
+void SQWeakRef::AddEntry(SQTable *t,const SQObject &key)
+{
+    SQWeakEntry *e = (SQWeakEntry *)SQ_MALLOC(sizeof(SQWeakEntry));
+    e->_table = t;
+    e->_key = key;
+    e->_next = _entries;
+    _entries = e;
+}
+
+void SQWeakRef::RemoveEntry(SQTable *t,const SQObject &key)
+{
+    SQWeakEntry **pe = &_entries;
+    while(*pe) {
+        SQWeakEntry *e = *pe;
+        if(e->_table == t && sq_type(e->_key) == sq_type(key) && _rawval(e->_key) == _rawval(key)) {
+            *pe = e->_next;
+            SQ_FREE(e,sizeof(SQWeakEntry));
+            return;
+        }
+        pe = &e->_next;
+    }
+}
+
+//the object died, its slots are removed from the weak tables
+void SQWeakRef::PurgeEntries()
+{
+    //removing a slot can release the last reference to this and change the list
+    SQWeakRef *self = this;
+    __ObjAddRef(self);
+    SQWeakEntry *e;
+    while((e = _entries)) {
+        _entries = e->_next;
+        SQTable *t = e->_table;
+        SQObject key = e->_key;
+        SQ_FREE(e,sizeof(SQWeakEntry));
+        t->_Purge(key);
+    }
+    __ObjRelease(self);
+}
+
 void SQWeakRef::Release() {
-    if(ISREFCOUNTED(_obj._type)) {
+    if(ISREFCOUNTED(_obj._type) && !ISIMMORTAL(_obj._unVal.pRefCounted)) {
         _obj._unVal.pRefCounted->_weakref = NULL;
     }
     sq_delete(this,SQWeakRef);
@@ -140,12 +186,14 @@ bool SQGenerator::Yield(SQVM *v,SQInteger target)
     _stack.resize(size);
     SQObject _this = v->_stack[v->_stackbase];
     _stack._vals[0] = ISREFCOUNTED(sq_type(_this)) ? SQObjectPtr(_refcounted(_this)->GetWeakRef(sq_type(_this))) : _this;
+    //move the frame into the generator without touching the refcounts
+    SQObjectPtr *src = &v->_stack._vals[v->_stackbase];
     for(SQInteger n =1; n<target; n++) {
-        _stack._vals[n] = v->_stack[v->_stackbase+n];
+        _Swap(_stack._vals[n],src[n]);
     }
     for(SQInteger j =0; j < size; j++)
     {
-        v->_stack[v->_stackbase+j].Null();
+        src[j].Null();
     }
 
     _ci = *v->ci;
@@ -193,8 +241,9 @@ bool SQGenerator::Resume(SQVM *v,SQObjectPtr &dest)
     SQObject _this = _stack._vals[0];
     v->_stack[v->_stackbase] = sq_type(_this) == OT_WEAKREF ? _weakref(_this)->_obj : _this;
 
+    SQObjectPtr *dst = &v->_stack._vals[v->_stackbase];
     for(SQInteger n = 1; n<size; n++) {
-        v->_stack[v->_stackbase+n] = _stack._vals[n];
+        _Swap(dst[n],_stack._vals[n]);
         _stack._vals[n].Null();
     }
 
@@ -371,6 +420,7 @@ bool ReadObject(HSQUIRRELVM v,SQUserPointer up,SQREADFUNC read,SQObjectPtr &o)
 bool SQClosure::Save(SQVM *v,SQUserPointer up,SQWRITEFUNC write)
 {
     _CHECK_IO(WriteTag(v,write,up,SQ_CLOSURESTREAM_HEAD));
+    _CHECK_IO(WriteTag(v,write,up,SQ_CLOSURESTREAM_VERSION));
     _CHECK_IO(WriteTag(v,write,up,sizeof(SQChar)));
     _CHECK_IO(WriteTag(v,write,up,sizeof(SQInteger)));
     _CHECK_IO(WriteTag(v,write,up,sizeof(SQFloat)));
@@ -382,7 +432,15 @@ bool SQClosure::Save(SQVM *v,SQUserPointer up,SQWRITEFUNC write)
 bool SQClosure::Load(SQVM *v,SQUserPointer up,SQREADFUNC read,SQObjectPtr &ret)
 {
     _CHECK_IO(CheckTag(v,read,up,SQ_CLOSURESTREAM_HEAD));
-    _CHECK_IO(CheckTag(v,read,up,sizeof(SQChar)));
+    SQUnsignedInteger32 version;
+    _CHECK_IO(SafeRead(v,read,up,&version,sizeof(version)));
+    if(version == SQ_CLOSURESTREAM_VERSION) {
+        _CHECK_IO(CheckTag(v,read,up,sizeof(SQChar)));
+    }
+    else if(version != sizeof(SQChar)) {
+        v->Raise_Error(_SC("unsupported bytecode version"));
+        return false;
+    }
     _CHECK_IO(CheckTag(v,read,up,sizeof(SQInteger)));
     _CHECK_IO(CheckTag(v,read,up,sizeof(SQFloat)));
     SQObjectPtr func;
@@ -550,125 +608,1584 @@ bool SQFunctionProto::Load(SQVM *v,SQUserPointer up,SQREADFUNC read,SQObjectPtr
     return true;
 }
 
-#ifndef NO_GARBAGE_COLLECTOR
+#define SQ_IMAGE_ALIGNMENT 8
+#define SQ_IMAGE_MAXDEPTH 1024
+
+struct SQImageWriter
+{
+    SQImageWriter(SQVM *v)
+    {
+        _v = v;
+        _stringidx = SQTable::Create(_ss(v),0);
+        _protoidx = SQTable::Create(_ss(v),0);
+        Alloc(sizeof(SQImageHeader));
+    }
+    SQUnsignedInteger Alloc(SQUnsignedInteger size)
+    {
+        SQUnsignedInteger off = _buf.size();
+        _buf.resize(off + ((size + (SQ_IMAGE_ALIGNMENT - 1)) & ~(SQUnsignedInteger)(SQ_IMAGE_ALIGNMENT - 1)),0);
+        return off;
+    }
+    //the buffer grows while writing, pointers are only valid until the next Alloc()
+    template<typename T> T *At(SQUnsignedInteger off) { return (T *)&_buf[off]; }
+    bool Object(SQObjectPtr &o,SQImageObject &io)
+    {
+        io._type = sq_type(o);
+        io._val._integer = 0;
+        switch(sq_type(o)){
+        case OT_STRING:{
+            SQObjectPtr idx;
+            if(!_table(_stringidx)->Get(o,idx)) {
+                idx = (SQInteger)_strings.size();
+                _strings.push_back(o);
+                _table(_stringidx)->NewSlot(o,idx);
+            }
+            io._val._integer = _integer(idx);
+                       }
+            break;
+        case OT_BOOL:
+        case OT_INTEGER:
+            io._val._integer = _integer(o); break;
+        case OT_FLOAT:
+            io._val._float = _float(o); break;
+        case OT_NULL:
+            break;
+        default:
+            _v->Raise_Error(_SC("cannot serialize a %s"),GetTypeName(o));
+            return false;
+        }
+        return true;
+    }
+    template<typename T> SQUnsignedInteger Copy(const T *src,SQInteger n)
+    {
+        SQUnsignedInteger off = Alloc(n * sizeof(T));
+        if(n) memcpy(At<T>(off),src,n * sizeof(T));
+        return off;
+    }
+    bool Proto(SQFunctionProto *f,SQUnsignedInteger &ret)
+    {
+        SQInteger i;
+        SQImageProto ip;
+        SQObjectPtr idx;
+        //a function written more than once (eg. by a snapshot) is stored only once
+        if(_table(_protoidx)->Get(SQObjectPtr(f),idx)) {
+            ret = (SQUnsignedInteger)_integer(idx);
+            return true;
+        }
+        _CHECK_IO(Object(f->_sourcename,ip._sourcename));
+        _CHECK_IO(Object(f->_name,ip._name));
+        SQUnsignedInteger p = Alloc(sizeof(SQImageProto));
+        SQUnsignedInteger literals = Alloc(f->_nliterals * sizeof(SQImageObject));
+        for(i = 0; i < f->_nliterals; i++) {
+            SQImageObject io;
+            _CHECK_IO(Object(f->_literals[i],io));
+            At<SQImageObject>(literals)[i] = io;
+        }
+        SQUnsignedInteger parameters = Alloc(f->_nparameters * sizeof(SQImageObject));
+        for(i = 0; i < f->_nparameters; i++) {
+            SQImageObject io;
+            _CHECK_IO(Object(f->_parameters[i],io));
+            At<SQImageObject>(parameters)[i] = io;
+        }
+        SQUnsignedInteger outervalues = Alloc(f->_noutervalues * sizeof(SQImageOuterVar));
+        for(i = 0; i < f->_noutervalues; i++) {
+            SQImageOuterVar iov;
+            iov._type = f->_outervalues[i]._type;
+            _CHECK_IO(Object(f->_outervalues[i]._name,iov._name));
+            _CHECK_IO(Object(f->_outervalues[i]._src,iov._src));
+            At<SQImageOuterVar>(outervalues)[i] = iov;
+        }
+        SQUnsignedInteger localvarinfos = Alloc(f->_nlocalvarinfos * sizeof(SQImageLocalVarInfo));
+        for(i = 0; i < f->_nlocalvarinfos; i++) {
+            SQLocalVarInfo &lvi = f->_localvarinfos[i];
+            SQImageLocalVarInfo ilvi;
+            _CHECK_IO(Object(lvi._name,ilvi._name));
+            ilvi._start_op = lvi._start_op;
+            ilvi._end_op = lvi._end_op;
+            ilvi._pos = lvi._pos;
+            At<SQImageLocalVarInfo>(localvarinfos)[i] = ilvi;
+        }
+        SQUnsignedInteger lineinfos = Copy(f->_lineinfos,f->_nlineinfos);
+        SQUnsignedInteger defaultparams = Copy(f->_defaultparams,f->_ndefaultparams);
+        SQUnsignedInteger instructions = Copy(f->_instructions,f->_ninstructions);
+        SQUnsignedInteger functions = Alloc(f->_nfunctions * sizeof(SQUnsignedInteger));
+        for(i = 0; i < f->_nfunctions; i++) {
+            SQUnsignedInteger child;
+            _CHECK_IO(Proto(_funcproto(f->_functions[i]),child));
+            At<SQUnsignedInteger>(functions)[i] = child;
+        }
+        ip._stacksize = f->_stacksize;
+        ip._bgenerator = f->_bgenerator ? 1 : 0;
+        ip._varparams = f->_varparams;
+        ip._nliterals = f->_nliterals;
+        ip._nparameters = f->_nparameters;
+        ip._noutervalues = f->_noutervalues;
+        ip._nlocalvarinfos = f->_nlocalvarinfos;
+        ip._nlineinfos = f->_nlineinfos;
+        ip._ndefaultparams = f->_ndefaultparams;
+        ip._ninstructions = f->_ninstructions;
+        ip._nfunctions = f->_nfunctions;
+        ip._literals = literals;
+        ip._parameters = parameters;
+        ip._outervalues = outervalues;
+        ip._localvarinfos = localvarinfos;
+        ip._lineinfos = lineinfos;
+        ip._defaultparams = defaultparams;
+        ip._instructions = instructions;
+        ip._functions = functions;
+        *At<SQImageProto>(p) = ip;
+        _table(_protoidx)->NewSlot(SQObjectPtr(f),SQObjectPtr((SQInteger)p));
+        ret = p;
+        return true;
+    }
+    void Finish(SQUnsignedInteger root)
+    {
+        SQUnsignedInteger nstrings = _strings.size();
+        SQUnsignedInteger strings = Alloc(nstrings * sizeof(SQUnsignedInteger));
+        for(SQUnsignedInteger i = 0; i < nstrings; i++) {
+            SQString *str = _string(_strings[i]);
+            SQUnsignedInteger o = Alloc(sizeof(SQInteger) + sq_rsl(str->_len + 1));
+            *At<SQInteger>(o) = str->_len;
+            memcpy(At<SQChar>(o + sizeof(SQInteger)),str->_val,sq_rsl(str->_len));
+            At<SQUnsignedInteger>(strings)[i] = o;
+        }
+        SQImageHeader *h = At<SQImageHeader>(0);
+        h->_tag = SQ_BYTECODE_IMAGE_TAG;
+        h->_charsize = sizeof(SQChar);
+        h->_intsize = sizeof(SQInteger);
+        h->_floatsize = sizeof(SQFloat);
+        h->_instrsize = sizeof(SQInstruction);
+        h->_magic = SQ_BYTECODE_IMAGE_MAGIC;
+        h->_version = SQ_BYTECODE_IMAGE_VERSION;
+        h->_endian = SQ_BYTECODE_IMAGE_ENDIAN;
+        h->_nstrings = (SQUnsignedInteger32)nstrings;
+        h->_size = _buf.size();
+        h->_strings = strings;
+        h->_root = root;
+    }
+    SQVM *_v;
+    sqvector<unsigned char> _buf;
+    SQObjectPtr _stringidx;
+    SQObjectPtr _protoidx;
+    sqvector<SQObjectPtr> _strings;
+};
+
+bool SQFunctionProto::SaveImage(SQVM *v,SQUserPointer up,SQWRITEFUNC write)
+{
+    SQImageWriter w(v);
+    SQUnsignedInteger root;
+    _CHECK_IO(w.Proto(this,root));
+    w.Finish(root);
+    return SafeWrite(v,write,up,w._buf._vals,w._buf.size());
+}
+
+struct SQImageHolder
+{
+    SQUserPointer _image;
+    SQInteger _size;
+    SQRELEASEHOOK _release;
+};
+
+static SQInteger image_releasehook(SQUserPointer p,SQInteger SQ_UNUSED_ARG(size))
+{
+    SQImageHolder *h = (SQImageHolder *)p;
+    if(h->_release) h->_release(h->_image,h->_size);
+    return 1;
+}
+
+struct SQImageReader
+{
+    bool Error()
+    {
+        _v->Raise_Error(_SC("invalid or corrupted bytecode image"));
+        return false;
+    }
+    bool Check(SQUnsignedInteger off,SQUnsignedInteger count,SQUnsignedInteger elemsize)
+    {
+        if(off > _size || (off & (SQ_IMAGE_ALIGNMENT - 1)) || count > (_size - off) / elemsize)
+            return Error();
+        return true;
+    }
+    template<typename T> T *At(SQUnsignedInteger off) { return (T *)(_base + off); }
+    bool Object(const SQImageObject &io,SQObjectPtr &o)
+    {
+        switch(io._type){
+        case OT_STRING:{
+            SQUnsignedInteger idx = (SQUnsignedInteger)io._val._integer;
+            if(idx >= _strings.size()) return Error();
+            if(sq_type(_strings[idx]) == OT_NULL) {
+                //interned the first time the string is referenced
+                SQUnsignedInteger so = At<SQUnsignedInteger>(_stringoffs)[idx];
+                _CHECK_IO(Check(so,1,sizeof(SQInteger)));
+                SQInteger len = *At<SQInteger>(so);
+                _CHECK_IO(Check(so,1,sizeof(SQInteger) + sq_rsl(len)));
+                _strings[idx] = SQString::Create(_ss(_v),At<SQChar>(so + sizeof(SQInteger)),len);
+            }
+            o = _strings[idx];
+                       }
+            break;
+        case OT_INTEGER:
+            o = io._val._integer; break;
+        case OT_BOOL:
+            o = io._val._integer ? true : false; break;
+        case OT_FLOAT:
+            o = io._val._float; break;
+        case OT_NULL:
+            o.Null(); break;
+        default:
+            return Error();
+        }
+        return true;
+    }
+    bool Proto(SQUnsignedInteger off,SQInteger depth,SQObjectPtr &ret)
+    {
+        SQInteger i;
+        if(depth > SQ_IMAGE_MAXDEPTH) return Error();
+        if(_table(_protos)->Get(SQObjectPtr((SQInteger)off),ret)) return true;
+        _CHECK_IO(Check(off,1,sizeof(SQImageProto)));
+        const SQImageProto *ip = At<SQImageProto>(off);
+        if(ip->_nliterals < 0 || ip->_nparameters < 0 || ip->_noutervalues < 0 || ip->_nlocalvarinfos < 0
+            || ip->_nlineinfos < 0 || ip->_ndefaultparams < 0 || ip->_ninstructions < 0 || ip->_nfunctions < 0)
+            return Error();
+        _CHECK_IO(Check(ip->_literals,ip->_nliterals,sizeof(SQImageObject)));
+        _CHECK_IO(Check(ip->_parameters,ip->_nparameters,sizeof(SQImageObject)));
+        _CHECK_IO(Check(ip->_outervalues,ip->_noutervalues,sizeof(SQImageOuterVar)));
+        _CHECK_IO(Check(ip->_localvarinfos,ip->_nlocalvarinfos,sizeof(SQImageLocalVarInfo)));
+        _CHECK_IO(Check(ip->_lineinfos,ip->_nlineinfos,sizeof(SQLineInfo)));
+        _CHECK_IO(Check(ip->_defaultparams,ip->_ndefaultparams,sizeof(SQInteger)));
+        _CHECK_IO(Check(ip->_instructions,ip->_ninstructions,sizeof(SQInstruction)));
+        _CHECK_IO(Check(ip->_functions,ip->_nfunctions,sizeof(SQUnsignedInteger)));
+
+        SQFunctionProto *f = SQFunctionProto::CreateMapped(_ss(_v),_holder,
+            At<SQInstruction>(ip->_instructions),ip->_ninstructions,ip->_nliterals,ip->_nparameters,
+            ip->_nfunctions,ip->_noutervalues,At<SQLineInfo>(ip->_lineinfos),ip->_nlineinfos,
+            ip->_nlocalvarinfos,ip->_ndefaultparams);
+        SQObjectPtr proto = f; //gets a ref in case of failure
+        _CHECK_IO(Object(ip->_sourcename,f->_sourcename));
+        _CHECK_IO(Object(ip->_name,f->_name));
+        const SQImageObject *literals = At<SQImageObject>(ip->_literals);
+        for(i = 0; i < ip->_nliterals; i++) _CHECK_IO(Object(literals[i],f->_literals[i]));
+        const SQImageObject *parameters = At<SQImageObject>(ip->_parameters);
+        for(i = 0; i < ip->_nparameters; i++) _CHECK_IO(Object(parameters[i],f->_parameters[i]));
+        const SQImageOuterVar *outervalues = At<SQImageOuterVar>(ip->_outervalues);
+        for(i = 0; i < ip->_noutervalues; i++) {
+            SQOuterVar &ov = f->_outervalues[i];
+            ov._type = (SQOuterType)outervalues[i]._type;
+            _CHECK_IO(Object(outervalues[i]._name,ov._name));
+            _CHECK_IO(Object(outervalues[i]._src,ov._src));
+        }
+        const SQImageLocalVarInfo *localvarinfos = At<SQImageLocalVarInfo>(ip->_localvarinfos);
+        for(i = 0; i < ip->_nlocalvarinfos; i++) {
+            SQLocalVarInfo &lvi = f->_localvarinfos[i];
+            _CHECK_IO(Object(localvarinfos[i]._name,lvi._name));
+            lvi._start_op = localvarinfos[i]._start_op;
+            lvi._end_op = localvarinfos[i]._end_op;
+            lvi._pos = localvarinfos[i]._pos;
+        }
+        if(ip->_ndefaultparams) memcpy(f->_defaultparams,At<SQInteger>(ip->_defaultparams),ip->_ndefaultparams * sizeof(SQInteger));
+        const SQUnsignedInteger *functions = At<SQUnsignedInteger>(ip->_functions);
+        for(i = 0; i < ip->_nfunctions; i++) _CHECK_IO(Proto(functions[i],depth + 1,f->_functions[i]));
+        f->_stacksize = ip->_stacksize;
+        f->_bgenerator = ip->_bgenerator ? true : false;
+        f->_varparams = ip->_varparams;
+        _table(_protos)->NewSlot(SQObjectPtr((SQInteger)off),proto);
+        ret = f;
+        return true;
+    }
+    SQVM *_v;
+    unsigned char *_base;
+    SQUnsignedInteger _size;
+    SQUnsignedInteger _stringoffs;
+    SQObjectPtr _holder;
+    SQObjectPtr _protos;
+    sqvector<SQObjectPtr> _strings;
+};
+
+//validates the header and hands the image over to a holder, from here on the holder owns it
+//and release() runs when the last function using it dies
+static bool OpenImage(SQVM *v,SQUserPointer image,SQInteger size,SQRELEASEHOOK release,SQImageReader &r)
+{
+    SQUserData *ud = SQUserData::Create(_ss(v),sizeof(SQImageHolder));
+    SQImageHolder *h = (SQImageHolder *)sq_aligning(ud + 1);
+    h->_image = image;
+    h->_size = size;
+    h->_release = release;
+    ud->_hook = image_releasehook;
+
+    r._v = v;
+    r._holder = ud;
+    r._protos = SQTable::Create(_ss(v),0);
+    r._base = (unsigned char *)image;
+    r._size = size < 0 ? 0 : (SQUnsignedInteger)size;
+    if(((size_t)image & (SQ_IMAGE_ALIGNMENT - 1)) || r._size < sizeof(SQImageHeader))
+        return r.Error();
+    const SQImageHeader *hdr = r.At<SQImageHeader>(0);
+    if(hdr->_tag != SQ_BYTECODE_IMAGE_TAG || hdr->_magic != SQ_BYTECODE_IMAGE_MAGIC || hdr->_endian != SQ_BYTECODE_IMAGE_ENDIAN)
+        return r.Error();
+    if(hdr->_version != SQ_BYTECODE_IMAGE_VERSION) {
+        v->Raise_Error(_SC("unsupported bytecode image version %d"),(SQInteger)hdr->_version);
+        return false;
+    }
+    if(hdr->_charsize != sizeof(SQChar) || hdr->_intsize != sizeof(SQInteger)
+        || hdr->_floatsize != sizeof(SQFloat) || hdr->_instrsize != sizeof(SQInstruction)) {
+        v->Raise_Error(_SC("the bytecode image was built for a different configuration"));
+        return false;
+    }
+    if(hdr->_size > r._size) return r.Error();
+    r._size = hdr->_size;
+    _CHECK_IO(r.Check(hdr->_strings,hdr->_nstrings,sizeof(SQUnsignedInteger)));
+    r._stringoffs = hdr->_strings;
+    r._strings.resize(hdr->_nstrings);
+    return true;
+}
+
+bool SQFunctionProto::LoadImage(SQVM *v,SQUserPointer image,SQInteger size,SQRELEASEHOOK release,SQObjectPtr &ret)
+{
+    SQImageReader r;
+    _CHECK_IO(OpenImage(v,image,size,release,r));
+    return r.Proto(r.At<SQImageHeader>(0)->_root,0,ret);
+}
 
-#define START_MARK()    if(!(_uiRef&MARK_FLAG)){ \
-        _uiRef|=MARK_FLAG;
+//object graphs: a compact stream of tables, arrays, instances and plain values.
+//every string, table, array and instance gets an index the first time it is written,
+//later occurrences only write that index so shared references and cycles survive the trip.
+#define SQ_OBJECTSTREAM_NULL        0
+#define SQ_OBJECTSTREAM_TRUE        1
+#define SQ_OBJECTSTREAM_FALSE       2
+#define SQ_OBJECTSTREAM_INTEGER     3
+#define SQ_OBJECTSTREAM_FLOAT32     4
+#define SQ_OBJECTSTREAM_FLOAT64     5
+#define SQ_OBJECTSTREAM_STRING      6
+#define SQ_OBJECTSTREAM_TABLE       7
+#define SQ_OBJECTSTREAM_ARRAY       8
+#define SQ_OBJECTSTREAM_INSTANCE    9
+#define SQ_OBJECTSTREAM_REF         10
+
+//floats are stored little endian
+static void LittleEndian(unsigned char *b,SQInteger size)
+{
+    SQUnsignedInteger32 one = 1;
+    if(*(unsigned char *)&one) return;
+    for(SQInteger i = 0; i < size / 2; i++) {
+        unsigned char t = b[i]; b[i] = b[size - 1 - i]; b[size - 1 - i] = t;
+    }
+}
 
-#define END_MARK() RemoveFromChain(&_sharedstate->_gc_chain, this); \
-        AddToChain(chain, this); }
+struct SQObjectGraphWriter
+{
+    SQObjectGraphWriter(SQVM *v)
+    {
+        _v = v;
+        _refs = SQTable::Create(_ss(v),0);
+        _nrefs = 0;
+    }
+    void Byte(unsigned char b) { _buf.push_back(b); }
+    void Bytes(const void *p,SQUnsignedInteger size)
+    {
+        SQUnsignedInteger off = _buf.size();
+        _buf.resize(off + size);
+        if(size) memcpy(&_buf[off],p,size);
+    }
+    void UInt(SQUnsignedInteger n)
+    {
+        while(n >= 0x80) { Byte((unsigned char)(n | 0x80)); n >>= 7; }
+        Byte((unsigned char)n);
+    }
+    //zigzag, small negative numbers stay short too
+    void Int(SQInteger i)
+    {
+        UInt(((SQUnsignedInteger)i << 1) ^ (SQUnsignedInteger)(i >> (sizeof(SQInteger) * 8 - 1)));
+    }
+    void Float(SQFloat f)
+    {
+        unsigned char b[sizeof(SQFloat)];
+        memcpy(b,&f,sizeof(SQFloat));
+        LittleEndian(b,sizeof(SQFloat));
+        Byte(sizeof(SQFloat) == sizeof(float) ? SQ_OBJECTSTREAM_FLOAT32 : SQ_OBJECTSTREAM_FLOAT64);
+        Bytes(b,sizeof(SQFloat));
+    }
+    //writes a back reference if o was already written, otherwise gives it the next index
+    bool Ref(const SQObjectPtr &o)
+    {
+        SQObjectPtr idx;
+        if(_table(_refs)->Get(o,idx)) {
+            Byte(SQ_OBJECTSTREAM_REF);
+            UInt((SQUnsignedInteger)_integer(idx));
+            return true;
+        }
+        _table(_refs)->NewSlot(o,SQObjectPtr(_nrefs++));
+        return false;
+    }
+    bool Error(const SQChar *err,const SQObjectPtr &o)
+    {
+        _v->Raise_Error(err,GetTypeName(o));
+        return false;
+    }
+    bool ClassName(SQClass *c,SQObjectPtr &name)
+    {
+        if(sq_type(_classnames) == OT_NULL) {
+            //reverse the name->class table once, the first time an instance shows up
+            _classnames = SQTable::Create(_ss(_v),0);
+            if(sq_type(_classes) == OT_TABLE) {
+                SQObjectPtr refpos,key,val;
+                SQInteger idx;
+                while((idx = _table(_classes)->Next(false,refpos,key,val)) != -1) {
+                    if(sq_type(val) == OT_CLASS && sq_type(key) == OT_STRING)
+                        _table(_classnames)->NewSlot(val,key);
+                    refpos = idx;
+                }
+            }
+        }
+        return _table(_classnames)->Get(SQObjectPtr(c),name);
+    }
+    bool Value(const SQObjectPtr &o,SQInteger depth)
+    {
+        SQObjectPtr refpos,key,val;
+        SQInteger idx;
+        switch(sq_type(o)){
+        case OT_NULL: Byte(SQ_OBJECTSTREAM_NULL); break;
+        case OT_BOOL: Byte(_integer(o) ? SQ_OBJECTSTREAM_TRUE : SQ_OBJECTSTREAM_FALSE); break;
+        case OT_INTEGER: Byte(SQ_OBJECTSTREAM_INTEGER); Int(_integer(o)); break;
+        case OT_FLOAT: Float(_float(o)); break;
+        case OT_STRING:
+            if(Ref(o)) break;
+            Byte(SQ_OBJECTSTREAM_STRING);
+            UInt((SQUnsignedInteger)_string(o)->_len);
+            Bytes(_stringval(o),sq_rsl(_string(o)->_len));
+            break;
+        case OT_TABLE:
+            if(Ref(o)) break;
+            if(depth >= SQ_OBJECTSTREAM_MAXDEPTH) return Error(_SC("%s nested too deeply"),o);
+            Byte(SQ_OBJECTSTREAM_TABLE);
+            UInt((SQUnsignedInteger)_table(o)->CountUsed());
+            while((idx = _table(o)->Next(false,refpos,key,val)) != -1) {
+                _CHECK_IO(Value(key,depth + 1));
+                _CHECK_IO(Value(val,depth + 1));
+                refpos = idx;
+            }
+            break;
+        case OT_ARRAY: {
+            if(Ref(o)) break;
+            if(depth >= SQ_OBJECTSTREAM_MAXDEPTH) return Error(_SC("%s nested too deeply"),o);
+            SQObjectPtrVec &values = _array(o)->_values;
+            Byte(SQ_OBJECTSTREAM_ARRAY);
+            UInt((SQUnsignedInteger)values.size());
+            for(SQUnsignedInteger i = 0; i < values.size(); i++) {
+                _CHECK_IO(Value(_realval(values[i]),depth + 1));
+            }
+                       }
+            break;
+        case OT_INSTANCE: {
+            if(Ref(o)) break;
+            if(depth >= SQ_OBJECTSTREAM_MAXDEPTH) return Error(_SC("%s nested too deeply"),o);
+            SQInstance *inst = _instance(o);
+            SQClass *c = inst->_class;
+            SQObjectPtr name;
+            if(inst->_userpointer) return Error(_SC("cannot serialize an %s of a native class"),o);
+            if(!ClassName(c,name)) return Error(_SC("cannot serialize an %s of an unnamed class"),o);
+            Byte(SQ_OBJECTSTREAM_INSTANCE);
+            _CHECK_IO(Value(name,depth + 1));
+            SQInteger nfields = 0;
+            while((idx = c->_members->Next(false,refpos,key,val)) != -1) {
+                if(_isfield(val)) nfields++;
+                refpos = idx;
+            }
+            UInt((SQUnsignedInteger)nfields);
+            refpos.Null();
+            SQObjectPtr member;
+            while((idx = c->_members->Next(false,refpos,key,member)) != -1) {
+                if(_isfield(member)) {
+                    _CHECK_IO(Value(key,depth + 1));
+                    _CHECK_IO(Value(_realval(inst->_values[_member_idx(member)]),depth + 1));
+                }
+                refpos = idx;
+            }
+                          }
+            break;
+        default:
+            return Error(_SC("cannot serialize a %s"),o);
+        }
+        return true;
+    }
+    SQVM *_v;
+    sqvector<unsigned char> _buf;
+    SQObjectPtr _refs;
+    SQInteger _nrefs;
+    SQObjectPtr _classes;
+    SQObjectPtr _classnames;
+};
+
+//header: tag, version, char size and payload length, so that the reader can fetch the payload at once
+static bool WritePayload(SQVM *v,unsigned short tag,unsigned char version,sqvector<unsigned char> &payload,SQUserPointer up,SQWRITEFUNC write)
+{
+    SQObjectGraphWriter h(v);
+    h.Bytes(&tag,sizeof(tag));
+    h.Byte(version);
+    h.Byte((unsigned char)sizeof(SQChar));
+    h.UInt((SQUnsignedInteger)payload.size());
+    _CHECK_IO(SafeWrite(v,write,up,&h._buf[0],h._buf.size()));
+    if(payload.size()) _CHECK_IO(SafeWrite(v,write,up,&payload[0],payload.size()));
+    return true;
+}
+
+bool WriteObjectGraph(SQVM *v,const SQObjectPtr &o,const SQObjectPtr &classes,SQUserPointer up,SQWRITEFUNC write)
+{
+    SQObjectGraphWriter w(v);
+    w._classes = classes;
+    _CHECK_IO(w.Value(o,0));
+    return WritePayload(v,SQ_OBJECT_STREAM_TAG,SQ_OBJECTSTREAM_VERSION,w._buf,up,write);
+}
+
+struct SQObjectGraphReader
+{
+    bool Error()
+    {
+        _v->Raise_Error(_SC("invalid or corrupted %s"),_what);
+        return false;
+    }
+    SQUnsignedInteger Left() { return (SQUnsignedInteger)(_end - _p); }
+    bool Byte(unsigned char &b)
+    {
+        if(_p == _end) return Error();
+        b = *_p++;
+        return true;
+    }
+    bool Raw(void *dest,SQInteger size)
+    {
+        if(Left() < (SQUnsignedInteger)size) return Error();
+        memcpy(dest,_p,size);
+        LittleEndian((unsigned char *)dest,size);
+        _p += size;
+        return true;
+    }
+    //values that do not fit an SQUnsignedInteger (eg. 64-bit data on a 32-bit build) are rejected
+    bool UInt(SQUnsignedInteger &n)
+    {
+        n = 0;
+        for(SQUnsignedInteger shift = 0; shift < sizeof(SQUnsignedInteger) * 8; shift += 7) {
+            unsigned char b;
+            _CHECK_IO(Byte(b));
+            if(((SQUnsignedInteger)(b & 0x7F) << shift) >> shift != (SQUnsignedInteger)(b & 0x7F)) return Error();
+            n |= (SQUnsignedInteger)(b & 0x7F) << shift;
+            if(!(b & 0x80)) return true;
+        }
+        return Error();
+    }
+    //a count of items that need at least 'itemsize' bytes each, checked against what is left
+    bool Count(SQInteger itemsize,SQInteger &n)
+    {
+        SQUnsignedInteger u;
+        _CHECK_IO(UInt(u));
+        if(u > Left() / (SQUnsignedInteger)itemsize) return Error();
+        n = (SQInteger)u;
+        return true;
+    }
+    bool Value(SQObjectPtr &o,SQInteger depth)
+    {
+        unsigned char t;
+        SQUnsignedInteger u;
+        SQInteger n;
+        _CHECK_IO(Byte(t));
+        switch(t){
+        case SQ_OBJECTSTREAM_NULL: o.Null(); break;
+        case SQ_OBJECTSTREAM_TRUE: o = true; break;
+        case SQ_OBJECTSTREAM_FALSE: o = false; break;
+        case SQ_OBJECTSTREAM_INTEGER:
+            _CHECK_IO(UInt(u));
+            o = (SQInteger)((u >> 1) ^ (~(u & 1) + 1));
+            break;
+        case SQ_OBJECTSTREAM_FLOAT32: {
+            float f;
+            _CHECK_IO(Raw(&f,sizeof(f)));
+            o = (SQFloat)f;
+                                      }
+            break;
+        case SQ_OBJECTSTREAM_FLOAT64: {
+            double f;
+            _CHECK_IO(Raw(&f,sizeof(f)));
+            o = (SQFloat)f;
+                                      }
+            break;
+        case SQ_OBJECTSTREAM_STRING: {
+            _CHECK_IO(Count(sizeof(SQChar),n));
+            //copied out because the payload is not SQChar aligned
+            SQChar *s = _ss(_v)->GetScratchPad(sq_rsl(n));
+            memcpy(s,_p,sq_rsl(n));
+            _p += sq_rsl(n);
+            o = SQString::Create(_ss(_v),s,n);
+            _refs.push_back(o);
+                                     }
+            break;
+        case SQ_OBJECTSTREAM_TABLE: {
+            if(depth >= SQ_OBJECTSTREAM_MAXDEPTH) return Error();
+            _CHECK_IO(Count(2,n));
+            SQTable *tbl = SQTable::Create(_ss(_v),n);
+            o = tbl;
+            _refs.push_back(o);
+            SQObjectPtr key,val;
+            for(SQInteger i = 0; i < n; i++) {
+                _CHECK_IO(Value(key,depth + 1));
+                _CHECK_IO(Value(val,depth + 1));
+                if(sq_type(key) == OT_NULL) return Error();
+                tbl->NewSlot(key,val);
+            }
+                                    }
+            break;
+        case SQ_OBJECTSTREAM_ARRAY: {
+            if(depth >= SQ_OBJECTSTREAM_MAXDEPTH) return Error();
+            _CHECK_IO(Count(1,n));
+            SQArray *arr = SQArray::Create(_ss(_v),n);
+            o = arr;
+            _refs.push_back(o);
+            for(SQInteger i = 0; i < n; i++) {
+                _CHECK_IO(Value(arr->_values[i],depth + 1));
+            }
+                                    }
+            break;
+        case SQ_OBJECTSTREAM_INSTANCE: {
+            if(depth >= SQ_OBJECTSTREAM_MAXDEPTH) return Error();
+            //the instance index comes before its class name, keep the slot until the class is known
+            SQUnsignedInteger self = _refs.size();
+            _refs.push_back(SQObjectPtr());
+            SQObjectPtr name,cls;
+            _CHECK_IO(Value(name,depth + 1));
+            if(sq_type(name) != OT_STRING) return Error();
+            if(sq_type(_classes) != OT_TABLE || !_table(_classes)->Get(name,cls) || sq_type(cls) != OT_CLASS) {
+                _v->Raise_Error(_SC("unknown class '%s' in object stream"),_stringval(name));
+                return false;
+            }
+            if(_class(cls)->_udsize) {
+                _v->Raise_Error(_SC("cannot deserialize an instance of the native class '%s'"),_stringval(name));
+                return false;
+            }
+            SQInstance *inst = _class(cls)->CreateInstance();
+            o = inst;
+            _refs[self] = o;
+            _CHECK_IO(Count(2,n));
+            SQObjectPtr key,val;
+            for(SQInteger i = 0; i < n; i++) {
+                _CHECK_IO(Value(key,depth + 1));
+                _CHECK_IO(Value(val,depth + 1));
+                //fields the class no longer has are dropped, new ones keep their default
+                inst->Set(key,val);
+            }
+                                       }
+            break;
+        case SQ_OBJECTSTREAM_REF:
+            _CHECK_IO(UInt(u));
+            if(u >= _refs.size() || sq_type(_refs[(SQUnsignedInteger)u]) == OT_NULL) return Error();
+            o = _refs[(SQUnsignedInteger)u];
+            break;
+        default:
+            return Error();
+        }
+        return true;
+    }
+    SQVM *_v;
+    const SQChar *_what;
+    const unsigned char *_p;
+    const unsigned char *_end;
+    sqvector<SQObjectPtr> _refs;
+    SQObjectPtr _classes;
+};
+
+static bool ReadPayload(SQVM *v,unsigned short expected,unsigned char version,const SQChar *what,SQUserPointer up,SQREADFUNC read,sqvector<unsigned char> &buf)
+{
+    unsigned short tag;
+    unsigned char hdr[2],b;
+    SQUnsignedInteger size = 0;
+    _CHECK_IO(SafeRead(v,read,up,&tag,sizeof(tag)));
+    _CHECK_IO(SafeRead(v,read,up,hdr,sizeof(hdr)));
+    if(tag != expected) {
+        v->Raise_Error(_SC("invalid %s"),what);
+        return false;
+    }
+    if(hdr[0] != version || hdr[1] != sizeof(SQChar)) {
+        v->Raise_Error(_SC("unsupported %s version or character size"),what);
+        return false;
+    }
+    SQUnsignedInteger shift = 0;
+    do {
+        if(shift >= sizeof(SQUnsignedInteger) * 8) {
+            v->Raise_Error(_SC("invalid or corrupted %s"),what);
+            return false;
+        }
+        _CHECK_IO(SafeRead(v,read,up,&b,1));
+        size |= (SQUnsignedInteger)(b & 0x7F) << shift;
+        shift += 7;
+    } while(b & 0x80);
+    //grown as the data arrives, so a corrupted length runs out of input before it runs out of memory
+    while(buf.size() < size) {
+        SQUnsignedInteger off = buf.size();
+        SQUnsignedInteger chunk = size - off;
+        if(chunk > off + 65536) chunk = off + 65536;
+        buf.resize(off + (SQUnsignedInteger)chunk);
+        _CHECK_IO(SafeRead(v,read,up,&buf[off],(SQInteger)chunk));
+    }
+    return true;
+}
 
-void SQVM::Mark(SQCollectable **chain)
+bool ReadObjectGraph(SQVM *v,const SQObjectPtr &classes,SQUserPointer up,SQREADFUNC read,SQObjectPtr &ret)
 {
-    START_MARK()
-        SQSharedState::MarkObject(_lasterror,chain);
-        SQSharedState::MarkObject(_errorhandler,chain);
-        SQSharedState::MarkObject(_debughook_closure,chain);
-        SQSharedState::MarkObject(_roottable, chain);
-        SQSharedState::MarkObject(temp_reg, chain);
-        for(SQUnsignedInteger i = 0; i < _stack.size(); i++) SQSharedState::MarkObject(_stack[i], chain);
-        for(SQInteger k = 0; k < _callsstacksize; k++) SQSharedState::MarkObject(_callsstack[k]._closure, chain);
-    END_MARK()
+    sqvector<unsigned char> buf;
+    _CHECK_IO(ReadPayload(v,SQ_OBJECT_STREAM_TAG,SQ_OBJECTSTREAM_VERSION,_SC("object stream"),up,read,buf));
+    SQObjectGraphReader r;
+    r._v = v;
+    r._what = _SC("object stream");
+    r._classes = classes;
+    r._p = buf.size() ? &buf[0] : NULL;
+    r._end = r._p + buf.size();
+    _CHECK_IO(r.Value(ret,0));
+    if(r._p != r._end) return r.Error();
+    return true;
 }
 
-void SQArray::Mark(SQCollectable **chain)
+//heap snapshots: everything reachable from the root table, the registry and the constants.
+//the payload lists every object first (what is needed to allocate it, dependencies always come
+//earlier in the list) and then the contents of each one, so that any graph, cycles included, is
+//rebuilt in two linear passes. Objects that belong to the host (native functions, native classes,
+//their instances, userdata and userpointers) are not written, they are looked up by name in a
+//bindings table when the snapshot is loaded.
+#define SQ_OBJECTSTREAM_WEAKREF     11
+
+#define SQ_SNAPSHOT_BINDING         0
+#define SQ_SNAPSHOT_STRING          1
+#define SQ_SNAPSHOT_TABLE           2
+#define SQ_SNAPSHOT_ARRAY           3
+#define SQ_SNAPSHOT_USERDATA        4
+#define SQ_SNAPSHOT_OUTER           5
+#define SQ_SNAPSHOT_FUNCPROTO       6
+#define SQ_SNAPSHOT_CLOSURE         7
+#define SQ_SNAPSHOT_NATIVECLOSURE   8
+#define SQ_SNAPSHOT_CLASS           9
+#define SQ_SNAPSHOT_INSTANCE        10
+#define SQ_SNAPSHOT_WEAKTABLE       11
+
+#define SQ_BINDINGS_MAXDEPTH        8
+
+struct SQBindingCollector
+{
+    SQBindingCollector(SQVM *v,SQTable *out)
+    {
+        _v = v;
+        _out = out;
+        _seen = SQTable::Create(_ss(v),0);
+    }
+    void Walk(const SQObjectPtr &o,SQInteger depth)
+    {
+        SQObjectPtr refpos,key,val;
+        SQInteger idx;
+        SQTable *members = sq_type(o) == OT_CLASS ? _class(o)->_members : _table(o);
+        while((idx = members->Next(false,refpos,key,val)) != -1) {
+            refpos = idx;
+            if(sq_type(key) != OT_STRING) continue;
+            if(sq_type(o) == OT_CLASS) _class(o)->Get(key,val);
+            SQUnsignedInteger len = _path.size();
+            if(depth) _path.push_back(_SC('.'));
+            for(SQInteger i = 0; i < _string(key)->_len; i++) _path.push_back(_stringval(key)[i]);
+            switch(sq_type(val)) {
+            case OT_NATIVECLOSURE: case OT_CLASS: case OT_INSTANCE: case OT_USERDATA: case OT_USERPOINTER:
+                _out->NewSlot(SQString::Create(_ss(_v),&_path[0],_path.size()),val);
+                break;
+            default: break;
+            }
+            if((sq_type(val) == OT_TABLE || sq_type(val) == OT_CLASS) && depth < SQ_BINDINGS_MAXDEPTH) {
+                SQObjectPtr dummy;
+                if(!_table(_seen)->Get(val,dummy)) {
+                    _table(_seen)->NewSlot(val,dummy);
+                    Walk(val,depth + 1);
+                }
+            }
+            _path.resize(len);
+        }
+    }
+    void Root(const SQObjectPtr &o,const SQChar *prefix)
+    {
+        _path.resize(0);
+        while(*prefix) _path.push_back(*prefix++);
+        _table(_seen)->NewSlot(o,SQObjectPtr());
+        Walk(o,0);
+    }
+    SQVM *_v;
+    SQTable *_out;
+    SQObjectPtr _seen;
+    sqvector<SQChar> _path;
+};
+
+void CollectBindings(SQVM *v,SQObjectPtr &ret)
 {
-    START_MARK()
-        SQInteger len = _values.size();
-        for(SQInteger i = 0;i < len; i++) SQSharedState::MarkObject(_values[i], chain);
-    END_MARK()
+    SQTable *out = SQTable::Create(_ss(v),0);
+    ret = out;
+    SQBindingCollector c(v,out);
+    c.Root(v->_roottable,_SC(""));
+    c.Root(_ss(v)->_registry,_SC("@"));
+    c.Root(_ss(v)->_consts,_SC("$"));
 }
-void SQTable::Mark(SQCollectable **chain)
+
+struct SQSnapshotWriter
 {
-    START_MARK()
-        if(_delegate) _delegate->Mark(chain);
-        SQInteger len = _numofnodes;
-        for(SQInteger i = 0; i < len; i++){
-            SQSharedState::MarkObject(_nodes[i].key, chain);
-            SQSharedState::MarkObject(_nodes[i].val, chain);
+    SQSnapshotWriter(SQVM *v,const SQObjectPtr &bindings) : _head(v),_body(v),_image(v)
+    {
+        _v = v;
+        _names = SQTable::Create(_ss(v),0);
+        _functions = SQTable::Create(_ss(v),0);
+        if(sq_type(bindings) != OT_TABLE) return;
+        //reversed: object -> name, and native function -> name for the closures that share it
+        SQObjectPtr refpos,key,val,dummy;
+        SQInteger idx;
+        while((idx = _table(bindings)->Next(false,refpos,key,val)) != -1) {
+            refpos = idx;
+            if(sq_type(key) != OT_STRING || !(ISREFCOUNTED(sq_type(val)) || sq_type(val) == OT_USERPOINTER)) continue;
+            if(!_table(_names)->Get(val,dummy)) _table(_names)->NewSlot(val,key);
+            if(sq_type(val) == OT_NATIVECLOSURE) {
+                SQObjectPtr fn((SQUserPointer)_nativeclosure(val)->_function);
+                if(!_table(_functions)->Get(fn,dummy)) _table(_functions)->NewSlot(fn,key);
+            }
+        }
+    }
+    bool Error(const SQChar *err,const SQObjectPtr &o)
+    {
+        _v->Raise_Error(err,GetTypeName(o));
+        return false;
+    }
+    SQUnsignedInteger Index(const SQObject &o)
+    {
+        SQObjectPtr idx;
+        _table(_head._refs)->Get(o,idx);
+        return (SQUnsignedInteger)_integer(idx);
+    }
+    void Add(const SQObjectPtr &o,unsigned char kind)
+    {
+        _table(_head._refs)->NewSlot(o,SQObjectPtr((SQInteger)_objs.size()));
+        _objs.push_back(o);
+        _kinds.push_back(kind);
+        _head.Byte(kind);
+    }
+    //gives o an index and writes what is needed to allocate it, the contents come later
+    bool Visit(const SQObjectPtr &o)
+    {
+        SQObjectPtr idx,name;
+        switch(sq_type(o)) {
+        case OT_NULL: case OT_BOOL: case OT_INTEGER: case OT_FLOAT: return true;
+        case OT_WEAKREF: return Visit(_weakref(o)->_obj);
+        default: break;
+        }
+        if(_table(_head._refs)->Get(o,idx)) return true;
+        if(_table(_names)->Get(o,name)) {
+            _CHECK_IO(Visit(name));
+            Add(o,SQ_SNAPSHOT_BINDING);
+            _head.UInt(Index(name));
+            return true;
         }
-    END_MARK()
+        switch(sq_type(o)) {
+        case OT_STRING:
+            Add(o,SQ_SNAPSHOT_STRING);
+            _head.UInt((SQUnsignedInteger)_string(o)->_len);
+            _head.Bytes(_stringval(o),sq_rsl(_string(o)->_len));
+            break;
+        case OT_TABLE:
+            Add(o,_table(o)->_weakmode ? SQ_SNAPSHOT_WEAKTABLE : SQ_SNAPSHOT_TABLE);
+            _head.UInt((SQUnsignedInteger)_table(o)->CountUsed());
+            if(_table(o)->_weakmode) _head.Byte(_table(o)->_weakmode);
+            break;
+        case OT_ARRAY:
+            Add(o,SQ_SNAPSHOT_ARRAY);
+            _head.UInt((SQUnsignedInteger)_array(o)->_values.size());
+            break;
+        case OT_USERDATA: {
+            SQUserData *ud = _userdata(o);
+            if(ud->_hook) return Error(_SC("cannot snapshot a %s with a release hook"),o);
+            Add(o,SQ_SNAPSHOT_USERDATA);
+            _head.UInt((SQUnsignedInteger)ud->_size);
+            _head.UInt((SQUnsignedInteger)ud->_typetag);
+            _head.Bytes(_userdataval(o),ud->_size);
+                          }
+            break;
+        case OT_OUTER:
+            if(_outer(o)->_valptr != &_outer(o)->_value) return Error(_SC("cannot snapshot an open %s"),o);
+            Add(o,SQ_SNAPSHOT_OUTER);
+            break;
+        case OT_FUNCPROTO: {
+            SQUnsignedInteger off;
+            _CHECK_IO(_image.Proto(_funcproto(o),off));
+            Add(o,SQ_SNAPSHOT_FUNCPROTO);
+            _head.UInt(off);
+                           }
+            break;
+        case OT_CLOSURE: {
+            SQObjectPtr proto(_closure(o)->_function);
+            _CHECK_IO(Visit(proto));
+            Add(o,SQ_SNAPSHOT_CLOSURE);
+            _head.UInt(Index(proto));
+                         }
+            break;
+        case OT_NATIVECLOSURE:
+            if(!_table(_functions)->Get(SQObjectPtr((SQUserPointer)_nativeclosure(o)->_function),name)) {
+                SQObjectPtr &fname = _nativeclosure(o)->_name;
+                _v->Raise_Error(_SC("cannot snapshot the unbound native function '%s'"),
+                    sq_type(fname) == OT_STRING ? _stringval(fname) : _SC("unknown"));
+                return false;
+            }
+            _CHECK_IO(Visit(name));
+            Add(o,SQ_SNAPSHOT_NATIVECLOSURE);
+            _head.UInt(Index(name));
+            _head.UInt(_nativeclosure(o)->_noutervalues);
+            break;
+        case OT_CLASS: {
+            SQClass *c = _class(o);
+            SQObjectPtr members(c->_members);
+            if(c->_hook) return Error(_SC("cannot snapshot a %s with a release hook"),o);
+            _CHECK_IO(Visit(members));
+            Add(o,SQ_SNAPSHOT_CLASS);
+            _head.UInt(Index(members));
+            _head.UInt(c->_defaultvalues.size());
+            _head.UInt(c->_methods.size());
+            _head.UInt((SQUnsignedInteger)c->_udsize);
+                       }
+            break;
+        case OT_INSTANCE: {
+            SQObjectPtr cls(_instance(o)->_class);
+            if(_instance(o)->_userpointer || _instance(o)->_hook)
+                return Error(_SC("cannot snapshot an unbound %s of a native class"),o);
+            _CHECK_IO(Visit(cls));
+            Add(o,SQ_SNAPSHOT_INSTANCE);
+            _head.UInt(Index(cls));
+                          }
+            break;
+        case OT_USERPOINTER:
+            return Error(_SC("cannot snapshot an unbound %s"),o);
+        default:
+            return Error(_SC("cannot snapshot a %s"),o);
+        }
+        return true;
+    }
+    bool Value(const SQObjectPtr &o)
+    {
+        _CHECK_IO(Visit(o));
+        switch(sq_type(o)) {
+        case OT_NULL: _body.Byte(SQ_OBJECTSTREAM_NULL); break;
+        case OT_BOOL: _body.Byte(_integer(o) ? SQ_OBJECTSTREAM_TRUE : SQ_OBJECTSTREAM_FALSE); break;
+        case OT_INTEGER: _body.Byte(SQ_OBJECTSTREAM_INTEGER); _body.Int(_integer(o)); break;
+        case OT_FLOAT: _body.Float(_float(o)); break;
+        case OT_WEAKREF:
+            if(sq_type(_weakref(o)->_obj) == OT_NULL) {
+                _body.Byte(SQ_OBJECTSTREAM_NULL);
+                break;
+            }
+            _body.Byte(SQ_OBJECTSTREAM_WEAKREF);
+            _body.UInt(Index(_weakref(o)->_obj));
+            break;
+        default:
+            _body.Byte(SQ_OBJECTSTREAM_REF);
+            _body.UInt(Index(o));
+            break;
+        }
+        return true;
+    }
+    bool Weak(SQWeakRef *w)
+    {
+        if(!w) {
+            _body.Byte(SQ_OBJECTSTREAM_NULL);
+            return true;
+        }
+        return Value(SQObjectPtr(w));
+    }
+    bool Values(SQObjectPtr *values,SQUnsignedInteger n)
+    {
+        for(SQUnsignedInteger i = 0; i < n; i++) _CHECK_IO(Value(values[i]));
+        return true;
+    }
+    bool Members(SQClassMemberVec &members)
+    {
+        for(SQUnsignedInteger i = 0; i < members.size(); i++) {
+            _CHECK_IO(Value(members[i].val));
+            _CHECK_IO(Value(members[i].attrs));
+        }
+        return true;
+    }
+    bool Class(SQClass *c)
+    {
+        if(c) return Value(SQObjectPtr(c));
+        _body.Byte(SQ_OBJECTSTREAM_NULL);
+        return true;
+    }
+    bool Delegate(SQTable *d)
+    {
+        if(d) return Value(SQObjectPtr(d));
+        _body.Byte(SQ_OBJECTSTREAM_NULL);
+        return true;
+    }
+    //the contents, whatever they reference and is not known yet is appended to the list
+    bool Contents(const SQObjectPtr &o,unsigned char kind)
+    {
+        switch(kind) {
+        case SQ_SNAPSHOT_TABLE: case SQ_SNAPSHOT_WEAKTABLE: {
+            SQObjectPtr refpos,key,val;
+            SQInteger idx;
+            _body.UInt((SQUnsignedInteger)_table(o)->CountUsed());
+            //weak references are kept as such
+            while((idx = _table(o)->Next(true,refpos,key,val)) != -1) {
+                _CHECK_IO(Value(key));
+                _CHECK_IO(Value(val));
+                refpos = idx;
+            }
+            return Delegate(_table(o)->_delegate);
+                                }
+        case SQ_SNAPSHOT_ARRAY:
+            return Values(_array(o)->_values._vals,_array(o)->_values.size());
+        case SQ_SNAPSHOT_USERDATA:
+            return Delegate(_userdata(o)->_delegate);
+        case SQ_SNAPSHOT_OUTER:
+            return Value(_outer(o)->_value);
+        case SQ_SNAPSHOT_CLOSURE: {
+            SQClosure *c = _closure(o);
+            _CHECK_IO(Weak(c->_root));
+            _CHECK_IO(Weak(c->_env));
+            _CHECK_IO(Class(c->_base));
+            _CHECK_IO(Values(c->_outervalues,c->_function->_noutervalues));
+            return Values(c->_defaultparams,c->_function->_ndefaultparams);
+                                  }
+        case SQ_SNAPSHOT_NATIVECLOSURE: {
+            SQNativeClosure *c = _nativeclosure(o);
+            _CHECK_IO(Values(c->_outervalues,c->_noutervalues));
+            _body.UInt(c->_typecheck.size());
+            for(SQUnsignedInteger i = 0; i < c->_typecheck.size(); i++) _body.Int(c->_typecheck[i]);
+            _body.Int(c->_nparamscheck);
+            _CHECK_IO(Value(c->_name));
+            return Weak(c->_env);
+                                        }
+        case SQ_SNAPSHOT_CLASS: {
+            SQClass *c = _class(o);
+            _CHECK_IO(Class(c->_base));
+            _CHECK_IO(Members(c->_defaultvalues));
+            _CHECK_IO(Members(c->_methods));
+            _body.UInt(MT_LAST);
+            _CHECK_IO(Values(c->_metamethods,MT_LAST));
+            _CHECK_IO(Value(c->_attributes));
+            _body.UInt((SQUnsignedInteger)c->_typetag);
+            _body.Int(c->_constructoridx);
+            _body.Byte(c->_locked ? 1 : 0);
+            return true;
+                                }
+        case SQ_SNAPSHOT_INSTANCE:
+            return Values(_instance(o)->_values,_instance(o)->_class->_defaultvalues.size());
+        default:
+            return true;
+        }
+    }
+    bool Write(const SQObjectPtr *roots,SQInteger nroots)
+    {
+        for(SQInteger i = 0; i < nroots; i++) _CHECK_IO(Visit(roots[i]));
+        for(SQUnsignedInteger i = 0; i < _objs.size(); i++) {
+            SQObjectPtr o = _objs[i];
+            _CHECK_IO(Contents(o,_kinds[i]));
+        }
+        for(SQInteger i = 0; i < nroots; i++) _CHECK_IO(Value(roots[i]));
+        return true;
+    }
+    SQVM *_v;
+    SQObjectGraphWriter _head;
+    SQObjectGraphWriter _body;
+    SQImageWriter _image;
+    sqvector<SQObjectPtr> _objs;
+    sqvector<unsigned char> _kinds;
+    SQObjectPtr _names;
+    SQObjectPtr _functions;
+};
+
+bool WriteSnapshot(SQVM *v,const SQObjectPtr &bindings,SQUserPointer up,SQWRITEFUNC write)
+{
+    SQObjectPtr roots[] = { v->_roottable, _ss(v)->_registry, _ss(v)->_consts };
+    SQSnapshotWriter w(v,bindings);
+    _CHECK_IO(w.Write(roots,sizeof(roots) / sizeof(roots[0])));
+    //all the functions go in a single bytecode image, loaded once and used in place
+    w._image.Finish(0);
+    SQObjectGraphWriter p(v);
+    p.Byte((unsigned char)sizeof(SQInteger));
+    p.Byte((unsigned char)sizeof(SQFloat));
+    p.UInt(w._image._buf.size());
+    p.Bytes(&w._image._buf[0],w._image._buf.size());
+    p.UInt(w._objs.size());
+    p.Bytes(w._head._buf.size() ? &w._head._buf[0] : NULL,w._head._buf.size());
+    p.Bytes(w._body._buf.size() ? &w._body._buf[0] : NULL,w._body._buf.size());
+    return WritePayload(v,SQ_SNAPSHOT_TAG,SQ_SNAPSHOT_VERSION,p._buf,up,write);
 }
 
-void SQClass::Mark(SQCollectable **chain)
+static SQInteger _snapshot_releaseimage(SQUserPointer p,SQInteger size)
 {
-    START_MARK()
-        _members->Mark(chain);
-        if(_base) _base->Mark(chain);
-        SQSharedState::MarkObject(_attributes, chain);
-        for(SQUnsignedInteger i =0; i< _defaultvalues.size(); i++) {
-            SQSharedState::MarkObject(_defaultvalues[i].val, chain);
-            SQSharedState::MarkObject(_defaultvalues[i].attrs, chain);
+    sq_vm_free(p,size);
+    return 1;
+}
+
+struct SQSnapshotReader : public SQObjectGraphReader
+{
+    //an index to an object of the given type created before 'limit'
+    bool Ref(SQUnsignedInteger limit,SQObjectType type,SQObjectPtr &o)
+    {
+        SQUnsignedInteger idx;
+        _CHECK_IO(UInt(idx));
+        if(idx >= limit || sq_type(_refs[idx]) != type) return Error();
+        o = _refs[idx];
+        return true;
+    }
+    bool Binding(SQUnsignedInteger limit,SQObjectPtr &o)
+    {
+        SQObjectPtr name;
+        _CHECK_IO(Ref(limit,OT_STRING,name));
+        if(sq_type(_bindings) != OT_TABLE || !_table(_bindings)->Get(name,o)) {
+            _v->Raise_Error(_SC("the binding '%s' is missing"),_stringval(name));
+            return false;
+        }
+        return true;
+    }
+    bool Create(SQUnsignedInteger i,unsigned char kind)
+    {
+        SQSharedState *ss = _ss(_v);
+        SQObjectPtr &o = _refs[i];
+        SQObjectPtr dep;
+        SQInteger n;
+        switch(kind) {
+        case SQ_SNAPSHOT_BINDING:
+            _CHECK_IO(Binding(i,o));
+            break;
+        case SQ_SNAPSHOT_STRING: {
+            _CHECK_IO(Count(sizeof(SQChar),n));
+            SQChar *s = ss->GetScratchPad(sq_rsl(n));
+            memcpy(s,_p,sq_rsl(n));
+            _p += sq_rsl(n);
+            o = SQString::Create(ss,s,n);
+                                 }
+            break;
+        case SQ_SNAPSHOT_TABLE:
+            _CHECK_IO(Count(2,n));
+            o = SQTable::Create(ss,n);
+            break;
+        case SQ_SNAPSHOT_WEAKTABLE: {
+            unsigned char mode;
+            _CHECK_IO(Count(2,n));
+            _CHECK_IO(Byte(mode));
+            if(mode == 0 || !SQTable::IsWeakMode(mode)) return Error();
+            o = SQTable::Create(ss,n);
+            _table(o)->SetWeakMode(mode);
+                                    }
+            break;
+        case SQ_SNAPSHOT_ARRAY:
+            _CHECK_IO(Count(1,n));
+            o = SQArray::Create(ss,n);
+            break;
+        case SQ_SNAPSHOT_USERDATA: {
+            SQUnsignedInteger typetag;
+            _CHECK_IO(Count(1,n));
+            SQUserData *ud = SQUserData::Create(ss,n);
+            o = ud;
+            _CHECK_IO(UInt(typetag));
+            ud->_typetag = (SQUserPointer)typetag;
+            if(Left() < (SQUnsignedInteger)n) return Error();
+            memcpy(_userdataval(o),_p,n);
+            _p += n;
+                                   }
+            break;
+        case SQ_SNAPSHOT_OUTER: {
+            SQOuter *outer = SQOuter::Create(ss,NULL);
+            outer->_valptr = &outer->_value;
+            o = outer;
+                                }
+            break;
+        case SQ_SNAPSHOT_FUNCPROTO: {
+            SQUnsignedInteger off;
+            _CHECK_IO(UInt(off));
+            _CHECK_IO(_image.Proto(off,0,o));
+                                    }
+            break;
+        case SQ_SNAPSHOT_CLOSURE:
+            _CHECK_IO(Ref(i,OT_FUNCPROTO,dep));
+            //the root is fixed along with the contents
+            o = SQClosure::Create(ss,_funcproto(dep),_table(_v->_roottable)->GetWeakRef(OT_TABLE));
+            break;
+        case SQ_SNAPSHOT_NATIVECLOSURE:
+            _CHECK_IO(Binding(i,dep));
+            if(sq_type(dep) != OT_NATIVECLOSURE) return Error();
+            _CHECK_IO(Count(1,n));
+            o = SQNativeClosure::Create(ss,_nativeclosure(dep)->_function,n);
+            break;
+        case SQ_SNAPSHOT_CLASS: {
+            SQInteger nmethods;
+            SQUnsignedInteger udsize;
+            _CHECK_IO(Ref(i,OT_TABLE,dep));
+            SQClass *c = SQClass::Create(ss,NULL);
+            o = c;
+            __ObjRelease(c->_members);
+            c->_members = _table(dep);
+            __ObjAddRef(c->_members);
+            _CHECK_IO(Count(2,n));
+            c->_defaultvalues.resize(n);
+            _CHECK_IO(Count(2,nmethods));
+            c->_methods.resize(nmethods);
+            _CHECK_IO(UInt(udsize));
+            c->_udsize = (SQInteger)udsize;
+                                }
+            break;
+        case SQ_SNAPSHOT_INSTANCE:
+            _CHECK_IO(Ref(i,OT_CLASS,dep));
+            o = SQInstance::Create(ss,_class(dep));
+            break;
+        default:
+            return Error();
         }
-        for(SQUnsignedInteger j =0; j< _methods.size(); j++) {
-            SQSharedState::MarkObject(_methods[j].val, chain);
-            SQSharedState::MarkObject(_methods[j].attrs, chain);
+        return true;
+    }
+    bool Value(SQObjectPtr &o)
+    {
+        SQUnsignedInteger idx;
+        if(_p == _end) return Error();
+        if(*_p != SQ_OBJECTSTREAM_WEAKREF) {
+            if(*_p > SQ_OBJECTSTREAM_FLOAT64 && *_p != SQ_OBJECTSTREAM_REF) return Error();
+            return SQObjectGraphReader::Value(o,0);
+        }
+        _p++;
+        _CHECK_IO(UInt(idx));
+        if(idx >= _refs.size() || !ISREFCOUNTED(sq_type(_refs[idx]))) return Error();
+        o = _refcounted(_refs[idx])->GetWeakRef(sq_type(_refs[idx]));
+        return true;
+    }
+    bool Value(SQObjectType type,SQObjectPtr &o)
+    {
+        _CHECK_IO(Value(o));
+        if(sq_type(o) != type && sq_type(o) != OT_NULL) return Error();
+        return true;
+    }
+    bool Values(SQObjectPtr *values,SQUnsignedInteger n)
+    {
+        for(SQUnsignedInteger i = 0; i < n; i++) _CHECK_IO(Value(values[i]));
+        return true;
+    }
+    bool Members(SQClassMemberVec &members)
+    {
+        for(SQUnsignedInteger i = 0; i < members.size(); i++) {
+            _CHECK_IO(Value(members[i].val));
+            _CHECK_IO(Value(members[i].attrs));
         }
-        for(SQUnsignedInteger k =0; k< MT_LAST; k++) {
-            SQSharedState::MarkObject(_metamethods[k], chain);
+        return true;
+    }
+    bool Weak(SQWeakRef *&w)
+    {
+        SQObjectPtr o;
+        _CHECK_IO(Value(OT_WEAKREF,o));
+        if(sq_type(o) == OT_NULL) return true;
+        if(w) __ObjRelease(w);
+        w = _weakref(o);
+        __ObjAddRef(w);
+        return true;
+    }
+    bool Delegate(SQDelegable *d)
+    {
+        SQObjectPtr o;
+        _CHECK_IO(Value(OT_TABLE,o));
+        if(sq_type(o) == OT_TABLE) d->SetDelegate(_table(o));
+        return true;
+    }
+    bool Contents(SQObjectPtr &o,unsigned char kind)
+    {
+        SQInteger n;
+        SQObjectPtr tmp;
+        switch(kind) {
+        case SQ_SNAPSHOT_TABLE: case SQ_SNAPSHOT_WEAKTABLE: {
+            SQObjectPtr key,val;
+            _CHECK_IO(Count(2,n));
+            for(SQInteger i = 0; i < n; i++) {
+                _CHECK_IO(Value(key));
+                _CHECK_IO(Value(val));
+                if(sq_type(key) == OT_NULL) return Error();
+                _table(o)->NewSlot(key,val);
+            }
+            return Delegate(_table(o));
+                                }
+        case SQ_SNAPSHOT_ARRAY:
+            return Values(_array(o)->_values._vals,_array(o)->_values.size());
+        case SQ_SNAPSHOT_USERDATA:
+            return Delegate(_userdata(o));
+        case SQ_SNAPSHOT_OUTER:
+            return Value(_outer(o)->_value);
+        case SQ_SNAPSHOT_CLOSURE: {
+            SQClosure *c = _closure(o);
+            SQWeakRef *root = NULL;
+            _CHECK_IO(Weak(root));
+            if(root) {
+                if(sq_type(root->_obj) != OT_TABLE) { __ObjRelease(root); return Error(); }
+                c->SetRoot(root);
+                __ObjRelease(root);
+            }
+            _CHECK_IO(Weak(c->_env));
+            _CHECK_IO(Value(OT_CLASS,tmp));
+            if(sq_type(tmp) == OT_CLASS) {
+                c->_base = _class(tmp);
+                __ObjAddRef(c->_base);
+            }
+            _CHECK_IO(Values(c->_outervalues,c->_function->_noutervalues));
+            return Values(c->_defaultparams,c->_function->_ndefaultparams);
+                                  }
+        case SQ_SNAPSHOT_NATIVECLOSURE: {
+            SQNativeClosure *c = _nativeclosure(o);
+            SQUnsignedInteger u;
+            _CHECK_IO(Values(c->_outervalues,c->_noutervalues));
+            _CHECK_IO(Count(1,n));
+            for(SQInteger i = 0; i < n; i++) {
+                _CHECK_IO(UInt(u));
+                c->_typecheck.push_back((SQInteger)((u >> 1) ^ (~(u & 1) + 1)));
+            }
+            _CHECK_IO(UInt(u));
+            c->_nparamscheck = (SQInteger)((u >> 1) ^ (~(u & 1) + 1));
+            _CHECK_IO(Value(c->_name));
+            return Weak(c->_env);
+                                        }
+        case SQ_SNAPSHOT_CLASS: {
+            SQClass *c = _class(o);
+            SQUnsignedInteger u;
+            _CHECK_IO(Value(OT_CLASS,tmp));
+            if(sq_type(tmp) == OT_CLASS) {
+                c->_base = _class(tmp);
+                __ObjAddRef(c->_base);
+            }
+            _CHECK_IO(Members(c->_defaultvalues));
+            _CHECK_IO(Members(c->_methods));
+            _CHECK_IO(UInt(u));
+            if(u != MT_LAST) return Error();
+            _CHECK_IO(Values(c->_metamethods,MT_LAST));
+            _CHECK_IO(Value(c->_attributes));
+            _CHECK_IO(UInt(u));
+            c->_typetag = (SQUserPointer)u;
+            _CHECK_IO(UInt(u));
+            c->_constructoridx = (SQInteger)((u >> 1) ^ (~(u & 1) + 1));
+            if(c->_constructoridx < -1 || c->_constructoridx >= (SQInteger)c->_methods.size()) return Error();
+            unsigned char locked;
+            _CHECK_IO(Byte(locked));
+            c->_locked = locked != 0;
+            return true;
+                                }
+        case SQ_SNAPSHOT_INSTANCE:
+            return Values(_instance(o)->_values,_instance(o)->_class->_defaultvalues.size());
+        default:
+            return true;
         }
-    END_MARK()
+    }
+    SQObjectPtr _bindings;
+    SQImageReader _image;
+};
+
+bool ReadSnapshot(SQVM *v,const SQObjectPtr &bindings,SQUserPointer up,SQREADFUNC read)
+{
+    sqvector<unsigned char> buf;
+    _CHECK_IO(ReadPayload(v,SQ_SNAPSHOT_TAG,SQ_SNAPSHOT_VERSION,_SC("snapshot"),up,read,buf));
+    SQSnapshotReader r;
+    r._v = v;
+    r._what = _SC("snapshot");
+    r._bindings = bindings;
+    r._p = buf.size() ? &buf[0] : NULL;
+    r._end = r._p + buf.size();
+    unsigned char intsize,floatsize;
+    SQInteger n;
+    _CHECK_IO(r.Byte(intsize));
+    _CHECK_IO(r.Byte(floatsize));
+    if(intsize != sizeof(SQInteger) || floatsize != sizeof(SQFloat)) {
+        v->Raise_Error(_SC("the snapshot was written by a different configuration"));
+        return false;
+    }
+    //copied, the payload is not aligned and the functions keep pointing into the image
+    _CHECK_IO(r.Count(1,n));
+    SQUserPointer image = sq_vm_malloc(n);
+    memcpy(image,r._p,n);
+    r._p += n;
+    _CHECK_IO(OpenImage(v,image,n,_snapshot_releaseimage,r._image));
+    _CHECK_IO(r.Count(1,n));
+    r._refs.resize(n);
+    sqvector<unsigned char> kinds;
+    kinds.resize(n);
+    for(SQInteger i = 0; i < n; i++) {
+        _CHECK_IO(r.Byte(kinds[i]));
+        _CHECK_IO(r.Create(i,kinds[i]));
+    }
+    for(SQInteger i = 0; i < n; i++) {
+        _CHECK_IO(r.Contents(r._refs[i],kinds[i]));
+    }
+    SQObjectPtr root,registry,consts;
+    _CHECK_IO(r.Value(root));
+    _CHECK_IO(r.Value(registry));
+    _CHECK_IO(r.Value(consts));
+    if(r._p != r._end || sq_type(root) != OT_TABLE || sq_type(registry) != OT_TABLE || sq_type(consts) != OT_TABLE)
+        return r.Error();
+    //the root table is replaced, the closures of the snapshot point to it; registry and constants are merged
+    v->_roottable = root;
+    SQObjectPtr refpos,key,val;
+    SQInteger idx;
+    while((idx = _table(registry)->Next(true,refpos,key,val)) != -1) {
+        _table(_ss(v)->_registry)->NewSlot(key,val);
+        refpos = idx;
+    }
+    refpos.Null();
+    while((idx = _table(consts)->Next(true,refpos,key,val)) != -1) {
+        _table(_ss(v)->_consts)->NewSlot(key,val);
+        refpos = idx;
+    }
+    return true;
 }
 
-void SQInstance::Mark(SQCollectable **chain)
+//the whole graph is checked first, nothing is frozen if it contains something that cannot be
+bool FreezeObject(SQVM *v,const SQObjectPtr &o)
 {
-    START_MARK()
-        _class->Mark(chain);
-        SQUnsignedInteger nvalues = _class->_defaultvalues.size();
-        for(SQUnsignedInteger i =0; i< nvalues; i++) {
-            SQSharedState::MarkObject(_values[i], chain);
+    sqvector<SQObjectPtr> pending;
+    sqvector<SQObjectPtr> found;
+    SQObjectPtr visited = SQTable::Create(_ss(v),0);
+    SQObjectPtr cur,refpos,key,val;
+    SQInteger idx;
+    pending.push_back(o);
+    while(pending.size()) {
+        cur = pending.back();
+        pending.pop_back();
+        switch(sq_type(cur)) {
+        case OT_NULL: case OT_BOOL: case OT_INTEGER: case OT_FLOAT:
+        case OT_USERPOINTER: case OT_STRING:
+            break;
+        case OT_TABLE:
+            if(_table(cur)->_frozen || _table(visited)->Get(cur,val)) break;
+            if(_table(cur)->_weakmode) {
+                v->Raise_Error(_SC("cannot freeze a weak table"));
+                return false;
+            }
+            _table(visited)->NewSlot(cur,true);
+            found.push_back(cur);
+            if(_table(cur)->_delegate) pending.push_back(_table(cur)->_delegate);
+            refpos.Null();
+            while((idx = _table(cur)->Next(true,refpos,key,val)) != -1) {
+                pending.push_back(key);
+                pending.push_back(val);
+                refpos = idx;
+            }
+            break;
+        case OT_ARRAY:
+            if(_array(cur)->_frozen || _table(visited)->Get(cur,val)) break;
+            _table(visited)->NewSlot(cur,true);
+            found.push_back(cur);
+            for(SQUnsignedInteger i = 0; i < _array(cur)->_values.size(); i++)
+                pending.push_back(_array(cur)->_values[i]);
+            break;
+        default:
+            v->Raise_Error(_SC("cannot freeze a %s"),GetTypeName(cur));
+            return false;
         }
-    END_MARK()
+    }
+    for(SQUnsignedInteger i = 0; i < found.size(); i++) {
+        if(sq_type(found[i]) == OT_TABLE) _table(found[i])->_frozen = true;
+        else _array(found[i])->_frozen = true;
+    }
+    return true;
+}
+
+#ifndef NO_GARBAGE_COLLECTOR
+
+void SQVM::Mark(SQGCMarker *marker)
+{
+    SQSharedState::MarkObject(_lasterror,marker);
+    SQSharedState::MarkObject(_errorhandler,marker);
+    SQSharedState::MarkObject(_debughook_closure,marker);
+    SQSharedState::MarkObject(_roottable, marker);
+    SQSharedState::MarkObject(temp_reg, marker);
+    for(SQUnsignedInteger i = 0; i < _stack.size(); i++) SQSharedState::MarkObject(_stack[i], marker);
+    for(SQInteger k = 0; k < _callsstacksize; k++) SQSharedState::MarkObject(_callsstack[k]._closure, marker);
+}
+
+void SQArray::Mark(SQGCMarker *marker)
+{
+    SQInteger len = _values.size();
+    for(SQInteger i = 0;i < len; i++) SQSharedState::MarkObject(_values[i], marker);
+}
+void SQTable::Mark(SQGCMarker *marker)
+{
+    if(_delegate) marker->Push(_delegate);
+    for(SQInteger i = 0; i < _arraysize; i++) SQSharedState::MarkObject(_array[i], marker);
+    bool ephemeron = (_weakmode & SQ_WEAK_EPHEMERON) == SQ_WEAK_EPHEMERON, deferred = false;
+    SQInteger len = _numofnodes;
+    for(SQInteger i = 0; i < len; i++){
+        SQSharedState::MarkObject(_nodes[i].key, marker);
+        //the value of a weak key is marked once the key is known to be reachable
+        if(ephemeron && sq_type(_nodes[i].key) == OT_WEAKREF) deferred = true;
+        else SQSharedState::MarkObject(_nodes[i].val, marker);
+    }
+    if(deferred) marker->_ephemerons.push_back(this);
+}
+
+//marks the values of the keys marked so far, see SQSharedState::RunMark()
+void SQTable::MarkEphemerons(SQGCMarker *marker)
+{
+    for(SQInteger i = 0; i < _numofnodes; i++) {
+        _HashNode &n = _nodes[i];
+        if(sq_type(n.key) == OT_WEAKREF && SQSharedState::IsMarked(_weakref(n.key)->_obj))
+            SQSharedState::MarkObject(n.val, marker);
+    }
+}
+
+void SQClass::Mark(SQGCMarker *marker)
+{
+    marker->Push(_members);
+    if(_base) marker->Push(_base);
+    SQSharedState::MarkObject(_attributes, marker);
+    for(SQUnsignedInteger i =0; i< _defaultvalues.size(); i++) {
+        SQSharedState::MarkObject(_defaultvalues[i].val, marker);
+        SQSharedState::MarkObject(_defaultvalues[i].attrs, marker);
+    }
+    for(SQUnsignedInteger j =0; j< _methods.size(); j++) {
+        SQSharedState::MarkObject(_methods[j].val, marker);
+        SQSharedState::MarkObject(_methods[j].attrs, marker);
+    }
+    for(SQUnsignedInteger k =0; k< MT_LAST; k++) {
+        SQSharedState::MarkObject(_metamethods[k], marker);
+    }
+}
+
+void SQInstance::Mark(SQGCMarker *marker)
+{
+    marker->Push(_class);
+    SQUnsignedInteger nvalues = _class->_defaultvalues.size();
+    for(SQUnsignedInteger i =0; i< nvalues; i++) {
+        SQSharedState::MarkObject(_values[i], marker);
+    }
 }
 
-void SQGenerator::Mark(SQCollectable **chain)
+void SQGenerator::Mark(SQGCMarker *marker)
 {
-    START_MARK()
-        for(SQUnsignedInteger i = 0; i < _stack.size(); i++) SQSharedState::MarkObject(_stack[i], chain);
-        SQSharedState::MarkObject(_closure, chain);
-    END_MARK()
+    for(SQUnsignedInteger i = 0; i < _stack.size(); i++) SQSharedState::MarkObject(_stack[i], marker);
+    SQSharedState::MarkObject(_closure, marker);
 }
 
-void SQFunctionProto::Mark(SQCollectable **chain)
+void SQFunctionProto::Mark(SQGCMarker *marker)
 {
-    START_MARK()
-        for(SQInteger i = 0; i < _nliterals; i++) SQSharedState::MarkObject(_literals[i], chain);
-        for(SQInteger k = 0; k < _nfunctions; k++) SQSharedState::MarkObject(_functions[k], chain);
-    END_MARK()
+    for(SQInteger i = 0; i < _nliterals; i++) SQSharedState::MarkObject(_literals[i], marker);
+    for(SQInteger k = 0; k < _nfunctions; k++) SQSharedState::MarkObject(_functions[k], marker);
 }
 
-void SQClosure::Mark(SQCollectable **chain)
+void SQClosure::Mark(SQGCMarker *marker)
 {
-    START_MARK()
-        if(_base) _base->Mark(chain);
-        SQFunctionProto *fp = _function;
-        fp->Mark(chain);
-        for(SQInteger i = 0; i < fp->_noutervalues; i++) SQSharedState::MarkObject(_outervalues[i], chain);
-        for(SQInteger k = 0; k < fp->_ndefaultparams; k++) SQSharedState::MarkObject(_defaultparams[k], chain);
-    END_MARK()
+    if(_base) marker->Push(_base);
+    SQFunctionProto *fp = _function;
+    marker->Push(fp);
+    for(SQInteger i = 0; i < fp->_noutervalues; i++) SQSharedState::MarkObject(_outervalues[i], marker);
+    for(SQInteger k = 0; k < fp->_ndefaultparams; k++) SQSharedState::MarkObject(_defaultparams[k], marker);
 }
 
-void SQNativeClosure::Mark(SQCollectable **chain)
+void SQNativeClosure::Mark(SQGCMarker *marker)
 {
-    START_MARK()
-        for(SQUnsignedInteger i = 0; i < _noutervalues; i++) SQSharedState::MarkObject(_outervalues[i], chain);
-    END_MARK()
+    for(SQUnsignedInteger i = 0; i < _noutervalues; i++) SQSharedState::MarkObject(_outervalues[i], marker);
 }
 
-void SQOuter::Mark(SQCollectable **chain)
+void SQOuter::Mark(SQGCMarker *marker)
 {
-    START_MARK()
     /* If the valptr points to a closed value, that value is alive */
     if(_valptr == &_value) {
-      SQSharedState::MarkObject(_value, chain);
+      SQSharedState::MarkObject(_value, marker);
     }
-    END_MARK()
 }
 
-void SQUserData::Mark(SQCollectable **chain){
-    START_MARK()
-        if(_delegate) _delegate->Mark(chain);
-    END_MARK()
+void SQUserData::Mark(SQGCMarker *marker){
+    if(_delegate) marker->Push(_delegate);
 }
 
 void SQCollectable::UnMark() { _uiRef&=~MARK_FLAG; }
@@ -3,6 +3,9 @@
 #define _SQOBJECT_H_
 
 #include "squtils.h"
+#if SQ_GC_THREADS > 1
+#include <atomic>
+#endif
 
 #ifdef _SQ64
 #define UINT_MINUS_ONE (0xFFFFFFFFFFFFFFFF)
@@ -13,6 +16,13 @@
 #define SQ_CLOSURESTREAM_HEAD (('S'<<24)|('Q'<<16)|('I'<<8)|('R'))
 #define SQ_CLOSURESTREAM_PART (('P'<<24)|('A'<<16)|('R'<<8)|('T'))
 #define SQ_CLOSURESTREAM_TAIL (('T'<<24)|('A'<<16)|('I'<<8)|('L'))
+//follows the head tag so that older VMs reject newer streams; streams written before it
+//was added have sizeof(SQChar) there and are still loaded
+#define SQ_CLOSURESTREAM_VERSION (('V'<<24)|('E'<<16)|('R'<<8)|2)
+
+#define SQ_OBJECTSTREAM_VERSION 1
+#define SQ_OBJECTSTREAM_MAXDEPTH 1024
+#define SQ_SNAPSHOT_VERSION 1
 
 struct SQSharedState;
 
@@ -95,37 +105,55 @@ struct SQRefCounted
 
 };
 
+//a slot of a weak table that holds a weak reference, see SQTable::_Purge()
+struct SQWeakEntry
+{
+    struct SQTable *_table;
+    SQObject _key;
+    SQWeakEntry *_next;
+};
+
 struct SQWeakRef : SQRefCounted
 {
+    SQWeakRef() { _entries = NULL; }
     void Release();
+    void AddEntry(SQTable *t,const SQObject &key);
+    void RemoveEntry(SQTable *t,const SQObject &key);
+    void PurgeEntries();
     SQObject _obj;
+    //the weak tables slots to remove when _obj dies
+    SQWeakEntry *_entries;
 };
 
 #define _realval(o) (sq_type((o)) != OT_WEAKREF?(SQObject)o:_weakref(o)->_obj)
 
 struct SQObjectPtr;
 
-#define __AddRef(type,unval) if(ISREFCOUNTED(type)) \
+//objects shared between VMs (see sq_share) are immortal, their reference count is never
+//modified so that any thread can hold references to them without synchronization
+#define SQ_IMMORTAL_FLAG 0x40000000
+#define ISIMMORTAL(obj) ((obj)->_uiRef&SQ_IMMORTAL_FLAG)
+
+#define __AddRef(type,unval) if(ISREFCOUNTED(type) && !ISIMMORTAL(unval.pRefCounted)) \
         { \
             unval.pRefCounted->_uiRef++; \
         }
 
-#define __Release(type,unval) if(ISREFCOUNTED(type) && ((--unval.pRefCounted->_uiRef)==0))  \
+#define __Release(type,unval) if(ISREFCOUNTED(type) && !ISIMMORTAL(unval.pRefCounted) && ((--unval.pRefCounted->_uiRef)==0))  \
         {   \
             unval.pRefCounted->Release();   \
         }
 
 #define __ObjRelease(obj) { \
     if((obj)) { \
-        (obj)->_uiRef--; \
-        if((obj)->_uiRef == 0) \
+        if(!ISIMMORTAL(obj) && --(obj)->_uiRef == 0) \
             (obj)->Release(); \
         (obj) = NULL;   \
     } \
 }
 
 #define __ObjAddRef(obj) { \
-    (obj)->_uiRef++; \
+    if(!ISIMMORTAL(obj)) (obj)->_uiRef++; \
 }
 
 #define is_delegable(t) (sq_type(t)&SQOBJECT_DELEGABLE)
@@ -171,7 +199,7 @@ struct SQObjectPtr;
         _type=type; \
         _unVal.sym = x; \
         assert(_unVal.pTable); \
-        _unVal.pRefCounted->_uiRef++; \
+        __ObjAddRef(_unVal.pRefCounted); \
     } \
     inline SQObjectPtr& operator=(_class *x) \
     {  \
@@ -182,7 +210,7 @@ struct SQObjectPtr;
         _type = type; \
         SQ_REFOBJECT_INIT() \
         _unVal.sym = x; \
-        _unVal.pRefCounted->_uiRef++; \
+        __ObjAddRef(_unVal.pRefCounted); \
         __Release(tOldType,unOldVal); \
         return *this; \
     }
@@ -310,13 +338,29 @@ inline void _Swap(SQObject &a,SQObject &b)
 /////////////////////////////////////////////////////////////////////////////////////
 #ifndef NO_GARBAGE_COLLECTOR
 #define MARK_FLAG 0x80000000
+struct SQGCMarker;
 struct SQCollectable : public SQRefCounted {
     SQCollectable *_next;
     SQCollectable *_prev;
     SQSharedState *_sharedstate;
     virtual SQObjectType GetType()=0;
     virtual void Release()=0;
-    virtual void Mark(SQCollectable **chain)=0;
+    //pushes the objects referenced by this one on the marker
+    virtual void Mark(SQGCMarker *marker)=0;
+    //sets the mark flag, returns false if the object was already marked
+    inline bool SetMark()
+    {
+        //immortal objects belong to no VM and only reference other immortal objects
+#if SQ_GC_THREADS > 1
+        std::atomic<SQUnsignedInteger> *ref = reinterpret_cast<std::atomic<SQUnsignedInteger> *>(&_uiRef);
+        if(ref->load(std::memory_order_relaxed)&(MARK_FLAG|SQ_IMMORTAL_FLAG)) return false;
+        return !(ref->fetch_or(MARK_FLAG,std::memory_order_relaxed)&MARK_FLAG);
+#else
+        if(_uiRef&(MARK_FLAG|SQ_IMMORTAL_FLAG)) return false;
+        _uiRef|=MARK_FLAG;
+        return true;
+#endif
+    }
     void UnMark();
     virtual void Finalize()=0;
     static void AddToChain(SQCollectable **chain,SQCollectable *c);
@@ -347,6 +391,12 @@ typedef sqvector<SQObjectPtr> SQObjectPtrVec;
 typedef sqvector<SQInteger> SQIntVec;
 const SQChar *GetTypeName(const SQObjectPtr &obj1);
 const SQChar *IdType2Name(SQObjectType type);
+bool WriteObjectGraph(SQVM *v,const SQObjectPtr &o,const SQObjectPtr &classes,SQUserPointer up,SQWRITEFUNC write);
+bool ReadObjectGraph(SQVM *v,const SQObjectPtr &classes,SQUserPointer up,SQREADFUNC read,SQObjectPtr &ret);
+void CollectBindings(SQVM *v,SQObjectPtr &ret);
+bool WriteSnapshot(SQVM *v,const SQObjectPtr &bindings,SQUserPointer up,SQWRITEFUNC write);
+bool ReadSnapshot(SQVM *v,const SQObjectPtr &bindings,SQUserPointer up,SQREADFUNC read);
+bool FreezeObject(SQVM *v,const SQObjectPtr &o);
 
 
 
@@ -28,6 +28,15 @@ enum NewObjectType {
     NOT_CLASS = 2
 };
 
+//_OP_NEWOBJ NOT_CLASS: arg1 packs the stack slot of the base class (MAX_FUNC_STACKSIZE if none)
+//with the number of fields and methods in the class body; -1 (older bytecode) means no base and no sizes
+#define NEWCLASS_MAXFIELDS 0xFFF
+#define NEWCLASS_MAXMETHODS 0x7FF
+#define _newclass_arg(base,nfields,nmethods) ((SQInteger)(((base)&0xFF)|((nfields)<<8)|((nmethods)<<20)))
+#define _newclass_base(arg) (((arg) < 0 || ((arg)&0xFF) == MAX_FUNC_STACKSIZE) ? -1 : (SQInteger)((arg)&0xFF))
+#define _newclass_nfields(arg) ((arg) < 0 ? 0 : (SQInteger)(((arg)>>8)&NEWCLASS_MAXFIELDS))
+#define _newclass_nmethods(arg) ((arg) < 0 ? 0 : (SQInteger)(((arg)>>20)&NEWCLASS_MAXMETHODS))
+
 enum AppendArrayType {
     AAT_STACK = 0,
     AAT_LITERAL = 1,
@@ -11,6 +11,10 @@
 #include "sqarray.h"
 #include "squserdata.h"
 #include "sqclass.h"
+#if SQ_GC_THREADS > 1
+#include <thread>
+#include <mutex>
+#endif
 
 SQSharedState::SQSharedState()
 {
@@ -21,6 +25,7 @@ SQSharedState::SQSharedState()
     _notifyallexceptions = false;
     _foreignptr = NULL;
     _releasehook = NULL;
+    _frozenheap = NULL;
 }
 
 #define newsysstring(s) {   \
@@ -207,6 +212,97 @@ SQSharedState::~SQSharedState()
     sq_delete(_metamethods,SQObjectPtrVec);
     sq_delete(_stringtable,SQStringTable);
     if(_scratchpad)SQ_FREE(_scratchpad,_scratchpadsize);
+    //last, the objects of this state could reference the shared ones
+    if(_frozenheap) _frozenheap->Release();
+    for(SQUnsignedInteger i = 0; i < _attachedheaps.size(); i++)
+        _attachedheaps[i]->Release();
+}
+
+//makes a frozen graph immortal: its objects leave the garbage collector and their reference
+//counts are not touched anymore, so other VMs can use them from other threads
+void SQSharedState::Share(const SQObjectPtr &o)
+{
+    sqvector<SQObject> pending;
+    SQObjectPtr refpos,key,val;
+    SQInteger idx;
+    pending.push_back(o);
+    while(pending.size()) {
+        SQObject cur = pending.back();
+        pending.pop_back();
+        if(!ISREFCOUNTED(sq_type(cur)) || ISIMMORTAL(_refcounted(cur))) continue;
+        switch(sq_type(cur)) {
+        case OT_TABLE: {
+            SQTable *t = _table(cur);
+            t->Unshare();
+            t->_sharedkeys = true;
+            if(t->_delegate) pending.push_back(SQObjectPtr(t->_delegate));
+            refpos.Null();
+            while((idx = t->Next(true,refpos,key,val)) != -1) {
+                pending.push_back(key);
+                pending.push_back(val);
+                refpos = idx;
+            }
+#ifndef NO_GARBAGE_COLLECTOR
+            SQCollectable::RemoveFromChain(&_gc_chain,t);
+#endif
+            }
+            break;
+        case OT_ARRAY: {
+            SQArray *a = _array(cur);
+            a->Unshare();
+            for(SQUnsignedInteger i = 0; i < a->_values.size(); i++)
+                pending.push_back(a->_values[i]);
+#ifndef NO_GARBAGE_COLLECTOR
+            SQCollectable::RemoveFromChain(&_gc_chain,a);
+#endif
+            }
+            break;
+        default: break; //strings
+        }
+        key.Null();
+        val.Null();
+        //the weak references already taken are left pointing to it, it outlives them
+        _refcounted(cur)->_weakref = NULL;
+        _refcounted(cur)->_uiRef = SQ_IMMORTAL_FLAG;
+        if(!_frozenheap) sq_new(_frozenheap,SQFrozenHeap);
+        _frozenheap->_objects.push_back(cur);
+    }
+}
+
+void SQSharedState::Attach(SQFrozenHeap *heap)
+{
+    if(heap == _frozenheap) return;
+    for(SQUnsignedInteger i = 0; i < _attachedheaps.size(); i++)
+        if(_attachedheaps[i] == heap) return;
+    heap->AddRef();
+    _attachedheaps.push_back(heap);
+}
+
+void SQFrozenHeap::Release()
+{
+    if(_refs.fetch_sub(1,std::memory_order_acq_rel) != 1) return;
+    //the objects only reference each other, all the references are dropped before freeing any
+    for(SQUnsignedInteger i = 0; i < _objects.size(); i++) {
+        SQObject &o = _objects[i];
+        if(sq_type(o) == OT_TABLE) _table(o)->Finalize();
+        else if(sq_type(o) == OT_ARRAY) _array(o)->Finalize();
+    }
+    for(SQUnsignedInteger i = 0; i < _objects.size(); i++) {
+        SQObject &o = _objects[i];
+        if(sq_type(o) == OT_STRING) {
+            SQString *s = _string(o);
+            SQInteger len = s->_len;
+            s->~SQString();
+            SQ_FREE(s,sizeof(SQString) + sq_rsl(len));
+        }
+        else {
+#ifndef NO_GARBAGE_COLLECTOR
+            _refcounted(o)->_uiRef |= MARK_FLAG; //not in any chain
+#endif
+            _refcounted(o)->Release();
+        }
+    }
+    sq_delete(this,SQFrozenHeap);
 }
 
 
@@ -223,45 +319,198 @@ SQInteger SQSharedState::GetMetaMethodIdxByName(const SQObjectPtr &name)
 
 #ifndef NO_GARBAGE_COLLECTOR
 
-void SQSharedState::MarkObject(SQObjectPtr &o,SQCollectable **chain)
+void SQSharedState::MarkObject(SQObjectPtr &o,SQGCMarker *marker)
 {
     switch(sq_type(o)){
-    case OT_TABLE:_table(o)->Mark(chain);break;
-    case OT_ARRAY:_array(o)->Mark(chain);break;
-    case OT_USERDATA:_userdata(o)->Mark(chain);break;
-    case OT_CLOSURE:_closure(o)->Mark(chain);break;
-    case OT_NATIVECLOSURE:_nativeclosure(o)->Mark(chain);break;
-    case OT_GENERATOR:_generator(o)->Mark(chain);break;
-    case OT_THREAD:_thread(o)->Mark(chain);break;
-    case OT_CLASS:_class(o)->Mark(chain);break;
-    case OT_INSTANCE:_instance(o)->Mark(chain);break;
-    case OT_OUTER:_outer(o)->Mark(chain);break;
-    case OT_FUNCPROTO:_funcproto(o)->Mark(chain);break;
+    case OT_TABLE:marker->Push(_table(o));break;
+    case OT_ARRAY:marker->Push(_array(o));break;
+    case OT_USERDATA:marker->Push(_userdata(o));break;
+    case OT_CLOSURE:marker->Push(_closure(o));break;
+    case OT_NATIVECLOSURE:marker->Push(_nativeclosure(o));break;
+    case OT_GENERATOR:marker->Push(_generator(o));break;
+    case OT_THREAD:marker->Push(_thread(o));break;
+    case OT_CLASS:marker->Push(_class(o));break;
+    case OT_INSTANCE:marker->Push(_instance(o));break;
+    case OT_OUTER:marker->Push(_outer(o));break;
+    case OT_FUNCPROTO:marker->Push(_funcproto(o));break;
     default: break; //shutup compiler
     }
 }
 
-void SQSharedState::RunMark(SQVM* SQ_UNUSED_ARG(vm),SQCollectable **tchain)
+//false if o is collectable and was not reached by the marking
+bool SQSharedState::IsMarked(const SQObject &o)
 {
-    SQVM *vms = _thread(_root_vm);
+    switch(sq_type(o)){
+    case OT_TABLE: case OT_ARRAY: case OT_USERDATA: case OT_CLOSURE: case OT_NATIVECLOSURE:
+    case OT_GENERATOR: case OT_THREAD: case OT_CLASS: case OT_INSTANCE: case OT_OUTER: case OT_FUNCPROTO:
+        return (_refcounted(o)->_uiRef & (MARK_FLAG|SQ_IMMORTAL_FLAG)) != 0;
+    default: return true;
+    }
+}
 
-    vms->Mark(tchain);
+//visits up to 'budget' objects (all of them if budget is negative), returns true when no work is left
+bool SQGCMarker::Drain(SQInteger budget)
+{
+    while(!_stack.empty()) {
+        if(budget-- == 0) return false;
+        SQCollectable *o = _stack.back();
+        _stack.pop_back();
+        o->Mark(this);
+    }
+    return true;
+}
+
+#if SQ_GC_THREADS > 1
+//objects the collecting thread marks alone before starting the helper threads,
+//small heaps are collected without paying for the threads
+#define SQ_GC_SERIAL_MARKS 4096
+//a marker shares half of its stack when it has more than this and its shared stack is empty
+#define SQ_GC_SHARE_MIN 64
 
-    _refs_table.Mark(tchain);
-    MarkObject(_registry,tchain);
-    MarkObject(_consts,tchain);
-    MarkObject(_metamethodsmap,tchain);
-    MarkObject(_table_default_delegate,tchain);
-    MarkObject(_array_default_delegate,tchain);
-    MarkObject(_string_default_delegate,tchain);
-    MarkObject(_number_default_delegate,tchain);
-    MarkObject(_generator_default_delegate,tchain);
-    MarkObject(_thread_default_delegate,tchain);
-    MarkObject(_closure_default_delegate,tchain);
-    MarkObject(_class_default_delegate,tchain);
-    MarkObject(_instance_default_delegate,tchain);
-    MarkObject(_weakref_default_delegate,tchain);
+struct SQGCWorker
+{
+    SQGCWorker() : _nshared(0) {}
+    SQGCMarker _marker;
+    std::mutex _lock;
+    sqvector<SQCollectable *> _shared;
+    std::atomic<SQUnsignedInteger> _nshared;
+};
+
+//marking split across SQ_GC_THREADS markers, idle markers steal from the shared stacks of the others
+struct SQGCParallelMark
+{
+    SQGCParallelMark() : _idle(0) {}
+    void Run(SQInteger id);
+    void Share(SQGCWorker &w);
+    bool Steal(SQInteger id);
+    SQGCWorker _workers[SQ_GC_THREADS];
+    std::atomic<SQInteger> _idle;
+};
+
+void SQGCParallelMark::Share(SQGCWorker &w)
+{
+    sqvector<SQCollectable *> &st = w._marker._stack;
+    SQUnsignedInteger size = st.size(), n = size / 2;
+    std::lock_guard<std::mutex> lock(w._lock);
+    //the bottom of the stack holds the oldest and usually the largest pending subgraphs
+    for(SQUnsignedInteger i = 0; i < n; i++) w._shared.push_back(st[i]);
+    memmove(&st[0], &st[n], (size - n) * sizeof(SQCollectable *));
+    st.resize(size - n);
+    w._nshared.store(w._shared.size(), std::memory_order_release);
+}
+
+bool SQGCParallelMark::Steal(SQInteger id)
+{
+    sqvector<SQCollectable *> &st = _workers[id]._marker._stack;
+    for(SQInteger k = 0; k < SQ_GC_THREADS; k++) {
+        SQGCWorker &victim = _workers[(id + k) % SQ_GC_THREADS];
+        if(victim._nshared.load(std::memory_order_acquire) == 0) continue;
+        std::lock_guard<std::mutex> lock(victim._lock);
+        SQUnsignedInteger size = victim._shared.size();
+        if(size == 0) continue;
+        //the owner takes everything back, thieves take half
+        SQUnsignedInteger keep = k == 0 ? 0 : size / 2;
+        for(SQUnsignedInteger i = keep; i < size; i++) st.push_back(victim._shared[i]);
+        victim._shared.resize(keep);
+        victim._nshared.store(keep, std::memory_order_release);
+        return true;
+    }
+    return false;
+}
+
+void SQGCParallelMark::Run(SQInteger id)
+{
+    SQGCWorker &w = _workers[id];
+    sqvector<SQCollectable *> &st = w._marker._stack;
+    for(;;) {
+        while(!st.empty()) {
+            SQCollectable *o = st.back();
+            st.pop_back();
+            o->Mark(&w._marker);
+            if(st.size() > SQ_GC_SHARE_MIN && w._nshared.load(std::memory_order_relaxed) == 0)
+                Share(w);
+        }
+        if(Steal(id)) continue;
+        //a marker goes idle only with an empty shared stack and never shares while idle,
+        //so when all markers are idle no work is left anywhere
+        _idle.fetch_add(1);
+        bool found = false;
+        while(!found) {
+            if(_idle.load() == SQ_GC_THREADS) return;
+            for(SQInteger k = 0; k < SQ_GC_THREADS && !found; k++)
+                found = _workers[k]._nshared.load(std::memory_order_relaxed) != 0;
+            if(!found) std::this_thread::yield();
+        }
+        _idle.fetch_sub(1);
+    }
+}
 
+static void sq_gc_mark_thread(SQGCParallelMark *pm,SQInteger id)
+{
+    pm->Run(id);
+}
+#endif
+
+void SQSharedState::RunMark(SQVM* SQ_UNUSED_ARG(vm),SQCollectable **tchain)
+{
+    SQGCMarker marker;
+    marker.Push(_thread(_root_vm));
+
+    _refs_table.Mark(&marker);
+    MarkObject(_registry,&marker);
+    MarkObject(_consts,&marker);
+    MarkObject(_metamethodsmap,&marker);
+    MarkObject(_table_default_delegate,&marker);
+    MarkObject(_array_default_delegate,&marker);
+    MarkObject(_string_default_delegate,&marker);
+    MarkObject(_number_default_delegate,&marker);
+    MarkObject(_generator_default_delegate,&marker);
+    MarkObject(_thread_default_delegate,&marker);
+    MarkObject(_closure_default_delegate,&marker);
+    MarkObject(_class_default_delegate,&marker);
+    MarkObject(_instance_default_delegate,&marker);
+    MarkObject(_weakref_default_delegate,&marker);
+
+#if SQ_GC_THREADS > 1
+    if(!marker.Drain(SQ_GC_SERIAL_MARKS)) {
+        SQGCParallelMark *pm;
+        sq_new(pm,SQGCParallelMark);
+        for(SQUnsignedInteger i = 0; i < marker._stack.size(); i++)
+            pm->_workers[i % SQ_GC_THREADS]._marker._stack.push_back(marker._stack[i]);
+        marker._stack.resize(0);
+        std::thread helpers[SQ_GC_THREADS - 1];
+        for(SQInteger i = 1; i < SQ_GC_THREADS; i++) helpers[i - 1] = std::thread(sq_gc_mark_thread,pm,i);
+        pm->Run(0);
+        for(SQInteger i = 1; i < SQ_GC_THREADS; i++) helpers[i - 1].join();
+        for(SQInteger i = 0; i < SQ_GC_THREADS; i++) {
+            sqvector<SQTable *> &eph = pm->_workers[i]._marker._ephemerons;
+            for(SQUnsignedInteger k = 0; k < eph.size(); k++) marker._ephemerons.push_back(eph[k]);
+        }
+        sq_delete(pm,SQGCParallelMark);
+    }
+#else
+    marker.Drain(-1);
+#endif
+
+    //the values of the ephemeron tables are marked until no new key is reached
+    bool again = marker._ephemerons.size() > 0;
+    while(again) {
+        for(SQUnsignedInteger i = 0; i < marker._ephemerons.size(); i++)
+            marker._ephemerons[i]->MarkEphemerons(&marker);
+        again = !marker._stack.empty();
+        marker.Drain(-1);
+    }
+
+    //moves the reachable objects to tchain, _gc_chain keeps the unreachable ones
+    SQCollectable *t = _gc_chain;
+    while(t) {
+        SQCollectable *nx = t->_next;
+        if(t->_uiRef&MARK_FLAG) {
+            SQCollectable::RemoveFromChain(&_gc_chain,t);
+            SQCollectable::AddToChain(tchain,t);
+        }
+        t = nx;
+    }
 }
 
 SQInteger SQSharedState::ResurrectUnreachable(SQVM *vm)
@@ -409,12 +658,12 @@ RefTable::~RefTable()
 }
 
 #ifndef NO_GARBAGE_COLLECTOR
-void RefTable::Mark(SQCollectable **chain)
+void RefTable::Mark(SQGCMarker *marker)
 {
     RefNode *nodes = (RefNode *)_nodes;
     for(SQUnsignedInteger n = 0; n < _numofslots; n++) {
         if(sq_type(nodes->obj) != OT_NULL) {
-            SQSharedState::MarkObject(nodes->obj,chain);
+            SQSharedState::MarkObject(nodes->obj,marker);
         }
         nodes++;
     }
@@ -2,6 +2,7 @@
 #ifndef _SQSTATE_H_
 #define _SQSTATE_H_
 
+#include <atomic>
 #include "squtils.h"
 #include "sqobject.h"
 struct SQString;
@@ -24,6 +25,19 @@ private:
     SQSharedState *_sharedstate;
 };
 
+#ifndef NO_GARBAGE_COLLECTOR
+//objects that were marked but whose references were not visited yet;
+//marking is iterative so deep object graphs don't exhaust the native stack
+struct SQGCMarker
+{
+    inline void Push(SQCollectable *o) { if(o->SetMark()) _stack.push_back(o); }
+    bool Drain(SQInteger budget);
+    sqvector<SQCollectable *> _stack;
+    //ephemeron tables with values not marked yet
+    sqvector<SQTable *> _ephemerons;
+};
+#endif
+
 struct RefTable {
     struct RefNode {
         SQObjectPtr obj;
@@ -36,7 +50,7 @@ struct RefTable {
     SQBool Release(SQObject &obj);
     SQUnsignedInteger GetRefCount(SQObject &obj);
 #ifndef NO_GARBAGE_COLLECTOR
-    void Mark(SQCollectable **chain);
+    void Mark(SQGCMarker *marker);
 #endif
     void Finalize();
 private:
@@ -51,6 +65,25 @@ private:
     RefNode **_buckets;
 };
 
+//the objects a state made immortal to share them with other VMs (see sq_share); they are
+//freed when the state and all the VMs that received some of them have been closed
+struct SQFrozenHeap
+{
+    SQFrozenHeap() : _refs(1) {}
+    void AddRef() { _refs.fetch_add(1,std::memory_order_relaxed); }
+    void Release();
+    std::atomic<SQInteger> _refs;
+    sqvector<SQObject> _objects;
+};
+
+//an immortal object on its way to another VM, keeps alive the heaps it could belong to
+struct SQSharedObject
+{
+    SQObject _obj;
+    SQInteger _nheaps;
+    SQFrozenHeap *_heaps[1];
+};
+
 #define ADD_STRING(ss,str,len) ss->_stringtable->Add(str,len)
 #define REMOVE_STRING(ss,bstr) ss->_stringtable->Remove(bstr)
 
@@ -64,11 +97,14 @@ struct SQSharedState
 public:
     SQChar* GetScratchPad(SQInteger size);
     SQInteger GetMetaMethodIdxByName(const SQObjectPtr &name);
+    void Share(const SQObjectPtr &o);
+    void Attach(SQFrozenHeap *heap);
 #ifndef NO_GARBAGE_COLLECTOR
     SQInteger CollectGarbage(SQVM *vm);
     void RunMark(SQVM *vm,SQCollectable **tchain);
     SQInteger ResurrectUnreachable(SQVM *vm);
-    static void MarkObject(SQObjectPtr &o,SQCollectable **chain);
+    static void MarkObject(SQObjectPtr &o,SQGCMarker *marker);
+    static bool IsMarked(const SQObject &o);
 #endif
     SQObjectPtrVec *_metamethods;
     SQObjectPtr _metamethodsmap;
@@ -82,6 +118,8 @@ public:
 #ifndef NO_GARBAGE_COLLECTOR
     SQCollectable *_gc_chain;
 #endif
+    SQFrozenHeap *_frozenheap; //the objects shared by this state, NULL if none
+    sqvector<SQFrozenHeap *> _attachedheaps; //the ones of the objects received from other states
     SQObjectPtr _root_vm;
     SQObjectPtr _table_default_delegate;
     static const SQRegFunction _table_default_delegate_funcz[];
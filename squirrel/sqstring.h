@@ -26,6 +26,14 @@ public:
     SQChar _val[1];
 };
 
+//strings are interned so different strings have different contents, unless one of them
+//is shared with other VMs (see sq_share): those are not interned in the VMs using them
+inline bool _samestring(const SQString *a,const SQString *b)
+{
+    return a == b || (((a->_uiRef | b->_uiRef) & SQ_IMMORTAL_FLAG) && a->_hash == b->_hash
+        && a->_len == b->_len && memcmp(a->_val,b->_val,sq_rsl(a->_len)) == 0);
+}
+
 
 
 #endif //_SQSTRING_H_
@@ -10,19 +10,126 @@ see copyright notice in squirrel.h
 SQTable::SQTable(SQSharedState *ss,SQInteger nInitialSize)
 {
     SQInteger pow2size=MINPOWER2;
-    while(nInitialSize>pow2size)pow2size=pow2size<<1;
+    while(nInitialSize>pow2size && pow2size<MAXTABLECAPACITY)pow2size=pow2size<<1;
     AllocNodes(pow2size);
     _usednodes = 0;
+    _array = NULL;
+    _arraysize = 0;
+    _arrayused = 0;
+    _sharers = NULL;
+    _sharedkeys = false;
+    _frozen = false;
+    _weakmode = 0;
     _delegate = NULL;
     INIT_CHAIN();
     ADD_TO_CHAIN(&_sharedstate->_gc_chain,this);
 }
 
-void SQTable::Remove(const SQObjectPtr &key)
+//a clone of t that uses its nodes until one of the two is modified
+SQTable::SQTable(SQSharedState *ss,SQTable *t)
 {
+    _sharers = NULL;
+    if(ISIMMORTAL(t)) {
+        //other threads read t, it cannot be touched
+        _CopyNodes(t->_nodes,t->_numofnodes,t->_firstfree);
+        _CopyArray(t->_array,t->_arraysize);
+    }
+    else {
+        if(!t->_sharers) {
+            t->_sharers = (SQUnsignedInteger *)SQ_MALLOC(sizeof(SQUnsignedInteger));
+            *t->_sharers = 1;
+        }
+        (*t->_sharers)++;
+        _sharers = t->_sharers;
+        _nodes = t->_nodes;
+        _firstfree = t->_firstfree;
+        _numofnodes = t->_numofnodes;
+        _array = t->_array;
+        _arraysize = t->_arraysize;
+    }
+    _usednodes = t->_usednodes;
+    _arrayused = t->_arrayused;
+    _sharedkeys = t->_sharedkeys;
+    _frozen = false;
+    _weakmode = 0;
+    _delegate = NULL;
+    INIT_CHAIN();
+    ADD_TO_CHAIN(&_sharedstate->_gc_chain,this);
+}
 
+//stops sharing the nodes, returns true if other tables still use them
+bool SQTable::_ReleaseShared()
+{
+    if(!_sharers) return false;
+    if(--(*_sharers) == 0) {
+        SQ_FREE(_sharers,sizeof(SQUnsignedInteger));
+        _sharers = NULL;
+        return false;
+    }
+    _sharers = NULL;
+    return true;
+}
+
+//copies the nodes of another table without rehashing them
+void SQTable::_CopyNodes(_HashNode *src,SQInteger n,_HashNode *firstfree)
+{
+    AllocNodes(n);
+    for(SQInteger i = 0; i < n; i++) {
+        _nodes[i].key = src[i].key;
+        _nodes[i].val = src[i].val;
+        if(src[i].next) _nodes[i].next = _nodes + (src[i].next - src);
+    }
+    _firstfree = _nodes + (firstfree - src);
+}
+
+void SQTable::_CopyArray(SQObjectPtr *src,SQInteger n)
+{
+    _AllocArray(n);
+    for(SQInteger i = 0; i < n; i++) _array[i] = src[i];
+}
+
+void SQTable::_Unshare()
+{
+    if(!_ReleaseShared()) return; //the last table using the nodes keeps them
+    _CopyNodes(_nodes,_numofnodes,_firstfree);
+    _CopyArray(_array,_arraysize);
+}
+
+//slow path of _Get(), compares the strings by value
+SQTable::_HashNode *SQTable::_GetShared(const SQObjectPtr &key,SQHash hash)
+{
+    _HashNode *n = &_nodes[hash];
+    do{
+        if(sq_type(n->key) == OT_STRING && _samestring(_string(n->key),_string(key)))
+            return n;
+    }while((n = n->next));
+    return NULL;
+}
+
+void SQTable::FreeNodes()
+{
+    if(_ReleaseShared()) return;
+    for (SQInteger i = 0; i < _numofnodes; i++) _nodes[i].~_HashNode();
+    SQ_FREE(_nodes, _numofnodes * sizeof(_HashNode));
+    _FreeArray(_array,_arraysize);
+}
+
+void SQTable::_Remove(const SQObjectPtr &key)
+{
+    if(_InArray(key) && sq_type(_array[_integer(key)]) != OT_NULL) {
+        Unshare();
+        _array[_integer(key)].Null();
+        _arrayused--;
+        if(_arrayused <= _arraysize/4) Rehash(true); //shrinks the array part
+        return;
+    }
     _HashNode *n = _Get(key, HashObj(key) & (_numofnodes - 1));
     if (n) {
+        if(_sharers) {
+            SQInteger idx = n - _nodes;
+            _Unshare();
+            n = &_nodes[idx];
+        }
         n->val.Null();
         n->key.Null();
         _usednodes--;
@@ -43,64 +150,134 @@ void SQTable::AllocNodes(SQInteger nSize)
     _firstfree=&_nodes[_numofnodes-1];
 }
 
+void SQTable::_AllocArray(SQInteger n)
+{
+    SQObjectPtr *a = NULL;
+    if(n) a = (SQObjectPtr *)SQ_MALLOC(sizeof(SQObjectPtr)*n);
+    for(SQInteger i = 0; i < n; i++) new (&a[i]) SQObjectPtr;
+    _array = a;
+    _arraysize = n;
+}
+
+void SQTable::_FreeArray(SQObjectPtr *a,SQInteger n)
+{
+    if(!a) return;
+    for(SQInteger i = 0; i < n; i++) a[i].~SQObjectPtr();
+    SQ_FREE(a,n * sizeof(SQObjectPtr));
+}
+
+//counts k in nums[b], 2^(b-1) <= k < 2^b
+static void _CountArrayKey(SQInteger *nums,SQInteger k)
+{
+    SQInteger b = 0;
+    while(((SQInteger)1 << b) <= k) b++;
+    nums[b]++;
+}
+
+//the largest power of 2 n such that more than half of the keys 0..n-1 are used (Lua's computesizes()),
+//nhash receives the number of slots left for the hash part
+SQInteger SQTable::_ComputeArraySize(SQInteger &nhash)
+{
+    SQInteger nums[MAXARRAYBITS + 1];
+    SQInteger nints = 0;
+    //more than half of the array part is used, larger keys cannot be in it
+    SQInteger maxkey = 2 * CountUsed();
+    if(maxkey > ((SQInteger)1 << MAXARRAYBITS)) maxkey = (SQInteger)1 << MAXARRAYBITS;
+    for(SQInteger b = 0; b <= MAXARRAYBITS; b++) nums[b] = 0;
+    for(SQInteger i = 0; i < _arraysize && i < maxkey; i++) {
+        if(sq_type(_array[i]) != OT_NULL) { _CountArrayKey(nums,i); nints++; }
+    }
+    for(SQInteger i = 0; i < _numofnodes; i++) {
+        _HashNode &n = _nodes[i];
+        if(sq_type(n.key) == OT_INTEGER && sq_type(n.val) != OT_NULL
+            && _integer(n.key) >= 0 && _integer(n.key) < maxkey) {
+            _CountArrayKey(nums,_integer(n.key));
+            nints++;
+        }
+    }
+    SQInteger na = 0, inarray = 0, a = 0;
+    for(SQInteger b = 0, twotob = 1; b <= MAXARRAYBITS && twotob/2 < nints; b++, twotob <<= 1) {
+        a += nums[b];
+        if(a > twotob/2) {
+            na = twotob;
+            inarray = a;
+        }
+    }
+    nhash = CountUsed() - inarray;
+    return na;
+}
+
 void SQTable::Rehash(bool force)
 {
     SQInteger oldsize=_numofnodes;
     //prevent problems with the integer division
     if(oldsize<4)oldsize=4;
-    _HashNode *nold=_nodes;
-    SQInteger nelems=CountUsed();
-    if (nelems >= oldsize-oldsize/4)  /* using more than 3/4? */
-        AllocNodes(oldsize*2);
-    else if (nelems <= oldsize/4 &&  /* less than 1/4? */
-        oldsize > MINPOWER2)
-        AllocNodes(oldsize/2);
-    else if(force)
-        AllocNodes(oldsize);
-    else
+    SQInteger nelems=_usednodes;
+    if (!force &&
+        nelems < oldsize-oldsize/4 &&  /* using less than 3/4? */
+        (nelems > oldsize/4 || oldsize <= MINPOWER2))  /* and more than 1/4? */
         return;
+    //the integer keys are split again between the array and the hash part
+    SQInteger nhash;
+    SQInteger na = _ComputeArraySize(nhash);
+    SQInteger newsize = MINPOWER2;
+    while(nhash >= newsize-newsize/4) newsize <<= 1;
+    _Resize(newsize,na);
+}
+
+//moves the slots to newsize nodes and an array part of newarraysize values,
+//the old ones are freed unless other tables share them
+void SQTable::_Resize(SQInteger newsize,SQInteger newarraysize)
+{
+    SQInteger oldsize=_numofnodes,oldarraysize=_arraysize;
+    _HashNode *nold=_nodes;
+    SQObjectPtr *aold=_array;
+    bool shared = _ReleaseShared();
+    AllocNodes(newsize);
+    _AllocArray(newarraysize);
     _usednodes = 0;
+    _arrayused = 0;
+    for (SQInteger i=0; i<oldarraysize; i++) {
+        if (sq_type(aold[i]) != OT_NULL)
+            _NewSlot(SQObjectPtr(i),aold[i]);
+    }
     for (SQInteger i=0; i<oldsize; i++) {
         _HashNode *old = nold+i;
         if (sq_type(old->key) != OT_NULL)
-            NewSlot(old->key,old->val);
+            _NewSlot(old->key,old->val);
     }
+    if(shared) return;
     for(SQInteger k=0;k<oldsize;k++)
         nold[k].~_HashNode();
     SQ_FREE(nold,oldsize*sizeof(_HashNode));
+    _FreeArray(aold,oldarraysize);
+}
+
+//grows the table so that n slots fit without a rehash
+void SQTable::Reserve(SQInteger n)
+{
+    SQInteger pow2size=_numofnodes;
+    while(n>pow2size && pow2size<MAXTABLECAPACITY)pow2size=pow2size<<1;
+    if(pow2size>_numofnodes)
+        _Resize(pow2size,_arraysize);
 }
 
-SQTable *SQTable::Clone()
-{
-    SQTable *nt=Create(_opt_ss(this),_numofnodes);
-#ifdef _FAST_CLONE
-    _HashNode *basesrc = _nodes;
-    _HashNode *basedst = nt->_nodes;
-    _HashNode *src = _nodes;
-    _HashNode *dst = nt->_nodes;
-    SQInteger n = 0;
-    for(n = 0; n < _numofnodes; n++) {
-        dst->key = src->key;
-        dst->val = src->val;
-        if(src->next) {
-            assert(src->next > basesrc);
-            dst->next = basedst + (src->next - basesrc);
-            assert(dst != dst->next);
+SQTable *SQTable::Clone(SQSharedState *ss)
+{
+    SQTable *nt=(SQTable*)SQ_MALLOC(sizeof(SQTable));
+    if(_weakmode) {
+        //every weak slot is known by the weak references it holds, nothing is shared
+        new (nt) SQTable(ss,CountUsed());
+        nt->_weakmode = _weakmode;
+        SQObjectPtr refpos,key,val;
+        SQInteger idx;
+        while((idx = Next(true,refpos,key,val)) != -1) {
+            nt->_NewSlot(key,val);
+            nt->_AddEntries(key,val);
+            refpos = idx;
         }
-        dst++;
-        src++;
-    }
-    assert(_firstfree > basesrc);
-    assert(_firstfree != NULL);
-    nt->_firstfree = basedst + (_firstfree - basesrc);
-    nt->_usednodes = _usednodes;
-#else
-    SQInteger ridx=0;
-    SQObjectPtr key,val;
-    while((ridx=Next(true,ridx,key,val))!=-1){
-        nt->NewSlot(key,val);
-    }
-#endif
+    }
+    else new (nt) SQTable(ss,this);
     nt->SetDelegate(_delegate);
     return nt;
 }
@@ -109,6 +286,17 @@ bool SQTable::Get(const SQObjectPtr &key,SQObjectPtr &val)
 {
     if(sq_type(key) == OT_NULL)
         return false;
+    if(_weakmode & SQ_WEAK_KEYS) {
+        SQObjectPtr wkey;
+        SQObjectPtr *v;
+        if(!_WeakKey(key,wkey,false) || !(v = _Find(wkey))) return false;
+        val = _realval(*v);
+        return true;
+    }
+    if(_InArray(key) && sq_type(_array[_integer(key)]) != OT_NULL) {
+        val = _realval(_array[_integer(key)]);
+        return true;
+    }
     _HashNode *n = _Get(key, HashObj(key) & (_numofnodes - 1));
     if (n) {
         val = _realval(n->val);
@@ -116,9 +304,34 @@ bool SQTable::Get(const SQObjectPtr &key,SQObjectPtr &val)
     }
     return false;
 }
-bool SQTable::NewSlot(const SQObjectPtr &key,const SQObjectPtr &val)
+bool SQTable::_NewSlot(const SQObjectPtr &key,const SQObjectPtr &val)
 {
     assert(sq_type(key) != OT_NULL);
+    Unshare();
+    if(_InArray(key)) {
+        SQObjectPtr &slot = _array[_integer(key)];
+        if(sq_type(slot) != OT_NULL) {
+            if(sq_type(val) != OT_NULL) {
+                slot = val;
+                return false;
+            }
+            //null values are kept in the hash part
+            slot.Null();
+            _arrayused--;
+            _NewSlotHash(key,val);
+            return false;
+        }
+        if(sq_type(val) != OT_NULL && !_Get(key,HashObj(key) & (_numofnodes - 1))) {
+            slot = val;
+            _arrayused++;
+            return true;
+        }
+    }
+    return _NewSlotHash(key,val);
+}
+
+bool SQTable::_NewSlotHash(const SQObjectPtr &key,const SQObjectPtr &val)
+{
     SQHash h = HashObj(key) & (_numofnodes - 1);
     _HashNode *n = _Get(key, h);
     if (n) {
@@ -159,6 +372,7 @@ bool SQTable::NewSlot(const SQObjectPtr &key,const SQObjectPtr &val)
         }
     }
     mp->key = key;
+    if(sq_type(key) == OT_STRING && ISIMMORTAL(_string(key))) _sharedkeys = true;
 
     for (;;) {  /* correct `firstfree' */
         if (sq_type(_firstfree->key) == OT_NULL && _firstfree->next == NULL) {
@@ -170,17 +384,26 @@ bool SQTable::NewSlot(const SQObjectPtr &key,const SQObjectPtr &val)
         else (_firstfree)--;
     }
     Rehash(true);
-    return NewSlot(key, val);
+    return _NewSlot(key, val);
 }
 
 SQInteger SQTable::Next(bool getweakrefs,const SQObjectPtr &refpos, SQObjectPtr &outkey, SQObjectPtr &outval)
 {
     SQInteger idx = (SQInteger)TranslateIndex(refpos);
-    while (idx < _numofnodes) {
-        if(sq_type(_nodes[idx].key) != OT_NULL) {
+    //the array part comes first, then the nodes
+    while (idx < _arraysize) {
+        if(sq_type(_array[idx]) != OT_NULL) {
+            outkey = idx;
+            outval = getweakrefs?(SQObject)_array[idx]:_realval(_array[idx]);
+            return ++idx;
+        }
+        ++idx;
+    }
+    while (idx - _arraysize < _numofnodes) {
+        if(sq_type(_nodes[idx - _arraysize].key) != OT_NULL) {
             //first found
-            _HashNode &n = _nodes[idx];
-            outkey = n.key;
+            _HashNode &n = _nodes[idx - _arraysize];
+            outkey = getweakrefs || !(_weakmode & SQ_WEAK_KEYS)?(SQObject)n.key:_realval(n.key);
             outval = getweakrefs?(SQObject)n.val:_realval(n.val);
             //return idx for the next iteration
             return ++idx;
@@ -192,10 +415,27 @@ SQInteger SQTable::Next(bool getweakrefs,const SQObjectPtr &refpos, SQObjectPtr
 }
 
 
-bool SQTable::Set(const SQObjectPtr &key, const SQObjectPtr &val)
+bool SQTable::_Set(const SQObjectPtr &key, const SQObjectPtr &val)
 {
+    if(_InArray(key) && sq_type(_array[_integer(key)]) != OT_NULL) {
+        Unshare();
+        if(sq_type(val) != OT_NULL) {
+            _array[_integer(key)] = val;
+            return true;
+        }
+        //null values are kept in the hash part
+        _array[_integer(key)].Null();
+        _arrayused--;
+        _NewSlotHash(key,val);
+        return true;
+    }
     _HashNode *n = _Get(key, HashObj(key) & (_numofnodes - 1));
     if (n) {
+        if(_sharers) {
+            SQInteger idx = n - _nodes;
+            _Unshare();
+            n = &_nodes[idx];
+        }
         n->val = val;
         return true;
     }
@@ -205,17 +445,166 @@ bool SQTable::Set(const SQObjectPtr &key, const SQObjectPtr &val)
 void SQTable::_ClearNodes()
 {
     for(SQInteger i = 0;i < _numofnodes; i++) { _HashNode &n = _nodes[i]; n.key.Null(); n.val.Null(); }
+    for(SQInteger i = 0;i < _arraysize; i++) _array[i].Null();
+    _arrayused = 0;
 }
 
 void SQTable::Finalize()
 {
-    _ClearNodes();
+    if(_weakmode) _RemoveAllEntries();
+    //nodes still used by other tables are left alone
+    if(_ReleaseShared()) {
+        AllocNodes(MINPOWER2);
+        _usednodes = 0;
+        _array = NULL;
+        _arraysize = 0;
+        _arrayused = 0;
+    }
+    else _ClearNodes();
     SetDelegate(NULL);
 }
 
 void SQTable::Clear()
 {
+    if(_weakmode) _RemoveAllEntries();
+    if(_ReleaseShared()) {
+        AllocNodes(MINPOWER2);
+        _usednodes = 0;
+        _array = NULL;
+        _arraysize = 0;
+        _arrayused = 0;
+        return;
+    }
     _ClearNodes();
     _usednodes = 0;
     Rehash(true);
 }
+
+//WEAK TABLES
+//the weak keys and values are stored as weak references (the one cached in the object), each weak
+//reference keeps the list of the slots that hold it and removes them when its object dies
+
+static bool _isweakable(const SQObjectPtr &o)
+{
+    return ISREFCOUNTED(sq_type(o)) && sq_type(o) != OT_STRING && sq_type(o) != OT_WEAKREF
+        && !ISIMMORTAL(_refcounted(o)); //immortal objects never die
+}
+
+static bool _isdeadref(const SQObjectPtr &o)
+{
+    return sq_type(o) == OT_WEAKREF && sq_type(_weakref(o)->_obj) == OT_NULL;
+}
+
+SQObjectPtr *SQTable::_Find(const SQObjectPtr &key)
+{
+    if(_InArray(key) && sq_type(_array[_integer(key)]) != OT_NULL)
+        return &_array[_integer(key)];
+    _HashNode *n = _Get(key, HashObj(key) & (_numofnodes - 1));
+    return n ? &n->val : NULL;
+}
+
+//the key stored in the table for key, false if key cannot be in the table and create is false
+bool SQTable::_WeakKey(const SQObjectPtr &key,SQObjectPtr &wkey,bool create)
+{
+    if(!(_weakmode & SQ_WEAK_KEYS) || !_isweakable(key)) {
+        wkey = key;
+        return true;
+    }
+    if(!create && !_refcounted(key)->_weakref) return false;
+    wkey = _refcounted(key)->GetWeakRef(sq_type(key));
+    return true;
+}
+
+void SQTable::_WeakValue(const SQObjectPtr &val,SQObjectPtr &wval)
+{
+    if((_weakmode & SQ_WEAK_VALUES) && _isweakable(val))
+        wval = _refcounted(val)->GetWeakRef(sq_type(val));
+    else if(_isdeadref(val))
+        wval.Null();
+    else
+        wval = val;
+}
+
+void SQTable::_AddEntries(const SQObjectPtr &key,const SQObjectPtr &val)
+{
+    if((_weakmode & SQ_WEAK_KEYS) && sq_type(key) == OT_WEAKREF) _weakref(key)->AddEntry(this,key);
+    if((_weakmode & SQ_WEAK_VALUES) && sq_type(val) == OT_WEAKREF) _weakref(val)->AddEntry(this,key);
+}
+
+void SQTable::_RemoveEntries(const SQObjectPtr &key,const SQObjectPtr &val)
+{
+    if((_weakmode & SQ_WEAK_KEYS) && sq_type(key) == OT_WEAKREF) _weakref(key)->RemoveEntry(this,key);
+    if((_weakmode & SQ_WEAK_VALUES) && sq_type(val) == OT_WEAKREF) _weakref(val)->RemoveEntry(this,key);
+}
+
+void SQTable::_RemoveAllEntries()
+{
+    for(SQInteger i = 0; i < _arraysize; i++)
+        if(sq_type(_array[i]) != OT_NULL) _RemoveEntries(SQObjectPtr(i),_array[i]);
+    for(SQInteger i = 0; i < _numofnodes; i++)
+        if(sq_type(_nodes[i].key) != OT_NULL) _RemoveEntries(_nodes[i].key,_nodes[i].val);
+}
+
+bool SQTable::_WeakNewSlot(const SQObjectPtr &key,const SQObjectPtr &val)
+{
+    SQObjectPtr wkey,wval;
+    _WeakKey(key,wkey,true);
+    if(_isdeadref(wkey)) return false; //as if it was removed right away
+    _WeakValue(val,wval);
+    SQObjectPtr *old = _Find(wkey);
+    if(old) {
+        if((_weakmode & SQ_WEAK_VALUES) && sq_type(*old) == OT_WEAKREF) _weakref(*old)->RemoveEntry(this,wkey);
+        _NewSlot(wkey,wval);
+        if((_weakmode & SQ_WEAK_VALUES) && sq_type(wval) == OT_WEAKREF) _weakref(wval)->AddEntry(this,wkey);
+        return false;
+    }
+    _NewSlot(wkey,wval);
+    _AddEntries(wkey,wval);
+    return true;
+}
+
+bool SQTable::_WeakSet(const SQObjectPtr &key, const SQObjectPtr &val)
+{
+    SQObjectPtr wkey,wval;
+    SQObjectPtr *old;
+    if(!_WeakKey(key,wkey,false) || !(old = _Find(wkey))) return false;
+    _WeakValue(val,wval);
+    if((_weakmode & SQ_WEAK_VALUES) && sq_type(*old) == OT_WEAKREF) _weakref(*old)->RemoveEntry(this,wkey);
+    _Set(wkey,wval);
+    if((_weakmode & SQ_WEAK_VALUES) && sq_type(wval) == OT_WEAKREF) _weakref(wval)->AddEntry(this,wkey);
+    return true;
+}
+
+void SQTable::_WeakRemove(const SQObjectPtr &key)
+{
+    SQObjectPtr wkey;
+    SQObjectPtr *val;
+    if(!_WeakKey(key,wkey,false) || !(val = _Find(wkey))) return;
+    _RemoveEntries(wkey,*val);
+    _Remove(wkey);
+}
+
+//removes the slot of key because its key or its value died, called by SQWeakRef::PurgeEntries()
+void SQTable::_Purge(const SQObject &key)
+{
+    SQObjectPtr k = key;
+    SQObjectPtr *val = _Find(k);
+    if(!val) return;
+    _RemoveEntries(k,*val);
+    //no rehash, the table can be in the middle of an iteration
+    if(_InArray(k) && val == &_array[_integer(k)]) {
+        _arrayused--;
+        val->Null();
+        return;
+    }
+    _HashNode *n = _Get(k, HashObj(k) & (_numofnodes - 1));
+    _usednodes--;
+    n->key.Null();
+    n->val.Null();
+}
+
+void SQTable::SetWeakMode(SQInteger mode)
+{
+    Unshare();
+    _weakmode = (unsigned char)mode;
+}
@@ -11,6 +11,10 @@
 
 
 #define hashptr(p)  ((SQHash)(((SQInteger)p) >> 3))
+//integer keys above 2^MAXARRAYBITS are always stored in the hash part
+#define MAXARRAYBITS 30
+//largest number of slots a table can be created or reserved with
+#define MAXTABLECAPACITY ((SQInteger)1 << (sizeof(SQInteger) * 8 - 8))
 
 inline SQHash HashObj(const SQObjectPtr &key)
 {
@@ -36,12 +40,45 @@ private:
     _HashNode *_nodes;
     SQInteger _numofnodes;
     SQInteger _usednodes;
+    //array part, the non null values with the integer keys 0.._arraysize-1 (like Lua 5 tables)
+    SQObjectPtr *_array;
+    SQInteger _arraysize;
+    SQInteger _arrayused;
+    //clones share the nodes and the array part (copy on write), this counts the tables using them; NULL if never shared
+    SQUnsignedInteger *_sharers;
 
 ///////////////////////////
     void AllocNodes(SQInteger nSize);
+    void FreeNodes();
     void Rehash(bool force);
+    void _Resize(SQInteger newsize,SQInteger newarraysize);
+    SQInteger _ComputeArraySize(SQInteger &nhash);
+    void _AllocArray(SQInteger n);
+    void _FreeArray(SQObjectPtr *a,SQInteger n);
+    bool _NewSlotHash(const SQObjectPtr &key,const SQObjectPtr &val);
+    bool _NewSlot(const SQObjectPtr &key,const SQObjectPtr &val);
+    bool _Set(const SQObjectPtr &key, const SQObjectPtr &val);
+    void _Remove(const SQObjectPtr &key);
+    SQObjectPtr *_Find(const SQObjectPtr &key);
+    bool _WeakKey(const SQObjectPtr &key,SQObjectPtr &wkey,bool create);
+    void _WeakValue(const SQObjectPtr &val,SQObjectPtr &wval);
+    void _AddEntries(const SQObjectPtr &key,const SQObjectPtr &val);
+    void _RemoveEntries(const SQObjectPtr &key,const SQObjectPtr &val);
+    void _RemoveAllEntries();
+    bool _WeakNewSlot(const SQObjectPtr &key,const SQObjectPtr &val);
+    bool _WeakSet(const SQObjectPtr &key, const SQObjectPtr &val);
+    void _WeakRemove(const SQObjectPtr &key);
     SQTable(SQSharedState *ss, SQInteger nInitialSize);
+    SQTable(SQSharedState *ss, SQTable *t);
     void _ClearNodes();
+    void _CopyNodes(_HashNode *src,SQInteger n,_HashNode *firstfree);
+    void _CopyArray(SQObjectPtr *src,SQInteger n);
+    inline bool _InArray(const SQObjectPtr &key) {
+        return sq_type(key) == OT_INTEGER && (SQUnsignedInteger)_integer(key) < (SQUnsignedInteger)_arraysize;
+    }
+    bool _ReleaseShared();
+    void _Unshare();
+    _HashNode *_GetShared(const SQObjectPtr &key,SQHash hash);
 public:
     static SQTable* Create(SQSharedState *ss,SQInteger nInitialSize)
     {
@@ -51,16 +88,19 @@ public:
         return newtable;
     }
     void Finalize();
-    SQTable *Clone();
+    SQTable *Clone(SQSharedState *ss);
+    //called before the nodes are modified in place, takes a private copy if they are shared
+    inline void Unshare() { if(_sharers) _Unshare(); }
     ~SQTable()
     {
+        if(_weakmode) _RemoveAllEntries();
         SetDelegate(NULL);
         REMOVE_FROM_CHAIN(&_sharedstate->_gc_chain, this);
-        for (SQInteger i = 0; i < _numofnodes; i++) _nodes[i].~_HashNode();
-        SQ_FREE(_nodes, _numofnodes * sizeof(_HashNode));
+        FreeNodes();
     }
 #ifndef NO_GARBAGE_COLLECTOR
-    void Mark(SQCollectable **chain);
+    void Mark(SQGCMarker *marker);
+    void MarkEphemerons(SQGCMarker *marker);
     SQObjectType GetType() {return OT_TABLE;}
 #endif
     inline _HashNode *_Get(const SQObjectPtr &key,SQHash hash)
@@ -71,6 +111,9 @@ public:
                 return n;
             }
         }while((n = n->next));
+        //strings shared with other VMs are not interned in this one
+        if(sq_type(key) == OT_STRING && (_sharedkeys || ISIMMORTAL(_string(key))))
+            return _GetShared(key,hash);
         return NULL;
     }
     //for compiler use
@@ -92,18 +135,31 @@ public:
         return false;
     }
     bool Get(const SQObjectPtr &key,SQObjectPtr &val);
-    void Remove(const SQObjectPtr &key);
-    bool Set(const SQObjectPtr &key, const SQObjectPtr &val);
+    inline void Remove(const SQObjectPtr &key) { if(_weakmode) _WeakRemove(key); else _Remove(key); }
+    inline bool Set(const SQObjectPtr &key, const SQObjectPtr &val) { return _weakmode ? _WeakSet(key,val) : _Set(key,val); }
     //returns true if a new slot has been created false if it was already present
-    bool NewSlot(const SQObjectPtr &key,const SQObjectPtr &val);
+    inline bool NewSlot(const SQObjectPtr &key,const SQObjectPtr &val) { return _weakmode ? _WeakNewSlot(key,val) : _NewSlot(key,val); }
+    void SetWeakMode(SQInteger mode);
+    static bool IsWeakMode(SQInteger mode) {
+        return mode == SQ_WEAK_KEYS || mode == SQ_WEAK_VALUES || mode == SQ_WEAK_EPHEMERON
+            || mode == (SQ_WEAK_KEYS|SQ_WEAK_VALUES) || mode == (SQ_WEAK_EPHEMERON|SQ_WEAK_VALUES);
+    }
+    void _Purge(const SQObject &key);
     SQInteger Next(bool getweakrefs,const SQObjectPtr &refpos, SQObjectPtr &outkey, SQObjectPtr &outval);
 
-    SQInteger CountUsed(){ return _usednodes;}
+    SQInteger CountUsed(){ return _usednodes + _arrayused;}
+    void Reserve(SQInteger n);
     void Clear();
     void Release()
     {
         sq_delete(this, SQTable);
     }
+    //set by sq_freeze, the table cannot be modified anymore
+    bool _frozen;
+    //some keys are strings shared with other VMs, see _GetShared()
+    bool _sharedkeys;
+    //SQ_WEAK_KEYS, SQ_WEAK_VALUES and SQ_WEAK_EPHEMERON, the slots holding a dead object are removed
+    unsigned char _weakmode;
 
 };
 
@@ -19,7 +19,7 @@ struct SQUserData : SQDelegable
         return ud;
     }
 #ifndef NO_GARBAGE_COLLECTOR
-    void Mark(SQCollectable **chain);
+    void Mark(SQGCMarker *marker);
     void Finalize(){SetDelegate(NULL);}
     SQObjectType GetType(){ return OT_USERDATA;}
 #endif
@@ -5,6 +5,11 @@
 void *sq_vm_malloc(SQUnsignedInteger size);
 void *sq_vm_realloc(void *p,SQUnsignedInteger oldsize,SQUnsignedInteger size);
 void sq_vm_free(void *p,SQUnsignedInteger size);
+#ifdef SQ_RESERVED_STACK
+void *sq_vm_reserve(SQUnsignedInteger size);
+bool sq_vm_commit(void *p,SQUnsignedInteger oldsize,SQUnsignedInteger size);
+void sq_vm_unreserve(void *p,SQUnsignedInteger size);
+#endif
 
 #define sq_new(__ptr,__type) {__ptr=(__type *)sq_vm_malloc(sizeof(__type));new (__ptr) __type;}
 #define sq_delete(__ptr,__type) {__ptr->~__type();sq_vm_free(__ptr,sizeof(__type));}
@@ -28,6 +33,20 @@ public:
     {
         copy(v);
     }
+    //uses the buffer of v without copying it; the caller makes sure that neither vector
+    //modifies it while shared and that only the last one to stop using it frees it (see unalias)
+    void alias(const sqvector<T>& v)
+    {
+        _vals = v._vals;
+        _size = v._size;
+        _allocated = v._allocated;
+    }
+    void unalias()
+    {
+        _vals = NULL;
+        _size = 0;
+        _allocated = 0;
+    }
     void copy(const sqvector<T>& v)
     {
         if(_size) {
@@ -113,4 +132,62 @@ private:
     SQUnsignedInteger _allocated;
 };
 
+#ifdef SQ_RESERVED_STACK
+//sqreservedvector reserves address space for 'reserved' elements on the first resize
+//and commits memory as it grows; _vals never moves, so pointers into it stay valid
+template<typename T,SQUnsignedInteger reserved> class sqreservedvector
+{
+public:
+    sqreservedvector()
+    {
+        _vals = NULL;
+        _size = 0;
+        _committed = 0;
+    }
+    ~sqreservedvector()
+    {
+        if(_vals) {
+            for(SQUnsignedInteger i = 0; i < _size; i++)
+                _vals[i].~T();
+            sq_vm_unreserve(_vals, reserved * sizeof(T));
+        }
+    }
+    bool resize(SQUnsignedInteger newsize, const T& fill = T())
+    {
+        if(newsize > reserved)
+            return false;
+        if(!_vals) {
+            _vals = (T*)sq_vm_reserve(reserved * sizeof(T));
+            if(!_vals) return false;
+        }
+        if(newsize > _committed) {
+            if(!sq_vm_commit(_vals, _committed * sizeof(T), newsize * sizeof(T)))
+                return false;
+            _committed = newsize;
+        }
+        if(newsize > _size) {
+            while(_size < newsize) {
+                new ((void *)&_vals[_size]) T(fill);
+                _size++;
+            }
+        }
+        else{
+            for(SQUnsignedInteger i = newsize; i < _size; i++) {
+                _vals[i].~T();
+            }
+            _size = newsize;
+        }
+        return true;
+    }
+    inline SQUnsignedInteger size() const { return _size; }
+    SQUnsignedInteger capacity() { return reserved; }
+    inline T& operator[](SQUnsignedInteger pos) const{ return _vals[pos]; }
+    T* _vals;
+private:
+    sqreservedvector(const sqreservedvector<T,reserved>&);
+    SQUnsignedInteger _size;
+    SQUnsignedInteger _committed;
+};
+#endif
+
 #endif //_SQUTILS_H_
@@ -329,6 +329,8 @@ bool SQVM::StringCat(const SQObjectPtr &str,const SQObjectPtr &obj,SQObjectPtr &
     if(!ToString(str, a)) return false;
     if(!ToString(obj, b)) return false;
     SQInteger l = _string(a)->_len , ol = _string(b)->_len;
+    if(ol == 0) { dest = a; return true; }
+    if(l == 0) { dest = b; return true; }
     SQChar *s = _sp(sq_rsl(l + ol + 1));
     memcpy(s, _stringval(a), sq_rsl(l));
     memcpy(s + l, _stringval(b), sq_rsl(ol));
@@ -351,7 +353,12 @@ bool SQVM::TypeOf(const SQObjectPtr &obj1,SQObjectPtr &dest)
 
 bool SQVM::Init(SQVM *friendvm, SQInteger stacksize)
 {
+#ifdef SQ_RESERVED_STACK
+    if(!_stack.resize(stacksize))
+        return false;
+#else
     _stack.resize(stacksize);
+#endif
     _alloccallsstacksize = 4;
     _callstackdata.resize(_alloccallsstacksize);
     _callsstacksize = 0;
@@ -616,7 +623,7 @@ bool SQVM::CLOSURE_OP(SQObjectPtr &target, SQFunctionProto *func)
 }
 
 
-bool SQVM::CLASS_OP(SQObjectPtr &target,SQInteger baseclass,SQInteger attributes)
+bool SQVM::CLASS_OP(SQObjectPtr &target,SQInteger baseclass,SQInteger attributes,SQInteger nfields,SQInteger nmethods)
 {
     SQClass *base = NULL;
     SQObjectPtr attrs;
@@ -628,6 +635,7 @@ bool SQVM::CLASS_OP(SQObjectPtr &target,SQInteger baseclass,SQInteger attributes
         attrs = _stack._vals[_stackbase+attributes];
     }
     target = SQClass::Create(_ss(this),base);
+    _class(target)->Reserve(nfields,nmethods);
     if(sq_type(_class(target)->_metamethods[MT_INHERITED]) != OT_NULL) {
         int nparams = 2;
         SQObjectPtr ret;
@@ -649,6 +657,9 @@ bool SQVM::IsEqual(const SQObjectPtr &o1,const SQObjectPtr &o2,bool &res)
 		if (t1 == OT_FLOAT) {
 			res = (_float(o1) == _float(o2));
 		}
+		else if (t1 == OT_STRING) {
+			res = _samestring(_string(o1),_string(o2));
+		}
 		else {
 			res = (_rawval(o1) == _rawval(o2));
 		}
@@ -910,7 +921,7 @@ exception_restore:
                 switch(arg3) {
                     case NOT_TABLE: TARGET = SQTable::Create(_ss(this), arg1); continue;
                     case NOT_ARRAY: TARGET = SQArray::Create(_ss(this), 0); _array(TARGET)->Reserve(arg1); continue;
-                    case NOT_CLASS: _GUARD(CLASS_OP(TARGET,arg1,arg2)); continue;
+                    case NOT_CLASS: _GUARD(CLASS_OP(TARGET,_newclass_base(arg1),arg2,_newclass_nfields(arg1),_newclass_nmethods(arg1))); continue;
                     default: assert(0); continue;
                 }
             case _OP_APPENDARRAY:
@@ -1358,6 +1369,7 @@ bool SQVM::Set(const SQObjectPtr &self,const SQObjectPtr &key,const SQObjectPtr
 {
     switch(sq_type(self)){
     case OT_TABLE:
+        if(_table(self)->_frozen) { Raise_FrozenError(self); return false; }
         if(_table(self)->Set(key,val)) return true;
         break;
     case OT_INSTANCE:
@@ -1365,6 +1377,7 @@ bool SQVM::Set(const SQObjectPtr &self,const SQObjectPtr &key,const SQObjectPtr
         break;
     case OT_ARRAY:
         if(!sq_isnumeric(key)) { Raise_Error(_SC("indexing %s with %s"),GetTypeName(self),GetTypeName(key)); return false; }
+        if(_array(self)->_frozen) { Raise_FrozenError(self); return false; }
         if(!_array(self)->Set(tointeger(key),val)) {
             Raise_IdxError(key);
             return false;
@@ -1381,7 +1394,7 @@ bool SQVM::Set(const SQObjectPtr &self,const SQObjectPtr &key,const SQObjectPtr
         case FALLBACK_NO_MATCH: break; //keep falling back
         case FALLBACK_ERROR: return false; // the metamethod failed
     }
-    if(selfidx == 0) {
+    if(selfidx == 0 && !_table(_roottable)->_frozen) {
         if(_table(_roottable)->Set(key,val))
             return true;
     }
@@ -1430,7 +1443,7 @@ bool SQVM::Clone(const SQObjectPtr &self,SQObjectPtr &target)
     SQObjectPtr newobj;
     switch(sq_type(self)){
     case OT_TABLE:
-        newobj = _table(self)->Clone();
+        newobj = _table(self)->Clone(_ss(this));
         goto cloned_mt;
     case OT_INSTANCE: {
         newobj = _instance(self)->Clone(_ss(this));
@@ -1446,7 +1459,7 @@ cloned_mt:
         target = newobj;
         return true;
     case OT_ARRAY:
-        target = _array(self)->Clone();
+        target = _array(self)->Clone(_ss(this));
         return true;
     default:
         Raise_Error(_SC("cloning a %s"), GetTypeName(self));
@@ -1484,6 +1497,7 @@ bool SQVM::NewSlot(const SQObjectPtr &self,const SQObjectPtr &key,const SQObject
     switch(sq_type(self)) {
     case OT_TABLE: {
         bool rawcall = true;
+        if(_table(self)->_frozen) { Raise_FrozenError(self); return false; }
         if(_table(self)->_delegate) {
             SQObjectPtr res;
             if(!_table(self)->Get(key,res)) {
@@ -1554,6 +1568,10 @@ bool SQVM::DeleteSlot(const SQObjectPtr &self,const SQObjectPtr &key,SQObjectPtr
         }
         else {
             if(sq_type(self) == OT_TABLE) {
+                if(_table(self)->_frozen) {
+                    Raise_FrozenError(self);
+                    return false;
+                }
                 if(_table(self)->Get(key,t)) {
                     _table(self)->Remove(key);
                 }
@@ -1673,12 +1691,20 @@ bool SQVM::EnterFrame(SQInteger newbase, SQInteger newtop, bool tailcall)
     _stackbase = newbase;
     _top = newtop;
     if(newtop + MIN_STACK_OVERHEAD > (SQInteger)_stack.size()) {
+#ifdef SQ_RESERVED_STACK
+        //the stack grows in place; open outers and references into it stay valid
+        if(!_stack.resize(newtop + (MIN_STACK_OVERHEAD << 2))) {
+            Raise_Error(_SC("stack overflow"));
+            return false;
+        }
+#else
         if(_nmetamethodscall) {
             Raise_Error(_SC("stack overflow, cannot resize stack while in a metamethod"));
             return false;
         }
         _stack.resize(newtop + (MIN_STACK_OVERHEAD << 2));
         RelocateOuters();
+#endif
     }
     return true;
 }
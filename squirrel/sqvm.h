@@ -31,6 +31,12 @@ struct SQExceptionTrap{
 
 typedef sqvector<SQExceptionTrap> ExceptionsTraps;
 
+#ifdef SQ_RESERVED_STACK
+typedef sqreservedvector<SQObjectPtr,SQ_RESERVED_STACK> SQVMStack;
+#else
+typedef SQObjectPtrVec SQVMStack;
+#endif
+
 struct SQVM : public CHAINABLE_OBJ
 {
     struct CallInfo{
@@ -88,6 +94,7 @@ public:
     void Raise_Error(const SQObjectPtr &desc);
     void Raise_IdxError(const SQObjectPtr &o);
     void Raise_CompareError(const SQObject &o1, const SQObject &o2);
+    void Raise_FrozenError(const SQObject &o);
     void Raise_ParamTypeError(SQInteger nparam,SQInteger typemask,SQInteger type);
 
     void FindOuter(SQObjectPtr &target, SQObjectPtr *stackindex);
@@ -104,7 +111,7 @@ public:
     _INLINE bool NEG_OP(SQObjectPtr &trg,const SQObjectPtr &o1);
     _INLINE bool CMP_OP(CmpOP op, const SQObjectPtr &o1,const SQObjectPtr &o2,SQObjectPtr &res);
     bool CLOSURE_OP(SQObjectPtr &target, SQFunctionProto *func);
-    bool CLASS_OP(SQObjectPtr &target,SQInteger base,SQInteger attrs);
+    bool CLASS_OP(SQObjectPtr &target,SQInteger base,SQInteger attrs,SQInteger nfields,SQInteger nmethods);
     //return true if the loop is finished
     bool FOREACH_OP(SQObjectPtr &o1,SQObjectPtr &o2,SQObjectPtr &o3,SQObjectPtr &o4,SQInteger arg_2,int exitpos,int &jump);
     //_INLINE bool LOCAL_INC(SQInteger op,SQObjectPtr &target, SQObjectPtr &a, SQObjectPtr &incr);
@@ -115,7 +122,7 @@ public:
 #endif
 
 #ifndef NO_GARBAGE_COLLECTOR
-    void Mark(SQCollectable **chain);
+    void Mark(SQGCMarker *marker);
     SQObjectType GetType() {return OT_THREAD;}
 #endif
     void Finalize();
@@ -143,7 +150,7 @@ public:
     SQObjectPtr &GetUp(SQInteger n);
     SQObjectPtr &GetAt(SQInteger n);
 
-    SQObjectPtrVec _stack;
+    SQVMStack _stack;
 
     SQInteger _top;
     SQInteger _stackbase;
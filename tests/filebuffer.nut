@@ -0,0 +1,47 @@
+// differential test of the file buffer: random sequences of reads, writes, seeks and
+// flushes on a buffered file must give the same results as on an unbuffered one
+// usage: sq filebuffer.nut [scratchdir]
+local dir = vargv.len() > 0 ? vargv[0] : ".";
+local seed = 12345;
+local function rnd(n) { seed = (seed * 1103515245 + 12345) & 0x7fffffff; return (seed >> 8) % n; }
+local function run(path, bufsize, ops) {
+    local f = bufsize < 0 ? file(path, "wb+") : file(path, "wb+", bufsize);
+    local out = [];
+    foreach(op in ops) {
+        local r;
+        try {
+            switch(op[0]) {
+                case 0: { local b = blob(op[1]); for(local i = 0; i < op[1]; i++) b.writen(op[2] + i, 'c'); f.writeblob(b); r = "w"; break; }
+                case 1: { local b = f.readblob(op[1]); r = "r" + b.len(); b.seek(0); while(!b.eos()) r += "," + b.readn('c'); break; }
+                case 2: { r = "l" + f.readline(); break; }
+                case 3: { f.seek(op[1] % (f.len() + 1)); r = "s"; break; }
+                case 4: { r = "t" + f.tell() + ":" + f.len(); break; }
+                case 5: { f.flush(); r = "f"; break; }
+            }
+        } catch(e) r = "e";
+        out.append(r);
+    }
+    f.close();
+    local g = file(path, "rb");
+    local b = g.len() > 0 ? g.readblob(g.len()) : blob();
+    g.close();
+    local s = "len" + b.len();
+    while(!b.eos()) s += "," + b.readn('c');
+    out.append(s);
+    return out;
+}
+local failures = 0;
+for(local n = 0; n < 300; n++) {
+    local ops = [];
+    for(local i = rnd(20) + 1; i > 0; i--) {
+        local k = rnd(6);
+        ops.append([k, rnd(64) + 1, k == 0 ? 32 + rnd(64) : 0]);
+    }
+    local a = run(dir + "/fuzz_a.bin", 0, ops);
+    local b = run(dir + "/fuzz_b.bin", [-1, 4096, 8 + rnd(40)][rnd(3)], ops);
+    for(local i = 0; i < a.len(); i++) {
+        if(a[i] != b[i]) { print("run " + n + " op " + i + ": " + a[i] + " != " + b[i] + "\n"); failures++; break; }
+    }
+}
+remove(dir + "/fuzz_a.bin"); remove(dir + "/fuzz_b.bin");
+return failures > 0 ? 1 : 0;